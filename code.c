@@ -2,618 +2,5822 @@
 // Players press touch sensors when the Green Light appears.
 // Features a menu, Bluetooth control, and SD card storage.
 
+// Bluetooth link: Classic SPP through BluetoothSerial (the default), or a BLE
+// GATT service through NimBLE-Arduino. Build with -DBT_TRANSPORT=BT_BLE for
+// BLE; the Classic stack is then not linked at all, which frees its RAM and
+// flash, and iOS devices can connect.
+#define BT_CLASSIC 0
+#define BT_BLE 1
+#ifndef BT_TRANSPORT
+#define BT_TRANSPORT BT_CLASSIC
+#endif
+
+// Display: the 128x64 SSD1306 OLED on I2C (the default), or a 320x240 SPI
+// TFT fed by DMA. Build with -DDISPLAY_BACKEND=DISPLAY_TFT for an ST7789,
+// adding -DTFT_CONTROLLER=TFT_ILI9341 for that controller. The screens are
+// drawn through the same Adafruit_GFX calls on either and laid out from the
+// panel size.
+#define DISPLAY_SSD1306 0
+#define DISPLAY_TFT 1
+#ifndef DISPLAY_BACKEND
+#define DISPLAY_BACKEND DISPLAY_SSD1306
+#endif
+#define TFT_ST7789 0
+#define TFT_ILI9341 1
+#ifndef TFT_CONTROLLER
+#define TFT_CONTROLLER TFT_ST7789
+#endif
+
+// Touch sensing: TTP223 modules driving RISING edges on TOUCH_PINS (the
+// default), or bare electrodes on the same GPIOs read by the ESP32's own
+// touch peripheral. Build with -DTOUCH_SENSING=TOUCH_NATIVE for that; it skips
+// the modules' internal detection delay, is calibrated at boot and reports
+// each pad's measured latency (PADS), so each unit can use the faster path.
+#define TOUCH_TTP223 0
+#define TOUCH_NATIVE 1
+#ifndef TOUCH_SENSING
+#define TOUCH_SENSING TOUCH_TTP223
+#endif
+
 // Include necessary libraries
+#ifdef HOST_BUILD
+#include "hal.h"              // Host build (host/Makefile): mocked board APIs for the benchmarks
+#else
+#if DISPLAY_BACKEND == DISPLAY_TFT
+#include <Adafruit_GFX.h>     // Text and shapes on the TFT's frame (GFXcanvas1)
+#include <driver/spi_master.h> // For DMA transfers to the TFT
+#include <esp_heap_caps.h>    // For the DMA-capable band buffers
+#else
 #include <Wire.h>            // For I2C communication with the OLED display
 #include <Adafruit_SSD1306.h> // Library for SSD1306 OLED display
+#endif
+#if BT_TRANSPORT == BT_BLE
+#include <NimBLEDevice.h>     // For the BLE GATT service (NimBLE-Arduino)
+#else
 #include <BluetoothSerial.h>  // For Bluetooth communication (ESP32 core)
+#endif
 #include <SD.h>              // For SD card operations (SPI interface)
 #include <SPI.h>             // For SPI communication with SD card
+#include <esp_timer.h>        // For microsecond timestamps (esp_timer_get_time)
+#include <esp_sleep.h>        // For light sleep while the menu is idle
+#include <driver/gpio.h>      // For the GPIO wake-up levels
+#include <esp_bt.h>           // For the Bluetooth controller state (light sleep)
+#include <freertos/FreeRTOS.h> // For the game and I/O tasks
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <Preferences.h>      // For the runtime settings in NVS
+#include <esp_ota_ops.h>      // For the A/B app partitions (OTA updates)
+#endif
+#include <atomic>             // For the lock-free touch event queue
+#include <stdarg.h>           // For FixedString::appendf
+
+// Networked arena: several boards race the same light over ESP-NOW. One
+// board is the coordinator (board 0): it announces every round and merges
+// the followers' results into its registry and leaderboard. Followers keep
+// their clocks synchronized to it and start each round at the announced
+// coordinator time. Build with -DARENA_MODE=ARENA_COORDINATOR, or with
+// -DARENA_MODE=ARENA_FOLLOWER -DARENA_BOARD_ID=<1..>, to enable it.
+#define ARENA_OFF 0
+#define ARENA_COORDINATOR 1
+#define ARENA_FOLLOWER 2
+#ifndef ARENA_MODE
+#define ARENA_MODE ARENA_OFF
+#endif
+#ifndef ARENA_BOARD_ID
+#define ARENA_BOARD_ID 0
+#endif
+#if ARENA_MODE != ARENA_OFF && !defined(HOST_BUILD)
+#include <WiFi.h>             // ESP-NOW runs on the Wi-Fi radio (station mode, not connected)
+#include <esp_wifi.h>
+#include <esp_now.h>
+#endif
+
+// Live scoreboard for spectator screens: a Wi-Fi access point running an
+// async web server (ESPAsyncWebServer) that pushes phase changes and results
+// over a WebSocket and serves the history log with HTTP range reads. Build
+// with -DWEB_ENABLED=1 to enable it.
+#ifndef WEB_ENABLED
+#define WEB_ENABLED 0
+#endif
+#if WEB_ENABLED && !defined(HOST_BUILD)
+#include <WiFi.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+#include <Update.h>           // Writes an uploaded firmware image to the idle app partition
+#include <mbedtls/md.h>       // HMAC-SHA256 of an uploaded image
+#include <memory>             // A log download keeps its file open until the response is gone
+#endif
+// The web admin pages (POST /config and /update) take HTTP basic auth with
+// credentials set per board: -DWEB_ADMIN_USER/-DWEB_ADMIN_PASSWORD, or the
+// NVS strings "admin_user"/"admin_pass" in CONFIG_NAMESPACE, which win. With
+// no password set, both pages are refused. /update also needs the board's
+// firmware key, 32 bytes: -DOTA_KEY="<64 hex digits>", or the NVS blob
+// "ota_key", which wins. An image is only booted if its X-Firmware-HMAC
+// header carries the HMAC-SHA256 of the whole image under that key:
+//   openssl dgst -sha256 -mac HMAC -macopt hexkey:$KEY reflex.bin
+//   curl -u admin:$PASS -H "X-Firmware-HMAC: $HMAC" -F image=@reflex.bin http://192.168.4.1/update
+// Builds with secure boot (CONFIG_SECURE_SIGNED_ON_UPDATE) check the image
+// signature in Update.end() as well.
+#ifndef WEB_ADMIN_USER
+#define WEB_ADMIN_USER "admin"
+#endif
+#ifndef WEB_ADMIN_PASSWORD
+#define WEB_ADMIN_PASSWORD "" // None: this repository is public
+#endif
+#ifndef OTA_KEY
+#define OTA_KEY "" // None, for the same reason
+#endif
 
 // Constants for hardware and game settings
+#if DISPLAY_BACKEND == DISPLAY_TFT
+const int SCREEN_WIDTH = 320;        // TFT width in pixels (landscape)
+const int SCREEN_HEIGHT = 240;       // TFT height in pixels
+const int TEXT_SCALE = 2;            // Text size of ordinary screens (12x16 pixel cells)
+const spi_host_device_t TFT_SPI_HOST = SPI2_HOST; // HSPI; the SD card has VSPI
+const int TFT_SCLK_PIN = 25;         // TFT SPI clock
+const int TFT_MOSI_PIN = 26;         // TFT SPI data
+const int TFT_CS_PIN = 32;           // TFT chip select
+const int TFT_DC_PIN = 33;           // TFT data/command select
+const int TFT_RESET_PIN = 16;        // TFT reset (active-low)
+const int TFT_BACKLIGHT_PIN = 17;    // TFT backlight enable
+const int TFT_SPI_CLOCK = 40000000;  // TFT SPI clock (Hz; the pins go through the GPIO matrix)
+const int TFT_BAND_ROWS = 16;        // Pixel rows per DMA transfer; two band buffers alternate
+const int TFT_ROW_BYTES = SCREEN_WIDTH / 8; // One row of the 1-bit frame
+const size_t TFT_BAND_BYTES = (size_t)SCREEN_WIDTH * TFT_BAND_ROWS * 2; // One RGB565 band
+const int TFT_LIGHT_RADIUS = 90;     // Traffic light radius (pixels)
+const int TFT_LIGHT_Y = 140;         // Traffic light center row
+static_assert(SCREEN_WIDTH % 8 == 0 && SCREEN_HEIGHT % TFT_BAND_ROWS == 0, "The frame splits into whole bytes and bands");
+#else
 const int SCREEN_WIDTH = 128;        // OLED display width in pixels
 const int SCREEN_HEIGHT = 64;        // OLED display height in pixels
-const int MAX_PLAYERS = 4;           // Maximum number of players supported
+const int TEXT_SCALE = 1;            // Text size of ordinary screens (6x8 pixel cells)
+const uint8_t OLED_I2C_ADDRESS = 0x3C; // OLED I2C address
+const uint32_t OLED_I2C_CLOCK = 400000; // OLED I2C clock (Hz); 1000000 runs fast-mode-plus if the panel and pull-ups allow it
+const int OLED_PAGES = SCREEN_HEIGHT / 8; // SSD1306 pages (8 pixel rows each)
+const int OLED_I2C_CHUNK = 127;      // Data bytes per I2C transaction (the ESP32 Wire buffer is 128 bytes with the control byte)
+#endif
+const int TEXT_COLUMNS = SCREEN_WIDTH / (6 * TEXT_SCALE); // Characters per line of text
+const int TEXT_LINE_HEIGHT = 8 * TEXT_SCALE;              // Pixel rows per line of text
+const int TEXT_ROWS = SCREEN_HEIGHT / TEXT_LINE_HEIGHT;   // Lines of text per screen
 const int SD_CS_PIN = 5;             // SD card chip select pin (SPI)
 const int JOYSTICK_Y = 35;           // Analog pin for joystick Y-axis (menu navigation)
 const int MENU_BUTTON = 27;          // Digital pin for menu selection button (active-low)
-const int TOUCH_PINS[MAX_PLAYERS] = {12, 13, 14, 15}; // GPIO pins for TTP223 touch sensors
-const int JOYSTICK_THRESHOLD = 1000; // Threshold for joystick movement detection (analog range 0-4095)
-const int DEBOUNCE_DELAY = 20;       // Debounce delay for button in milliseconds
-const int MAX_HISTORY_SIZE = 10000;  // Max characters for game history (SD card storage)
-const int RESULT_DISPLAY_TIME = 5000; // Time to display game results on OLED (ms)
-const int BLUETOOTH_CHUNK_SIZE = 200; // Chunk size for sending history over Bluetooth
+// GPIO pins for the touch sensors, one per player. Add pins here to add
+// pads: MAX_PLAYERS and all per-player tables follow this list. These are
+// also touch channels T5, T4, T6 and T3 for TOUCH_NATIVE.
+const int TOUCH_PINS[] = {12, 13, 14, 15};
+const int MAX_PLAYERS = sizeof(TOUCH_PINS) / sizeof(TOUCH_PINS[0]); // Maximum number of players supported
+const int JOYSTICK_THRESHOLD = 1000; // Default threshold for joystick movement detection (analog range 0-4095; config joy_threshold)
+const int JOYSTICK_HYSTERESIS = 300; // Default distance back past the threshold that re-centers the joystick (joy_hysteresis)
+const int64_t JOYSTICK_SAMPLE_US = 5000; // Joystick sampling period (microseconds)
+const int64_t BUTTON_DEBOUNCE_US = 20000; // Default: button edges this soon after an accepted edge are bounce (button_debounce)
+const int64_t MENU_REPEAT_DELAY_US = 400000;    // Joystick hold time before auto-repeat starts
+const int64_t MENU_REPEAT_INTERVAL_US = 150000; // Auto-repeat interval while the joystick is held
+const int RESULT_DISPLAY_TIME = 5000; // Default time to display game results on OLED (ms; result_ms)
+const int GAME_COOLDOWN_TIME = 5000;  // Default pause after results before the menu returns (ms; cooldown_ms)
+const int TOURNAMENT_MAX_ROUNDS = 100; // Longest tournament TOURNAMENT_<n> accepts
+const float TOURNAMENT_QUANTILE = 0.95f; // Reaction quantile tracked per player in a tournament
+const int LOOP_IDLE_TIME = 100;       // Longest loop() sleep waiting for menu input (ms)
+const uint32_t IDLE_TIMEOUT = 60000;  // Default quiet time at the menu before idle mode (ms; IDLE_<seconds> changes it)
+const uint32_t IDLE_MAX_TIMEOUT = 86400; // Longest timeout IDLE_<seconds> accepts (s)
+const int IDLE_SLEEP_SLICE = 200;     // Light sleep between wake-up checks while idle (ms)
+const int IDLE_LISTEN_TIME = 30;      // Awake time between light sleeps, for the radio and the tasks (ms)
+const int64_t IDLE_JOYSTICK_SAMPLE_US = 25000; // Joystick sampling period while idle: under IDLE_LISTEN_TIME, so every awake window samples
+const uint32_t IDLE_CPU_FREQUENCY = 80; // CPU clock while idle (MHz; the lowest the radios allow)
+const int GREEN_SHOWN_TIMEOUT = 250;  // Longest wait for the display task to confirm Green Light is on screen (ms)
+const int BLUETOOTH_CHUNK_SIZE = 512; // Bytes of history log read and sent per chunk over Bluetooth (default and largest bt_chunk)
+const char *HISTORY_FILE = "/history.bin"; // Binary append-only game history log on SD
+const char *HISTORY_OLD_FILE = "/history.old.bin"; // Previous history log generation (RETAIN_ROTATE)
+const char *SESSION_FILE = "/session.rec";   // Last recorded session (RECORD_ON to RECORD_OFF), for REPLAY
+const int HISTORY_RING_SIZE = 64;     // Most recent games kept in RAM for "last N games" queries
+const char *PLAYERS_FILE = "/players.bin";         // Player registry: one PlayerRecord per player, in registration order
+const char *PLAYERS_INDEX_FILE = "/players.idx";   // Registry index: PlayerIndexEntry array sorted by id
+const char *LEADERBOARD_FILE = "/leaderboard.bin"; // Top LEADERBOARD_SIZE PlayerRecords, fastest first
+const char *LEGACY_LEADERBOARD_FILE = "/leaderboard_us.txt"; // CSV leaderboard of earlier versions (imported once)
+const char *PERSIST_MARKER_FILE = "/persist.dirty"; // Exists while snapshots on SD lag behind RAM
+const int PERSIST_DELAY = 2000;        // Write-behind delay: snapshot changes are batched for this long (ms)
+const uint32_t SNAPSHOT_MAGIC = 0x31534E52; // "RNS1": header of a snapshot file
+const int REGISTRY_MAX_PLAYERS = 2048; // Registered players (8 bytes of RAM index each)
+const int LEADERBOARD_SIZE = 10;       // Entries on the leaderboard
+const int LEADERBOARD_SCREEN_ENTRIES = TEXT_ROWS - 1; // Entries that fit on the screen under the title
+
+// What to do when the history log reaches its budget or the card runs low
+enum RetentionPolicy {
+  RETAIN_ROTATE, // Keep the current log as HISTORY_OLD_FILE (dropping the older one) and start a new log
+  RETAIN_STOP,   // Stop appending history and warn; nothing is deleted
+  RETAIN_DELETE  // Delete all history and start over (the original behaviour)
+};
+const RetentionPolicy HISTORY_RETENTION = RETAIN_ROTATE; // Retention policy for the history log
+const uint32_t HISTORY_MAX_BYTES = 1024 * 1024;      // Budget for the current history log
+const uint64_t SD_RESERVE_BYTES = 256 * 1024;        // Free space always left on the card
+const int HISTORY_SCREEN_GAMES = TEXT_ROWS - 1; // Recent games shown on the screen by "View History"
+const int64_t TOUCH_DEBOUNCE_US = 50000; // Default debounce window for touch sensor interrupts (microseconds; touch_debounce)
+const uint32_t TOUCH_QUEUE_SIZE = 32;    // Capacity of the touch event queue (must be a power of two)
+#if TOUCH_SENSING == TOUCH_NATIVE
+const uint16_t TOUCH_MEASURE_CYCLES = 0x1000; // Length of one pad measurement (8 MHz cycles): longer filters more noise but adds latency
+const uint16_t TOUCH_SLEEP_CYCLES = 0x100;    // Pause between measurements (150 kHz cycles); the core's default alone is 27 ms
+const float TOUCH_THRESHOLD_RATIO = 0.7f;     // A touched pad reads below this fraction of its untouched baseline
+const int TOUCH_CAL_SAMPLES = 32;             // Untouched readings per pad behind the boot calibration
+const int64_t TOUCH_CAL_TIMEOUT_US = 100000;  // Longest wait for a pad's next fresh reading while calibrating
+const uint32_t TOUCH_HOLD_SCANS = 3;          // Interrupts within this many scan periods of the last are one held touch
+#endif
+const uint32_t TTP223_LATENCY_US = 60000;     // TTP223 fast-mode response time (datasheet): not measurable from the ESP32
+static_assert(IDLE_JOYSTICK_SAMPLE_US < IDLE_LISTEN_TIME * 1000, "Each idle listen window must sample the joystick");
+static_assert(MAX_PLAYERS >= 1 && MAX_PLAYERS <= 16, "1 to 16 touch pads are supported");
+static_assert((TOUCH_QUEUE_SIZE & (TOUCH_QUEUE_SIZE - 1)) == 0, "TOUCH_QUEUE_SIZE must be a power of two");
+const unsigned long REACTION_NONE = 0xFFFFFFFF; // Reaction time value meaning "no response"
+const unsigned long REACTION_JUMPSTART = 0;     // Reaction time value meaning "jumpstart"
+const unsigned long REACTION_FLOOR_US = 100000; // Faster "reactions" are anticipation, not reaction: flagged
+const int64_t TOUCH_BOUNCE_WINDOW_US = 20000;   // Edges this close to a scoring touch are pad chatter
+const int TOUCH_BOUNCE_EDGES = 3;      // Edges within the window (the touch included) that make it a bounce
+const uint32_t TOUCH_EDGE_HISTORY = 8; // Recent edge times kept per pad (must be a power of two)
+static_assert((TOUCH_EDGE_HISTORY & (TOUCH_EDGE_HISTORY - 1)) == 0, "TOUCH_EDGE_HISTORY must be a power of two");
+const float PAD_NOISE_GAIN = 0.25f;    // Weight of the latest round in a pad's noise level
+const float PAD_NOISE_LIMIT = 1.0f;    // Chatter edges per round above which a pad's results are flagged
+const uint32_t SESSION_EDGE_RING = 64;          // Touch edges the ISR can hold for the recorder (must be a power of two)
+static_assert((SESSION_EDGE_RING & (SESSION_EDGE_RING - 1)) == 0, "SESSION_EDGE_RING must be a power of two");
+const int SESSION_BUFFER_RECORDS = 64;          // Records per recorder buffer (two alternate)
+const uint32_t SESSION_MAX_BYTES = 512 * 1024;  // A recording stops when its file reaches this size
+const int64_t SESSION_REPLAY_GAP_US = 1000000;  // Virtual time between replayed rounds
+
+// Task layout: reaction capture and phase timing run alone on the application
+// core at high priority; display, SD and Bluetooth run on the protocol core
+// and talk to the game through FreeRTOS queues, so I/O never stretches a phase
+const BaseType_t GAME_TASK_CORE = 1;        // Core for the game task (touch ISRs are attached here too)
+const BaseType_t IO_TASK_CORE = 0;          // Core for display, storage and Bluetooth tasks
+const UBaseType_t GAME_TASK_PRIORITY = 10;  // Above everything else on the game core
+const UBaseType_t BLUETOOTH_TASK_PRIORITY = 3;
+const UBaseType_t DISPLAY_TASK_PRIORITY = 2;
+const UBaseType_t STORAGE_TASK_PRIORITY = 1;
+const uint32_t GAME_TASK_STACK = 6144;      // Task stack sizes in bytes (the game task reads SD for REPLAY)
+const uint32_t DISPLAY_TASK_STACK = 4096;
+const uint32_t STORAGE_TASK_STACK = 6144;
+const uint32_t BLUETOOTH_TASK_STACK = 6144;
+const int GAME_QUEUE_LENGTH = 8;            // Queue depths (messages)
+const int DISPLAY_QUEUE_LENGTH = 8;
+const int STORAGE_QUEUE_LENGTH = 4;
+const int BLUETOOTH_QUEUE_LENGTH = 16;
+const uint16_t BLE_MTU = 517;               // ATT MTU requested for BLE (the largest allowed)
+const size_t BLE_ATTRIBUTE_MAX = 512;       // Longest attribute value NimBLE stores (BLE_ATT_ATTR_MAX_LEN)
+const uint16_t BLE_DEFAULT_MTU = 23;        // ATT MTU until the client negotiates a larger one
+const uint16_t BLE_DATA_LENGTH = 251;       // Link-layer payload requested (data length extension)
+const uint16_t BLE_CONN_INTERVAL_MIN = 6;   // Connection interval while connected (1.25 ms units)
+const uint16_t BLE_CONN_INTERVAL_MAX = 12;
+const uint16_t BLE_SUPERVISION_TIMEOUT = 400; // Link loss timeout (10 ms units)
+const int BLE_RX_BUFFER_SIZE = 1024;        // Received bytes waiting for the Bluetooth task
+const char *const BLE_SERVICE_UUID = "52520001-7265-666c-6578-727573680000"; // "reflexrush"
+const char *const BLE_COMMAND_UUID = "52520002-7265-666c-6578-727573680000";
+const char *const BLE_RESPONSE_UUID = "52520003-7265-666c-6578-727573680000";
+const char *const BLE_STATE_UUID = "52520004-7265-666c-6578-727573680000";
+const char *const BLE_RESULTS_UUID = "52520005-7265-666c-6578-727573680000";
+const char *const BLE_HISTORY_UUID = "52520006-7265-666c-6578-727573680000";
+const int MENU_QUEUE_LENGTH = 8;
+const int DISPLAY_TEXT_SIZE = 192;          // Max text per display message (a full screen of results)
+const int BLUETOOTH_TEXT_SIZE = 128;        // Max text per Bluetooth message (longer text is split)
+const int BLUETOOTH_POLL_TIME = 10;         // Bluetooth task polling interval for incoming commands (ms)
+const int PLAYER_NAME_SIZE = 24;            // Max player name length including terminator
+const int COMMAND_LINE_SIZE = 64;           // Longest Bluetooth command line including terminator
+const uint8_t ARENA_CHANNEL = 1;            // Wi-Fi channel shared by all arena boards
+const int ARENA_MAX_BOARDS = 16;            // Boards in one arena, coordinator included
+const int ARENA_QUEUE_LENGTH = 16;
+const int ARENA_RESULT_QUEUE_LENGTH = (ARENA_MAX_BOARDS - 1) * MAX_PLAYERS; // Coordinator: a round of every follower seat
+const UBaseType_t ARENA_TASK_PRIORITY = 4;  // Above Bluetooth: sync timestamps age while queued
+const uint32_t ARENA_TASK_STACK = 4096;
+const int ARENA_SYNC_INTERVAL = 250;        // Follower clock sync exchange period (ms)
+const int ARENA_SYNC_SAMPLES = 16;          // Exchanges per sync epoch; the lowest-delay one is kept
+const int ARENA_DRIFT_BASELINE = 30000;     // Shortest span a drift measurement is taken over (ms)
+const double ARENA_DRIFT_GAIN = 0.25;       // Weight of each new drift measurement
+const int ARENA_START_LEAD = 300;           // Rounds are announced this long before they start (ms)
+const int ARENA_MAX_PACKET = 64;            // Largest arena packet (ESP-NOW allows 250 bytes)
+const uint16_t ARENA_MAGIC = 0x5252;        // "RR": first bytes of every arena packet
+const char *const WEB_AP_SSID = "ReflexRush";    // Access point the spectator screens join
+const char *const WEB_AP_PASSWORD = "reflexrush"; // WPA2 needs at least 8 characters
+const uint16_t WEB_PORT = 80;
+const int WEB_QUEUE_LENGTH = 16;
+const UBaseType_t WEB_TASK_PRIORITY = 2;
+const uint32_t WEB_TASK_STACK = 6144;
+const int JSON_TEXT_SIZE = 768;             // Longest JSON message including terminator
+const int WEB_CLEANUP_INTERVAL = 1000;      // How often closed WebSocket clients are released (ms)
+const int WEB_ADMIN_TEXT_SIZE = 33;         // Longest admin user or password including terminator
+const size_t OTA_KEY_SIZE = 32;             // Firmware key and HMAC-SHA256 bytes
+const int CONFIG_REPLY_TIMEOUT = 500;       // How long a setting change waits for the game task to apply it (ms)
+const int OTA_RESTART_DELAY = 1000;         // Reboot this long after an update is written, so the reply goes out (ms)
+const int STORAGE_CLOSE_TIMEOUT = 2000;     // How long a reboot waits for the SD card to be closed (ms)
+const int STORAGE_SEND_TIMEOUT = 250;       // How long a request waits for room in the storage queue (ms)
+const char *const CONFIG_NAMESPACE = "reflexrush"; // NVS namespace of the runtime settings
+const char *const FIRMWARE_BUILD = __DATE__ " " __TIME__; // Identifies the running image (CONFIG, /config)
+
+// Binary Bluetooth protocol. Every frame is
+//   [FRAME_START][type][length lo][length hi][payload: length bytes][CRC-16 lo][CRC-16 hi]
+// with the CRC-16/CCITT-FALSE taken over type, length and payload. Frames and
+// text command lines share the link: a line never starts with FRAME_START.
+// History transfer is credit based: the client grants credits (frames it can
+// buffer) and every FRAME_HISTORY_BATCH spends one, so the device streams as
+// fast as the client can take it with no fixed sleeps.
+const uint8_t FRAME_START = 0xA5;           // First byte of every binary frame
+const int FRAME_HEADER_SIZE = 4;            // Start, type, 16-bit length
+const int FRAME_CRC_SIZE = 2;               // Trailing CRC-16
+const int FRAME_MAX_RX_PAYLOAD = 16;        // Longest payload accepted from the client
+const uint16_t FRAME_MAX_CREDITS = 256;     // Cap on outstanding credits
+enum FrameType {
+  FRAME_HISTORY_REQUEST = 0x01, // Client: start a history transfer; payload u16 initial credits
+  FRAME_CREDIT = 0x02,          // Client: grant more frames; payload u16 credits
+  FRAME_CANCEL = 0x03,          // Client: abort the transfer; no payload
+  FRAME_HISTORY_BATCH = 0x81,   // Device: payload u16 record count + that many raw 16-byte HistoryRecords
+  FRAME_HISTORY_END = 0x82,     // Device: transfer done; payload u32 records sent
+  FRAME_ERROR = 0xFF            // Device: payload u8 FrameError
+};
+enum FrameError {
+  FRAME_ERROR_CRC = 1,     // Frame failed its CRC
+  FRAME_ERROR_TYPE = 2,    // Unknown frame type or bad payload length
+  FRAME_ERROR_BUSY = 3,    // A transfer is already running
+  FRAME_ERROR_NO_HISTORY = 4 // No history on the card
+};
+const int RESULT_TEXT_SIZE = 40 * MAX_PLAYERS + 16; // Room for one results line per player
+
+// Fixed-capacity string backed by an inline buffer (on the stack or inside a
+// struct). Appends truncate at capacity instead of allocating, so building
+// results, Bluetooth replies and display text never touches the heap and
+// cannot fragment it over days of uptime.
+template <size_t N>
+class FixedString {
+ public:
+  FixedString() { clear(); }
+  FixedString(const char *initial) { clear(); append(initial); }
+  void clear() { used = 0; text[0] = '\0'; }
+  const char *c_str() const { return text; }
+  size_t length() const { return used; }
+  FixedString &append(const char *more) {
+    while (*more != '\0' && used < N - 1) text[used++] = *more++;
+    text[used] = '\0';
+    return *this;
+  }
+  FixedString &append(char c) {
+    if (used < N - 1) text[used++] = c;
+    text[used] = '\0';
+    return *this;
+  }
+  FixedString &append(unsigned long value) { return appendf("%lu", value); }
+  FixedString &appendf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(text + used, N - used, format, args);
+    va_end(args);
+    if (written > 0) used += ((size_t)written < N - used) ? (size_t)written : N - 1 - used;
+    return *this;
+  }
+
+ private:
+  char text[N];
+  size_t used;
+};
+typedef FixedString<BLUETOOTH_TEXT_SIZE> MessageText; // One Bluetooth line / display message
+typedef FixedString<RESULT_TEXT_SIZE> ResultText;     // Results of one round
+typedef FixedString<JSON_TEXT_SIZE> JsonText;         // One JSON message (WebSocket or BLE)
+
+// Log levels. Messages above LOG_LEVEL are removed by the preprocessor, so a
+// production build (-DLOG_LEVEL=LOG_LEVEL_NONE) contains no log code, no log
+// strings and does not even start the UART.
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4 // Per-redraw, per-touch and per-chunk detail
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Subsystem tag printed with each log line
+enum LogSubsystem { LOG_SYSTEM, LOG_GAME, LOG_INPUT, LOG_DISPLAY, LOG_STORAGE, LOG_BLUETOOTH, LOG_ARENA };
+
+// LOG_xxx(subsystem, printf-style format, ...). Lines are queued in RAM and
+// written to Serial by logFlush() only as fast as the UART drains, so logging
+// never blocks a task; lines that do not fit are counted and dropped.
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(subsystem, ...) logWrite('E', subsystem, __VA_ARGS__)
+#else
+#define LOG_ERROR(subsystem, ...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(subsystem, ...) logWrite('W', subsystem, __VA_ARGS__)
+#else
+#define LOG_WARN(subsystem, ...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(subsystem, ...) logWrite('I', subsystem, __VA_ARGS__)
+#else
+#define LOG_INFO(subsystem, ...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(subsystem, ...) logWrite('D', subsystem, __VA_ARGS__)
+#else
+#define LOG_DEBUG(subsystem, ...) do {} while (0)
+#endif
+
+// Latency profiler: probes around the hot sections feed one histogram per
+// section, read back with the STATS Bluetooth command. Build with
+// -DPROFILE_ENABLED=0 to remove the probes.
+#ifndef PROFILE_ENABLED
+#define PROFILE_ENABLED 1
+#endif
+enum ProfileSection {
+  PROFILE_DISPLAY_PUSH,  // pushDisplay(): OLED transfer (cycles)
+  PROFILE_SD_APPEND,     // saveHistoryToSD(): write + flush (cycles)
+  PROFILE_BT_WRITE,      // One Bluetooth text message or frame (cycles)
+  PROFILE_GAME_STEP,     // handleGameCommand(): one game state machine event (cycles)
+  PROFILE_TOUCH_LATENCY, // Touch ISR to the game task handling it (us)
+  PROFILE_MENU_LATENCY,  // Button edge or joystick sample to loop() handling it (us)
+  PROFILE_GREEN_SHOWN,   // Green Light request to the frame being on the OLED (us)
+  PROFILE_WAKE_LATENCY,  // Wake-up input to the OLED being back on (us)
+  PROFILE_SECTIONS
+};
+#if PROFILE_ENABLED
+// Records the cycles from here to the end of the enclosing block
+#define PROFILE_SCOPE(section) ProfileScope profileScope(section)
+#define PROFILE_RECORD(section, value) profileRecord(section, value)
+#else
+#define PROFILE_SCOPE(section) do {} while (0)
+#define PROFILE_RECORD(section, value) do { (void)(value); } while (0)
+#endif
+const int PROFILE_SUB_BUCKETS = 4; // Histogram buckets per power of two (~19% resolution)
+const int PROFILE_BUCKETS = 31 * PROFILE_SUB_BUCKETS; // Covers every uint32_t value
+
+// Latency histogram of one profiled section. Values below
+// PROFILE_SUB_BUCKETS get a bucket each; above that every power of two is
+// split into PROFILE_SUB_BUCKETS equal buckets.
+struct ProfileHistogram {
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint32_t buckets[PROFILE_BUCKETS];
+};
+
+#if LOG_LEVEL > LOG_LEVEL_NONE
+const unsigned long LOG_BAUD_RATE = 115200;
+const size_t LOG_BUFFER_SIZE = 2048;   // Queued log text; must be a power of two
+const size_t LOG_UART_BUFFER = 1024;   // UART driver TX buffer, so flushes rarely find it full
+const int LOG_LINE_SIZE = 128;         // Longest log line; longer lines are truncated
+static_assert((LOG_BUFFER_SIZE & (LOG_BUFFER_SIZE - 1)) == 0, "LOG_BUFFER_SIZE must be a power of two");
+#endif
+
+#if DISPLAY_BACKEND == DISPLAY_TFT
+// RGB565 colors for the TFT
+const uint16_t TFT_WHITE = 0xFFFF;
+const uint16_t TFT_RED = 0xF800;
+const uint16_t TFT_YELLOW = 0xFFE0;
+const uint16_t TFT_GREEN = 0x07E0;
+
+// Controller setup: command, data byte count (| TFT_DELAY: a delay in ms
+// follows the data), data
+const uint8_t TFT_DELAY = 0x80;
+const uint8_t TFT_INIT[] = {
+  0x01, TFT_DELAY, 150,   // SWRESET
+  0x11, TFT_DELAY, 120,   // SLPOUT
+  0x3A, 1, 0x55,          // COLMOD: 16 bits per pixel
+#if TFT_CONTROLLER == TFT_ST7789
+  0x36, 1, 0x60,          // MADCTL: landscape (MX | MV)
+  0x21, 0,                // INVON: ST7789 IPS panels are inverted
+#else
+  0x36, 1, 0x28,          // MADCTL: landscape (MV | BGR)
+#endif
+  0x13, 0,                // NORON
+  0x29, TFT_DELAY, 20     // DISPON
+};
+
+// SPI TFT (ST7789 or ILI9341) offering the SSD1306 calls the sketch uses
+// (begin, clearDisplay, display and the Adafruit_GFX drawing calls), so the
+// screens are shared. The frame is drawn at 1 bit per pixel (9.6 KB) in one
+// ink color per screen. display() expands the bands that changed since the
+// last push to RGB565 and sends them by DMA: two band buffers alternate, so
+// the next band is expanded while the previous one is on the wire, and the
+// display task sleeps on the transfer instead of spinning.
+class TftDisplay : public GFXcanvas1 {
+ public:
+  TftDisplay()
+      : GFXcanvas1(SCREEN_WIDTH, SCREEN_HEIGHT), spi(NULL), ink(TFT_WHITE), shownInk(TFT_WHITE),
+        shadowValid(false), inFlight(0), nextBand(0) {}
+  bool begin() {
+    if (getBuffer() == NULL) return false; // No RAM for the frame
+    for (int i = 0; i < 2; i++) {
+      band[i] = (uint16_t *)heap_caps_malloc(TFT_BAND_BYTES, MALLOC_CAP_DMA);
+      if (band[i] == NULL) return false;
+    }
+    spi_bus_config_t bus = {};
+    bus.mosi_io_num = TFT_MOSI_PIN;
+    bus.miso_io_num = -1;
+    bus.sclk_io_num = TFT_SCLK_PIN;
+    bus.quadwp_io_num = -1;
+    bus.quadhd_io_num = -1;
+    bus.max_transfer_sz = TFT_BAND_BYTES;
+    if (spi_bus_initialize(TFT_SPI_HOST, &bus, SPI_DMA_CH_AUTO) != ESP_OK) return false;
+    spi_device_interface_config_t device = {};
+    device.clock_speed_hz = TFT_SPI_CLOCK;
+    device.mode = 0;
+    device.spics_io_num = TFT_CS_PIN;
+    device.queue_size = 2; // One transfer per band buffer
+    device.pre_cb = selectDataOrCommand;
+    device.flags = SPI_DEVICE_HALFDUPLEX; // Write-only
+    if (spi_bus_add_device(TFT_SPI_HOST, &device, &spi) != ESP_OK) return false;
+    pinMode(TFT_DC_PIN, OUTPUT);
+    pinMode(TFT_RESET_PIN, OUTPUT);
+    pinMode(TFT_BACKLIGHT_PIN, OUTPUT);
+    digitalWrite(TFT_RESET_PIN, LOW);
+    delay(10);
+    digitalWrite(TFT_RESET_PIN, HIGH);
+    delay(120);
+    for (size_t i = 0; i < sizeof(TFT_INIT);) {
+      uint8_t code = TFT_INIT[i];
+      uint8_t count = TFT_INIT[i + 1] & ~TFT_DELAY;
+      bool wait = TFT_INIT[i + 1] & TFT_DELAY;
+      command(code, TFT_INIT + i + 2, count);
+      i += 2 + count;
+      if (wait) delay(TFT_INIT[i++]);
+    }
+    setTextColor(1);
+    display(); // Clear the panel
+    digitalWrite(TFT_BACKLIGHT_PIN, HIGH);
+    return true;
+  }
+  void clearDisplay() {
+    fillScreen(0);
+    ink = TFT_WHITE;
+  }
+  void setInk(uint16_t color) { ink = color; } // Color of the set pixels of this frame
+  uint16_t getInk() const { return ink; }
+
+  // Send the bands that differ from the panel: changed pixels, or set pixels
+  // whose ink changed. Runs of such bands share one address window.
+  void display() {
+    const uint8_t *frame = getBuffer();
+    for (int top = 0; top < SCREEN_HEIGHT;) {
+      if (!bandDirty(frame, top)) {
+        top += TFT_BAND_ROWS;
+        continue;
+      }
+      int bottom = top + TFT_BAND_ROWS;
+      while (bottom < SCREEN_HEIGHT && bandDirty(frame, bottom)) bottom += TFT_BAND_ROWS;
+      finishTransfers(); // Window commands must not overtake queued pixels
+      setWindow(top, bottom - 1);
+      for (int y = top; y < bottom; y += TFT_BAND_ROWS) queueBand(frame, y);
+      top = bottom;
+    }
+    finishTransfers();
+    memcpy(shadow, frame, sizeof(shadow));
+    shownInk = ink;
+    shadowValid = true;
+  }
+  void setPower(bool on) {
+    if (on) {
+      command(0x11, NULL, 0); // SLPOUT
+      delay(5);
+      command(0x29, NULL, 0); // DISPON
+      digitalWrite(TFT_BACKLIGHT_PIN, HIGH);
+    } else {
+      digitalWrite(TFT_BACKLIGHT_PIN, LOW);
+      command(0x28, NULL, 0); // DISPOFF
+      command(0x10, NULL, 0); // SLPIN
+    }
+  }
+
+ private:
+  // SPI pre-transfer callback (interrupt context): the transfer's user field
+  // is the D/C level
+  static void IRAM_ATTR selectDataOrCommand(spi_transaction_t *transfer) {
+    gpio_set_level((gpio_num_t)TFT_DC_PIN, (uint32_t)(uintptr_t)transfer->user);
+  }
+  // A command and up to 4 data bytes, sent without DMA
+  void command(uint8_t code, const uint8_t *data, size_t count) {
+    spi_transaction_t transfer = {};
+    transfer.flags = SPI_TRANS_USE_TXDATA;
+    transfer.length = 8;
+    transfer.tx_data[0] = code;
+    transfer.user = (void *)0;
+    spi_device_polling_transmit(spi, &transfer);
+    if (count == 0) return;
+    transfer.length = count * 8;
+    memcpy(transfer.tx_data, data, count);
+    transfer.user = (void *)1;
+    spi_device_polling_transmit(spi, &transfer);
+  }
+  void setWindow(int top, int bottom) {
+    uint8_t columns[4] = {0, 0, (uint8_t)((SCREEN_WIDTH - 1) >> 8), (uint8_t)(SCREEN_WIDTH - 1)};
+    uint8_t rows[4] = {(uint8_t)(top >> 8), (uint8_t)top, (uint8_t)(bottom >> 8), (uint8_t)bottom};
+    command(0x2A, columns, 4); // CASET
+    command(0x2B, rows, 4);    // RASET
+    command(0x2C, NULL, 0);    // RAMWR: pixel data follows
+  }
+  bool bandDirty(const uint8_t *frame, int top) {
+    if (!shadowValid) return true;
+    const uint8_t *current = frame + top * TFT_ROW_BYTES;
+    const uint8_t *shown = shadow + top * TFT_ROW_BYTES;
+    size_t bytes = TFT_BAND_ROWS * TFT_ROW_BYTES;
+    if (memcmp(current, shown, bytes) != 0) return true;
+    if (ink == shownInk) return false;
+    for (size_t i = 0; i < bytes; i++) {
+      if (current[i] != 0) return true; // Same pixels in a new color
+    }
+    return false;
+  }
+  // Expand one band into the free buffer and queue it behind the other
+  void queueBand(const uint8_t *frame, int top) {
+    if (inFlight == 2) waitTransfer(); // The oldest transfer used this buffer
+    uint16_t on = (uint16_t)((ink >> 8) | (ink << 8)); // The panel takes RGB565 big-endian
+    uint16_t *pixels = band[nextBand];
+    const uint8_t *bits = frame + top * TFT_ROW_BYTES;
+    for (int i = 0; i < TFT_BAND_ROWS * TFT_ROW_BYTES; i++) {
+      uint8_t byte = bits[i];
+      for (int bit = 0; bit < 8; bit++) {
+        *pixels++ = (byte & 0x80) ? on : 0;
+        byte <<= 1;
+      }
+    }
+    spi_transaction_t &transfer = transfers[nextBand];
+    memset(&transfer, 0, sizeof(transfer));
+    transfer.length = TFT_BAND_BYTES * 8;
+    transfer.tx_buffer = band[nextBand];
+    transfer.user = (void *)1;
+    spi_device_queue_trans(spi, &transfer, portMAX_DELAY);
+    inFlight++;
+    nextBand ^= 1;
+  }
+  void waitTransfer() {
+    spi_transaction_t *done;
+    spi_device_get_trans_result(spi, &done, portMAX_DELAY);
+    inFlight--;
+  }
+  void finishTransfers() {
+    while (inFlight > 0) waitTransfer();
+  }
 
-// OLED Display object (128x64, I2C interface)
-Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, -1);
+  spi_device_handle_t spi;
+  uint16_t *band[2];                 // RGB565 band buffers (DMA-capable RAM)
+  spi_transaction_t transfers[2];    // One per band buffer
+  uint8_t shadow[TFT_ROW_BYTES * SCREEN_HEIGHT]; // The frame the panel shows
+  uint16_t ink;                      // Ink of the frame being drawn
+  uint16_t shownInk;                 // Ink of the frame on the panel
+  bool shadowValid;                  // False until the first frame is sent
+  int inFlight;                      // Queued band transfers
+  int nextBand;                      // Band buffer to fill next
+};
+TftDisplay display;
+#else
+// OLED Display object (128x64, I2C interface). The same clock is used during
+// and after each transfer because the OLED is the only device on the bus.
+Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, -1, OLED_I2C_CLOCK, OLED_I2C_CLOCK);
+
+// Copy of what the OLED panel currently shows, used by pushDisplay() to send
+// only the changed columns of each page (display task only)
+uint8_t oledShadow[SCREEN_WIDTH * OLED_PAGES];
+bool oledShadowValid = false; // False until the first full frame is sent
+#endif
+int64_t displayPushedTime = 0; // When the last pushDisplay() finished its transfer (display task)
+bool panelOn = true;           // OLED panel powered (display task; off in idle mode)
 
-// Bluetooth object for ESP32
+// Bluetooth object for ESP32 (the BLE link is declared with the queues)
+#if BT_TRANSPORT == BT_CLASSIC
 BluetoothSerial ESP_BT;
+#endif
 
 // Game variables
 long redDuration, yellowDuration, greenDuration; // Durations for each traffic light phase (randomized)
-volatile unsigned long reactionTimes[MAX_PLAYERS] = {0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF}; // Reaction times for each player (volatile for ISR)
-volatile bool touchDetected[MAX_PLAYERS] = {false, false, false, false}; // Flags to track if each player has touched (volatile for ISR)
-String gameHistory = "";                  // String to store game history
+uint32_t phaseRandomState = 1;           // Phase duration generator (xorshift32); seeded at boot, logged by the recorder
+uint32_t roundRandomState = 1;           // phaseRandomState the current round's durations were drawn from
+unsigned long reactionTimes[MAX_PLAYERS]; // Reaction times for each player in microseconds (reset by startGame)
+bool touchDetected[MAX_PLAYERS];          // Flags to track if each player has touched this round
+int64_t touchTimes[MAX_PLAYERS];          // When each player's scoring touch happened (for validation)
 int numberOfPlayers = 1;                 // Number of active players (default: 1)
-String playerNames[MAX_PLAYERS] = {"Player 1", "Player 2", "Player 3", "Player 4"}; // Default player names
-unsigned long greenStartTime = 0;        // Timestamp when Green Light starts
+char playerNames[MAX_PLAYERS][PLAYER_NAME_SIZE]; // Player names ("Player N" by default, set in setup)
+int64_t greenStartTime = 0;              // When the Green Light frame finished reaching the OLED (0 until it has)
+int64_t greenEndTime = 0;                // Timestamp when Green Light ends (microseconds, esp_timer clock)
+
+// Game state machine: a one-shot esp_timer fires at each phase deadline and
+// wakes the game task, which advances the round in handleGameCommand().
+// Nothing in a round blocks or polls; all output is handed to the I/O tasks
+// through their queues.
+enum GameState {
+  GAME_IDLE,     // At the menu, no round running
+  GAME_RED,      // Red Light: touches are jumpstarts
+  GAME_YELLOW,   // Yellow Light: touches are jumpstarts
+  GAME_GREEN,    // Green Light: touches are reactions
+  GAME_RESULTS,  // Results shown on the OLED
+  GAME_COOLDOWN, // Short pause before returning to the menu
+  GAME_ARMED     // Arena: waiting for the announced start time
+};
+volatile GameState gameState = GAME_IDLE; // Current phase of the round (read by the I/O tasks)
+int64_t phaseDeadline = 0;               // When the current phase ends (microseconds, esp_timer clock)
+int64_t greenRequestTime = 0;            // When Green Light was sent to the display task
+int64_t roundStartTime = 0;              // When Red Light began; Red and Yellow deadlines count from here
+uint32_t arenaRoundId = 0;               // Arena round being played (0: a local round)
+esp_timer_handle_t phaseTimer;           // Fires at phaseDeadline
+std::atomic<bool> touchWakePending(false); // A GAME_CMD_TOUCH is queued and not yet handled
+int roundPlayers = 1;                    // numberOfPlayers captured when the round started
+ResultText gameResult;                   // Results text of the last round
+
+// Outcome of one round, handed from the game task to the storage task
+struct RoundResult {
+  uint8_t numberOfPlayers;                // Players in the round
+  unsigned long reactionTimes[MAX_PLAYERS]; // Reaction times in microseconds (or REACTION_NONE/REACTION_JUMPSTART)
+  uint8_t flags[MAX_PLAYERS];               // HISTORY_FLAGS_SUSPECT reasons per player (0: trusted)
+};
+RoundResult lastRound;                   // Result of the last round (owned by the game task)
+
+// Streaming quantile estimate in constant memory: the P-square algorithm
+// (Jain & Chlamtac, 1985). Five markers track the minimum, the p/2, p and
+// (1+p)/2 quantiles and the maximum; each observation nudges the middle
+// markers toward their ideal positions along a parabola through their
+// neighbours. Until five observations have arrived the exact value is used.
+class P2Quantile {
+ public:
+  explicit P2Quantile(float quantile = TOURNAMENT_QUANTILE) : p(quantile), count(0) {}
+  uint32_t size() const { return count; }
+  void add(float x) {
+    if (count < 5) {
+      height[count++] = x;
+      if (count == 5) {
+        sortHeights(height, 5);
+        for (int i = 0; i < 5; i++) position[i] = i + 1;
+        desired[0] = 1;
+        desired[1] = 1 + 2 * p;
+        desired[2] = 1 + 4 * p;
+        desired[3] = 3 + 2 * p;
+        desired[4] = 5;
+      }
+      return;
+    }
+    count++;
+    int k; // Cell containing x
+    if (x < height[0]) {
+      height[0] = x;
+      k = 0;
+    } else if (x >= height[4]) {
+      height[4] = x;
+      k = 3;
+    } else {
+      k = 0;
+      while (x >= height[k + 1]) k++;
+    }
+    for (int i = k + 1; i < 5; i++) position[i]++;
+    desired[1] += p / 2;
+    desired[2] += p;
+    desired[3] += (1 + p) / 2;
+    desired[4] += 1;
+    for (int i = 1; i <= 3; i++) {
+      float offset = desired[i] - position[i];
+      if ((offset >= 1 && position[i + 1] - position[i] > 1) || (offset <= -1 && position[i - 1] - position[i] < -1)) {
+        int step = offset > 0 ? 1 : -1;
+        float candidate = parabolic(i, step);
+        height[i] = (height[i - 1] < candidate && candidate < height[i + 1]) ? candidate : linear(i, step);
+        position[i] += step;
+      }
+    }
+  }
+  float value() const {
+    if (count >= 5) return height[2];
+    if (count == 0) return 0;
+    float sorted[5];
+    memcpy(sorted, height, count * sizeof(float));
+    sortHeights(sorted, count);
+    int rank = (int)ceilf(p * count); // Nearest-rank quantile of what we have
+    return sorted[rank > 0 ? rank - 1 : 0];
+  }
+
+ private:
+  static void sortHeights(float *values, int n) {
+    for (int i = 1; i < n; i++) {
+      float v = values[i];
+      int j = i;
+      for (; j > 0 && values[j - 1] > v; j--) values[j] = values[j - 1];
+      values[j] = v;
+    }
+  }
+  float parabolic(int i, int d) const {
+    float span = position[i + 1] - position[i - 1];
+    float right = (position[i] - position[i - 1] + d) * (height[i + 1] - height[i]) / (position[i + 1] - position[i]);
+    float left = (position[i + 1] - position[i] - d) * (height[i] - height[i - 1]) / (position[i] - position[i - 1]);
+    return height[i] + d / span * (right + left);
+  }
+  float linear(int i, int d) const {
+    return height[i] + d * (height[i + d] - height[i]) / (position[i + d] - position[i]);
+  }
+
+  float p;            // Quantile being estimated
+  uint32_t count;     // Observations so far
+  float height[5];    // Marker heights (the first five observations until count reaches 5)
+  int32_t position[5]; // Marker positions (1-based ranks)
+  float desired[5];   // Ideal marker positions
+};
+
+// Running tournament aggregates for one seat, O(1) memory: Welford's online
+// mean and variance of valid reactions, the best one, a streaming p95, and
+// counts of jumpstarts and misses. Owned by the game task.
+struct PlayerStats {
+  uint32_t valid;      // Valid reactions
+  uint32_t jumpstarts; // Rounds lost to a jumpstart
+  uint32_t misses;     // Rounds with no response
+  double mean;         // Mean valid reaction (us)
+  double m2;           // Sum of squared deviations from the mean (Welford)
+  unsigned long best;  // Best valid reaction (us)
+  P2Quantile p95;      // Streaming TOURNAMENT_QUANTILE of valid reactions
+  uint32_t flagged;    // Rounds with a suspect result (not counted above)
+};
+PlayerStats tournamentStats[MAX_PLAYERS];
+int tournamentArmedRounds = 0; // Rounds of the tournament the next start begins (0: a single round)
+int tournamentRounds = 0;      // Rounds in the running tournament (0: none running)
+int tournamentRound = 0;       // Rounds of the current or last tournament played
+
+// Game history is an append-only log of fixed-size binary records on SD, one
+// record per player per round. Records are 16 bytes so exactly 32 fit in a
+// 512-byte SD sector and none ever straddles two sectors; a round costs a
+// single write of at most MAX_PLAYERS records, and capacity is bounded only
+// by the card.
+enum HistoryFlags {
+  HISTORY_FLAG_VALID = 0x01,       // reactionUs holds a measured reaction
+  HISTORY_FLAG_JUMPSTART = 0x02,   // Player touched before Green Light
+  HISTORY_FLAG_NO_RESPONSE = 0x04, // Player did not touch during Green Light
+  HISTORY_FLAG_TOO_FAST = 0x08,    // Suspect: a valid touch under REACTION_FLOOR_US
+  HISTORY_FLAG_BOUNCE = 0x10,      // Suspect: the scoring touch was part of a burst of pad chatter
+  HISTORY_FLAG_NOISY_PAD = 0x20    // Suspect: the pad's noise level was over PAD_NOISE_LIMIT
+};
+// Suspect results are kept in history but never ranked: no leaderboard,
+// personal best or tournament statistics, and a suspect jumpstart is not held
+// against the player
+const uint8_t HISTORY_FLAGS_SUSPECT = HISTORY_FLAG_TOO_FAST | HISTORY_FLAG_BOUNCE | HISTORY_FLAG_NOISY_PAD;
+struct HistoryRecord {
+  uint32_t gameId;      // Round number, increasing across reboots
+  uint32_t timestampMs; // millis() when the round finished
+  uint32_t reactionUs;  // Reaction time in microseconds (0 unless HISTORY_FLAG_VALID)
+  uint8_t player;       // Player index (0-based)
+  uint8_t flags;        // HistoryFlags
+  uint16_t checksum;    // CRC-16 of the first 14 bytes, detects torn or corrupt records
+};
+static_assert(sizeof(HistoryRecord) == 16, "HistoryRecord must stay 16 bytes (sector aligned)");
+File historyFile;                        // History log opened for appending (storage task, historyMutex)
+uint32_t nextGameId = 1;                 // gameId of the next round written to history
+uint32_t historyRecordCount = 0;         // Records currently in the history log
+uint32_t historyGeneration = 0;          // Bumped (under historyMutex) when a log or the session file is replaced or removed
+
+// A log being downloaded from the web server, read one response chunk at a
+// time from the AsyncTCP task. The file stays open between chunks.
+struct HistoryReader {
+  File file;
+  uint32_t generation; // historyGeneration when the file was opened
+};
+const size_t HISTORY_READ_BUSY = (size_t)-1; // readHistoryRange: historyMutex is held, try again later
+
+// SD usage, seeded once at boot from the FAT and then updated by every write
+// (storage task only), so space checks are O(1). Byte counts are an estimate
+// between boots because the FAT allocates whole clusters.
+bool sdReady = false;                    // SD card initialized
+uint64_t sdTotalBytes = 0;               // Card capacity
+uint64_t sdUsedBytes = 0;                // Estimated bytes in use
+uint32_t leaderboardFileBytes = 0;       // Current size of the leaderboard file
+uint32_t playersIndexFileBytes = 0;      // Current size of the registry index file
+
+// Write-behind persistence (storage task only). The registry records and the
+// history log are written through: each write is a single in-place record or
+// an append that boot-time checks can validate. The index and leaderboard
+// are snapshots derived from the records; changes to them only mark them
+// dirty, and the storage task writes them out PERSIST_DELAY after the first
+// change, so a round (or a burst of tournament rounds) costs one rewrite.
+// Snapshots are replaced with write-to-temp-then-rename and carry a CRC, and
+// PERSIST_MARKER_FILE exists whenever they may be stale, so boot knows when to
+// rebuild them from the records instead.
+enum PersistFlags {
+  PERSIST_INDEX = 0x01,      // playerIndex differs from PLAYERS_INDEX_FILE
+  PERSIST_LEADERBOARD = 0x02 // leaderboard differs from LEADERBOARD_FILE
+};
+uint8_t persistDirty = 0;    // PersistFlags waiting to be written
+int64_t persistDueUs = 0;    // When the dirty snapshots are written (esp_timer clock)
+
+// Header in front of a snapshot file's payload
+struct SnapshotHeader {
+  uint32_t magic;    // SNAPSHOT_MAGIC
+  uint32_t bytes;    // Payload bytes after the header
+  uint16_t crc;      // CRC-16 of the payload
+  uint16_t reserved;
+};
+bool historyFull = false;                // RETAIN_STOP: history appends are suspended
+
+// One finished round as kept in RAM
+struct GameRecord {
+  uint32_t gameId;                   // Round number, increasing across reboots
+  uint32_t timestampMs;              // millis() when the round finished
+  uint8_t numberOfPlayers;           // Players in the round
+  uint8_t flags[MAX_PLAYERS];        // HistoryFlags per player
+  uint32_t reactionUs[MAX_PLAYERS];  // Reaction time per player (0 unless HISTORY_FLAG_VALID)
+};
+
+// Circular store of the most recent games, mirroring the tail of the SD log.
+// Pushing a game when full overwrites the oldest slot, so eviction is O(1) and
+// one game at a time; the n-th most recent game is one index computation away.
+// Guarded by historyRingMutex, which is only held for single-record copies.
+GameRecord historyRing[HISTORY_RING_SIZE];
+uint32_t historyRingPushed = 0;          // Games ever pushed (next slot = historyRingPushed % size)
+uint32_t historyRingCount = 0;           // Games currently stored (<= HISTORY_RING_SIZE)
+
+// Binary history transfer in progress (Bluetooth task only). Records are read
+// from SD straight into the payload of historyFrame, so nothing is copied
+// between the card and the radio.
+struct HistoryTransfer {
+  bool active;           // A transfer is running
+  uint8_t generation;    // 0 = HISTORY_OLD_FILE, 1 = HISTORY_FILE
+  uint32_t offset;       // Read position in the current generation (bytes)
+  uint16_t credits;      // Frames the client can still accept
+  uint32_t recordsSent;  // Records sent so far
+};
+HistoryTransfer historyTransfer = {false, 0, 0, 0, 0};
+uint8_t historyFrame[FRAME_HEADER_SIZE + 2 + BLUETOOTH_CHUNK_SIZE + FRAME_CRC_SIZE]; // One batch frame
+
+// Incoming text command line being assembled byte by byte (Bluetooth task only)
+char commandLine[COMMAND_LINE_SIZE];
+int commandLineUsed = 0;        // Characters of the current line received so far
+bool commandLineOverflow = false; // Current line is too long and will be rejected
+
+// Incoming frame being assembled byte by byte (Bluetooth task only)
+uint8_t frameRx[FRAME_HEADER_SIZE + FRAME_MAX_RX_PAYLOAD + FRAME_CRC_SIZE];
+int frameRxUsed = 0; // Bytes of the current frame received so far
+
+// Runtime settings, tuned without reflashing: CONFIG_<key>=<value> over
+// Bluetooth or POST /config over Wi-Fi changes one, and it is kept in NVS
+// (Preferences namespace CONFIG_NAMESPACE). loadConfig() reads them into
+// config at boot and each change is written there too, so the ISRs and the
+// game read a RAM field and never look a setting up. The constants above are
+// the defaults. Settings only change at the menu, outside a recording: the
+// game task applies every change between its commands (GAME_CMD_CONFIG).
+struct Config {
+  uint32_t touchDebounceUs;          // Touch ISR debounce window (microseconds)
+  uint32_t buttonDebounceUs;         // Button ISR debounce window (microseconds)
+  uint32_t joystickThreshold;        // Joystick movement threshold (analog units)
+  uint32_t joystickHysteresis;       // Joystick re-centering margin (analog units)
+  uint32_t resultDisplayMs;          // Results on screen (ms)
+  uint32_t cooldownMs;               // Pause after results (ms)
+  uint32_t bluetoothChunk;           // History bytes per Bluetooth chunk (whole records, at most BLUETOOTH_CHUNK_SIZE)
+  uint32_t redMinMs, redMaxMs;       // Red Light duration range [min, max) (ms)
+  uint32_t yellowMinMs, yellowMaxMs; // Yellow Light duration range (ms)
+  uint32_t greenMinMs, greenMaxMs;   // Green Light window range (ms)
+};
+DRAM_ATTR Config config; // The touch and button ISRs read it
+
+// The settings: key (NVS key, CONFIG_ and /config name; NVS allows 15
+// characters), field, default and accepted range. Sessions record settings
+// by index, so new ones go at the end.
+struct ConfigSetting {
+  const char *key;
+  uint32_t Config::*field;
+  uint32_t defaultValue;
+  uint32_t minimum;
+  uint32_t maximum;
+};
+const ConfigSetting CONFIG_SETTINGS[] = {
+  {"touch_debounce", &Config::touchDebounceUs, TOUCH_DEBOUNCE_US, 1000, 500000},
+  {"button_debounce", &Config::buttonDebounceUs, BUTTON_DEBOUNCE_US, 1000, 200000},
+  {"joy_threshold", &Config::joystickThreshold, JOYSTICK_THRESHOLD, 100, 1900},
+  {"joy_hysteresis", &Config::joystickHysteresis, JOYSTICK_HYSTERESIS, 0, 1000},
+  {"result_ms", &Config::resultDisplayMs, RESULT_DISPLAY_TIME, 500, 60000},
+  {"cooldown_ms", &Config::cooldownMs, GAME_COOLDOWN_TIME, 0, 60000},
+  {"bt_chunk", &Config::bluetoothChunk, BLUETOOTH_CHUNK_SIZE, sizeof(HistoryRecord), BLUETOOTH_CHUNK_SIZE},
+  {"red_min_ms", &Config::redMinMs, 1000, 100, 30000},
+  {"red_max_ms", &Config::redMaxMs, 5000, 100, 30000},
+  {"yellow_min_ms", &Config::yellowMinMs, 500, 100, 30000},
+  {"yellow_max_ms", &Config::yellowMaxMs, 2000, 100, 30000},
+  {"green_min_ms", &Config::greenMinMs, 1000, 100, 30000},
+  {"green_max_ms", &Config::greenMaxMs, 3000, 100, 30000},
+};
+const int CONFIG_SETTING_COUNT = sizeof(CONFIG_SETTINGS) / sizeof(CONFIG_SETTINGS[0]);
+Preferences configStore;       // NVS namespace, open from boot
+SemaphoreHandle_t configMutex; // One change in flight from the Bluetooth and web tasks
+QueueHandle_t configReplyQueue; // ConfigResult of the change in flight, from the game task
+std::atomic<uint32_t> configTicket(0); // Claimed by the game task applying a change, or by its requester giving up
+const uint8_t CONFIG_RESET_ALL = 0xFF; // GAME_CMD_CONFIG setting: every setting back to its default
+
+// How a setting change went
+enum ConfigResult {
+  CONFIG_OK,
+  CONFIG_BUSY_GAME,    // A round or tournament is running
+  CONFIG_BUSY_SESSION, // A session records or replays
+  CONFIG_UNFIT,        // The value does not fit the other settings
+  CONFIG_NVS_FAILED,   // NVS refused the write
+  CONFIG_NO_REPLY      // The game task did not take it in time (nothing changed)
+};
+
+// What a touch means, decided by the ISR from the phase it landed in
+enum TouchKind {
+  TOUCH_JUMPSTART, // Before Green Light was on screen
+  TOUCH_VALID,     // Inside the Green Light window
+  TOUCH_LATE       // After the Green Light window closed
+};
+
+// Touch event captured by an ISR: which player touched, when (microseconds)
+// and how it was classified
+struct TouchEvent {
+  uint8_t player;      // Player index (0-based)
+  uint8_t kind;        // TouchKind
+  int64_t timestampUs; // esp_timer_get_time() at the moment of the interrupt
+};
+
+// Phase as seen by the touch ISR. The game task publishes it with release
+// ordering after greenStartTime/greenEndTime are written, so an ISR that
+// reads TOUCH_PHASE_GREEN with acquire ordering sees the whole window.
+enum TouchPhase {
+  TOUCH_PHASE_IDLE,  // No round: touches are dropped in the ISR
+  TOUCH_PHASE_WAIT,  // Red, Yellow, or Green not yet shown: jumpstarts
+  TOUCH_PHASE_GREEN, // Green window open: valid, or late after greenEndTime
+  TOUCH_PHASE_OVER   // Results and cooldown: late
+};
+std::atomic<uint8_t> touchPhase(TOUCH_PHASE_IDLE);
+
+// Lock-free single-producer/single-consumer ring buffer of touch events.
+// The touch ISRs are the only producer (they all run in the GPIO interrupt of
+// one core), the game task is the only consumer. The head index is published
+// with release ordering after the slot is written, so the consumer never sees
+// a half-written event.
+TouchEvent touchQueue[TOUCH_QUEUE_SIZE];
+std::atomic<uint32_t> touchQueueHead(0);     // Next slot to write (owned by the ISRs)
+std::atomic<uint32_t> touchQueueTail(0);     // Next slot to read (owned by the game task)
+std::atomic<uint32_t> touchQueueOverflows(0); // Events dropped because the queue was full
+
+// Per-player debounce state for the touch ISR: low 32 bits of the last
+// accepted touch timestamp. Four bytes per pad in DRAM so the ISR never
+// touches flash; differences stay correct across the 71-minute wrap.
+DRAM_ATTR uint32_t touchLastUs[MAX_PLAYERS];
+
+// Per-pad edge stream, written by the touch ISR only: the times of the last
+// TOUCH_EDGE_HISTORY edges (accepted or not) for the bounce detector, and
+// counts for the noise profile. The game task reads them once a round's
+// touches are in.
+DRAM_ATTR volatile uint32_t touchEdgeUs[MAX_PLAYERS][TOUCH_EDGE_HISTORY];
+DRAM_ATTR volatile uint32_t touchEdges[MAX_PLAYERS];   // Edges seen per pad (also the edge ring position)
+DRAM_ATTR volatile uint32_t touchChatter[MAX_PLAYERS]; // Edges rejected by the debounce per pad
+
+#if TOUCH_SENSING == TOUCH_NATIVE
+// Native touch pads, calibrated at boot with the pads untouched. The
+// peripheral scans them continuously and interrupts on every scan that reads
+// below the threshold, so a held touch is one edge until it lets go.
+struct TouchPadCalibration {
+  uint16_t baseline;  // Mean untouched reading
+  uint16_t noise;     // Spread of the untouched readings
+  uint16_t threshold; // Readings below this are a touch
+  uint32_t periodUs;  // Measured time between fresh readings: the pad's worst-case detection latency
+};
+TouchPadCalibration touchCalibration[MAX_PLAYERS];
+DRAM_ATTR uint32_t touchHeldUs[MAX_PLAYERS]; // Low 32 bits of each pad's last native interrupt
+DRAM_ATTR uint32_t touchHoldUs;              // Gap that ends a held touch (TOUCH_HOLD_SCANS of the slowest pad)
+#endif
+
+// Pad noise profile (game task): chatter per round, smoothed over rounds
+uint32_t padChatterSeen[MAX_PLAYERS]; // touchChatter at the end of the last round
+float padNoise[MAX_PLAYERS];          // Smoothed chatter edges per round
+uint32_t padFlagged[MAX_PLAYERS];     // Suspect results per pad since boot
 
-// Leaderboard structure to store player names and best reaction times
-struct Player {
-  String name;              // Player name
-  unsigned long bestReactionTime; // Best reaction time in milliseconds
+// Session recorder. While it runs (RECORD_ON), every round goes to
+// SESSION_FILE as fixed 8-byte records: the generator state its phases were
+// drawn from and the durations, the pads' noise levels, each phase end the
+// game task handled and when, when Green Light was shown, every touch edge the
+// ISR saw, and the results. Times count from the round's start; the
+// settings the session ran with open it. The ISR hands
+// edges over through a ring; the game task fills two RAM buffers in turn and
+// the storage task appends each full one (and the last of every round).
+// REPLAY re-drives the same state machine from the file on a virtual clock,
+// at full speed, and compares each round with what was recorded.
+enum SessionRecordType {
+  SESSION_BEGIN,  // player: SESSION_VERSION, value: MAX_PLAYERS, data: the generator's state (the seed)
+  SESSION_ROUND,  // player: players, value: Red ms, data: generator state the durations were drawn from
+  SESSION_PHASES, // player: 1 if the durations came from an arena coordinator, value: Yellow ms, data: Green ms
+  SESSION_NOISE,  // player: pad, data: its noise level as the round began (float bits)
+  SESSION_PHASE,  // player: GameState whose end the game task handled, data: when
+  SESSION_GREEN,  // data: when Green Light was shown, as the display reported it
+  SESSION_EDGE,   // player: pad, value: TouchPhase the ISR saw, data: when
+  SESSION_RESULT, // player: player, value: suspect HistoryFlags, data: reaction (or REACTION_NONE/REACTION_JUMPSTART)
+  SESSION_CONFIG  // player: CONFIG_SETTINGS index, data: its value (every setting, after SESSION_BEGIN)
 };
-Player leaderboard[MAX_PLAYERS]; // Array to store leaderboard data
+struct SessionRecord {
+  uint8_t type;   // SessionRecordType
+  uint8_t player; // Pad, player or count (see SessionRecordType)
+  uint16_t value;
+  uint32_t data;  // Times are microseconds since the round started
+};
+static_assert(sizeof(SessionRecord) == 8, "SessionRecord must stay 8 bytes");
+const uint8_t SESSION_VERSION = 2;
+
+struct SessionEdge {
+  uint32_t timeUs; // Low 32 bits of the edge's timestamp
+  uint8_t player;  // Pad
+  uint8_t phase;   // TouchPhase when it fired
+};
+std::atomic<bool> sessionRecording(false); // The recorder runs (the touch ISR feeds it)
+std::atomic<bool> sessionReplaying(false); // A replay drives the game; the touch ISR ignores the pads
+DRAM_ATTR SessionEdge sessionEdges[SESSION_EDGE_RING]; // Edges from the ISR, not yet recorded
+std::atomic<uint32_t> sessionEdgeHead(0);    // Written by the ISR only
+std::atomic<uint32_t> sessionEdgeTail(0);    // Written by the game task only
+std::atomic<uint32_t> sessionEdgesDropped(0); // Edges lost to a full ring
+SessionRecord sessionBuffer[2][SESSION_BUFFER_RECORDS]; // Filled by the game task, written by the storage task
+std::atomic<bool> sessionBufferBusy[2];      // Handed to the storage task and not written yet
+int sessionBufferIndex = 0;                  // Buffer being filled (game task)
+int sessionBufferUsed = 0;                   // Records in it
+uint32_t sessionBytes = 0;                   // Bytes handed to the storage task this session
+uint32_t sessionRounds = 0;                  // Rounds recorded this session
+uint32_t sessionDropped = 0;                 // Records lost because the storage task fell behind
+File sessionFile;                            // SESSION_FILE being written (storage task only)
+
+// Replay in progress (game task only). The live pad state is set aside while
+// replayed edges run through it, so a replay leaves no trace on the game.
+struct PadState {
+  uint32_t lastUs, edges, chatter, chatterSeen, flagged;
+  uint32_t edgeUs[TOUCH_EDGE_HISTORY];
+  float noise;
+};
+struct SessionReplay {
+  int64_t base;         // Virtual time the current round started
+  uint32_t randomState; // Generator state the next local round must start from
+  uint32_t roundState;  // Generator state recorded for the current round
+  uint16_t redMs;       // Recorded Red duration of the current round
+  uint8_t players;      // Players of the current round
+  bool roundOpen;       // A round was started and not reported yet
+  bool differs;         // Something in the current round did not replay as recorded
+  int results;          // Recorded results compared so far in the current round
+  uint32_t rounds;      // Rounds replayed
+  uint32_t matched;     // Rounds that replayed exactly
+  uint32_t savedRandomState;
+  Config savedConfig;
+  uint32_t savedArenaRoundId;
+  RoundResult savedRound;
+  ResultText savedResult;
+  PadState savedPads[MAX_PLAYERS];
+};
+SessionReplay replay;
+int64_t replayClock = 0; // Virtual clock during a replay (see gameNow())
+
+// Players are people, not seats: each name is registered once under a 32-bit
+// FNV-1a hash of the name (its id) with its best reaction, and keeps that
+// record whichever seat it plays from. Records live on SD in PLAYERS_FILE;
+// RAM holds only the index, sorted by id for binary search. Ids that collide
+// are told apart by the name in the record.
+struct PlayerRecord {
+  uint32_t id;                 // playerId(name); a mismatch marks a corrupt record
+  uint32_t bestReactionTime;   // Best valid reaction in microseconds (0: none yet)
+  char name[PLAYER_NAME_SIZE]; // Player name
+};
+static_assert(sizeof(PlayerRecord) == 32, "PlayerRecord must stay 32 bytes (16 per SD sector)");
+struct PlayerIndexEntry {
+  uint32_t id;   // Player id
+  uint16_t slot; // Record number in PLAYERS_FILE
+  uint16_t reserved;
+};
+PlayerIndexEntry playerIndex[REGISTRY_MAX_PLAYERS]; // Sorted by id (storage task only)
+int registeredPlayers = 0;                          // Entries in playerIndex
+File playersFile;                                   // PLAYERS_FILE opened read/write (storage task only)
+
+// Leaderboard: the LEADERBOARD_SIZE fastest players, sorted by best reaction
+// (ties by id) so a result finds its place with a binary search
+PlayerRecord leaderboard[LEADERBOARD_SIZE];
+int leaderboardCount = 0; // Entries in leaderboard
 
 // Menu variables
 int currentMenuOption = 0;       // Currently selected menu option (index)
-const String MENU_OPTIONS[] = {"Start Game", "View History", "View Leaderboard", "Delete History"}; // Menu options
+const char *const MENU_OPTIONS[] = {"Start Game", "View History", "View Leaderboard", "Delete History"}; // Menu options
 const int MENU_SIZE = 4;         // Number of menu options
-bool menuDisplayed = false;      // Flag to track if menu is currently displayed
-
-// Interrupt Service Routines (ISRs) for TTP223 touch sensors
-// Each ISR handles a player's touch sensor, recording the reaction time
-void IRAM_ATTR touchISR1() {
-  static unsigned long lastInterrupt = 0; // Static to retain last interrupt time
-  if (!touchDetected[0] && millis() - lastInterrupt > 50) { // Check if not already detected and debounce
-    reactionTimes[0] = millis(); // Record the time of touch
-    touchDetected[0] = true;     // Mark player as having touched
-    Serial.print("Player 1 touched at: ");
-    Serial.print(reactionTimes[0]);
-    Serial.println(" ms");
-    lastInterrupt = millis();    // Update last interrupt time
-  }
-}
-void IRAM_ATTR touchISR2() {
-  static unsigned long lastInterrupt = 0;
-  if (!touchDetected[1] && millis() - lastInterrupt > 50) {
-    reactionTimes[1] = millis();
-    touchDetected[1] = true;
-    Serial.print("Player 2 touched at: ");
-    Serial.print(reactionTimes[1]);
-    Serial.println(" ms");
-    lastInterrupt = millis();
-  }
-}
-void IRAM_ATTR touchISR3() {
-  static unsigned long lastInterrupt = 0;
-  if (!touchDetected[2] && millis() - lastInterrupt > 50) {
-    reactionTimes[2] = millis();
-    touchDetected[2] = true;
-    Serial.print("Player 3 touched at: ");
-    Serial.print(reactionTimes[2]);
-    Serial.println(" ms");
-    lastInterrupt = millis();
-  }
-}
-void IRAM_ATTR touchISR4() {
-  static unsigned long lastInterrupt = 0;
-  if (!touchDetected[3] && millis() - lastInterrupt > 50) {
-    reactionTimes[3] = millis();
-    touchDetected[3] = true;
-    Serial.print("Player 4 touched at: ");
-    Serial.print(reactionTimes[3]);
-    Serial.println(" ms");
-    lastInterrupt = millis();
+volatile bool menuDisplayed = false; // Flag to track if menu is currently displayed
+
+// Screens that never change, rendered once at boot and copied into the
+// framebuffer when shown, so phase changes and cursor moves do no font
+// rendering. 1 KB each on the OLED; the TFT's 9.6 KB frames are not cached
+// unless built with -DFRAME_CACHE=1.
+#ifndef FRAME_CACHE
+#define FRAME_CACHE (DISPLAY_BACKEND == DISPLAY_SSD1306)
+#endif
+enum StaticFrame {
+  FRAME_RED,                          // Traffic lights
+  FRAME_YELLOW,
+  FRAME_GREEN,
+  FRAME_MENU,                         // Main menu with the cursor on option 0, ...
+  FRAME_LEADERBOARD = FRAME_MENU + MENU_SIZE, // Leaderboard title
+  FRAME_HISTORY,                      // Recent games title
+  STATIC_FRAMES
+};
+const char *const TRAFFIC_LIGHT_COLORS[] = {"RED", "YELLOW", "GREEN"}; // Text of FRAME_RED...FRAME_GREEN
+const size_t FRAME_BYTES = (size_t)SCREEN_WIDTH * SCREEN_HEIGHT / 8; // One 1-bit framebuffer
+#if FRAME_CACHE
+uint8_t staticFrames[STATIC_FRAMES][FRAME_BYTES];
+#if DISPLAY_BACKEND == DISPLAY_TFT
+uint16_t staticFrameInk[STATIC_FRAMES];
+#endif
+#endif
+
+// Menu input events. The button ISR and the joystick sampler produce them as
+// soon as an input changes; loop() sleeps on the queue, so a press is handled
+// within a few milliseconds instead of on the next poll.
+enum MenuEventType {
+  MENU_UP,             // Joystick pushed (or held) up
+  MENU_DOWN,           // Joystick pushed (or held) down
+  MENU_SELECT,         // Button pressed
+  MENU_WAKE_TOUCH,     // Touch pad pressed with no round running (wakes idle mode only)
+  MENU_WAKE_BLUETOOTH, // Bluetooth client connected or sent a command (wakes idle mode only)
+  MENU_WAKE_ROUND      // A round started (wakes idle mode only)
+};
+const char *const WAKE_SOURCE_NAMES[] = {"joystick", "joystick", "button", "touch", "bluetooth", "round"};
+static_assert(sizeof(WAKE_SOURCE_NAMES) / sizeof(WAKE_SOURCE_NAMES[0]) == MENU_WAKE_ROUND + 1, "One name per menu event");
+struct MenuEvent {
+  uint8_t type;        // MenuEventType
+  int64_t timestampUs; // When the input changed
+};
+QueueHandle_t menuQueue;
+
+// Idle mode: after idleTimeout of no input at the menu, loop() turns the OLED
+// off, slows the CPU and light-sleeps between checks; any input wakes it.
+// loop() owns powerMode; other tasks post a MENU_WAKE_* event to leave it.
+enum PowerMode {
+  POWER_ACTIVE,
+  POWER_IDLE
+};
+volatile uint8_t powerMode = POWER_ACTIVE;   // PowerMode
+volatile uint32_t lastActivityMs = 0;        // millis() of the last input, command or round
+volatile uint32_t idleTimeout = IDLE_TIMEOUT; // ms; 0 never goes idle
+volatile bool bluetoothConnected = false;    // A client is connected (light sleep would drop it)
+uint32_t activeCpuFrequency = 0;             // CPU clock to restore on wake-up (MHz)
+
+// Button debounce state (button ISR; resynchronized by the joystick sampler)
+volatile bool buttonPressed = false; // Debounced button level
+volatile uint32_t buttonEdgeUs = 0;  // Low 32 bits of the last accepted edge
+
+// Joystick sampler state (esp_timer task only)
+esp_timer_handle_t joystickTimer;
+int joystickDirection = -1;    // MENU_UP, MENU_DOWN or -1 when centered
+int64_t joystickRepeatUs = 0;  // When the held direction repeats next
+
+// Messages for the game task
+enum GameCommandType {
+  GAME_CMD_START,       // Start a round (ignored if one is running)
+  GAME_CMD_PHASE_END,   // The phase timer fired
+  GAME_CMD_TOUCH,       // Touch events are waiting in the touch queue
+  GAME_CMD_GREEN_SHOWN, // The Green Light frame is on the OLED as of timestampUs
+  GAME_CMD_TOURNAMENT,  // Make the next start a tournament of value rounds (0: single round)
+  GAME_CMD_STANDINGS,   // Send the tournament standings over Bluetooth
+  GAME_CMD_ARENA_ROUND, // Arena follower: play round value starting at timestampUs
+  GAME_CMD_RECORD,      // Start (value 1) or stop (value 0) the session recorder
+  GAME_CMD_REPLAY,      // Replay SESSION_FILE
+  GAME_CMD_CONFIG       // Set setting to value and answer on configReplyQueue
+};
+struct GameCommand {
+  uint8_t type;        // GameCommandType
+  int64_t timestampUs; // For GAME_CMD_GREEN_SHOWN and GAME_CMD_ARENA_ROUND
+  int32_t value;       // For GAME_CMD_TOURNAMENT, GAME_CMD_ARENA_ROUND and GAME_CMD_CONFIG
+  uint16_t phaseMs[3]; // Red, Yellow and Green durations for GAME_CMD_ARENA_ROUND
+  uint8_t setting;     // For GAME_CMD_CONFIG: CONFIG_SETTINGS index, or CONFIG_RESET_ALL
+  uint32_t ticket;     // For GAME_CMD_CONFIG: configTicket when the change was sent
+};
+
+// Messages for the display task. Every message is a full-screen redraw, so
+// when the queue is full the oldest message is dropped (the newest screen wins).
+enum DisplayCommandType {
+  DISPLAY_TEXT,          // One line of small text
+  DISPLAY_TRAFFIC_LIGHT, // "<color> LIGHT" in large text
+  DISPLAY_RESULTS,       // Wrapped results text
+  DISPLAY_MENU,          // Main menu with the cursor on option
+  DISPLAY_LEADERBOARD,   // Leaderboard entries
+  DISPLAY_HISTORY,       // Most recent games, one line each
+  DISPLAY_POWER          // Panel on (option 1) or off (option 0); keeps the frame
+};
+struct DisplayCommand {
+  uint8_t type;                  // DisplayCommandType
+  int8_t option;                 // Cursor position for DISPLAY_MENU, on/off for DISPLAY_POWER
+  bool reportShown;              // Send GAME_CMD_GREEN_SHOWN once the frame is on the panel
+  int64_t timestampUs;           // DISPLAY_POWER on: the wake-up input, for the latency report
+  char text[DISPLAY_TEXT_SIZE];  // Text for DISPLAY_TEXT, DISPLAY_TRAFFIC_LIGHT and DISPLAY_RESULTS
+};
+
+// Messages for the storage task (the only task that writes to the SD card)
+enum StorageCommandType {
+  STORAGE_SAVE_ROUND,    // Append round to history and update leaderboard
+  STORAGE_DELETE_HISTORY, // Delete the history file
+  STORAGE_ARENA_RESULT,   // Record the results waiting in arenaResultQueue in the registry
+  STORAGE_SESSION_OPEN,   // Start a new SESSION_FILE
+  STORAGE_SESSION_WRITE,  // Append records of sessionBuffer[buffer] to it
+  STORAGE_SESSION_CLOSE,  // Close it
+  STORAGE_SHUTDOWN        // Flush and close everything before a reboot, then give done
+};
+struct StorageCommand {
+  uint8_t type;      // StorageCommandType
+  RoundResult round; // Round for STORAGE_SAVE_ROUND
+  uint8_t buffer;    // Recorder buffer for STORAGE_SESSION_WRITE
+  uint16_t records;  // Records in it
+  SemaphoreHandle_t done; // Given once STORAGE_SHUTDOWN is finished
+};
+
+// Messages for the Bluetooth task (the only task that writes to ESP_BT)
+enum BluetoothMessageType {
+  BT_SEND_TEXT,       // Send text (println if newline is set)
+  BT_SEND_HISTORY,    // Send the game history in chunks
+  BT_SEND_RECENT,     // Send the last count games from the RAM ring
+  BT_SEND_LEADERBOARD, // Send the leaderboard entries
+  BT_RECEIVED,         // BLE: bytes arrived (only wakes the task)
+  BT_NOTIFY_STATE,     // BLE: publish phase count on the state characteristic
+  BT_NOTIFY_RESULT     // BLE: publish round on the results characteristic
+};
+struct BluetoothMessage {
+  uint8_t type;                   // BluetoothMessageType
+  bool newline;                   // End BT_SEND_TEXT with a newline
+  uint16_t count;                 // Number of games for BT_SEND_RECENT, GameState for BT_NOTIFY_STATE
+  char text[BLUETOOTH_TEXT_SIZE]; // Text for BT_SEND_TEXT
+  RoundResult round;              // Round for BT_NOTIFY_RESULT
+};
+
+// Queues connecting the tasks, and locks for state shared between them.
+// playerMutex guards playerNames, numberOfPlayers updates and leaderboard[]
+// and is never held across I/O; historyMutex guards the history log file.
+QueueHandle_t gameQueue;
+QueueHandle_t displayQueue;
+QueueHandle_t storageQueue;
+QueueHandle_t bluetoothQueue;
+TaskHandle_t gameTaskHandle = NULL;         // Set when the game task starts (see bluetoothQueueWait)
+std::atomic<uint32_t> bluetoothDropped(0); // Bluetooth messages dropped on a full queue
+SemaphoreHandle_t playerMutex;
+SemaphoreHandle_t historyMutex;
+SemaphoreHandle_t historyRingMutex;
+
+#if BT_TRANSPORT == BT_BLE
+// BLE stand-in for BluetoothSerial: one GATT service with
+//   command  (write)        command lines and binary frames from the client
+//   response (notify)       text replies, as the SPP link sends them
+//   state    (read, notify) the current phase as JSON ({"type":"phase",...})
+//   results  (read, notify) the last round's results as JSON
+//   history  (notify)       binary frames: history batches, errors, the end
+// It offers the Stream calls the Bluetooth task uses, so the command and
+// frame code is shared with Classic. Received bytes pass through a lock-free
+// ring from the NimBLE host task to the Bluetooth task and wake it, so
+// nothing polls. Each notification carries up to MTU - 3 bytes; a large MTU
+// and long link-layer packets are requested on connect for bulk transfers.
+class BleLink : public NimBLEServerCallbacks, public NimBLECharacteristicCallbacks {
+ public:
+  BleLink() : connection(BLE_HS_CONN_HANDLE_NONE), mtu(BLE_DEFAULT_MTU), rxHead(0), rxTail(0), wakePending(false) {}
+  void begin(const char *name) {
+    NimBLEDevice::init(name);
+    NimBLEDevice::setMTU(BLE_MTU);
+    server = NimBLEDevice::createServer();
+    server->setCallbacks(this, false); // A global: never deleted
+    NimBLEService *service = server->createService(BLE_SERVICE_UUID);
+    NimBLECharacteristic *command =
+        service->createCharacteristic(BLE_COMMAND_UUID, NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::WRITE_NR);
+    command->setCallbacks(this);
+    response = service->createCharacteristic(BLE_RESPONSE_UUID, NIMBLE_PROPERTY::NOTIFY);
+    state = service->createCharacteristic(BLE_STATE_UUID, NIMBLE_PROPERTY::READ | NIMBLE_PROPERTY::NOTIFY);
+    results = service->createCharacteristic(BLE_RESULTS_UUID, NIMBLE_PROPERTY::READ | NIMBLE_PROPERTY::NOTIFY);
+    history = service->createCharacteristic(BLE_HISTORY_UUID, NIMBLE_PROPERTY::NOTIFY);
+    service->start();
+    NimBLEAdvertising *advertising = NimBLEDevice::getAdvertising();
+    advertising->addServiceUUID(BLE_SERVICE_UUID);
+    advertising->start();
+  }
+
+  // Stream calls, for the Bluetooth task
+  int available() { return (uint16_t)(rxHead.load(std::memory_order_acquire) - rxTail.load(std::memory_order_relaxed)); }
+  int read() {
+    if (available() == 0) return -1;
+    uint16_t tail = rxTail.load(std::memory_order_relaxed);
+    uint8_t byte = rx[tail % BLE_RX_BUFFER_SIZE];
+    rxTail.store(tail + 1, std::memory_order_release);
+    return byte;
+  }
+  size_t write(const uint8_t *data, size_t length) {
+    notifyChunks(response, data, length);
+    return length;
+  }
+  size_t print(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+  size_t println(const char *text) {
+    size_t length = strlen(text);
+    if (length > BLUETOOTH_TEXT_SIZE) return print(text) + print("\r\n");
+    uint8_t line[BLUETOOTH_TEXT_SIZE + 2]; // Text and line end in one notification
+    memcpy(line, text, length);
+    line[length] = '\r';
+    line[length + 1] = '\n';
+    return write(line, length + 2);
+  }
+
+  // BLE-only calls, for the Bluetooth task
+  void writeFrame(const uint8_t *data, size_t length) { notifyChunks(history, data, length); }
+  void setState(const char *json) { setAndNotify(state, json); }
+  void setResults(const char *json) { setAndNotify(results, json); }
+  void rearm() { wakePending.store(false); } // Call before reading, so later bytes wake the task again
+
+  // NimBLE host task callbacks
+  void onConnect(NimBLEServer *connected, ble_gap_conn_desc *desc) override {
+    connection.store(desc->conn_handle);
+    bluetoothConnected = true;
+    if (powerMode == POWER_IDLE) {
+      MenuEvent wake = {MENU_WAKE_BLUETOOTH, esp_timer_get_time()};
+      xQueueSend(menuQueue, &wake, 0);
+    }
+    connected->setDataLen(desc->conn_handle, BLE_DATA_LENGTH);
+    connected->updateConnParams(desc->conn_handle, BLE_CONN_INTERVAL_MIN, BLE_CONN_INTERVAL_MAX, 0, BLE_SUPERVISION_TIMEOUT);
+  }
+  void onDisconnect(NimBLEServer *disconnected) override { // Advertising restarts by itself
+    connection.store(BLE_HS_CONN_HANDLE_NONE);
+    mtu.store(BLE_DEFAULT_MTU);
+    bluetoothConnected = false;
+  }
+  void onMTUChange(uint16_t value, ble_gap_conn_desc *desc) override { mtu.store(value); }
+  void onWrite(NimBLECharacteristic *characteristic) override {
+    std::string value = characteristic->getValue();
+    uint16_t head = rxHead.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < value.length(); i++) {
+      if ((uint16_t)(head - rxTail.load(std::memory_order_acquire)) >= BLE_RX_BUFFER_SIZE) break; // Full: the rest is lost
+      rx[head++ % BLE_RX_BUFFER_SIZE] = value[i];
+    }
+    rxHead.store(head, std::memory_order_release);
+    if (!wakePending.exchange(true)) {
+      BluetoothMessage wake;
+      wake.type = BT_RECEIVED;
+      xQueueSend(bluetoothQueue, &wake, 0);
+    }
+  }
+
+ private:
+  void notifyChunks(NimBLECharacteristic *characteristic, const uint8_t *data, size_t length) {
+    if (connection.load() == BLE_HS_CONN_HANDLE_NONE) return; // Nobody to hear it
+    size_t chunk = mtu.load() - 3; // ATT notification header
+    if (chunk > BLE_ATTRIBUTE_MAX) chunk = BLE_ATTRIBUTE_MAX; // setValue rejects longer pieces (MTU 517 leaves 514)
+    while (length > 0) {
+      size_t piece = length < chunk ? length : chunk;
+      characteristic->setValue(data, piece);
+      characteristic->notify();
+      data += piece;
+      length -= piece;
+    }
+  }
+  void setAndNotify(NimBLECharacteristic *characteristic, const char *json) {
+    characteristic->setValue((const uint8_t *)json, strlen(json)); // Kept for reads
+    if (connection.load() != BLE_HS_CONN_HANDLE_NONE) characteristic->notify();
+  }
+
+  NimBLEServer *server;
+  NimBLECharacteristic *response;
+  NimBLECharacteristic *state;
+  NimBLECharacteristic *results;
+  NimBLECharacteristic *history;
+  std::atomic<uint16_t> connection; // Connection handle, or BLE_HS_CONN_HANDLE_NONE
+  std::atomic<uint16_t> mtu;        // Negotiated ATT MTU
+  uint8_t rx[BLE_RX_BUFFER_SIZE];   // Received bytes, NimBLE host task -> Bluetooth task
+  std::atomic<uint16_t> rxHead;     // Written by the host task
+  std::atomic<uint16_t> rxTail;     // Written by the Bluetooth task
+  std::atomic<bool> wakePending;    // A BT_RECEIVED is queued and not yet handled
+};
+BleLink ESP_BT;
+#endif
+
+// Events for the WebSocket clients, formatted and sent by the web task
+enum LiveEventType {
+  LIVE_EVENT_PHASE,       // A new phase is on the OLED
+  LIVE_EVENT_RESULT,      // Results of the round just played
+  LIVE_EVENT_LEADERBOARD, // The leaderboard changed
+  LIVE_EVENT_HELLO        // A client connected: send it the current state
+};
+struct LiveEvent {
+  uint8_t type;      // LiveEventType
+  uint8_t phase;     // GameState for LIVE_EVENT_PHASE
+  uint32_t client;   // WebSocket client id for LIVE_EVENT_HELLO
+  RoundResult round; // Round for LIVE_EVENT_RESULT
+};
+QueueHandle_t webQueue;
+const char *const GAME_STATE_NAMES[] = {"idle", "red", "yellow", "green", "results", "cooldown", "armed"};
+static_assert(sizeof(GAME_STATE_NAMES) / sizeof(GAME_STATE_NAMES[0]) == GAME_ARMED + 1,
+              "GAME_STATE_NAMES needs one name per GameState");
+
+// Arena packets. Every packet starts with an ArenaHeader; all but results are
+// broadcast and receivers drop those addressed to another board. Results go
+// to the coordinator by unicast, which the radio acknowledges and retries. Times are esp_timer
+// microseconds on the sender's clock unless noted.
+enum ArenaPacketType {
+  ARENA_SYNC_REQUEST, // Follower -> coordinator: t1
+  ARENA_SYNC_REPLY,   // Coordinator -> follower: t1 echoed, t2 received, t3 sent
+  ARENA_ROUND,        // Coordinator -> all: round about to start
+  ARENA_RESULT        // Follower -> coordinator: one player's result
+};
+struct ArenaHeader {
+  uint16_t magic; // ARENA_MAGIC
+  uint8_t type;   // ArenaPacketType
+  uint8_t board;  // Sender
+  uint8_t target; // Receiving board, or ARENA_ALL_BOARDS
+  uint8_t reserved[3];
+};
+const uint8_t ARENA_ALL_BOARDS = 0xFF;
+struct ArenaSync {
+  ArenaHeader header;
+  int64_t t1; // Follower clock: request sent
+  int64_t t2; // Coordinator clock: request received
+  int64_t t3; // Coordinator clock: reply sent
+};
+struct ArenaRound {
+  ArenaHeader header;
+  uint32_t roundId;    // Increases with every round the coordinator starts
+  uint16_t phaseMs[3]; // Red, Yellow and Green durations
+  int64_t startUs;     // Coordinator clock: when Red Light begins
+};
+struct ArenaResult {
+  ArenaHeader header;
+  uint32_t roundId;
+  uint32_t reactionUs;         // Reaction, or REACTION_NONE / REACTION_JUMPSTART
+  int64_t greenStartUs;        // Coordinator clock: when Green Light was on this board's OLED
+  uint32_t syncErrorUs;        // Bound on the follower's clock error
+  uint8_t flags;               // HISTORY_FLAGS_SUSPECT reasons: shown, never merged
+  char name[PLAYER_NAME_SIZE]; // Player name on the follower
+};
+static_assert(sizeof(ArenaResult) <= ARENA_MAX_PACKET && sizeof(ArenaRound) <= ARENA_MAX_PACKET &&
+                  sizeof(ArenaSync) <= ARENA_MAX_PACKET, "Arena packets must fit ARENA_MAX_PACKET");
+
+// Messages for the arena task
+enum ArenaMessageKind {
+  ARENA_MSG_RECEIVED, // Packet from another board
+  ARENA_MSG_SEND,     // Packet to broadcast as is
+  ARENA_MSG_RESULT,   // Follower result to convert to the coordinator clock and send
+  ARENA_MSG_STATUS    // Report the arena state over Bluetooth
+};
+struct ArenaMessage {
+  uint8_t kind;   // ArenaMessageKind
+  uint8_t length; // Bytes in data
+  int64_t timeUs; // Arrival time for ARENA_MSG_RECEIVED
+  uint8_t mac[6]; // Sender for ARENA_MSG_RECEIVED
+  uint8_t data[ARENA_MAX_PACKET];
+};
+
+// Follower clock model, NTP-style. Each exchange gives the offset
+// coordinator - follower = ((t2 - t1) + (t3 - t4)) / 2, wrong by at most half
+// the round-trip delay (t4 - t1) - (t3 - t2). Of every ARENA_SYNC_SAMPLES
+// exchanges the lowest-delay one becomes the anchor. The offset change
+// between anchors at least ARENA_DRIFT_BASELINE apart gives the drift (over
+// shorter spans the delay jitter swamps it), so conversion between anchors
+// tracks the two crystals instead of jumping at each sync.
+class ClockSync {
+ public:
+  ClockSync() : anchors(0), driftSpans(0), epochSamples(0), epochBest(), latest(), base(), drift(0) {}
+  void addSample(int64_t t1, int64_t t2, int64_t t3, int64_t t4) {
+    int64_t delay = (t4 - t1) - (t3 - t2);
+    if (delay < 0) return; // Nonsense: a reply that left before the request arrived
+    Sample sample = {t1 + (t4 - t1) / 2, ((t2 - t1) + (t3 - t4)) / 2, delay};
+    if (epochSamples == 0 || sample.delayUs < epochBest.delayUs) epochBest = sample;
+    epochSamples++;
+    if (anchors == 0) latest = epochBest; // Usable before the first epoch completes
+    if (epochSamples < ARENA_SYNC_SAMPLES) return;
+    if (anchors == 0) {
+      base = epochBest;
+    } else if (epochBest.localUs - base.localUs >= (int64_t)ARENA_DRIFT_BASELINE * 1000) {
+      double measured = (double)(epochBest.offsetUs - base.offsetUs) / (epochBest.localUs - base.localUs);
+      drift = driftSpans > 0 ? drift + (measured - drift) * ARENA_DRIFT_GAIN : measured;
+      driftSpans++;
+      base = epochBest;
+    }
+    latest = epochBest;
+    anchors++;
+    epochSamples = 0;
+  }
+  bool synced() const { return anchors > 0 || epochSamples > 0; }
+  int64_t offsetAt(int64_t localUs) const { return latest.offsetUs + (int64_t)(drift * (localUs - latest.localUs)); }
+  int64_t toCoordinator(int64_t localUs) const { return localUs + offsetAt(localUs); }
+  int64_t toLocal(int64_t coordinatorUs) const { return coordinatorUs - offsetAt(coordinatorUs - latest.offsetUs); }
+  uint32_t errorBoundUs() const { return (uint32_t)(latest.delayUs / 2); }
+  double driftPpm() const { return drift * 1e6; }
+
+ private:
+  struct Sample {
+    int64_t localUs;  // Follower clock at the middle of the exchange
+    int64_t offsetUs; // Coordinator - follower
+    int64_t delayUs;  // Round trip minus coordinator turnaround
+  };
+  uint32_t anchors;      // Epochs completed
+  uint32_t driftSpans;   // Drift measurements so far
+  int epochSamples;      // Exchanges so far in this epoch
+  Sample epochBest;      // Lowest-delay exchange of this epoch
+  Sample latest;         // Current anchor
+  Sample base;           // Anchor the next drift measurement starts from
+  double drift;          // Offset change per follower microsecond
+};
+
+// Arena state, owned by the arena task (the only task that talks to the radio)
+QueueHandle_t arenaQueue;
+ClockSync arenaClock;                      // Follower: coordinator clock estimate
+int64_t arenaSyncT1 = 0;                   // Follower: t1 of the outstanding sync request
+int64_t arenaBoardSeen[ARENA_MAX_BOARDS];  // Coordinator: last packet from each board (0: never)
+uint32_t arenaLastRound = 0;               // Last round announced (coordinator) or received (follower)
+int64_t arenaRoundStartUs = 0;             // Coordinator clock: start of arenaLastRound
+uint8_t arenaCoordinatorMac[6];            // Follower: where results go, learned from the coordinator's packets
+bool arenaCoordinatorKnown = false;
+
+// Coordinator: follower results for the registry. A whole round of every
+// board fits, and one STORAGE_ARENA_RESULT wakes the storage task for all
+// of them, so a full board never crowds the storage queue.
+struct ArenaPlayerResult {
+  char name[PLAYER_NAME_SIZE];
+  uint32_t reactionUs;
+};
+QueueHandle_t arenaResultQueue;
+std::atomic<bool> arenaResultsPending(false); // A STORAGE_ARENA_RESULT is queued and not yet handled
+std::atomic<uint32_t> arenaSendFailures(0); // Unicasts the radio gave up on (Wi-Fi task)
+
+// Push a touch event into the queue (called from ISR context only).
+// Never blocks and never does I/O; if the queue is full the event is dropped
+// and counted so the game task can report it.
+void IRAM_ATTR pushTouchEvent(uint8_t player, uint8_t kind, int64_t timestampUs) {
+  uint32_t head = touchQueueHead.load(std::memory_order_relaxed);
+  if (head - touchQueueTail.load(std::memory_order_acquire) >= TOUCH_QUEUE_SIZE) {
+    touchQueueOverflows.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  touchQueue[head & (TOUCH_QUEUE_SIZE - 1)].player = player;
+  touchQueue[head & (TOUCH_QUEUE_SIZE - 1)].kind = kind;
+  touchQueue[head & (TOUCH_QUEUE_SIZE - 1)].timestampUs = timestampUs;
+  touchQueueHead.store(head + 1, std::memory_order_release); // Publish the event
+}
+
+// Pop the oldest touch event from the queue (called from the game task only)
+bool popTouchEvent(TouchEvent &event) {
+  uint32_t tail = touchQueueTail.load(std::memory_order_relaxed);
+  if (tail == touchQueueHead.load(std::memory_order_acquire)) {
+    return false; // Queue is empty
+  }
+  event = touchQueue[tail & (TOUCH_QUEUE_SIZE - 1)];
+  touchQueueTail.store(tail + 1, std::memory_order_release); // Free the slot
+  return true;
+}
+
+// Interrupt Service Routine (ISR) shared by all touch sensors (through
+// nativeTouchISR() for TOUCH_NATIVE). attachInterruptArg() or
+// touchAttachInterruptArg() passes the player index, so one copy of this code in
+// IRAM serves every pad. It timestamps the touch first thing, hands it to the
+// recorder, and has acceptTouchEdge() debounce, classify and queue it;
+// scoring and Serial output happen in the game task.
+void IRAM_ATTR touchISR(void *arg) {
+  int64_t now = esp_timer_get_time(); // Timestamp before anything else
+  uint8_t player = (uint8_t)(uintptr_t)arg;
+  if (sessionReplaying.load(std::memory_order_relaxed)) return; // The replay is the game's only input meanwhile
+  if (sessionRecording.load(std::memory_order_relaxed)) recordTouchEdge(player, (uint32_t)now);
+  if (!acceptTouchEdge(player, now) || touchWakePending.load()) return;
+  touchWakePending.store(true); // One wake-up covers every touch queued before it is handled
+  GameCommand command = {GAME_CMD_TOUCH, now};
+  BaseType_t woken = pdFALSE;
+  if (xQueueSendFromISR(gameQueue, &command, &woken) != pdTRUE) {
+    touchWakePending.store(false); // Game queue full: the event waits in touchQueue and the next touch wakes the game
+  }
+  if (woken) portYIELD_FROM_ISR();
+}
+
+// One edge of a pad at time now, from the ISR (or a replay): feeds the edge
+// stream, debounces, classifies against the current phase and queues the
+// touch. Returns true if a touch event was queued.
+bool IRAM_ATTR acceptTouchEdge(uint8_t player, int64_t now) {
+  uint32_t nowLow = (uint32_t)now;
+  uint32_t edge = touchEdges[player];
+  touchEdgeUs[player][edge & (TOUCH_EDGE_HISTORY - 1)] = nowLow; // Every edge feeds the bounce detector
+  touchEdges[player] = edge + 1;
+  if (nowLow - touchLastUs[player] <= config.touchDebounceUs) {
+    touchChatter[player] = touchChatter[player] + 1;
+    return false;
+  }
+  touchLastUs[player] = nowLow; // Debounced: update last interrupt time
+  uint8_t kind;
+  switch (touchPhase.load(std::memory_order_acquire)) {
+    case TOUCH_PHASE_WAIT:  kind = TOUCH_JUMPSTART; break;
+    case TOUCH_PHASE_GREEN: kind = now <= greenEndTime ? TOUCH_VALID : TOUCH_LATE; break;
+    case TOUCH_PHASE_OVER:  kind = TOUCH_LATE; break;
+    default: // No round running: a touch only wakes idle mode
+      if (powerMode == POWER_IDLE) pushMenuEventFromISR(MENU_WAKE_TOUCH, now);
+      return false;
+  }
+  pushTouchEvent(player, kind, now); // Queue the touch for the game task
+  return true;
+}
+
+// Hand an edge to the session recorder (ISR context). Only edges during a
+// round are kept; when the ring is full the edge is dropped and counted.
+void IRAM_ATTR recordTouchEdge(uint8_t player, uint32_t nowLow) {
+  uint8_t phase = touchPhase.load(std::memory_order_acquire);
+  if (phase == TOUCH_PHASE_IDLE) return;
+  uint32_t head = sessionEdgeHead.load(std::memory_order_relaxed);
+  if (head - sessionEdgeTail.load(std::memory_order_acquire) >= SESSION_EDGE_RING) {
+    sessionEdgesDropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  SessionEdge &edge = sessionEdges[head & (SESSION_EDGE_RING - 1)];
+  edge.timeUs = nowLow;
+  edge.player = player;
+  edge.phase = phase;
+  sessionEdgeHead.store(head + 1, std::memory_order_release); // Publish the edge
+}
+
+#if TOUCH_SENSING == TOUCH_NATIVE
+// Native touch interrupt: only the first scan of a touch is an edge for
+// touchISR(); the ones that follow while the pad is held just extend it.
+void IRAM_ATTR nativeTouchISR(void *arg) {
+  uint8_t player = (uint8_t)(uintptr_t)arg;
+  uint32_t nowLow = (uint32_t)esp_timer_get_time();
+  uint32_t last = touchHeldUs[player];
+  touchHeldUs[player] = nowLow;
+  if (nowLow - last > touchHoldUs) touchISR(arg);
+}
+#endif
+
+// Queue a menu event from interrupt context
+void IRAM_ATTR pushMenuEventFromISR(uint8_t type, int64_t timestampUs) {
+  MenuEvent event = {type, timestampUs};
+  BaseType_t woken = pdFALSE;
+  xQueueSendFromISR(menuQueue, &event, &woken); // Dropped if loop() is that far behind
+  if (woken) portYIELD_FROM_ISR();
+}
+
+// Interrupt Service Routine for the menu button, on both edges. The first
+// edge that changes the debounced level is taken at once (so a press costs no
+// debounce delay); edges within the debounce window after it are bounce.
+void IRAM_ATTR buttonISR() {
+  int64_t now = esp_timer_get_time();
+  uint32_t nowLow = (uint32_t)now;
+  bool pressed = digitalRead(MENU_BUTTON) == LOW; // Active-low
+  if (pressed == buttonPressed || nowLow - buttonEdgeUs < config.buttonDebounceUs) return;
+  buttonPressed = pressed;
+  buttonEdgeUs = nowLow;
+  if (pressed) pushMenuEventFromISR(MENU_SELECT, now);
+}
+
+// Periodic joystick sampler (esp_timer callback, every JOYSTICK_SAMPLE_US).
+// Emits an event when the stick leaves the center and then auto-repeats while
+// it is held. Also releases the button if its release edge was lost in bounce.
+void sampleJoystick(void *arg) {
+  int64_t now = esp_timer_get_time();
+  int yValue = analogRead(JOYSTICK_Y);
+  int threshold = config.joystickThreshold;
+  int center = threshold + (int)config.joystickHysteresis;
+  int direction = joystickDirection;
+  if (yValue < threshold) {
+    direction = MENU_UP;
+  } else if (yValue > 4095 - threshold) {
+    direction = MENU_DOWN;
+  } else if (yValue > center && yValue < 4095 - center) {
+    direction = -1; // Back in the center
+  }
+  if (direction != joystickDirection) {
+    joystickDirection = direction;
+    joystickRepeatUs = now + MENU_REPEAT_DELAY_US;
+    if (direction >= 0) {
+      MenuEvent event = {(uint8_t)direction, now};
+      xQueueSend(menuQueue, &event, 0);
+    }
+  } else if (direction >= 0 && now >= joystickRepeatUs) {
+    joystickRepeatUs += MENU_REPEAT_INTERVAL_US;
+    MenuEvent event = {(uint8_t)direction, now};
+    xQueueSend(menuQueue, &event, 0);
+  }
+
+  if (buttonPressed && digitalRead(MENU_BUTTON) == HIGH && (uint32_t)now - buttonEdgeUs >= config.buttonDebounceUs) {
+    buttonPressed = false;
+    buttonEdgeUs = (uint32_t)now;
+  }
+}
+
+#if LOG_LEVEL > LOG_LEVEL_NONE
+// Log text waiting for the UART. Any task may append (under logLock); only
+// logFlush() in the loop task consumes. Positions are free-running counters.
+char logBuffer[LOG_BUFFER_SIZE];
+uint32_t logHead = 0;    // Total bytes appended
+uint32_t logTail = 0;    // Total bytes written to Serial
+uint32_t logDropped = 0; // Lines dropped because the buffer was full
+portMUX_TYPE logLock = portMUX_INITIALIZER_UNLOCKED;
+const char *const LOG_SUBSYSTEM_NAMES[] = {"SYS", "GAME", "INPUT", "OLED", "SD", "BT", "NET"};
+
+// Format one log line and queue it (use the LOG_xxx macros, not this)
+__attribute__((format(printf, 3, 4))) void logWrite(char level, LogSubsystem subsystem, const char *format, ...) {
+  char line[LOG_LINE_SIZE];
+  int used = snprintf(line, sizeof(line), "%lu %c %s: ", millis(), level, LOG_SUBSYSTEM_NAMES[subsystem]);
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line + used, sizeof(line) - used - 1, format, args);
+  va_end(args);
+  size_t length = strlen(line);
+  line[length++] = '\n'; // Room for it was kept back above
+
+  portENTER_CRITICAL(&logLock);
+  if (LOG_BUFFER_SIZE - (logHead - logTail) >= length) {
+    for (size_t i = 0; i < length; i++) {
+      logBuffer[(logHead + i) & (LOG_BUFFER_SIZE - 1)] = line[i];
+    }
+    logHead += length;
+  } else {
+    logDropped++;
+  }
+  portEXIT_CRITICAL(&logLock);
+}
+
+// Move queued log text to the UART, only as much as fits without blocking
+// (runs in the loop task)
+void logFlush() {
+  portENTER_CRITICAL(&logLock);
+  uint32_t head = logHead;
+  uint32_t dropped = logDropped;
+  logDropped = 0;
+  portEXIT_CRITICAL(&logLock);
+  if (dropped > 0) LOG_WARN(LOG_SYSTEM, "%lu log lines dropped", (unsigned long)dropped); // Sent on the next flush
+
+  while (logTail != head) {
+    size_t start = logTail & (LOG_BUFFER_SIZE - 1);
+    size_t pending = head - logTail;
+    size_t contiguous = LOG_BUFFER_SIZE - start;
+    size_t room = Serial.availableForWrite();
+    size_t count = pending < contiguous ? pending : contiguous;
+    if (count > room) count = room;
+    if (count == 0) break; // UART busy; try again next loop
+    Serial.write((const uint8_t *)logBuffer + start, count);
+    portENTER_CRITICAL(&logLock);
+    logTail += count; // Frees the space for writers
+    portEXIT_CRITICAL(&logLock);
+  }
+}
+#else
+void logFlush() {} // Production build: nothing is logged
+#endif
+
+#if PROFILE_ENABLED
+ProfileHistogram profiles[PROFILE_SECTIONS];
+portMUX_TYPE profileLock = portMUX_INITIALIZER_UNLOCKED; // Sections are recorded from several tasks
+const char *const PROFILE_SECTION_NAMES[] = {"display", "sd_append", "bt_write", "game_step", "touch_latency", "menu_latency", "green_shown", "wake"};
+const char *const PROFILE_SECTION_UNITS[] = {"cyc", "cyc", "cyc", "cyc", "us", "us", "us", "us"};
+static_assert(sizeof(PROFILE_SECTION_NAMES) / sizeof(PROFILE_SECTION_NAMES[0]) == PROFILE_SECTIONS, "One name per profile section");
+static_assert(sizeof(PROFILE_SECTION_UNITS) / sizeof(PROFILE_SECTION_UNITS[0]) == PROFILE_SECTIONS, "One unit per profile section");
+
+// Histogram bucket holding value
+int profileBucket(uint32_t value) {
+  if (value < (uint32_t)PROFILE_SUB_BUCKETS) return value;
+  int exponent = 31 - __builtin_clz(value); // >= 2
+  int sub = (value >> (exponent - 2)) & (PROFILE_SUB_BUCKETS - 1);
+  return (exponent - 1) * PROFILE_SUB_BUCKETS + sub;
+}
+
+// Smallest value falling in bucket
+uint32_t profileBucketStart(int bucket) {
+  if (bucket < PROFILE_SUB_BUCKETS) return bucket;
+  int exponent = bucket / PROFILE_SUB_BUCKETS + 1;
+  uint32_t sub = bucket % PROFILE_SUB_BUCKETS;
+  return (PROFILE_SUB_BUCKETS + sub) << (exponent - 2);
+}
+
+// Add one sample to a section's histogram (use PROFILE_RECORD)
+void profileRecord(ProfileSection section, uint32_t value) {
+  ProfileHistogram &histogram = profiles[section];
+  portENTER_CRITICAL(&profileLock);
+  if (histogram.count == 0 || value < histogram.min) histogram.min = value;
+  if (value > histogram.max) histogram.max = value;
+  histogram.count++;
+  histogram.buckets[profileBucket(value)]++;
+  portEXIT_CRITICAL(&profileLock);
+}
+
+// Value at quantile (0..1) of a histogram, to bucket resolution
+uint32_t profileQuantile(const ProfileHistogram &histogram, float quantile) {
+  uint32_t rank = (uint32_t)(quantile * (histogram.count - 1)); // 0-based sample rank
+  uint32_t seen = 0;
+  for (int bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+    seen += histogram.buckets[bucket];
+    if (seen > rank) {
+      uint32_t value = profileBucketStart(bucket);
+      if (value < histogram.min) value = histogram.min;
+      if (value > histogram.max) value = histogram.max;
+      return value;
+    }
   }
+  return histogram.max;
 }
 
+// Cycle-count probe: records the cycles between construction and the end of
+// its scope. CCOUNT is per core, which is fine because every task is pinned.
+class ProfileScope {
+ public:
+  ProfileScope(ProfileSection section) : section(section), start(ESP.getCycleCount()) {}
+  ~ProfileScope() { profileRecord(section, ESP.getCycleCount() - start); }
+
+ private:
+  ProfileSection section;
+  uint32_t start;
+};
+#endif
+
 // Setup function: Runs once on startup to initialize hardware and settings
 void setup() {
-  Serial.begin(115200); // Start serial communication at 115200 baud for debugging
-  Serial.println("Setup started");
+#if LOG_LEVEL > LOG_LEVEL_NONE
+  Serial.setTxBufferSize(LOG_UART_BUFFER); // Must precede begin()
+  Serial.begin(LOG_BAUD_RATE); // Start serial communication for debugging
+#endif
+  LOG_INFO(LOG_SYSTEM, "Setup started");
+
+  // Create the queues and locks the tasks communicate through
+  gameQueue = xQueueCreate(GAME_QUEUE_LENGTH, sizeof(GameCommand));
+  displayQueue = xQueueCreate(DISPLAY_QUEUE_LENGTH, sizeof(DisplayCommand));
+  storageQueue = xQueueCreate(STORAGE_QUEUE_LENGTH, sizeof(StorageCommand));
+  bluetoothQueue = xQueueCreate(BLUETOOTH_QUEUE_LENGTH, sizeof(BluetoothMessage));
+  menuQueue = xQueueCreate(MENU_QUEUE_LENGTH, sizeof(MenuEvent));
+  configReplyQueue = xQueueCreate(1, sizeof(uint8_t));
+  configMutex = xSemaphoreCreateMutex();
+  playerMutex = xSemaphoreCreateMutex();
+  historyMutex = xSemaphoreCreateMutex();
+  historyRingMutex = xSemaphoreCreateMutex();
+  configStore.begin(CONFIG_NAMESPACE, false); // Stays open: changes are written through it
+  loadConfig(); // The settings below (debounce windows, phase ranges) come from NVS
 
+#if DISPLAY_BACKEND == DISPLAY_TFT
+  // Initialize the TFT (SPI with DMA)
+  if (!display.begin()) {
+    LOG_ERROR(LOG_DISPLAY, "TFT initialization failed"); // If the TFT fails to initialize, halt
+    logFlush();
+    while (1);
+  }
+#else
   // Initialize OLED display (I2C, address 0x3C)
-  if (!display.begin(SSD1306_SWITCHCAPVCC, 0x3C)) {
-    Serial.println(F("SSD1306 allocation failed")); // If OLED fails to initialize, halt
+  if (!display.begin(SSD1306_SWITCHCAPVCC, OLED_I2C_ADDRESS)) {
+    LOG_ERROR(LOG_DISPLAY, "SSD1306 allocation failed"); // If OLED fails to initialize, halt
+    logFlush();
     while (1);
   }
   display.display(); // Show initial Adafruit splash screen
   delay(2000);       // Wait 2 seconds
-  display.clearDisplay(); // Clear the display
   display.setTextColor(SSD1306_WHITE); // Set text color to white
-  display.setTextSize(1); // Set text size
+#endif
+  buildStaticFrames(); // Menu and traffic light screens, before anything else draws
+  display.clearDisplay(); // Clear the display
+  display.setTextSize(TEXT_SCALE); // Set text size
   display.setCursor(0, 0); // Set cursor to top-left
   display.println(F("Reflex Rush")); // Display game title
-  display.display(); // Update the OLED
-  Serial.println("OLED initialized");
+  display.display(); // Update the screen
+  LOG_INFO(LOG_DISPLAY, "Display initialized");
 
-  // Initialize TTP223 touch sensor pins and attach interrupts
+  // Initialize the touch sensors and attach interrupts
+#if TOUCH_SENSING == TOUCH_NATIVE
+  calibrateTouchPads(); // Before any interrupt: the thresholds come from it
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    touchLastUs[i] = (uint32_t)esp_timer_get_time() - config.touchDebounceUs; // First touch is never debounced away
+    touchHeldUs[i] = (uint32_t)esp_timer_get_time() - touchHoldUs - 1;
+    touchAttachInterruptArg(TOUCH_PINS[i], nativeTouchISR, (void *)(uintptr_t)i, touchCalibration[i].threshold);
+  }
+  LOG_INFO(LOG_INPUT, "Native touch interrupts attached (TTP223 modules would add ~%lu us)", (unsigned long)TTP223_LATENCY_US);
+#else
   for (int i = 0; i < MAX_PLAYERS; i++) {
     pinMode(TOUCH_PINS[i], INPUT); // Set touch pins as input
-    Serial.print("Touch sensor ");
-    Serial.print(i + 1);
-    Serial.print(" initialized on GPIO ");
-    Serial.println(TOUCH_PINS[i]);
+    LOG_DEBUG(LOG_INPUT, "Touch sensor %d initialized on GPIO %d", i + 1, TOUCH_PINS[i]);
+    touchLastUs[i] = (uint32_t)esp_timer_get_time() - config.touchDebounceUs; // First touch is never debounced away
+    attachInterruptArg(digitalPinToInterrupt(TOUCH_PINS[i]), touchISR, (void *)(uintptr_t)i, RISING); // Same ISR, player index as argument
   }
-  attachInterrupt(digitalPinToInterrupt(TOUCH_PINS[0]), touchISR1, RISING); // Attach ISRs for touch sensors
-  attachInterrupt(digitalPinToInterrupt(TOUCH_PINS[1]), touchISR2, RISING);
-  attachInterrupt(digitalPinToInterrupt(TOUCH_PINS[2]), touchISR3, RISING);
-  attachInterrupt(digitalPinToInterrupt(TOUCH_PINS[3]), touchISR4, RISING);
-  Serial.println("Interrupts attached for touch sensors");
+  LOG_INFO(LOG_INPUT, "Interrupts attached for TTP223 touch sensors (~%lu us sensing latency)", (unsigned long)TTP223_LATENCY_US);
+#endif
 
   // Initialize menu selection button (active-low with internal pull-up)
   pinMode(MENU_BUTTON, INPUT_PULLUP);
-  Serial.println("Menu button initialized on GPIO 27");
+  buttonPressed = digitalRead(MENU_BUTTON) == LOW;
+  attachInterrupt(digitalPinToInterrupt(MENU_BUTTON), buttonISR, CHANGE);
+  LOG_INFO(LOG_INPUT, "Menu button initialized on GPIO %d", MENU_BUTTON);
   // Debug: Check initial button state
-  Serial.print("Initial button state (HIGH = not pressed, LOW = pressed): ");
-  Serial.println(digitalRead(MENU_BUTTON));
+  LOG_DEBUG(LOG_INPUT, "Initial button state (HIGH = not pressed, LOW = pressed): %d", digitalRead(MENU_BUTTON));
 
-  // Initialize leaderboard with empty entries
+  // Sample the joystick on a periodic timer instead of from loop()
+  esp_timer_create_args_t joystickTimerArgs = {};
+  joystickTimerArgs.callback = sampleJoystick;
+  joystickTimerArgs.name = "joystick";
+  esp_timer_create(&joystickTimerArgs, &joystickTimer);
+  esp_timer_start_periodic(joystickTimer, JOYSTICK_SAMPLE_US);
+
+  // Phase deadlines come from a one-shot timer armed by enterPhase()
+  esp_timer_create_args_t phaseTimerArgs = {};
+  phaseTimerArgs.callback = phaseTimerExpired;
+  phaseTimerArgs.name = "phase";
+  esp_timer_create(&phaseTimerArgs, &phaseTimer);
+
+  // Initialize default player names (the leaderboard starts empty)
   for (int i = 0; i < MAX_PLAYERS; i++) {
-    leaderboard[i].name = "";
-    leaderboard[i].bestReactionTime = 0;
+    snprintf(playerNames[i], PLAYER_NAME_SIZE, "Player %d", i + 1);
   }
-  Serial.println("Leaderboard initialized");
+  LOG_INFO(LOG_SYSTEM, "Leaderboard initialized");
 
   // Initialize Bluetooth with device name "ReflexRush"
   ESP_BT.begin("ReflexRush");
-  Serial.println(F("Bluetooth started with name: ReflexRush"));
+#if BT_TRANSPORT == BT_CLASSIC
+  // Track the SPP client (BLE does this in BleLink): idle mode must not
+  // light-sleep under a connection, and a new one wakes it
+  ESP_BT.register_callback([](esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
+    if (event == ESP_SPP_SRV_OPEN_EVT) {
+      bluetoothConnected = true;
+      postWakeEvent(MENU_WAKE_BLUETOOTH);
+    } else if (event == ESP_SPP_CLOSE_EVT) {
+      bluetoothConnected = false;
+    }
+  });
+#endif
+  LOG_INFO(LOG_BLUETOOTH, "Bluetooth started with name: ReflexRush");
   // Optional: Clear Bluetooth buffer to prevent residual commands
   // while (ESP_BT.available()) {
   //   ESP_BT.read();
   // }
-  // Serial.println("Bluetooth buffer cleared");
+  // LOG_DEBUG(LOG_BLUETOOTH, "Bluetooth buffer cleared");
 
   // Initialize SD card for storage
-  Serial.println("Attempting SD card initialization...");
+  LOG_INFO(LOG_STORAGE, "Attempting SD card initialization...");
   if (!SD.begin(SD_CS_PIN)) {
     display.clearDisplay();
     display.setCursor(0, 0);
     display.println("SD Card init failed!");
     display.display();
-    Serial.println(F("SD Card initialization failed! Continuing without SD..."));
+    LOG_ERROR(LOG_STORAGE, "SD Card initialization failed! Continuing without SD...");
     // Continue even if SD fails (non-critical for basic game functionality)
   } else {
-    Serial.println("SD Card initialized");
-    gameHistory = loadHistoryFromSD(); // Load game history from SD
-    loadLeaderboardFromSD();          // Load leaderboard from SD
+    LOG_INFO(LOG_STORAGE, "SD Card initialized");
+    sdReady = true;
+    sdTotalBytes = SD.totalBytes(); // FAT metadata, read once; kept up to date by the writers
+    sdUsedBytes = SD.usedBytes();
+    loadHistoryFromSD();              // Open the game history log on SD
+    loadRegistryFromSD();             // Open the player registry and its snapshots on SD
+    importLegacyLeaderboard();        // First boot after an upgrade only
   }
-  Serial.println("Setup completed");
+
+  phaseRandomState = esp_random() | 1; // Hardware entropy seeds the phase generator (xorshift needs nonzero)
+
+  // Start the tasks: game timing alone on the game core, I/O on the other
+  xTaskCreatePinnedToCore(gameTask, "game", GAME_TASK_STACK, NULL, GAME_TASK_PRIORITY, &gameTaskHandle, GAME_TASK_CORE);
+  xTaskCreatePinnedToCore(displayTask, "display", DISPLAY_TASK_STACK, NULL, DISPLAY_TASK_PRIORITY, NULL, IO_TASK_CORE);
+  xTaskCreatePinnedToCore(storageTask, "storage", STORAGE_TASK_STACK, NULL, STORAGE_TASK_PRIORITY, NULL, IO_TASK_CORE);
+  xTaskCreatePinnedToCore(bluetoothTask, "bluetooth", BLUETOOTH_TASK_STACK, NULL, BLUETOOTH_TASK_PRIORITY, NULL, IO_TASK_CORE);
+#if ARENA_MODE != ARENA_OFF
+  startArena();
+#endif
+#if WEB_ENABLED
+  startWeb();
+#endif
+  LOG_INFO(LOG_SYSTEM, "Tasks started");
+  lastActivityMs = millis(); // The idle timeout runs from the end of setup
+  confirmFirmware(); // This image boots: keep it
+  LOG_INFO(LOG_SYSTEM, "Setup completed");
+  logFlush();
+}
+
+// Loop function: Runs continuously after setup (Arduino loop task, lowest
+// priority on the game core). Only handles menu input, idle mode and flushes
+// the log; the game, display, SD and Bluetooth all run in their own tasks.
+void loop() {
+  LOG_DEBUG(LOG_SYSTEM, "Entering loop()"); // Debug: Confirm loop is reached
+  // Debug: Check button state to detect if it's stuck
+  LOG_DEBUG(LOG_INPUT, "Button state (HIGH = not pressed, LOW = pressed): %d", digitalRead(MENU_BUTTON));
+
+  // Sleep until an input event arrives (or LOOP_IDLE_TIME passes); blocking
+  // on the queue lets the CPU idle between inputs
+  MenuEvent event;
+  bool received;
+  if (powerMode == POWER_IDLE) {
+    received = idleWait(event);
+    if (received) {
+      wakeUp(event); // The input that wakes the board is not a menu action
+      received = false;
+    }
+  } else {
+    received = xQueueReceive(menuQueue, &event, pdMS_TO_TICKS(LOOP_IDLE_TIME)) == pdTRUE;
+  }
+  if (received || gameState != GAME_IDLE) lastActivityMs = millis();
+
+  // Menu navigation is only active while no round is running; input during a
+  // round is dropped
+  if (gameState == GAME_IDLE) {
+    // Display the main menu if not already displayed. A selected option's
+    // screen stays up until the next input or a quiet LOOP_IDLE_TIME.
+    if (!menuDisplayed) {
+      displayMainMenu();
+      menuDisplayed = true;
+      LOG_DEBUG(LOG_DISPLAY, "Main menu displayed");
+    }
+    if (received) {
+      handleMenuInput(event);
+    } else if (powerMode == POWER_ACTIVE && idleTimeout > 0 && millis() - lastActivityMs >= idleTimeout) {
+      enterIdle();
+    }
+  }
+  logFlush(); // Hand queued log lines to the UART
+}
+
+// Enter idle mode: OLED off, CPU slowed, joystick sampled less often. Radio
+// modem sleep is the controllers' own default between link events. Runs in
+// loop().
+void enterIdle() {
+  powerMode = POWER_IDLE;
+  postDisplayCommand(DISPLAY_POWER, "", 0);
+  activeCpuFrequency = getCpuFrequencyMhz();
+  setCpuFrequencyMhz(IDLE_CPU_FREQUENCY);
+  esp_timer_stop(joystickTimer);
+  esp_timer_start_periodic(joystickTimer, IDLE_JOYSTICK_SAMPLE_US);
+  LOG_INFO(LOG_SYSTEM, "Idle after %lu s: display off, CPU at %lu MHz",
+           (unsigned long)(idleTimeout / 1000), (unsigned long)IDLE_CPU_FREQUENCY);
+}
+
+// Leave idle mode on event; the display task reports the latency from the
+// event to the panel being back on. Runs in loop().
+void wakeUp(const MenuEvent &event) {
+  powerMode = POWER_ACTIVE;
+  setCpuFrequencyMhz(activeCpuFrequency);
+  esp_timer_stop(joystickTimer);
+  esp_timer_start_periodic(joystickTimer, JOYSTICK_SAMPLE_US);
+  DisplayCommand command;
+  command.type = DISPLAY_POWER;
+  command.option = 1;
+  command.reportShown = false;
+  command.timestampUs = event.timestampUs;
+  strcpy(command.text, WAKE_SOURCE_NAMES[event.type]);
+  queueDisplayCommand(command);
+  menuDisplayed = false; // Redraw the menu that was on screen
+  lastActivityMs = millis();
+}
+
+// Wait up to one idle slice for menu input. The board light-sleeps through
+// the slice when nothing needs it awake, then stays up for IDLE_LISTEN_TIME
+// so the radio can advertise and the tasks catch up. Returns false if no
+// input arrived.
+bool idleWait(MenuEvent &event) {
+  if (xQueueReceive(menuQueue, &event, pdMS_TO_TICKS(IDLE_LISTEN_TIME)) == pdTRUE) return true;
+  if (!canLightSleep()) return xQueueReceive(menuQueue, &event, pdMS_TO_TICKS(IDLE_SLEEP_SLICE)) == pdTRUE;
+  lightSleep();
+  return xQueueReceive(menuQueue, &event, 0) == pdTRUE;
+}
+
+#if TOUCH_SENSING == TOUCH_NATIVE
+// Boot-time calibration of the native touch pads, which must not be touched
+// meanwhile. Per pad: the scan period (its measured detection latency), the
+// untouched baseline and noise, and from them the interrupt threshold. A pad
+// whose noise comes near its threshold is reported: that unit is better off
+// with TTP223 modules on it.
+void calibrateTouchPads() {
+  touchSetCycles(TOUCH_MEASURE_CYCLES, TOUCH_SLEEP_CYCLES);
+  uint32_t slowest = 0;
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    TouchPadCalibration &pad = touchCalibration[i];
+    pad.periodUs = measureTouchPeriod(TOUCH_PINS[i]);
+    uint32_t sum = 0;
+    uint16_t low = 0xFFFF, high = 0;
+    for (int k = 0; k < TOUCH_CAL_SAMPLES; k++) {
+      uint16_t value = touchRead(TOUCH_PINS[i]);
+      sum += value;
+      if (value < low) low = value;
+      if (value > high) high = value;
+      delayMicroseconds(pad.periodUs); // One fresh reading each
+    }
+    pad.baseline = (uint16_t)(sum / TOUCH_CAL_SAMPLES);
+    pad.noise = high - low;
+    pad.threshold = (uint16_t)(pad.baseline * TOUCH_THRESHOLD_RATIO);
+    if (low <= pad.threshold + pad.noise) {
+      LOG_WARN(LOG_INPUT, "Touch pad %d (GPIO %d) is noisy: reads %u-%u untouched, threshold %u", i + 1, TOUCH_PINS[i],
+               low, high, pad.threshold);
+    } else {
+      LOG_INFO(LOG_INPUT, "Touch pad %d (GPIO %d): baseline %u, noise %u, threshold %u, latency %lu us", i + 1,
+               TOUCH_PINS[i], pad.baseline, pad.noise, pad.threshold, (unsigned long)pad.periodUs);
+    }
+    if (pad.periodUs > slowest) slowest = pad.periodUs;
+  }
+  touchHoldUs = TOUCH_HOLD_SCANS * slowest;
+}
+
+// Time between fresh readings of a native touch pad: the mean interval of its
+// reading changing, over TOUCH_CAL_SAMPLES changes (the reading's noise makes
+// nearly every fresh one differ)
+uint32_t measureTouchPeriod(int pin) {
+  uint16_t last = touchRead(pin);
+  int64_t start = esp_timer_get_time();
+  int64_t now = start;
+  int changes = -1; // The first change only starts the clock
+  while (changes < TOUCH_CAL_SAMPLES && now - start < TOUCH_CAL_TIMEOUT_US) {
+    uint16_t value = touchRead(pin);
+    now = esp_timer_get_time();
+    if (value == last) continue;
+    last = value;
+    if (++changes == 0) start = now;
+  }
+  if (changes <= 0) {
+    LOG_ERROR(LOG_INPUT, "Touch pad on GPIO %d gives no readings", pin);
+    return (uint32_t)TOUCH_CAL_TIMEOUT_US;
+  }
+  return (uint32_t)((now - start) / changes);
+}
+#endif
+
+// Light sleep stops the radio between slices, so it is only taken while no
+// link has to stay up: no Bluetooth client, no Wi-Fi scoreboard or arena.
+// An enabled Bluetooth controller only keeps its timing through light sleep
+// on an external 32 kHz crystal; on the main crystal (the Arduino default)
+// the board stays awake and idle mode saves power through the panel and the
+// CPU clock alone.
+bool canLightSleep() {
+  if (WEB_ENABLED || ARENA_MODE != ARENA_OFF || bluetoothConnected || gameState != GAME_IDLE) return false;
+#ifdef CONFIG_BTDM_CTRL_LPCLK_SEL_EXT_32K_XTAL
+  return true;
+#else
+  return esp_bt_controller_get_status() != ESP_BT_CONTROLLER_STATUS_ENABLED;
+#endif
+}
+
+// Whether a wake-up input is at its level right now: the button low or a
+// TTP223 pad high (native pads interrupt on their own)
+bool wakeLevelPresent() {
+  if (digitalRead(MENU_BUTTON) == LOW) return true;
+#if TOUCH_SENSING != TOUCH_NATIVE
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    if (digitalRead(TOUCH_PINS[i]) == HIGH) return true;
+  }
+#endif
+  return false;
+}
+
+// Light-sleep for IDLE_SLEEP_SLICE, waking early when the button goes low or
+// a pad goes high (or, for TOUCH_NATIVE, reads below its threshold). The
+// pins' interrupts are disabled while their wake-up levels are armed (a held
+// input would otherwise interrupt continuously), so the wake-up input is
+// queued from here. The joystick cannot wake the board: the ESP32 has no ADC
+// level wake-up without the ULP, so it is only sampled in the listen windows
+// and a push shorter than one slice while asleep can be missed.
+void lightSleep() {
+#if LOG_LEVEL > LOG_LEVEL_NONE
+  logFlush();
+  Serial.flush(); // The UART stops in light sleep
+#endif
+  gpio_intr_disable((gpio_num_t)MENU_BUTTON);
+  gpio_wakeup_enable((gpio_num_t)MENU_BUTTON, GPIO_INTR_LOW_LEVEL);
+#if TOUCH_SENSING == TOUCH_NATIVE
+  esp_sleep_enable_touchpad_wakeup(); // The touch peripheral keeps scanning in light sleep
+#else
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    gpio_intr_disable((gpio_num_t)TOUCH_PINS[i]);
+    gpio_wakeup_enable((gpio_num_t)TOUCH_PINS[i], GPIO_INTR_HIGH_LEVEL);
+  }
+#endif
+  esp_sleep_enable_gpio_wakeup();
+  esp_sleep_enable_timer_wakeup((uint64_t)IDLE_SLEEP_SLICE * 1000);
+  esp_err_t result = esp_light_sleep_start();
+  int64_t now = esp_timer_get_time();
+  gpio_wakeup_disable((gpio_num_t)MENU_BUTTON);
+  gpio_set_intr_type((gpio_num_t)MENU_BUTTON, GPIO_INTR_ANYEDGE);
+  gpio_intr_enable((gpio_num_t)MENU_BUTTON);
+#if TOUCH_SENSING != TOUCH_NATIVE
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    gpio_wakeup_disable((gpio_num_t)TOUCH_PINS[i]);
+    gpio_set_intr_type((gpio_num_t)TOUCH_PINS[i], GPIO_INTR_POSEDGE);
+    gpio_intr_enable((gpio_num_t)TOUCH_PINS[i]);
+  }
+#endif
+  if (result != ESP_OK) { // Refused: wake if an input is already at its level, else wait the slice out awake
+    LOG_DEBUG(LOG_SYSTEM, "Light sleep refused (%d)", (int)result);
+    if (!wakeLevelPresent()) {
+      delay(IDLE_SLEEP_SLICE);
+      return;
+    }
+  } else {
+    esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+    if (cause != ESP_SLEEP_WAKEUP_GPIO && cause != ESP_SLEEP_WAKEUP_TOUCHPAD) return; // Timer: sleep again after the listen time
+  }
+  MenuEvent event = {(uint8_t)(digitalRead(MENU_BUTTON) == LOW ? MENU_SELECT : MENU_WAKE_TOUCH), now};
+  xQueueSend(menuQueue, &event, 0);
+}
+
+// Wake idle mode from another task (a round starting, Bluetooth activity)
+void postWakeEvent(uint8_t source) {
+  if (powerMode != POWER_IDLE || sessionReplaying.load()) return;
+  MenuEvent event = {source, esp_timer_get_time()};
+  xQueueSend(menuQueue, &event, 0);
+}
+
+// Each task body is a loop around one service call, so the host benchmarks
+// (host/) can drive the same code single-threaded.
+
+// Game task: runs the round state machine on the game core
+void gameTask(void *parameter) {
+  for (;;) {
+    serviceGame(portMAX_DELAY);
+  }
+}
+
+// Handle the next game command, waiting up to wait ticks for one. The game
+// task only wakes for a start request, the phase timer, touches or the
+// display's Green Light confirmation; it never polls. Returns false if no
+// command arrived.
+bool serviceGame(TickType_t wait) {
+  GameCommand command;
+  if (xQueueReceive(gameQueue, &command, wait) != pdTRUE) return false;
+  if (command.type == GAME_CMD_REPLAY) { // A whole session, not a game step: kept out of its profile
+    replaySession();
+    return true;
+  }
+  PROFILE_SCOPE(PROFILE_GAME_STEP);
+  handleGameCommand(command);
+  return true;
+}
+
+// Ask the game task to start a round (callable from any task)
+void requestGameStart() {
+  postGameCommand(GAME_CMD_START, 0);
+}
+
+// Queue a command for the game task (callable from any task)
+void postGameCommand(uint8_t type, int32_t value) {
+  GameCommand command = {type, 0, value};
+  xQueueSend(gameQueue, &command, 0);
+}
+
+// Phase timer callback (esp_timer task): wake the game task at the deadline
+void phaseTimerExpired(void *arg) {
+  GameCommand command = {GAME_CMD_PHASE_END, esp_timer_get_time()};
+  if (xQueueSend(gameQueue, &command, 0) != pdTRUE) {
+    LOG_ERROR(LOG_GAME, "Game queue full, phase end lost");
+  }
+}
+
+// Display task: the only task that talks to the OLED
+void displayTask(void *parameter) {
+  for (;;) {
+    serviceDisplay(portMAX_DELAY);
+  }
+}
+
+// Draw the next queued screen, waiting up to wait ticks for one. Returns
+// false if none arrived.
+bool serviceDisplay(TickType_t wait) {
+  DisplayCommand command;
+  if (xQueueReceive(displayQueue, &command, wait) != pdTRUE) return false;
+  if (command.type == DISPLAY_POWER) {
+    setPanelPower(command.option != 0);
+    if (command.option != 0) {
+      uint32_t latency = (uint32_t)(esp_timer_get_time() - command.timestampUs);
+      PROFILE_RECORD(PROFILE_WAKE_LATENCY, latency);
+      LOG_INFO(LOG_DISPLAY, "Woke on %s in %lu us", command.text, (unsigned long)latency);
+    }
+    return true;
+  }
+  setPanelPower(true); // A screen drawn while idle (a round starting) is meant to be seen
+  switch (command.type) {
+    case DISPLAY_TEXT:          drawMenuOption(command.text); break;
+    case DISPLAY_TRAFFIC_LIGHT: drawTrafficLight(command.text); break;
+    case DISPLAY_RESULTS:       drawGameResults(command.text); break;
+    case DISPLAY_MENU:          drawMainMenu(command.option); break;
+    case DISPLAY_LEADERBOARD:   drawLeaderboard(); break;
+    case DISPLAY_HISTORY:       drawRecentHistory(); break;
+  }
+  if (command.reportShown) { // Tell the game when players could first see this frame
+    GameCommand shown = {GAME_CMD_GREEN_SHOWN, displayPushedTime};
+    xQueueSend(gameQueue, &shown, 0);
+  }
+  return true;
+}
+
+// Queue a screen for the display task without ever blocking the caller.
+void postDisplayCommand(uint8_t type, const char *text, int8_t option) {
+  DisplayCommand command;
+  command.type = type;
+  command.option = option;
+  command.reportShown = false;
+  command.timestampUs = 0;
+  strncpy(command.text, text, DISPLAY_TEXT_SIZE - 1);
+  command.text[DISPLAY_TEXT_SIZE - 1] = '\0';
+  queueDisplayCommand(command);
+}
+
+// If the display queue is full the oldest screen is dropped, since it is
+// stale anyway.
+void queueDisplayCommand(const DisplayCommand &command) {
+  if (xQueueSend(displayQueue, &command, 0) != pdTRUE) {
+    DisplayCommand stale;
+    xQueueReceive(displayQueue, &stale, 0);
+    xQueueSend(displayQueue, &command, 0);
+  }
+}
+
+// Switch the panel on or off (display task). The controller keeps its RAM
+// while off, so the panel comes back showing the last frame.
+void setPanelPower(bool on) {
+  if (on == panelOn) return;
+#if DISPLAY_BACKEND == DISPLAY_TFT
+  display.setPower(on);
+#else
+  display.ssd1306_command(on ? SSD1306_DISPLAYON : SSD1306_DISPLAYOFF);
+#endif
+  panelOn = on;
+}
+
+// Ticks to wait for an esp_timer time, rounded up: a wait that truncated to
+// 0 ticks would spin until the time came
+TickType_t ticksUntil(int64_t dueUs) {
+  int64_t remainingUs = dueUs - esp_timer_get_time();
+  if (remainingUs <= 0) return 0;
+  const int64_t tickUs = (int64_t)portTICK_PERIOD_MS * 1000;
+  return (TickType_t)((remainingUs + tickUs - 1) / tickUs);
+}
+
+// Storage task: the only task that touches the SD card
+void storageTask(void *parameter) {
+  for (;;) {
+    serviceStorage(portMAX_DELAY);
+  }
+}
+
+// Execute the next queued storage request, waiting up to wait ticks for one.
+// Returns false if none arrived.
+// Dirty snapshots are written once their write-behind delay has passed.
+bool serviceStorage(TickType_t wait) {
+  if (persistDirty != 0) { // Wake up in time to write the snapshots
+    TickType_t due = ticksUntil(persistDueUs);
+    if (due < wait) wait = due;
+  }
+  StorageCommand command;
+  bool received = xQueueReceive(storageQueue, &command, wait) == pdTRUE;
+  if (received) {
+    switch (command.type) {
+      case STORAGE_SAVE_ROUND:     storeRoundResults(command.round); break;
+      case STORAGE_DELETE_HISTORY: deleteHistory(); break;
+#if ARENA_MODE == ARENA_COORDINATOR
+      case STORAGE_ARENA_RESULT:   recordArenaResults(); break;
+#endif
+      case STORAGE_SESSION_OPEN:   openSessionFile(); break;
+      case STORAGE_SESSION_WRITE:  writeSessionBuffer(command.buffer, command.records); break;
+      case STORAGE_SESSION_CLOSE:  closeSessionFile(); break;
+      case STORAGE_SHUTDOWN:
+        closeStorage();
+        xSemaphoreGive(command.done);
+        break;
+    }
+  }
+  if (persistDirty != 0 && esp_timer_get_time() >= persistDueUs) flushPersistState();
+  return received;
+}
+
+// Queue a request for the storage task. These must not be lost, so even the
+// game task waits a little for room (the queue only stays full while the SD
+// card stalls); false if it never came, for the caller to report.
+bool postStorageCommand(uint8_t type, const RoundResult *round) {
+  StorageCommand command;
+  command.type = type;
+  if (round != NULL) {
+    command.round = *round;
+  }
+  if (xQueueSend(storageQueue, &command, pdMS_TO_TICKS(STORAGE_SEND_TIMEOUT)) != pdTRUE) {
+    LOG_ERROR(LOG_STORAGE, "Storage queue full, request %d dropped", type);
+    return false;
+  }
+  return true;
+}
+
+// Bluetooth task: receives commands and is the only task writing to ESP_BT
+void bluetoothTask(void *parameter) {
+  for (;;) {
+    serviceBluetooth();
+  }
+}
+
+// One pass of the Bluetooth task: consume received bytes, stream history and
+// send queued output
+void serviceBluetooth() {
+  BluetoothMessage message;
+#if BT_TRANSPORT == BT_BLE
+  ESP_BT.rearm();
+#endif
+  // Check for binary frames and Bluetooth commands; only bytes already
+  // received are consumed, so a slow phone never stalls this task
+  while (ESP_BT.available()) {
+    uint8_t byte = ESP_BT.read();
+    if (frameRxUsed > 0 || (commandLineUsed == 0 && byte == FRAME_START)) {
+      receiveFrameByte(byte);
+    } else {
+      receiveCommandByte(byte);
+    }
+  }
+  // Stream the next history batch while the client has credit
+  bool streaming = historyTransfer.active && historyTransfer.credits > 0;
+  if (streaming) {
+    sendHistoryBatch();
+  }
+  // Send queued output, waiting up to the polling interval for more
+  // (not at all while a transfer can keep the link busy). BLE reception
+  // queues a wake-up, so there the task sleeps until something happens.
+  TickType_t idleWait = BT_TRANSPORT == BT_BLE ? portMAX_DELAY : pdMS_TO_TICKS(BLUETOOTH_POLL_TIME);
+  TickType_t wait = streaming ? 0 : idleWait;
+  while (xQueueReceive(bluetoothQueue, &message, wait) == pdTRUE) {
+    switch (message.type) {
+      case BT_SEND_TEXT: {
+        PROFILE_SCOPE(PROFILE_BT_WRITE);
+        if (message.newline) {
+          ESP_BT.println(message.text);
+        } else {
+          ESP_BT.print(message.text);
+        }
+        break;
+      }
+      case BT_SEND_HISTORY:     sendHistoryInChunks(); break;
+      case BT_SEND_RECENT:      sendRecentHistory(message.count); break;
+      case BT_SEND_LEADERBOARD: sendLeaderboard(); break;
+      case BT_RECEIVED:         break; // The bytes are read on the next pass
+#if BT_TRANSPORT == BT_BLE
+      case BT_NOTIFY_STATE: {
+        JsonText json;
+        formatJsonPhase(message.count, json);
+        ESP_BT.setState(json.c_str());
+        break;
+      }
+      case BT_NOTIFY_RESULT: {
+        JsonText json;
+        formatJsonResult(message.round, json);
+        ESP_BT.setResults(json.c_str());
+        break;
+      }
+#endif
+    }
+    if (ESP_BT.available()) break; // Serve the next command promptly
+  }
+}
+
+// How long a task may wait for room in the Bluetooth queue: the game task
+// never waits (its timing must not depend on the link), the others briefly
+TickType_t bluetoothQueueWait() {
+  return xTaskGetCurrentTaskHandle() == gameTaskHandle ? 0 : pdMS_TO_TICKS(100);
+}
+
+// Queue a message for the Bluetooth task, counting it if the queue is full
+void sendBluetoothMessage(const BluetoothMessage &message) {
+  if (xQueueSend(bluetoothQueue, &message, bluetoothQueueWait()) != pdTRUE) {
+    bluetoothDropped.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+// Queue a Bluetooth request (callable from any task)
+void postBluetoothMessage(uint8_t type, uint16_t count) {
+  BluetoothMessage message;
+  message.type = type;
+  message.count = count;
+  message.newline = false;
+  message.text[0] = '\0';
+  sendBluetoothMessage(message);
+}
+
+// Queue a line of text for Bluetooth (callable from any task). Text longer
+// than one message is split; only the last piece ends the line.
+void btPrintln(const char *text) {
+  BluetoothMessage message;
+  message.type = BT_SEND_TEXT;
+  unsigned int length = strlen(text);
+  unsigned int offset = 0;
+  do {
+    unsigned int piece = length - offset;
+    if (piece > (unsigned int)BLUETOOTH_TEXT_SIZE - 1) piece = BLUETOOTH_TEXT_SIZE - 1;
+    memcpy(message.text, text + offset, piece);
+    message.text[piece] = '\0';
+    offset += piece;
+    message.newline = offset >= length;
+    sendBluetoothMessage(message);
+  } while (offset < length);
+}
+
+// Handle one joystick or button event while at the main menu
+void handleMenuInput(const MenuEvent &event) {
+  switch (event.type) {
+    case MENU_UP:
+      currentMenuOption = (currentMenuOption - 1 + MENU_SIZE) % MENU_SIZE; // Move cursor up
+      displayMainMenu();
+      LOG_DEBUG(LOG_INPUT, "Joystick moved UP, selected menu option: %s", MENU_OPTIONS[currentMenuOption]);
+      break;
+    case MENU_DOWN:
+      currentMenuOption = (currentMenuOption + 1) % MENU_SIZE; // Move cursor down
+      displayMainMenu();
+      LOG_DEBUG(LOG_INPUT, "Joystick moved DOWN, selected menu option: %s", MENU_OPTIONS[currentMenuOption]);
+      break;
+    case MENU_SELECT:
+      LOG_DEBUG(LOG_INPUT, "Menu button pressed, executing option: %s", MENU_OPTIONS[currentMenuOption]);
+      executeMenuOption(); // Execute the selected menu option
+      menuDisplayed = false; // Reset menu display flag
+      break;
+    default: // Wake-up events only matter in idle mode
+      return;
+  }
+  PROFILE_RECORD(PROFILE_MENU_LATENCY, (uint32_t)(esp_timer_get_time() - event.timestampUs));
+}
+
+// Feed one received byte to the command line assembler; executes the line
+// when its newline arrives. Overlong lines are rejected rather than split.
+void receiveCommandByte(uint8_t byte) {
+  if (byte == '\r') return;
+  if (byte != '\n') {
+    if (commandLineUsed < COMMAND_LINE_SIZE - 1) {
+      commandLine[commandLineUsed++] = byte;
+    } else {
+      commandLineOverflow = true;
+    }
+    return;
+  }
+  commandLine[commandLineUsed] = '\0';
+  bool overflow = commandLineOverflow;
+  commandLineUsed = 0;
+  commandLineOverflow = false;
+  if (overflow) {
+    btPrintln("ERROR: Command too long");
+    LOG_WARN(LOG_BLUETOOTH, "Bluetooth command too long, rejected");
+    return;
+  }
+  handleBluetoothCommand(commandLine);
+}
+
+// Parse a decimal number at the start of text. Returns false if there is
+// none; otherwise end points just past it.
+bool parseNumber(const char *text, long &value, const char **end) {
+  char *stop;
+  value = strtol(text, &stop, 10);
+  if (stop == text) return false;
+  if (end != NULL) *end = stop;
+  return true;
+}
+
+// SELECT_PLAYERS_<n>: set number of players
+void commandSelectPlayers(const char *argument) {
+  long num;
+  const char *end;
+  if (parseNumber(argument, num, &end) && *end == '\0' && num >= 1 && num <= MAX_PLAYERS) {
+    xSemaphoreTake(playerMutex, portMAX_DELAY);
+    numberOfPlayers = num; // Takes effect from the next round
+    xSemaphoreGive(playerMutex);
+    MessageText reply;
+    displayMenuOption(reply.appendf("Players: %ld", num).c_str());
+    reply.clear();
+    btPrintln(reply.appendf("OK: Players set to %ld", num).c_str());
+    LOG_INFO(LOG_BLUETOOTH, "Players set to: %ld", num);
+  } else {
+    displayMenuOption("Invalid player count");
+    btPrintln("ERROR: Invalid player count");
+    LOG_WARN(LOG_BLUETOOTH, "Invalid player count received");
+  }
+}
+
+// SET_PLAYER_<n>_<name>: set player name (n may have two digits)
+void commandSetPlayer(const char *argument) {
+  long number;
+  const char *end;
+  bool valid = parseNumber(argument, number, &end) && *end == '_' && end[1] != '\0';
+  int playerIndex = valid ? number - 1 : -1;
+  if (valid && playerIndex >= 0 && playerIndex < numberOfPlayers) {
+    const char *playerName = end + 1;
+    xSemaphoreTake(playerMutex, portMAX_DELAY);
+    strncpy(playerNames[playerIndex], playerName, PLAYER_NAME_SIZE - 1); // Long names are truncated
+    playerNames[playerIndex][PLAYER_NAME_SIZE - 1] = '\0';
+    xSemaphoreGive(playerMutex);
+    MessageText reply;
+    displayMenuOption(reply.append(playerName).append(" set!").c_str());
+    reply.clear();
+    btPrintln(reply.appendf("OK: Player %d set to %s", playerIndex + 1, playerName).c_str());
+    LOG_INFO(LOG_BLUETOOTH, "Player %d set to: %s", playerIndex + 1, playerName);
+  } else {
+    displayMenuOption("Invalid player");
+    btPrintln("ERROR: Invalid player or name");
+    LOG_WARN(LOG_BLUETOOTH, "Invalid player or name received");
+  }
+}
+
+// START: start game command (disabled for debugging)
+void commandStart(const char *argument) {
+  // Note: Uncomment the following lines to re-enable Bluetooth game start
+  LOG_INFO(LOG_BLUETOOTH, "START command received but disabled for debugging");
+  // displayMenuOption("Starting game...");
+  // btPrintln("OK: Game started");
+  // LOG_INFO(LOG_BLUETOOTH, "Game started via Bluetooth");
+  // requestGameStart();
+}
+
+// STATS: latency histograms of the profiled sections, one line each
+void commandStats(const char *argument) {
+#if PROFILE_ENABLED
+  btPrintln("OK: Stats");
+  for (int section = 0; section < PROFILE_SECTIONS; section++) {
+    ProfileHistogram histogram;
+    portENTER_CRITICAL(&profileLock);
+    histogram = profiles[section]; // Snapshot, so the lock is not held while formatting
+    portEXIT_CRITICAL(&profileLock);
+    MessageText line;
+    line.appendf("%s n=%lu", PROFILE_SECTION_NAMES[section], (unsigned long)histogram.count);
+    if (histogram.count > 0) {
+      line.appendf(" min=%lu p50=%lu p99=%lu max=%lu %s", (unsigned long)histogram.min,
+                   (unsigned long)profileQuantile(histogram, 0.50f), (unsigned long)profileQuantile(histogram, 0.99f),
+                   (unsigned long)histogram.max, PROFILE_SECTION_UNITS[section]);
+    }
+    btPrintln(line.c_str());
+  }
+  MessageText clock;
+  btPrintln(clock.appendf("cpu=%lu MHz", (unsigned long)ESP.getCpuFreqMHz()).c_str()); // To convert cycles to time
+#else
+  btPrintln("ERROR: Profiling disabled");
+#endif
+}
+
+// ARENA: arena status (clock sync on a follower, boards heard on the coordinator)
+void commandArena(const char *argument) {
+#if ARENA_MODE != ARENA_OFF
+  postArenaMessage(ARENA_MSG_STATUS, NULL, 0);
+#else
+  btPrintln("ERROR: Arena disabled");
+#endif
+}
+
+// STANDINGS: standings of the current or last tournament
+void commandStandings(const char *argument) {
+  postGameCommand(GAME_CMD_STANDINGS, 0);
+}
+
+// TOURNAMENT_<n>: the next game started from the menu runs n rounds back to
+// back with running statistics; TOURNAMENT_0 goes back to single rounds
+void commandTournament(const char *argument) {
+  long rounds;
+  const char *end;
+  if (parseNumber(argument, rounds, &end) && *end == '\0' && rounds >= 0 && rounds <= TOURNAMENT_MAX_ROUNDS) {
+    postGameCommand(GAME_CMD_TOURNAMENT, rounds);
+    MessageText reply;
+    if (rounds > 0) {
+      displayMenuOption(reply.appendf("Tournament: %ld rounds", rounds).c_str());
+      reply.clear();
+      btPrintln(reply.appendf("OK: Next game is a tournament of %ld rounds", rounds).c_str());
+    } else {
+      displayMenuOption("Single rounds");
+      btPrintln("OK: Tournament off");
+    }
+    LOG_INFO(LOG_BLUETOOTH, "Tournament rounds set to: %ld", rounds);
+  } else {
+    btPrintln("ERROR: Invalid round count");
+  }
+}
+
+// IDLE_<seconds>: quiet time at the menu before idle mode (0: never)
+void commandIdle(const char *argument) {
+  long seconds;
+  const char *end;
+  if (parseNumber(argument, seconds, &end) && *end == '\0' && seconds >= 0 && seconds <= (long)IDLE_MAX_TIMEOUT) {
+    idleTimeout = (uint32_t)seconds * 1000;
+    MessageText reply;
+    if (seconds > 0) {
+      displayMenuOption(reply.appendf("Idle after %ld s", seconds).c_str());
+      reply.clear();
+      btPrintln(reply.appendf("OK: Idle mode after %ld s at the menu", seconds).c_str());
+    } else {
+      displayMenuOption("Idle mode off");
+      btPrintln("OK: Idle mode off");
+    }
+    LOG_INFO(LOG_BLUETOOTH, "Idle timeout set to: %ld s", seconds);
+  } else {
+    btPrintln("ERROR: Invalid idle timeout");
+  }
+}
+
+// Read the settings from NVS into config (at boot, before the interrupts
+// are attached). A stored value out of range, or a set that does not fit
+// together, falls back to the defaults.
+void loadConfig() {
+  Config loaded;
+  for (int i = 0; i < CONFIG_SETTING_COUNT; i++) {
+    const ConfigSetting &setting = CONFIG_SETTINGS[i];
+    uint32_t value = configStore.getUInt(setting.key, setting.defaultValue);
+    if (value < setting.minimum || value > setting.maximum) {
+      LOG_WARN(LOG_SYSTEM, "Stored %s=%lu out of range, using %lu", setting.key, (unsigned long)value,
+               (unsigned long)setting.defaultValue);
+      value = setting.defaultValue;
+    }
+    loaded.*setting.field = value;
+  }
+  if (!configConsistent(loaded)) {
+    LOG_WARN(LOG_SYSTEM, "Stored settings do not fit together, using the defaults");
+    for (int i = 0; i < CONFIG_SETTING_COUNT; i++) loaded.*CONFIG_SETTINGS[i].field = CONFIG_SETTINGS[i].defaultValue;
+  }
+  config = loaded;
+  LOG_INFO(LOG_SYSTEM, "Settings loaded from NVS");
+}
+
+// Whether settings work together: every duration range is nonempty, the
+// joystick keeps a center band, and chunks hold whole history records
+bool configConsistent(const Config &settings) {
+  return settings.redMinMs < settings.redMaxMs && settings.yellowMinMs < settings.yellowMaxMs &&
+         settings.greenMinMs < settings.greenMaxMs &&
+         2 * (settings.joystickThreshold + settings.joystickHysteresis) < 4095 &&
+         settings.bluetoothChunk % sizeof(HistoryRecord) == 0;
+}
+
+// Index of the setting named key (in any case), or -1
+int findConfigSetting(const char *key) {
+  for (int i = 0; i < CONFIG_SETTING_COUNT; i++) {
+    if (strcasecmp(CONFIG_SETTINGS[i].key, key) == 0) return i;
+  }
+  return -1;
+}
+
+// Apply a setting change, or CONFIG_RESET_ALL, and keep it in NVS. Runs on
+// the game task between commands, so rounds and sessions (which record the
+// settings once, as they begin) see one set, and a replay's saved settings
+// are still those in NVS when it puts them back. The RAM copy changes by one
+// 32-bit store, so the other tasks and the ISRs never see a half-made change.
+uint8_t applyConfig(uint8_t setting, uint32_t value) {
+  if (gameState != GAME_IDLE || tournamentRounds > 0) return CONFIG_BUSY_GAME;
+  if (sessionRecording.load() || sessionReplaying.load()) return CONFIG_BUSY_SESSION;
+  if (setting == CONFIG_RESET_ALL) {
+    configStore.clear();
+    for (int i = 0; i < CONFIG_SETTING_COUNT; i++) config.*CONFIG_SETTINGS[i].field = CONFIG_SETTINGS[i].defaultValue;
+    LOG_INFO(LOG_SYSTEM, "Settings reset to the defaults");
+    return CONFIG_OK;
+  }
+  const ConfigSetting &entry = CONFIG_SETTINGS[setting];
+  Config changed = config;
+  changed.*entry.field = value;
+  if (!configConsistent(changed)) return CONFIG_UNFIT;
+  if (configStore.putUInt(entry.key, value) == 0) return CONFIG_NVS_FAILED;
+  config.*entry.field = value;
+  LOG_INFO(LOG_SYSTEM, "Setting changed: %s=%lu", entry.key, (unsigned long)value);
+  return CONFIG_OK;
+}
+
+// Have the game task apply a setting change and wait for how it went
+// (Bluetooth and web tasks; on the game task itself it applies at once). A
+// change the game task has not taken within CONFIG_REPLY_TIMEOUT, say behind
+// a replay, is given up: whichever side claims the ticket first decides.
+uint8_t changeConfig(uint8_t setting, uint32_t value) {
+  if (xTaskGetCurrentTaskHandle() == gameTaskHandle) return applyConfig(setting, value);
+  xSemaphoreTake(configMutex, portMAX_DELAY);
+  uint8_t result = CONFIG_NO_REPLY;
+  GameCommand command = {GAME_CMD_CONFIG, 0, (int32_t)value};
+  command.setting = setting;
+  command.ticket = configTicket.load();
+  if (xQueueSend(gameQueue, &command, 0) == pdTRUE &&
+      xQueueReceive(configReplyQueue, &result, pdMS_TO_TICKS(CONFIG_REPLY_TIMEOUT)) != pdTRUE) {
+    uint32_t ticket = command.ticket;
+    if (!configTicket.compare_exchange_strong(ticket, ticket + 1)) { // The game task is applying it: wait it out
+      xQueueReceive(configReplyQueue, &result, portMAX_DELAY);
+    }
+  }
+  xSemaphoreGive(configMutex);
+  return result;
+}
+
+// Why a change failed, for the errors every change can meet
+const char *configErrorText(uint8_t result) {
+  switch (result) {
+    case CONFIG_BUSY_GAME:    return "ERROR: Game in progress";
+    case CONFIG_BUSY_SESSION: return "ERROR: Settings are fixed while a session records or replays";
+    case CONFIG_NVS_FAILED:   return "ERROR: NVS write failed";
+    default:                  return "ERROR: The game is busy, try again";
+  }
+}
+
+// Change one setting and keep it in NVS (Bluetooth or web task). reply gets
+// "OK: key=value" or the error.
+bool setConfig(const char *key, const char *text, MessageText &reply) {
+  reply.clear();
+  int index = findConfigSetting(key);
+  if (index < 0) {
+    reply.appendf("ERROR: Unknown setting %s", key);
+    return false;
+  }
+  const ConfigSetting &setting = CONFIG_SETTINGS[index];
+  long value;
+  const char *end;
+  if (!parseNumber(text, value, &end) || *end != '\0' || value < (long)setting.minimum || value > (long)setting.maximum) {
+    reply.appendf("ERROR: %s must be %lu-%lu", setting.key, (unsigned long)setting.minimum, (unsigned long)setting.maximum);
+    return false;
+  }
+  uint8_t result = changeConfig(index, value);
+  if (result == CONFIG_OK) {
+    reply.appendf("OK: %s=%ld", setting.key, value);
+  } else if (result == CONFIG_UNFIT) {
+    reply.appendf("ERROR: %s=%ld does not fit the other settings", setting.key, value);
+  } else {
+    reply.append(configErrorText(result));
+  }
+  return result == CONFIG_OK;
+}
+
+// Put every setting back to its default and clear them from NVS
+bool resetConfig(MessageText &reply) {
+  reply.clear();
+  uint8_t result = changeConfig(CONFIG_RESET_ALL, 0);
+  reply.append(result == CONFIG_OK ? "OK: Settings reset to the defaults" : configErrorText(result));
+  return result == CONFIG_OK;
+}
+
+// Confirm the running image (at the end of setup). After an OTA update the
+// bootloader runs the new image on probation when the build enables
+// rollback; an image that never gets this far is replaced by the previous
+// one from the other app partition on the next reset.
+void confirmFirmware() {
+  esp_ota_mark_app_valid_cancel_rollback();
+  LOG_INFO(LOG_SYSTEM, "Firmware %s running from %s", FIRMWARE_BUILD, esp_ota_get_running_partition()->label);
+  if (esp_ota_get_next_update_partition(NULL) == NULL) {
+    LOG_WARN(LOG_SYSTEM, "No second app partition: OTA updates need an A/B partition table");
+  }
+}
+
+// CONFIG: the firmware and every setting with its default and range
+void commandConfig(const char *argument) {
+  displayMenuOption("Settings");
+  btPrintln("OK: Settings");
+  MessageText line;
+  btPrintln(line.appendf("Firmware %s on %s", FIRMWARE_BUILD, esp_ota_get_running_partition()->label).c_str());
+  for (int i = 0; i < CONFIG_SETTING_COUNT; i++) {
+    const ConfigSetting &setting = CONFIG_SETTINGS[i];
+    line.clear();
+    line.appendf("%s=%lu (default %lu, %lu-%lu)", setting.key, (unsigned long)(config.*setting.field),
+                 (unsigned long)setting.defaultValue, (unsigned long)setting.minimum, (unsigned long)setting.maximum);
+    btPrintln(line.c_str());
+  }
+}
+
+// CONFIG_<key>=<value>: change a setting (kept across reboots);
+// CONFIG_RESET puts them all back to the defaults
+void commandConfigSet(const char *argument) {
+  MessageText reply;
+  bool ok;
+  if (strcasecmp(argument, "RESET") == 0) {
+    ok = resetConfig(reply);
+  } else {
+    char key[COMMAND_LINE_SIZE];
+    const char *equals = strchr(argument, '=');
+    size_t length = equals != NULL ? equals - argument : 0;
+    if (length == 0) {
+      btPrintln("ERROR: Use CONFIG_<key>=<value>");
+      return;
+    }
+    memcpy(key, argument, length);
+    key[length] = '\0';
+    ok = setConfig(key, equals + 1, reply);
+  }
+  displayMenuOption(ok ? "Settings saved" : "Setting rejected");
+  btPrintln(reply.c_str());
+}
+
+// PADS: per-pad edge counts and noise levels from the validation pipeline,
+// and each pad's sensing path and latency
+void commandPads(const char *argument) {
+  displayMenuOption("Pad statistics");
+  btPrintln("OK: Pad statistics");
+  MessageText line;
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    line.clear();
+    line.appendf("Pad %d (GPIO %d): %lu edges, %lu chatter, noise %.2f/round%s, %lu flagged", i + 1, TOUCH_PINS[i],
+                 (unsigned long)touchEdges[i], (unsigned long)touchChatter[i], padNoise[i],
+                 padNoise[i] > PAD_NOISE_LIMIT ? " (noisy)" : "", (unsigned long)padFlagged[i]);
+    btPrintln(line.c_str());
+    line.clear();
+#if TOUCH_SENSING == TOUCH_NATIVE
+    const TouchPadCalibration &pad = touchCalibration[i];
+    line.appendf("  native: latency %lu us (TTP223: ~%lu us), baseline %u, noise %u, threshold %u",
+                 (unsigned long)pad.periodUs, (unsigned long)TTP223_LATENCY_US, pad.baseline, pad.noise, pad.threshold);
+#else
+    line.appendf("  TTP223: latency ~%lu us (datasheet)", (unsigned long)TTP223_LATENCY_US);
+#endif
+    btPrintln(line.c_str());
+  }
+  LOG_INFO(LOG_BLUETOOTH, "Pad statistics sent via Bluetooth");
+}
+
+// RECORD_ON: record every round from now on to SESSION_FILE (replacing the
+// last session); the game task replies
+void commandRecordOn(const char *argument) {
+  displayMenuOption("Recording session");
+  postGameCommand(GAME_CMD_RECORD, 1);
+}
+
+// RECORD_OFF: stop the session recorder
+void commandRecordOff(const char *argument) {
+  displayMenuOption("Session recorded");
+  postGameCommand(GAME_CMD_RECORD, 0);
+}
+
+// REPLAY: re-drive the game from SESSION_FILE and report each round
+void commandReplay(const char *argument) {
+  displayMenuOption("Replaying session...");
+  postGameCommand(GAME_CMD_REPLAY, 0);
+}
+
+// VIEW_HISTORY: view game history
+void commandViewHistory(const char *argument) {
+  displayMenuOption("Viewing history...");
+  btPrintln("OK: Game history");
+  LOG_INFO(LOG_BLUETOOTH, "Viewing history via Bluetooth");
+  postBluetoothMessage(BT_SEND_HISTORY, 0);
+}
+
+// VIEW_HISTORY_<n>: view the last n games
+void commandViewRecentHistory(const char *argument) {
+  long count;
+  const char *end;
+  if (parseNumber(argument, count, &end) && *end == '\0' && count >= 1 && count <= HISTORY_RING_SIZE) {
+    btPrintln("OK: Recent games");
+    postBluetoothMessage(BT_SEND_RECENT, count);
+  } else {
+    btPrintln("ERROR: Invalid game count");
+  }
+}
+
+// VIEW_LEADERBOARD: view leaderboard
+void commandViewLeaderboard(const char *argument) {
+  displayMenuOption("Leaderboard:");
+  btPrintln("OK: Leaderboard");
+  LOG_INFO(LOG_BLUETOOTH, "Viewing leaderboard via Bluetooth");
+  showLeaderboard();
+}
+
+// DELETE_HISTORY: delete game history
+void commandDeleteHistory(const char *argument) {
+  displayMenuOption("Deleting history...");
+  LOG_INFO(LOG_BLUETOOTH, "Deleting history via Bluetooth");
+  if (!postStorageCommand(STORAGE_DELETE_HISTORY, NULL)) btPrintln("ERROR: Storage busy, history not deleted");
+}
+
+// Bluetooth command table, sorted by name so lookup is a binary search.
+// Names ending in '_' take the rest of the line as their argument; the others
+// must match the whole line.
+struct BluetoothCommand {
+  const char *name;                    // Command name (or prefix, if takesArgument)
+  bool takesArgument;                  // Name is a prefix followed by an argument
+  void (*handler)(const char *argument); // Called with the text after the name
+};
+constexpr BluetoothCommand BLUETOOTH_COMMANDS[] = {
+  {"ARENA", false, commandArena},
+  {"CONFIG", false, commandConfig},
+  {"CONFIG_", true, commandConfigSet},
+  {"DELETE_HISTORY", false, commandDeleteHistory},
+  {"IDLE_", true, commandIdle},
+  {"PADS", false, commandPads},
+  {"RECORD_OFF", false, commandRecordOff},
+  {"RECORD_ON", false, commandRecordOn},
+  {"REPLAY", false, commandReplay},
+  {"SELECT_PLAYERS_", true, commandSelectPlayers},
+  {"SET_PLAYER_", true, commandSetPlayer},
+  {"STANDINGS", false, commandStandings},
+  {"START", false, commandStart},
+  {"STATS", false, commandStats},
+  {"TOURNAMENT_", true, commandTournament},
+  {"VIEW_HISTORY", false, commandViewHistory},
+  {"VIEW_HISTORY_", true, commandViewRecentHistory},
+  {"VIEW_LEADERBOARD", false, commandViewLeaderboard},
+};
+constexpr int BLUETOOTH_COMMAND_COUNT = sizeof(BLUETOOTH_COMMANDS) / sizeof(BLUETOOTH_COMMANDS[0]);
+
+// Compile-time check that the table is sorted (C++11 constexpr, so recursive)
+constexpr int constStrcmp(const char *a, const char *b) {
+  return (*a != *b || *a == '\0') ? (*a - *b) : constStrcmp(a + 1, b + 1);
+}
+constexpr bool commandsSorted(int i) {
+  return i + 1 >= BLUETOOTH_COMMAND_COUNT ||
+         (constStrcmp(BLUETOOTH_COMMANDS[i].name, BLUETOOTH_COMMANDS[i + 1].name) < 0 && commandsSorted(i + 1));
+}
+static_assert(commandsSorted(0), "BLUETOOTH_COMMANDS must be sorted by name");
+
+// Find the table index for a command line, or -1
+int findBluetoothCommand(const char *line) {
+  int low = 0;
+  int high = BLUETOOTH_COMMAND_COUNT - 1;
+  while (low <= high) {
+    int middle = (low + high) / 2;
+    const BluetoothCommand &command = BLUETOOTH_COMMANDS[middle];
+    size_t length = strlen(command.name);
+    int order = strncmp(line, command.name, length);
+    if (order == 0) {
+      if (command.takesArgument || line[length] == '\0') return middle;
+      order = 1; // Line extends an exact-match name: it sorts after it
+    }
+    if (order < 0) {
+      high = middle - 1;
+    } else {
+      low = middle + 1;
+    }
+  }
+  return -1;
+}
+
+// Execute one Bluetooth command line (runs in the Bluetooth task)
+void handleBluetoothCommand(char *line) {
+  // Remove whitespace
+  while (*line == ' ' || *line == '\t') line++;
+  size_t length = strlen(line);
+  while (length > 0 && (line[length - 1] == ' ' || line[length - 1] == '\t')) line[--length] = '\0';
+  if (length == 0) return;
+  LOG_INFO(LOG_BLUETOOTH, "Bluetooth command received: %s", line);
+  lastActivityMs = millis();
+  postWakeEvent(MENU_WAKE_BLUETOOTH);
+  if (gameState != GAME_IDLE) { // Commands would draw over the traffic light
+    btPrintln("ERROR: Game in progress");
+    LOG_WARN(LOG_BLUETOOTH, "Bluetooth command rejected, game in progress");
+    return;
+  }
+  menuDisplayed = false; // Reset menu display to refresh after command
+  int index = findBluetoothCommand(line);
+  if (index >= 0) {
+    const BluetoothCommand &command = BLUETOOTH_COMMANDS[index];
+    command.handler(line + strlen(command.name));
+  } else { // Unknown command
+    displayMenuOption("Invalid command");
+    btPrintln("ERROR: Unknown command");
+    LOG_WARN(LOG_BLUETOOTH, "Unknown Bluetooth command received");
+  }
+}
+
+// Drain queued touch events and record each player's first touch of the
+// round. The ISR has already classified every event, so this is a lookup per
+// event and no per-player work happens while phases run. A touch after a
+// jumpstart is still delivered (and logged) but the jumpstart stands.
+void processTouchEvents() {
+  TouchEvent event;
+  while (popTouchEvent(event)) {
+    if (!sessionReplaying.load()) PROFILE_RECORD(PROFILE_TOUCH_LATENCY, (uint32_t)(esp_timer_get_time() - event.timestampUs));
+    int i = event.player;
+    if (i >= roundPlayers) continue; // Inactive pad
+    if (touchDetected[i]) { // Player already has a result this round
+      LOG_DEBUG(LOG_GAME, "Extra touch (kind %d) for Player %d at: %lld us", event.kind, i + 1, (long long)event.timestampUs);
+      continue;
+    }
+    switch (event.kind) {
+      case TOUCH_JUMPSTART:
+        touchDetected[i] = true;
+        reactionTimes[i] = REACTION_JUMPSTART; // Jumpstart (penalized as 0)
+        touchTimes[i] = event.timestampUs;
+        LOG_DEBUG(LOG_GAME, "Jumpstart detected for Player %d at: %lld us", i + 1, (long long)event.timestampUs);
+        break;
+      case TOUCH_VALID:
+        touchDetected[i] = true;
+        reactionTimes[i] = (unsigned long)(event.timestampUs - greenStartTime); // Valid reaction
+        touchTimes[i] = event.timestampUs;
+        LOG_DEBUG(LOG_GAME, "Player %d touched at: %lld us", i + 1, (long long)event.timestampUs);
+        break;
+      default: // Late: ignored (No response)
+        LOG_DEBUG(LOG_GAME, "Late touch for Player %d at: %lld us", i + 1, (long long)event.timestampUs);
+        break;
+    }
+  }
+}
+
+// Start the game: picks the phase durations and switches to the Red Light
+// phase (in an arena, the coordinator first announces the round and arms it).
+// Returns immediately; the phase timer drives the rest of the sequence.
+void startGame() {
+  LOG_INFO(LOG_GAME, "Starting game sequence");
+  drawPhaseDurations();
+#if ARENA_MODE == ARENA_COORDINATOR
+  int64_t start = esp_timer_get_time() + (int64_t)ARENA_START_LEAD * 1000;
+  arenaAnnounceRound(start); // Followers start at the same coordinator time
+  gameState = GAME_ARMED;
+  schedulePhaseEnd(start);
+#else
+  arenaRoundId = 0;
+  beginRound(esp_timer_get_time());
+#endif
+}
+
+// Draw the phase durations from the seeded generator, so its recorded state
+// reproduces them
+void drawPhaseDurations() {
+  roundRandomState = phaseRandomState;
+  redDuration = phaseRandom(config.redMinMs, config.redMaxMs);       // 1-5 seconds by default
+  yellowDuration = phaseRandom(config.yellowMinMs, config.yellowMaxMs); // 0.5-2 seconds by default
+  greenDuration = phaseRandom(config.greenMinMs, config.greenMaxMs);   // 1-3 seconds by default
+}
+
+// Next value in [low, high) from the phase generator (xorshift32)
+long phaseRandom(long low, long high) {
+  uint32_t x = phaseRandomState;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  phaseRandomState = x;
+  return low + (long)(x % (uint32_t)(high - low));
+}
+
+// Reset the round and show Red Light; startTime is when it begins
+void beginRound(int64_t startTime) {
+  // Reset reaction times and touch detection flags
+  greenStartTime = 0;
+  greenEndTime = 0;
+  roundPlayers = numberOfPlayers; // Changes over Bluetooth apply from the next round
+  TouchEvent stale;
+  while (popTouchEvent(stale)) {
+    // Discard touches queued before the round started
+  }
+  touchQueueOverflows.store(0);
+  touchPhase.store(TOUCH_PHASE_WAIT, std::memory_order_release); // Touches are jumpstarts from here
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    reactionTimes[i] = REACTION_NONE; // Reset to max value (indicating no touch)
+    touchDetected[i] = false;         // Reset touch detection
+    LOG_DEBUG(LOG_GAME, "Reset reaction time for Player %d: 0xFFFFFFFF us", i + 1);
+  }
+
+  // Red Light phase: Players must wait
+  roundStartTime = startTime;
+  displayTrafficLight("RED");
+  LOG_DEBUG(LOG_GAME, "Red Light displayed for %lu ms", (unsigned long)redDuration);
+  gameState = GAME_RED;
+  schedulePhaseEnd(roundStartTime + (int64_t)redDuration * 1000);
+  postLiveEvent(LIVE_EVENT_PHASE, GAME_RED, NULL);
+  postWakeEvent(MENU_WAKE_ROUND);
+  if (sessionRecording.load()) recordRoundStart();
+}
+
+// Switch the state machine to a phase lasting durationMs from now
+void enterPhase(GameState state, long durationMs) {
+  gameState = state;
+  schedulePhaseEnd(gameNow() + (int64_t)durationMs * 1000);
+}
+
+// The game task's clock: esp_timer, or the virtual clock of a replay
+int64_t gameNow() {
+  return sessionReplaying.load() ? replayClock : esp_timer_get_time();
+}
+
+// Arm the phase timer for deadline (microseconds, esp_timer clock). A replay
+// delivers the phase ends itself.
+void schedulePhaseEnd(int64_t deadline) {
+  phaseDeadline = deadline;
+  if (sessionReplaying.load()) return;
+  int64_t delay = deadline - esp_timer_get_time();
+  esp_timer_stop(phaseTimer); // Fails harmlessly if it is not running
+  esp_timer_start_once(phaseTimer, delay > 0 ? delay : 1);
+}
+
+// Start the Green Light window at shownTime, when players could first see it
+void startGreenWindow(int64_t shownTime) {
+  greenStartTime = shownTime;
+  greenEndTime = greenStartTime + (int64_t)greenDuration * 1000;
+  touchPhase.store(TOUCH_PHASE_GREEN, std::memory_order_release); // Publish the window to the ISRs
+  schedulePhaseEnd(greenEndTime);
+  postLiveEvent(LIVE_EVENT_PHASE, GAME_GREEN, NULL); // Spectators see green when the players do
+  if (!sessionReplaying.load()) PROFILE_RECORD(PROFILE_GREEN_SHOWN, (uint32_t)(shownTime - greenRequestTime));
+  LOG_DEBUG(LOG_GAME, "Green Light shown %lld us after it was requested", (long long)(shownTime - greenRequestTime));
+}
+
+// Advance the game state machine on one command; called from the game task
+void handleGameCommand(const GameCommand &command) {
+  if (sessionRecording.load()) drainSessionEdges(); // Edges so far come before anything this command records
+  if (command.type == GAME_CMD_START) {
+    if (gameState != GAME_IDLE) return;
+    if (tournamentArmedRounds > 0) startTournament();
+    startGame();
+    return;
+  }
+  if (command.type == GAME_CMD_TOURNAMENT) {
+    tournamentArmedRounds = command.value;
+    return;
+  }
+  if (command.type == GAME_CMD_STANDINGS) {
+    sendStandings();
+    return;
+  }
+  if (command.type == GAME_CMD_RECORD) {
+    setSessionRecording(command.value != 0);
+    return;
+  }
+  if (command.type == GAME_CMD_CONFIG) {
+    uint32_t ticket = command.ticket;
+    if (!configTicket.compare_exchange_strong(ticket, ticket + 1)) return; // Its requester gave up on it
+    uint8_t result = applyConfig(command.setting, command.value);
+    xQueueSend(configReplyQueue, &result, 0);
+    return;
+  }
+#if ARENA_MODE == ARENA_FOLLOWER
+  if (command.type == GAME_CMD_ARENA_ROUND) {
+    if (gameState != GAME_IDLE && gameState != GAME_RESULTS && gameState != GAME_COOLDOWN) {
+      LOG_WARN(LOG_ARENA, "Arena round %ld skipped, a round is running", (long)command.value);
+      return;
+    }
+    // The coordinator skips its cooldown between tournament rounds, so the
+    // next round may arrive while results are still up
+    arenaRoundId = command.value;
+    redDuration = command.phaseMs[0];
+    yellowDuration = command.phaseMs[1];
+    greenDuration = command.phaseMs[2];
+    gameState = GAME_ARMED;
+    schedulePhaseEnd(command.timestampUs);
+    return;
+  }
+#endif
+  if (command.type == GAME_CMD_TOUCH) {
+    touchWakePending.store(false); // Before draining, so a later touch wakes us again
+    processTouchEvents();
+    return;
+  }
+  if (command.type == GAME_CMD_GREEN_SHOWN) {
+    if (gameState == GAME_GREEN && greenStartTime == 0) {
+      if (sessionRecording.load()) sessionRecord(SESSION_GREEN, 0, 0, sessionOffset(command.timestampUs));
+      startGreenWindow(command.timestampUs);
+    }
+    return;
+  }
+  if (gameState == GAME_IDLE || gameNow() < phaseDeadline) {
+    return; // Stale timer event from a deadline that has since moved
+  }
+  if (sessionRecording.load() && (gameState == GAME_RED || gameState == GAME_YELLOW || gameState == GAME_GREEN)) {
+    sessionRecord(SESSION_PHASE, gameState, 0, sessionOffset(gameNow()));
+  }
+  switch (gameState) {
+    case GAME_ARMED:
+      beginRound(phaseDeadline);
+      break;
+    case GAME_RED:
+      // Yellow Light phase: Players prepare. Deadlines count from the round
+      // start, so timer latency never accumulates (and arena boards agree)
+      displayTrafficLight("YELLOW");
+      LOG_DEBUG(LOG_GAME, "Yellow Light displayed for %lu ms", (unsigned long)yellowDuration);
+      gameState = GAME_YELLOW;
+      schedulePhaseEnd(roundStartTime + (int64_t)(redDuration + yellowDuration) * 1000);
+      postLiveEvent(LIVE_EVENT_PHASE, GAME_YELLOW, NULL);
+      break;
+    case GAME_YELLOW:
+      // Green Light phase: Players must press their touch sensors. The window
+      // opens when the display task reports the frame fully transferred, so
+      // reaction times start from when players can actually see green; until
+      // then a touch still counts as a jumpstart.
+      greenRequestTime = gameNow();
+      displayGreenLight();
+      enterPhase(GAME_GREEN, GREEN_SHOWN_TIMEOUT);
+      LOG_DEBUG(LOG_GAME, "Green Light requested for %lu ms", (unsigned long)greenDuration);
+      break;
+    case GAME_GREEN:
+      if (greenStartTime == 0) { // The display never confirmed: time from the request
+        LOG_WARN(LOG_DISPLAY, "Green Light not confirmed after %d ms", GREEN_SHOWN_TIMEOUT);
+        processTouchEvents(); // Touches so far are jumpstarts
+        startGreenWindow(greenRequestTime);
+        break;
+      }
+      touchPhase.store(TOUCH_PHASE_OVER, std::memory_order_release);
+      processTouchEvents(); // Pick up touches queued just before the deadline
+      finishRound();
+      enterPhase(GAME_RESULTS, config.resultDisplayMs); // Show results (5 seconds by default)
+      break;
+    case GAME_RESULTS:
+      if (tournamentRounds > 0 && tournamentRound < tournamentRounds) {
+        startGame(); // Tournament rounds run back to back, without the cooldown
+        break;
+      }
+      if (tournamentRounds > 0) {
+        btPrintln("Tournament complete");
+        LOG_INFO(LOG_GAME, "Tournament of %d rounds complete", tournamentRounds);
+        tournamentRounds = 0;
+      }
+      enterPhase(GAME_COOLDOWN, config.cooldownMs); // Prevent immediate restart
+      break;
+    case GAME_COOLDOWN:
+      touchPhase.store(TOUCH_PHASE_IDLE, std::memory_order_release);
+      gameState = GAME_IDLE;
+      menuDisplayed = false; // Reset menu display flag to show menu again
+      postLiveEvent(LIVE_EVENT_PHASE, GAME_IDLE, NULL);
+      LOG_INFO(LOG_GAME, "Game ended, returning to menu");
+      break;
+    default:
+      break;
+  }
+}
+
+// Compile the round's results and show them on OLED and Bluetooth
+void finishRound() {
+  if (touchQueueOverflows.load() > 0) {
+    LOG_WARN(LOG_INPUT, "Touch events dropped: %lu", (unsigned long)touchQueueOverflows.load());
+  }
+  uint32_t dropped = bluetoothDropped.exchange(0);
+  if (dropped > 0) LOG_WARN(LOG_BLUETOOTH, "Bluetooth messages dropped on a full queue: %lu", (unsigned long)dropped);
+
+  // Compile and display game results
+  lastRound.numberOfPlayers = roundPlayers;
+  for (int i = 0; i < roundPlayers; i++) {
+    lastRound.reactionTimes[i] = reactionTimes[i];
+  }
+  validateRound(lastRound);
+  formatRoundResult(lastRound, gameResult);
+  if (sessionRecording.load()) recordRoundResults();
+  if (sessionReplaying.load()) return; // A replayed round is compared, not published
+  btPrintln(gameResult.c_str()); // Send results via Bluetooth
+  LOG_INFO(LOG_GAME, "Game results: %s", gameResult.c_str());
+  displayGameResults(gameResult.c_str()); // Show results on OLED
+  postLiveEvent(LIVE_EVENT_RESULT, GAME_RESULTS, &lastRound);
+  saveRoundResults(); // Now, not when the results screen ends: a reset there would lose the round
+  if (tournamentRounds > 0) {
+    tournamentRound++;
+    updateTournamentStats(lastRound);
+    sendStandings();
+  }
+#if ARENA_MODE == ARENA_FOLLOWER
+  if (arenaRoundId != 0) arenaReportRound();
+#endif
+}
+
+// Validation pipeline, run on each round before its results go anywhere:
+// the reaction floor, the bounce detector on the pad's edge stream around
+// the scoring touch, and the pad's noise profile (updated here). Sets the
+// suspect flags of round.
+void validateRound(RoundResult &round) {
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    uint32_t chatter = touchChatter[i];
+    padNoise[i] += PAD_NOISE_GAIN * ((float)(chatter - padChatterSeen[i]) - padNoise[i]);
+    padChatterSeen[i] = chatter;
+  }
+  for (int i = 0; i < round.numberOfPlayers; i++) {
+    unsigned long reaction = round.reactionTimes[i];
+    uint8_t flags = 0;
+    if (reaction != REACTION_NONE) { // A scoring touch: jumpstart or reaction
+      if (reaction != REACTION_JUMPSTART && reaction < REACTION_FLOOR_US) flags |= HISTORY_FLAG_TOO_FAST;
+      if (edgesNear(i, touchTimes[i]) >= TOUCH_BOUNCE_EDGES) flags |= HISTORY_FLAG_BOUNCE;
+      if (padNoise[i] > PAD_NOISE_LIMIT) flags |= HISTORY_FLAG_NOISY_PAD;
+    }
+    round.flags[i] = flags;
+    if (flags != 0) {
+      padFlagged[i]++;
+      LOG_WARN(LOG_GAME, "Player %d result flagged (%s): %lu us", i + 1, suspectReason(flags), reaction);
+    }
+  }
+}
+
+// Edges of pad (accepted or not) within TOUCH_BOUNCE_WINDOW_US of time, from
+// the ISR's edge ring. A clean TTP223 touch is a single rising edge.
+int edgesNear(int pad, int64_t time) {
+  uint32_t edges = touchEdges[pad];
+  uint32_t kept = edges < TOUCH_EDGE_HISTORY ? edges : TOUCH_EDGE_HISTORY;
+  uint32_t center = (uint32_t)time;
+  int near = 0;
+  for (uint32_t k = 1; k <= kept; k++) {
+    uint32_t edge = touchEdgeUs[pad][(edges - k) & (TOUCH_EDGE_HISTORY - 1)];
+    if (edge - center + (uint32_t)TOUCH_BOUNCE_WINDOW_US <= 2 * (uint32_t)TOUCH_BOUNCE_WINDOW_US) near++; // |edge - center| <= window, across the wrap
+  }
+  return near;
+}
+
+// Why a result is suspect, for reports; NULL if it is not
+const char *suspectReason(uint8_t flags) {
+  if (flags & HISTORY_FLAG_TOO_FAST) return "too fast";
+  if (flags & HISTORY_FLAG_BOUNCE) return "pad bounce";
+  if (flags & HISTORY_FLAG_NOISY_PAD) return "noisy pad";
+  return NULL;
+}
+
+// One player's result the way every report writes it: "<n> us", "JS
+// (Jumpstart)" or "No response", then " (flagged: <reason>)" if it is suspect
+void formatReaction(unsigned long reactionUs, uint8_t flags, MessageText &text) {
+  text.clear();
+  if (reactionUs == REACTION_JUMPSTART) {
+    text.append("JS (Jumpstart)");
+  } else if (reactionUs == REACTION_NONE) {
+    text.append("No response");
+  } else {
+    text.appendf("%lu us", reactionUs);
+  }
+  const char *reason = suspectReason(flags);
+  if (reason != NULL) text.appendf(" (flagged: %s)", reason);
+}
+
+// A history record's reaction as a round holds it (REACTION_JUMPSTART,
+// REACTION_NONE or the time)
+unsigned long recordReaction(uint8_t flags, uint32_t reactionUs) {
+  if (flags & HISTORY_FLAG_JUMPSTART) return REACTION_JUMPSTART;
+  return (flags & HISTORY_FLAG_VALID) ? reactionUs : REACTION_NONE;
+}
+
+// Format a round's results as text, one line per player
+void formatRoundResult(const RoundResult &round, ResultText &result) {
+  result.clear();
+  result.append("Game result: \n");
+  MessageText reaction;
+  xSemaphoreTake(playerMutex, portMAX_DELAY);
+  for (int i = 0; i < round.numberOfPlayers; i++) {
+    formatReaction(round.reactionTimes[i], round.flags[i], reaction);
+    result.appendf("%s: %s\n", playerNames[i], reaction.c_str());
+  }
+  xSemaphoreGive(playerMutex);
+}
+
+// Hand the round's results to the storage task for history and leaderboard
+void saveRoundResults() {
+  if (!postStorageCommand(STORAGE_SAVE_ROUND, &lastRound)) btPrintln("ERROR: Storage busy, round not saved");
+}
+
+// Start (on) or stop the session recorder (game task). A new session
+// replaces SESSION_FILE and opens with the generator's state as its seed.
+void setSessionRecording(bool on) {
+  MessageText message;
+  if (on == sessionRecording.load()) {
+    btPrintln(on ? "ERROR: Already recording" : "ERROR: Not recording");
+    return;
+  }
+  if (on) {
+    if (!sdReady) {
+      btPrintln("ERROR: No SD card to record to");
+      return;
+    }
+    sessionBufferIndex = 0;
+    sessionBufferUsed = 0;
+    sessionBytes = 0;
+    sessionRounds = 0;
+    sessionDropped = 0;
+    sessionEdgesDropped.store(0);
+    sessionEdgeTail.store(sessionEdgeHead.load()); // Nothing from before the session
+    if (!postStorageCommand(STORAGE_SESSION_OPEN, NULL)) {
+      btPrintln("ERROR: Storage busy, not recording");
+      return;
+    }
+    sessionRecord(SESSION_BEGIN, SESSION_VERSION, MAX_PLAYERS, phaseRandomState);
+    for (int i = 0; i < CONFIG_SETTING_COUNT; i++) sessionRecord(SESSION_CONFIG, i, 0, config.*CONFIG_SETTINGS[i].field);
+    sessionRecording.store(true);
+    btPrintln(message.appendf("OK: Recording session (seed %08lx)", (unsigned long)phaseRandomState).c_str());
+    LOG_INFO(LOG_GAME, "Session recording started");
+    return;
+  }
+  sessionRecording.store(false);
+  flushSessionBuffer();
+  if (!postStorageCommand(STORAGE_SESSION_CLOSE, NULL)) btPrintln("ERROR: Storage busy, session file left open");
+  message.appendf("OK: Session recorded: %lu rounds, %lu bytes", (unsigned long)sessionRounds, (unsigned long)sessionBytes);
+  uint32_t lost = sessionDropped + sessionEdgesDropped.load();
+  if (lost > 0) message.appendf(", %lu records lost", (unsigned long)lost);
+  btPrintln(message.c_str());
+  LOG_INFO(LOG_GAME, "%s", message.c_str());
+}
+
+// Append a record to the session (game task). A full buffer goes to the
+// storage task; if it is still writing the other one, the record is lost.
+void sessionRecord(uint8_t type, uint8_t player, uint16_t value, uint32_t data) {
+  if (sessionBufferBusy[sessionBufferIndex].load()) {
+    sessionDropped++;
+    return;
+  }
+  SessionRecord &record = sessionBuffer[sessionBufferIndex][sessionBufferUsed++];
+  record.type = type;
+  record.player = player;
+  record.value = value;
+  record.data = data;
+  if (sessionBufferUsed == SESSION_BUFFER_RECORDS) flushSessionBuffer();
+}
+
+// Hand the buffer being filled to the storage task and switch to the other
+void flushSessionBuffer() {
+  if (sessionBufferUsed == 0) return;
+  StorageCommand command;
+  command.type = STORAGE_SESSION_WRITE;
+  command.buffer = sessionBufferIndex;
+  command.records = sessionBufferUsed;
+  sessionBufferBusy[sessionBufferIndex].store(true);
+  if (xQueueSend(storageQueue, &command, 0) != pdTRUE) {
+    sessionBufferBusy[sessionBufferIndex].store(false);
+    sessionDropped += sessionBufferUsed;
+    LOG_ERROR(LOG_STORAGE, "Storage queue full, session records dropped");
+  } else {
+    sessionBytes += sessionBufferUsed * sizeof(SessionRecord);
+  }
+  sessionBufferIndex ^= 1;
+  sessionBufferUsed = 0;
+  if (sessionBytes >= SESSION_MAX_BYTES && sessionRecording.load()) {
+    btPrintln("Session reached its size limit");
+    setSessionRecording(false);
+  }
+}
+
+// Move the edges the ISR has seen into the session
+void drainSessionEdges() {
+  uint32_t tail = sessionEdgeTail.load(std::memory_order_relaxed);
+  uint32_t head = sessionEdgeHead.load(std::memory_order_acquire);
+  for (; tail != head; tail++) {
+    const SessionEdge &edge = sessionEdges[tail & (SESSION_EDGE_RING - 1)];
+    sessionRecord(SESSION_EDGE, edge.player, edge.phase, edge.timeUs - (uint32_t)roundStartTime);
+  }
+  sessionEdgeTail.store(tail, std::memory_order_release); // Free the slots
+}
+
+// A time as a session record stores it: microseconds since the round started
+uint32_t sessionOffset(int64_t time) {
+  return (uint32_t)(time - roundStartTime);
+}
+
+// Record the round that just began: the generator state its durations came
+// from, the durations, and the pads' noise levels its validation depends on
+void recordRoundStart() {
+  sessionRecord(SESSION_ROUND, roundPlayers, (uint16_t)redDuration, roundRandomState);
+  sessionRecord(SESSION_PHASES, ARENA_MODE == ARENA_FOLLOWER && arenaRoundId != 0 ? 1 : 0, (uint16_t)yellowDuration, (uint32_t)greenDuration);
+  for (int i = 0; i < roundPlayers; i++) {
+    uint32_t bits;
+    memcpy(&bits, &padNoise[i], sizeof(bits));
+    sessionRecord(SESSION_NOISE, i, 0, bits);
+  }
+  sessionRounds++;
+}
+
+// Record the round's results; the round is on SD once they are
+void recordRoundResults() {
+  drainSessionEdges();
+  for (int i = 0; i < lastRound.numberOfPlayers; i++) {
+    sessionRecord(SESSION_RESULT, i, lastRound.flags[i], (uint32_t)lastRound.reactionTimes[i]);
+  }
+  flushSessionBuffer();
+}
+
+// Replay SESSION_FILE (game task, at the menu): every recorded round is
+// re-driven through the state machine on a virtual clock, and reported as
+// matching or not
+void replaySession() {
+  if (gameState != GAME_IDLE || tournamentRounds > 0 || sessionRecording.load()) {
+    btPrintln("ERROR: Replay runs at the menu, with no recording or tournament");
+    return;
+  }
+  if (sessionBufferBusy[0].load() || sessionBufferBusy[1].load()) { // The replay reads into them
+    btPrintln("ERROR: The session is still being written");
+    return;
+  }
+  // The card is shared with the Bluetooth and web readers: every SD call
+  // here is made under historyMutex, one buffer at a time
+  xSemaphoreTake(historyMutex, portMAX_DELAY);
+  File file = SD.open(SESSION_FILE, FILE_READ);
+  SessionRecord first;
+  bool valid = file && file.read((uint8_t *)&first, sizeof(first)) == sizeof(first) && first.type == SESSION_BEGIN &&
+               first.player == SESSION_VERSION && first.value == MAX_PLAYERS;
+  if (!valid && file) file.close();
+  xSemaphoreGive(historyMutex);
+  if (!valid) {
+    btPrintln("ERROR: No session to replay");
+    return;
+  }
+  int64_t started = esp_timer_get_time();
+  beginReplay(first.data);
+  for (;;) {
+    xSemaphoreTake(historyMutex, portMAX_DELAY);
+    size_t bytes = file.read((uint8_t *)sessionBuffer[0], sizeof(sessionBuffer[0]));
+    xSemaphoreGive(historyMutex);
+    if (bytes < sizeof(SessionRecord)) break;
+    for (size_t k = 0; k < bytes / sizeof(SessionRecord); k++) replayRecord(sessionBuffer[0][k]);
+  }
+  xSemaphoreTake(historyMutex, portMAX_DELAY);
+  file.close();
+  xSemaphoreGive(historyMutex);
+  finishReplayRound();
+  endReplay();
+  MessageText message;
+  message.appendf("OK: Replayed %lu rounds in %lu us: %lu match", (unsigned long)replay.rounds,
+                  (unsigned long)(esp_timer_get_time() - started), (unsigned long)replay.matched);
+  btPrintln(message.c_str());
+  LOG_INFO(LOG_GAME, "%s", message.c_str());
+}
+
+// Set the live game state aside and start the virtual clock
+void beginReplay(uint32_t seed) {
+  replay.savedRandomState = phaseRandomState;
+  replay.savedConfig = config;
+  replay.savedArenaRoundId = arenaRoundId;
+  replay.savedRound = lastRound;
+  replay.savedResult = gameResult;
+  sessionReplaying.store(true); // From here the ISR leaves the pad state alone
+  replayClock = 0;
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    PadState &pad = replay.savedPads[i];
+    pad.lastUs = touchLastUs[i];
+    pad.edges = touchEdges[i];
+    pad.chatter = touchChatter[i];
+    pad.chatterSeen = padChatterSeen[i];
+    pad.flagged = padFlagged[i];
+    pad.noise = padNoise[i];
+    for (uint32_t k = 0; k < TOUCH_EDGE_HISTORY; k++) pad.edgeUs[k] = touchEdgeUs[i][k];
+    touchLastUs[i] = (uint32_t)replayClock - config.touchDebounceUs; // As at boot
+    touchEdges[i] = 0;
+  }
+  replay.randomState = seed;
+  replay.roundOpen = false;
+  replay.rounds = 0;
+  replay.matched = 0;
+}
+
+// Put the live game state back
+void endReplay() {
+  TouchEvent stale;
+  while (popTouchEvent(stale)) {
+    // Replayed touches nobody picked up
+  }
+  touchPhase.store(TOUCH_PHASE_IDLE, std::memory_order_release);
+  gameState = GAME_IDLE;
+  for (int i = 0; i < MAX_PLAYERS; i++) {
+    const PadState &pad = replay.savedPads[i];
+    touchLastUs[i] = pad.lastUs;
+    touchEdges[i] = pad.edges;
+    touchChatter[i] = pad.chatter;
+    padChatterSeen[i] = pad.chatterSeen;
+    padFlagged[i] = pad.flagged;
+    padNoise[i] = pad.noise;
+    for (uint32_t k = 0; k < TOUCH_EDGE_HISTORY; k++) touchEdgeUs[i][k] = pad.edgeUs[k];
+  }
+  phaseRandomState = replay.savedRandomState; // The live rounds go on as if no replay had run
+  config = replay.savedConfig;
+  arenaRoundId = replay.savedArenaRoundId; // A coordinator's next round id must follow its last live one
+  lastRound = replay.savedRound;
+  gameResult = replay.savedResult;
+  sessionReplaying.store(false);
+}
+
+// Feed one record to the replayed game
+void replayRecord(const SessionRecord &record) {
+  int64_t at = replay.base + record.data;
+  switch (record.type) {
+    case SESSION_ROUND:
+      finishReplayRound(); // The last round never got its results
+      replay.players = record.player <= MAX_PLAYERS ? record.player : MAX_PLAYERS;
+      replay.redMs = record.value;
+      replay.roundState = record.data;
+      break;
+    case SESSION_PHASES:
+      startReplayRound(record.player != 0, record.value, record.data);
+      break;
+    case SESSION_NOISE:
+      if (!replay.roundOpen || record.player >= MAX_PLAYERS) break;
+      memcpy(&padNoise[record.player], &record.data, sizeof(float));
+      padChatterSeen[record.player] = touchChatter[record.player];
+      break;
+    case SESSION_PHASE:
+      if (!replay.roundOpen) break;
+      if (gameState != record.player) replay.differs = true; // The state machine is not where it was
+      replayAdvance(at);
+      {
+        GameCommand command = {GAME_CMD_PHASE_END, replayClock};
+        handleGameCommand(command);
+      }
+      break;
+    case SESSION_GREEN:
+      if (!replay.roundOpen) break;
+      replayAdvance(at);
+      {
+        GameCommand command = {GAME_CMD_GREEN_SHOWN, at};
+        handleGameCommand(command);
+      }
+      break;
+    case SESSION_EDGE:
+      if (!replay.roundOpen || record.player >= MAX_PLAYERS) break;
+      replayAdvance(at);
+      if (acceptTouchEdge(record.player, at)) processTouchEvents();
+      break;
+    case SESSION_CONFIG: // The session's settings stand in for the live ones
+      if (record.player >= CONFIG_SETTING_COUNT) break;
+      if (record.data >= CONFIG_SETTINGS[record.player].minimum && record.data <= CONFIG_SETTINGS[record.player].maximum) {
+        config.*CONFIG_SETTINGS[record.player].field = record.data;
+      }
+      break;
+    case SESSION_RESULT:
+      if (!replay.roundOpen) break;
+      if (gameState != GAME_RESULTS || record.player >= lastRound.numberOfPlayers ||
+          lastRound.reactionTimes[record.player] != record.data || lastRound.flags[record.player] != record.value) {
+        replay.differs = true;
+      }
+      replay.results++;
+      if (replay.results >= replay.players) finishReplayRound();
+      break;
+  }
+}
+
+// Start the replayed round recorded by the last SESSION_ROUND. A local
+// round's durations must come out of the generator state it recorded, and
+// that state must follow from the seed and the rounds before it.
+void startReplayRound(bool arena, uint16_t yellowMs, uint32_t greenMs) {
+  finishReplayRound();
+  replay.differs = false;
+  replay.results = 0;
+  if (!arena) {
+    if (replay.roundState != replay.randomState) replay.differs = true;
+    phaseRandomState = replay.roundState;
+    if (configConsistent(config)) {
+      drawPhaseDurations();
+      if (redDuration != replay.redMs || yellowDuration != yellowMs || greenDuration != (long)greenMs) replay.differs = true;
+    } else {
+      replay.differs = true; // No settings could have drawn the recorded durations
+    }
+    replay.randomState = phaseRandomState;
+  }
+  redDuration = replay.redMs; // The recorded phases are replayed either way
+  yellowDuration = yellowMs;
+  greenDuration = greenMs;
+  replay.base = replayClock + SESSION_REPLAY_GAP_US;
+  replayClock = replay.base;
+  gameState = GAME_IDLE;
+  arenaRoundId = 0;
+  beginRound(replay.base);
+  roundPlayers = replay.players;
+  replay.roundOpen = true;
+}
+
+// Report the replayed round, if one is open
+void finishReplayRound() {
+  if (!replay.roundOpen) return;
+  replay.roundOpen = false;
+  replay.rounds++;
+  bool complete = replay.results > 0;
+  if (complete && !replay.differs) replay.matched++;
+  MessageText line;
+  line.appendf("REPLAY round %lu: %s", (unsigned long)replay.rounds,
+               !complete ? "incomplete" : replay.differs ? "DIFFERS" : "match");
+  btPrintln(line.c_str());
+  if (complete && replay.differs) btPrintln(gameResult.c_str()); // What the replay made of it
+}
+
+// Move the virtual clock forward to time (never back: the file follows the
+// order the game task saw things in, which may trail the ISR's timestamps)
+void replayAdvance(int64_t time) {
+  if (time > replayClock) replayClock = time;
+}
+
+// Begin a tournament of the armed number of rounds with fresh statistics
+void startTournament() {
+  tournamentRounds = tournamentArmedRounds;
+  tournamentArmedRounds = 0;
+  tournamentRound = 0;
+  for (int i = 0; i < MAX_PLAYERS; i++) tournamentStats[i] = PlayerStats();
+  MessageText message;
+  btPrintln(message.appendf("Tournament started: %d rounds", tournamentRounds).c_str());
+  LOG_INFO(LOG_GAME, "Tournament of %d rounds started", tournamentRounds);
+}
+
+// Fold a round into each player's tournament statistics
+void updateTournamentStats(const RoundResult &round) {
+  for (int i = 0; i < round.numberOfPlayers; i++) {
+    PlayerStats &stats = tournamentStats[i];
+    unsigned long reaction = round.reactionTimes[i];
+    if (round.flags[i] & HISTORY_FLAGS_SUSPECT) {
+      stats.flagged++;
+    } else if (reaction == REACTION_JUMPSTART) {
+      stats.jumpstarts++;
+    } else if (reaction == REACTION_NONE) {
+      stats.misses++;
+    } else {
+      stats.valid++;
+      double delta = reaction - stats.mean; // Welford's update
+      stats.mean += delta / stats.valid;
+      stats.m2 += delta * (reaction - stats.mean);
+      if (stats.valid == 1 || reaction < stats.best) stats.best = reaction;
+      stats.p95.add(reaction);
+    }
+  }
+}
+
+// Send the tournament standings over Bluetooth, fastest mean first; players
+// without a valid reaction go last
+void sendStandings() {
+  if (tournamentRound == 0) {
+    btPrintln("ERROR: No tournament played");
+    return;
+  }
+  int players = lastRound.numberOfPlayers;
+  int order[MAX_PLAYERS];
+  for (int i = 0; i < players; i++) {
+    int j = i;
+    for (; j > 0 && standingBefore(i, order[j - 1]); j--) order[j] = order[j - 1];
+    order[j] = i;
+  }
+  MessageText line;
+  btPrintln(line.appendf("STANDINGS round %d/%d", tournamentRound, tournamentRounds > 0 ? tournamentRounds : tournamentRound).c_str());
+  MessageText lines[MAX_PLAYERS];
+  xSemaphoreTake(playerMutex, portMAX_DELAY); // Only for the names: the lines are sent after it is released
+  for (int rank = 0; rank < players; rank++) {
+    const PlayerStats &stats = tournamentStats[order[rank]];
+    MessageText &line = lines[rank];
+    line.appendf("%d. %s n=%lu", rank + 1, playerNames[order[rank]], (unsigned long)stats.valid);
+    if (stats.valid > 0) {
+      double sd = stats.valid > 1 ? sqrt(stats.m2 / (stats.valid - 1)) : 0;
+      line.appendf(" mean=%lu sd=%lu best=%lu p95=%lu", (unsigned long)stats.mean, (unsigned long)sd, stats.best,
+                   (unsigned long)stats.p95.value());
+    }
+    line.appendf(" js=%lu miss=%lu", (unsigned long)stats.jumpstarts, (unsigned long)stats.misses);
+    if (stats.flagged > 0) line.appendf(" flagged=%lu", (unsigned long)stats.flagged);
+  }
+  xSemaphoreGive(playerMutex);
+  for (int rank = 0; rank < players; rank++) btPrintln(lines[rank].c_str());
+}
+
+// Standings order: true if seat a ranks ahead of seat b
+bool standingBefore(int a, int b) {
+  const PlayerStats &sa = tournamentStats[a];
+  const PlayerStats &sb = tournamentStats[b];
+  if ((sa.valid > 0) != (sb.valid > 0)) return sa.valid > 0;
+  return sa.valid > 0 && sa.mean < sb.mean;
+}
+
+#if ARENA_MODE != ARENA_OFF
+const uint8_t ARENA_BROADCAST[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+// Bring up ESP-NOW on the arena channel and start the arena task (setup)
+void startArena() {
+  arenaQueue = xQueueCreate(ARENA_QUEUE_LENGTH, sizeof(ArenaMessage));
+#if ARENA_MODE == ARENA_COORDINATOR
+  arenaResultQueue = xQueueCreate(ARENA_RESULT_QUEUE_LENGTH, sizeof(ArenaPlayerResult));
+#endif
+  WiFi.mode(WEB_ENABLED ? WIFI_AP_STA : WIFI_STA); // ESP-NOW needs the station interface
+  esp_wifi_set_channel(ARENA_CHANNEL, WIFI_SECOND_CHAN_NONE);
+  if (esp_now_init() != ESP_OK) {
+    LOG_ERROR(LOG_ARENA, "ESP-NOW initialization failed, arena disabled");
+    return;
+  }
+  esp_now_register_recv_cb(arenaReceived);
+  esp_now_register_send_cb([](const uint8_t *mac, esp_now_send_status_t status) {
+    if (status != ESP_NOW_SEND_SUCCESS) arenaSendFailures.fetch_add(1); // Only unicasts are acknowledged
+  });
+  esp_now_peer_info_t peer = {};
+  memcpy(peer.peer_addr, ARENA_BROADCAST, sizeof(ARENA_BROADCAST));
+  peer.channel = ARENA_CHANNEL;
+  peer.encrypt = false;
+  esp_now_add_peer(&peer);
+  xTaskCreatePinnedToCore(arenaTask, "arena", ARENA_TASK_STACK, NULL, ARENA_TASK_PRIORITY, NULL, IO_TASK_CORE);
+  LOG_INFO(LOG_ARENA, "Arena started as %s, board %d, channel %d",
+           ARENA_MODE == ARENA_COORDINATOR ? "coordinator" : "follower", ARENA_BOARD_ID, ARENA_CHANNEL);
+}
+
+// ESP-NOW receive callback (Wi-Fi task): stamp the packet and queue it. The
+// arrival time is taken here, before any queueing, since it is t2 or t4 of a
+// clock sync exchange.
+void arenaReceived(const uint8_t *mac, const uint8_t *data, int length) {
+  int64_t now = esp_timer_get_time();
+  if (length < (int)sizeof(ArenaHeader) || length > ARENA_MAX_PACKET) return;
+  ArenaMessage message;
+  message.kind = ARENA_MSG_RECEIVED;
+  message.length = length;
+  message.timeUs = now;
+  memcpy(message.mac, mac, sizeof(message.mac));
+  memcpy(message.data, data, length);
+  xQueueSend(arenaQueue, &message, 0); // A lost sync sample or round is harmless
+}
+
+// Arena task: handles packets and keeps follower clocks in sync
+void arenaTask(void *parameter) {
+  for (;;) {
+    serviceArena();
+  }
+}
+
+// Handle the next arena message; followers also send a sync request every
+// ARENA_SYNC_INTERVAL
+void serviceArena() {
+  TickType_t wait = portMAX_DELAY;
+#if ARENA_MODE == ARENA_FOLLOWER
+  wait = ticksUntil(arenaSyncT1 + (int64_t)ARENA_SYNC_INTERVAL * 1000);
+#endif
+  ArenaMessage message;
+  if (xQueueReceive(arenaQueue, &message, wait) == pdTRUE) {
+    switch (message.kind) {
+      case ARENA_MSG_RECEIVED: handleArenaPacket(message); break;
+      case ARENA_MSG_SEND:     sendArenaPacket(ARENA_BROADCAST, message.data, message.length); break;
+      case ARENA_MSG_RESULT:   sendArenaResult(message); break;
+      case ARENA_MSG_STATUS:   sendArenaStatus(); break;
+    }
+  }
+#if ARENA_MODE == ARENA_FOLLOWER
+  if (esp_timer_get_time() - arenaSyncT1 >= (int64_t)ARENA_SYNC_INTERVAL * 1000) {
+    ArenaSync request = {};
+    fillArenaHeader(request.header, ARENA_SYNC_REQUEST, 0);
+    arenaSyncT1 = esp_timer_get_time(); // t1 as late as possible before sending
+    request.t1 = arenaSyncT1;
+    sendArenaPacket(ARENA_BROADCAST, &request, sizeof(request));
+  }
+#endif
+}
+
+// Act on one received packet (arena task)
+void handleArenaPacket(const ArenaMessage &message) {
+  ArenaHeader header;
+  memcpy(&header, message.data, sizeof(header));
+  if (header.magic != ARENA_MAGIC || header.board == ARENA_BOARD_ID) return;
+  if (header.target != ARENA_ALL_BOARDS && header.target != ARENA_BOARD_ID) return;
+#if ARENA_MODE == ARENA_COORDINATOR
+  if (header.board < ARENA_MAX_BOARDS) arenaBoardSeen[header.board] = message.timeUs;
+  if (header.type == ARENA_SYNC_REQUEST && message.length == sizeof(ArenaSync)) {
+    ArenaSync reply;
+    memcpy(&reply, message.data, sizeof(reply));
+    fillArenaHeader(reply.header, ARENA_SYNC_REPLY, header.board);
+    reply.t2 = message.timeUs;
+    reply.t3 = esp_timer_get_time(); // Time spent queued is in t3 - t2, so it cancels
+    sendArenaPacket(ARENA_BROADCAST, &reply, sizeof(reply));
+  } else if (header.type == ARENA_RESULT && message.length == sizeof(ArenaResult)) {
+    ArenaResult result;
+    memcpy(&result, message.data, sizeof(result));
+    mergeArenaResult(result);
+  }
+#else
+  if (header.board == 0) learnArenaCoordinator(message.mac);
+  if (header.type == ARENA_SYNC_REPLY && message.length == sizeof(ArenaSync)) {
+    ArenaSync reply;
+    memcpy(&reply, message.data, sizeof(reply));
+    if (reply.t1 != arenaSyncT1) return; // Reply to an earlier request; its t4 is unknown
+    arenaClock.addSample(reply.t1, reply.t2, reply.t3, message.timeUs);
+  } else if (header.type == ARENA_ROUND && message.length == sizeof(ArenaRound)) {
+    ArenaRound round;
+    memcpy(&round, message.data, sizeof(round));
+    if (round.roundId == arenaLastRound) return;
+    arenaLastRound = round.roundId;
+    if (!arenaClock.synced()) {
+      LOG_WARN(LOG_ARENA, "Arena round %lu skipped, clock not synchronized", (unsigned long)round.roundId);
+      return;
+    }
+    int64_t start = arenaClock.toLocal(round.startUs);
+    if (start <= esp_timer_get_time()) {
+      LOG_WARN(LOG_ARENA, "Arena round %lu announced too late", (unsigned long)round.roundId);
+      return;
+    }
+    GameCommand command = {GAME_CMD_ARENA_ROUND, start, (int32_t)round.roundId,
+                           {round.phaseMs[0], round.phaseMs[1], round.phaseMs[2]}};
+    xQueueSend(gameQueue, &command, 0);
+  }
+#endif
+}
+
+// Follower: make the coordinator a peer, so results can be unicast to it
+// (arena task). A coordinator that was swapped for another board replaces it.
+void learnArenaCoordinator(const uint8_t *mac) {
+  if (arenaCoordinatorKnown && memcmp(arenaCoordinatorMac, mac, sizeof(arenaCoordinatorMac)) == 0) return;
+  if (arenaCoordinatorKnown) esp_now_del_peer(arenaCoordinatorMac);
+  esp_now_peer_info_t peer = {};
+  memcpy(peer.peer_addr, mac, sizeof(peer.peer_addr));
+  peer.channel = ARENA_CHANNEL;
+  peer.encrypt = false;
+  arenaCoordinatorKnown = esp_now_add_peer(&peer) == ESP_OK;
+  if (!arenaCoordinatorKnown) {
+    LOG_ERROR(LOG_ARENA, "ESP-NOW could not add the coordinator as a peer");
+    return;
+  }
+  memcpy(arenaCoordinatorMac, mac, sizeof(arenaCoordinatorMac));
+  LOG_INFO(LOG_ARENA, "Arena coordinator at %02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4],
+           mac[5]);
+}
+
+// Send a packet to one board, or to every arena board with ARENA_BROADCAST
+// (arena task)
+void sendArenaPacket(const uint8_t *mac, const void *packet, size_t length) {
+  esp_err_t error = esp_now_send(mac, (const uint8_t *)packet, length);
+  if (error != ESP_OK) {
+    LOG_WARN(LOG_ARENA, "ESP-NOW send failed: %d", (int)error);
+  }
+}
+
+// Fill in the common header of an outgoing packet
+void fillArenaHeader(ArenaHeader &header, uint8_t type, uint8_t target) {
+  header.magic = ARENA_MAGIC;
+  header.type = type;
+  header.board = ARENA_BOARD_ID;
+  header.target = target;
+  memset(header.reserved, 0, sizeof(header.reserved));
+}
+
+// Queue a message for the arena task (callable from any task)
+void postArenaMessage(uint8_t kind, const void *packet, size_t length) {
+  ArenaMessage message;
+  message.kind = kind;
+  message.length = length;
+  message.timeUs = 0;
+  if (length > 0) memcpy(message.data, packet, length);
+  if (xQueueSend(arenaQueue, &message, 0) != pdTRUE) {
+    LOG_ERROR(LOG_ARENA, "Arena queue full, message dropped");
+  }
+}
+
+// Coordinator: announce the round about to start (game task). The durations
+// were picked by startGame, so every board shows the same sequence.
+void arenaAnnounceRound(int64_t startTime) {
+  ArenaRound round;
+  fillArenaHeader(round.header, ARENA_ROUND, ARENA_ALL_BOARDS);
+  round.roundId = ++arenaRoundId;
+  round.phaseMs[0] = redDuration;
+  round.phaseMs[1] = yellowDuration;
+  round.phaseMs[2] = greenDuration;
+  round.startUs = startTime;
+  arenaLastRound = round.roundId;
+  arenaRoundStartUs = startTime;
+  postArenaMessage(ARENA_MSG_SEND, &round, sizeof(round));
+  LOG_INFO(LOG_ARENA, "Arena round %lu announced", (unsigned long)round.roundId);
+}
+
+// Follower: report every seat's result of the arena round just played (game
+// task). greenStartUs is on the local clock here; the arena task converts it.
+void arenaReportRound() {
+  for (int i = 0; i < lastRound.numberOfPlayers; i++) {
+    ArenaResult result;
+    fillArenaHeader(result.header, ARENA_RESULT, 0);
+    result.roundId = arenaRoundId;
+    result.reactionUs = lastRound.reactionTimes[i];
+    result.greenStartUs = greenStartTime;
+    result.syncErrorUs = 0;
+    result.flags = lastRound.flags[i];
+    xSemaphoreTake(playerMutex, portMAX_DELAY);
+    memcpy(result.name, playerNames[i], PLAYER_NAME_SIZE);
+    xSemaphoreGive(playerMutex);
+    postArenaMessage(ARENA_MSG_RESULT, &result, sizeof(result));
+  }
+}
+
+// Follower: move a result onto the coordinator clock and send it (arena task)
+void sendArenaResult(const ArenaMessage &message) {
+  ArenaResult result;
+  memcpy(&result, message.data, sizeof(result));
+  result.greenStartUs = arenaClock.toCoordinator(result.greenStartUs);
+  result.syncErrorUs = arenaClock.errorBoundUs();
+  if (!arenaCoordinatorKnown) { // Only if adding the peer failed: results follow a round from the coordinator
+    LOG_WARN(LOG_ARENA, "Arena result for round %lu dropped, coordinator unknown", (unsigned long)result.roundId);
+    return;
+  }
+  sendArenaPacket(arenaCoordinatorMac, &result, sizeof(result));
+}
+
+// Coordinator: show a follower's result and record it in the registry, where
+// it competes on the same leaderboard as the local players. Default names
+// get the board as a prefix so seats of different boards stay apart.
+void mergeArenaResult(const ArenaResult &result) {
+  char name[PLAYER_NAME_SIZE];
+  if (strncmp(result.name, "Player ", 7) == 0) {
+    snprintf(name, sizeof(name), "B%d %.*s", result.header.board, PLAYER_NAME_SIZE - 6, result.name); // "B255 " at most
+  } else {
+    strncpy(name, result.name, PLAYER_NAME_SIZE - 1);
+    name[PLAYER_NAME_SIZE - 1] = '\0';
+  }
+  MessageText reaction;
+  formatReaction(result.reactionUs, result.flags, reaction);
+  MessageText line;
+  line.appendf("ARENA round %lu %s: %s", (unsigned long)result.roundId, name, reaction.c_str());
+  // Only a clean reaction is recorded; flagged ones were set aside on the follower
+  if (suspectReason(result.flags) == NULL && result.reactionUs != REACTION_JUMPSTART &&
+      result.reactionUs != REACTION_NONE) {
+    if (result.roundId == arenaLastRound) { // Touch time on the shared clock
+      line.appendf(", touch at +%lld us", (long long)(result.greenStartUs + result.reactionUs - arenaRoundStartUs));
+    }
+    ArenaPlayerResult player;
+    memcpy(player.name, name, sizeof(name));
+    player.reactionUs = result.reactionUs;
+    if (xQueueSend(arenaResultQueue, &player, 0) != pdTRUE) {
+      LOG_ERROR(LOG_STORAGE, "Arena result queue full, result dropped");
+      line.appendf(" (not recorded)");
+    } else if (!arenaResultsPending.exchange(true) && !postStorageCommand(STORAGE_ARENA_RESULT, NULL)) {
+      arenaResultsPending.store(false); // The next result tries again
+    }
+  }
+  line.appendf(" (sync +/-%lu us)", (unsigned long)result.syncErrorUs);
+  btPrintln(line.c_str());
+  LOG_INFO(LOG_ARENA, "%s", line.c_str());
+}
+
+#if ARENA_MODE == ARENA_COORDINATOR
+// Record the follower results merged since the last wake-up (storage task)
+void recordArenaResults() {
+  arenaResultsPending.store(false); // Before draining, so a later result wakes us again
+  ArenaPlayerResult player;
+  while (xQueueReceive(arenaResultQueue, &player, 0) == pdTRUE) recordPlayerResult(player.name, player.reactionUs);
+}
+#endif
+
+// Report the arena state over Bluetooth (arena task)
+void sendArenaStatus() {
+  MessageText line;
+#if ARENA_MODE == ARENA_COORDINATOR
+  btPrintln(line.appendf("ARENA coordinator, channel %d, round %lu", ARENA_CHANNEL, (unsigned long)arenaLastRound).c_str());
+  int64_t now = esp_timer_get_time();
+  for (int board = 1; board < ARENA_MAX_BOARDS; board++) {
+    if (arenaBoardSeen[board] == 0) continue;
+    line.clear();
+    btPrintln(line.appendf("B%d: seen %lu ms ago", board, (unsigned long)((now - arenaBoardSeen[board]) / 1000)).c_str());
+  }
+#else
+  line.appendf("ARENA follower B%d, channel %d: ", ARENA_BOARD_ID, ARENA_CHANNEL);
+  if (arenaClock.synced()) {
+    line.appendf("offset=%lld us drift=%.2f ppm error<=%lu us", (long long)arenaClock.offsetAt(esp_timer_get_time()),
+                 arenaClock.driftPpm(), (unsigned long)arenaClock.errorBoundUs());
+  } else {
+    line.append("not synchronized");
+  }
+  if (arenaSendFailures.load() > 0) line.appendf(", %lu results lost", (unsigned long)arenaSendFailures.load());
+  btPrintln(line.c_str());
+#endif
+}
+#endif
+
+// Queue an event for the live views: the WebSocket clients (WEB_ENABLED) and
+// the BLE state and results characteristics (BT_BLE). Callable from any task.
+void postLiveEvent(uint8_t type, uint8_t phase, const RoundResult *round) {
+  if (sessionReplaying.load()) return;
+#if BT_TRANSPORT == BT_BLE
+  if (type == LIVE_EVENT_PHASE || type == LIVE_EVENT_RESULT) {
+    BluetoothMessage message;
+    message.type = type == LIVE_EVENT_PHASE ? BT_NOTIFY_STATE : BT_NOTIFY_RESULT;
+    message.count = phase;
+    if (round != NULL) message.round = *round;
+    xQueueSend(bluetoothQueue, &message, 0);
+  }
+#endif
+#if WEB_ENABLED
+  LiveEvent event;
+  event.type = type;
+  event.phase = phase;
+  event.client = 0;
+  if (round != NULL) event.round = *round;
+  if (xQueueSend(webQueue, &event, 0) != pdTRUE) {
+    LOG_WARN(LOG_SYSTEM, "Web queue full, event dropped");
+  }
+#endif
+}
+
+// Append text to a JSON message as a quoted, escaped string
+void appendJsonString(JsonText &json, const char *text) {
+  json.append('"');
+  for (; *text != '\0'; text++) {
+    unsigned char c = *text;
+    if (c == '"' || c == '\\') {
+      json.append('\\').append((char)c);
+    } else if (c < 0x20) {
+      json.appendf("\\u%04x", c);
+    } else {
+      json.append((char)c);
+    }
+  }
+  json.append('"');
+}
+
+// {"type":"phase","phase":"green"}
+void formatJsonPhase(uint8_t phase, JsonText &json) {
+  json.clear();
+  json.appendf("{\"type\":\"phase\",\"phase\":\"%s\"}", phase <= GAME_ARMED ? GAME_STATE_NAMES[phase] : "idle");
+}
+
+// {"type":"result","players":[{"name":"Alice","us":231000},{"name":"Bob","result":"jumpstart"}]}
+// A player without "us" has "result" set to "jumpstart" or "none"; a suspect
+// result also has "flagged" set to the reason.
+void formatJsonResult(const RoundResult &round, JsonText &json) {
+  json.clear();
+  json.append("{\"type\":\"result\",\"players\":[");
+  xSemaphoreTake(playerMutex, portMAX_DELAY);
+  for (int i = 0; i < round.numberOfPlayers; i++) {
+    json.append(i > 0 ? ",{\"name\":" : "{\"name\":");
+    appendJsonString(json, playerNames[i]);
+    if (round.reactionTimes[i] == REACTION_JUMPSTART) {
+      json.append(",\"result\":\"jumpstart\"");
+    } else if (round.reactionTimes[i] == REACTION_NONE) {
+      json.append(",\"result\":\"none\"");
+    } else {
+      json.appendf(",\"us\":%lu", round.reactionTimes[i]);
+    }
+    const char *reason = suspectReason(round.flags[i]);
+    if (reason != NULL) json.appendf(",\"flagged\":\"%s\"", reason);
+    json.append('}');
+  }
+  xSemaphoreGive(playerMutex);
+  json.append("]}");
+}
+
+// {"type":"leaderboard","entries":[{"name":"Alice","us":198000},...]}, fastest first
+void formatJsonLeaderboard(JsonText &json) {
+  json.clear();
+  json.append("{\"type\":\"leaderboard\",\"entries\":[");
+  xSemaphoreTake(playerMutex, portMAX_DELAY);
+  for (int i = 0; i < leaderboardCount; i++) {
+    json.append(i > 0 ? ",{\"name\":" : "{\"name\":");
+    appendJsonString(json, leaderboard[i].name);
+    json.appendf(",\"us\":%lu}", (unsigned long)leaderboard[i].bestReactionTime);
+  }
+  xSemaphoreGive(playerMutex);
+  json.append("]}");
+}
+
+// {"type":"config","firmware":"Oct 14 2026 12:00:00","partition":"app0","settings":{"touch_debounce":50000,...}}
+void formatJsonConfig(JsonText &json) {
+  json.clear();
+  json.appendf("{\"type\":\"config\",\"firmware\":\"%s\",\"partition\":\"%s\",\"settings\":{", FIRMWARE_BUILD,
+               esp_ota_get_running_partition()->label);
+  for (int i = 0; i < CONFIG_SETTING_COUNT; i++) {
+    json.appendf(i > 0 ? ",\"%s\":%lu" : "\"%s\":%lu", CONFIG_SETTINGS[i].key, (unsigned long)(config.*CONFIG_SETTINGS[i].field));
+  }
+  json.append("}}");
+}
+
+// Parse an HTTP Range header for a file of size bytes into [start, end).
+// Only a single range is supported: "bytes=a-b", "bytes=a-" or "bytes=-n".
+// Returns false if the range is malformed or unsatisfiable.
+bool parseByteRange(const char *header, uint32_t size, uint32_t &start, uint32_t &end) {
+  if (strncmp(header, "bytes=", 6) != 0) return false;
+  const char *text = header + 6;
+  long first = -1;
+  long last = -1;
+  const char *rest;
+  if (*text != '-') {
+    if (!parseNumber(text, first, &rest) || first < 0) return false;
+    text = rest;
+  }
+  if (*text++ != '-') return false;
+  if (*text != '\0' && (!parseNumber(text, last, &rest) || *rest != '\0' || last < 0)) return false;
+  if (first < 0) { // Suffix range: the last n bytes
+    if (last <= 0) return false;
+    start = (uint32_t)last >= size ? 0 : size - last;
+    end = size;
+  } else {
+    if ((uint32_t)first >= size || (last >= 0 && last < first)) return false;
+    start = first;
+    end = (last < 0 || (uint32_t)last >= size) ? size : last + 1;
+  }
+  return true;
+}
+
+// Parse exactly 2 * size hex digits into bytes
+bool parseHex(const char *text, uint8_t *bytes, size_t size) {
+  if (strlen(text) != 2 * size) return false;
+  for (size_t i = 0; i < 2 * size; i++) {
+    char c = text[i];
+    int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+    if (digit < 0) return false;
+    bytes[i / 2] = (uint8_t)((i % 2 == 0 ? 0 : bytes[i / 2] << 4) | digit);
+  }
+  return true;
+}
+
+// Compare two secrets in time independent of where they differ
+bool sameBytes(const uint8_t *a, const uint8_t *b, size_t size) {
+  uint8_t difference = 0;
+  for (size_t i = 0; i < size; i++) difference |= a[i] ^ b[i];
+  return difference == 0;
+}
+
+// Open a history log (or the session file) for readHistoryRange and get its
+// size (0 if it does not exist). Never waits for historyMutex, since the
+// caller is the network task: returns false if another task holds it.
+bool openHistoryReader(HistoryReader &reader, const char *path, uint32_t &size) {
+  if (xSemaphoreTake(historyMutex, 0) != pdTRUE) return false;
+  reader.file = SD.open(path, FILE_READ);
+  reader.generation = historyGeneration;
+  size = reader.file ? reader.file.size() : 0;
+  xSemaphoreGive(historyMutex);
+  return true;
+}
+
+// Read up to length bytes of an opened log starting at offset, one SD read
+// under historyMutex (same as a Bluetooth batch). Returns the bytes read, 0
+// once the log was rotated, deleted or replaced since it was opened (so a
+// download never splices two generations), or HISTORY_READ_BUSY instead of
+// waiting for the mutex.
+size_t readHistoryRange(HistoryReader &reader, uint32_t offset, uint8_t *buffer, size_t length) {
+  if (xSemaphoreTake(historyMutex, 0) != pdTRUE) return HISTORY_READ_BUSY;
+  size_t bytes = 0;
+  if (reader.file && reader.generation == historyGeneration && reader.file.seek(offset)) {
+    bytes = reader.file.read(buffer, length);
+  }
+  xSemaphoreGive(historyMutex);
+  return bytes;
+}
+
+#if WEB_ENABLED
+AsyncWebServer webServer(WEB_PORT);
+AsyncWebSocket webSocket("/ws");
+AsyncWebServerRequest *otaUpload = NULL; // The upload being written to the idle app partition
+std::atomic<int64_t> otaRestartUs(0);    // When the web task reboots into a new image (0: not pending)
+char webAdminUser[WEB_ADMIN_TEXT_SIZE];     // Admin credentials, from NVS or the build (loadWebAdmin)
+char webAdminPassword[WEB_ADMIN_TEXT_SIZE]; // Empty: the admin pages are refused
+uint8_t otaKey[OTA_KEY_SIZE];            // Firmware key, from NVS or the build (loadWebAdmin)
+bool otaKeySet = false;                  // false: /update is refused
+uint8_t otaExpectedHmac[OTA_KEY_SIZE];   // From the upload's X-Firmware-HMAC header
+mbedtls_md_context_t otaHmac;            // HMAC of the upload so far
+
+// Spectator page: shows the light, the last results and the leaderboard as
+// the WebSocket pushes them. Indented and free of double quotes, so the
+// prototype generator never mistakes it for code.
+const char WEB_INDEX_PAGE[] PROGMEM = R"(<!DOCTYPE html>
+  <html><head><meta name='viewport' content='width=device-width'><title>Reflex Rush</title></head>
+  <body style='font:24px sans-serif;text-align:center;margin:0;padding:1em'>
+  <h1 id='phase'>-</h1><div id='result'></div><h2>Leaderboard</h2><ol id='board' style='display:inline-block;text-align:left'></ol>
+  <script>
+  var colors = {red: '#e33', yellow: '#ec3', green: '#3c3'};
+  function ms(us) { return (us / 1000).toFixed(1) + ' ms'; }
+  function fill(id, tag, items) {
+    var list = document.getElementById(id);
+    list.textContent = '';
+    items.forEach(function (text) { var e = document.createElement(tag); e.textContent = text; list.appendChild(e); });
+  }
+  function connect() {
+    var ws = new WebSocket('ws://' + location.host + '/ws');
+    ws.onmessage = function (event) {
+      var m = JSON.parse(event.data);
+      if (m.type == 'phase') {
+        document.getElementById('phase').textContent = m.phase.toUpperCase();
+        document.body.style.background = colors[m.phase] || '#fff';
+      } else if (m.type == 'result') {
+        fill('result', 'div', m.players.map(function (p) { return p.name + ': ' + ('us' in p ? ms(p.us) : p.result); }));
+      } else if (m.type == 'leaderboard') {
+        fill('board', 'li', m.entries.map(function (e) { return e.name + ' ' + ms(e.us); }));
+      }
+    };
+    ws.onclose = function () { setTimeout(connect, 2000); };
+  }
+  connect();
+  </script></body></html>)";
+
+// Start the access point, the web server and the web task (setup). Routes:
+//   /             spectator page
+//   /ws           WebSocket: JSON phase, result and leaderboard messages
+//   /history.bin  the history log as raw 16-byte HistoryRecords, with Range
+//                 support (?old=1 for the rotated-out generation), read from
+//                 SD one chunk at a time
+//   /session.rec  the last recorded session as raw 8-byte SessionRecords, the
+//                 same way
+void startWeb() {
+  webQueue = xQueueCreate(WEB_QUEUE_LENGTH, sizeof(LiveEvent));
+  loadWebAdmin();
+  WiFi.mode(ARENA_MODE != ARENA_OFF ? WIFI_AP_STA : WIFI_AP);
+  WiFi.softAP(WEB_AP_SSID, WEB_AP_PASSWORD, ARENA_CHANNEL); // ESP-NOW must share the AP channel
+  webSocket.onEvent([](AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg,
+                       uint8_t *data, size_t length) {
+    if (type != WS_EVT_CONNECT) return; // Clients only listen
+    LiveEvent event;
+    event.type = LIVE_EVENT_HELLO;
+    event.client = client->id();
+    xQueueSend(webQueue, &event, 0);
+  });
+  webServer.addHandler(&webSocket);
+  webServer.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
+    request->send_P(200, "text/html", WEB_INDEX_PAGE);
+  });
+  auto sendLog = [](AsyncWebServerRequest *request, const char *path) {
+    std::shared_ptr<HistoryReader> reader = std::make_shared<HistoryReader>(); // Closed with the response
+    uint32_t size = 0;
+    if (!openHistoryReader(*reader, path, size)) {
+      AsyncWebServerResponse *response = request->beginResponse(503);
+      response->addHeader("Retry-After", "1");
+      request->send(response);
+      return;
+    }
+    uint32_t start = 0;
+    uint32_t end = size;
+    bool ranged = request->hasHeader("Range");
+    if (ranged && !parseByteRange(request->header("Range").c_str(), size, start, end)) {
+      AsyncWebServerResponse *response = request->beginResponse(416);
+      response->addHeader("Content-Range", String("bytes */") + size);
+      request->send(response);
+      return;
+    }
+    // Appends never change bytes already in the log; a rotation or delete
+    // while the response streams cuts it short. The length is already sent
+    // and a callback returning 0 only means "nothing yet", so the connection
+    // is closed to end it.
+    AsyncWebServerResponse *response = request->beginResponse(
+        "application/octet-stream", end - start,
+        [request, reader, start, end](uint8_t *buffer, size_t maxLength, size_t index) -> size_t {
+          size_t remaining = end - start - index;
+          size_t bytes = readHistoryRange(*reader, start + index, buffer, maxLength < remaining ? maxLength : remaining);
+          if (bytes == HISTORY_READ_BUSY) return RESPONSE_TRY_AGAIN;
+          if (bytes == 0) request->client()->close(); // The client sees a short body, never spliced generations
+          return bytes;
+        });
+    if (ranged) {
+      response->setCode(206);
+      response->addHeader("Content-Range", String("bytes ") + start + "-" + (end - 1) + "/" + size);
+    }
+    response->addHeader("Accept-Ranges", "bytes");
+    request->send(response);
+  };
+  webServer.on("/history.bin", HTTP_GET, [sendLog](AsyncWebServerRequest *request) {
+    sendLog(request, request->hasParam("old") ? HISTORY_OLD_FILE : HISTORY_FILE);
+  });
+  webServer.on("/session.rec", HTTP_GET, [sendLog](AsyncWebServerRequest *request) { sendLog(request, SESSION_FILE); });
+  // Admin pages: true if the request carries the admin credentials;
+  // otherwise it is answered here
+  auto authorized = [](AsyncWebServerRequest *request) {
+    if (webAdminPassword[0] == '\0') {
+      request->send(403, "text/plain", "ERROR: No admin password is set on this board\n");
+      return false;
+    }
+    if (!request->authenticate(webAdminUser, webAdminPassword)) {
+      request->requestAuthentication();
+      return false;
+    }
+    return true;
+  };
+  // Settings: GET lists them; POST key=value pairs (basic auth) changes them
+  // like CONFIG_<key>=<value> does
+  webServer.on("/config", HTTP_GET, [](AsyncWebServerRequest *request) {
+    JsonText json;
+    formatJsonConfig(json);
+    request->send(200, "application/json", json.c_str());
+  });
+  webServer.on("/config", HTTP_POST, [authorized](AsyncWebServerRequest *request) {
+    if (!authorized(request)) return;
+    FixedString<JSON_TEXT_SIZE> text;
+    bool ok = request->params() > 0;
+    for (size_t i = 0; i < request->params(); i++) {
+      AsyncWebParameter *parameter = request->getParam(i);
+      MessageText reply;
+      if (!setConfig(parameter->name().c_str(), parameter->value().c_str(), reply)) ok = false;
+      text.append(reply.c_str()).append('\n');
+    }
+    request->send(ok ? 200 : 400, "text/plain", text.length() > 0 ? text.c_str() : "ERROR: No settings given\n");
+  });
+  // Firmware update (basic auth, at the menu only): the image is written to
+  // the app partition not running now and booted once complete; the running
+  // one stays as the fallback. Update.end() only switches partitions once the
+  // image's HMAC matches its X-Firmware-HMAC header. The upload callback gets
+  // the body in pieces.
+  webServer.on("/update", HTTP_POST,
+               [authorized](AsyncWebServerRequest *request) {
+                 if (!otaKeySet) {
+                   return request->send(403, "text/plain", "ERROR: No firmware key is set on this board\n");
+                 }
+                 if (!authorized(request)) return;
+                 uint8_t hmac[OTA_KEY_SIZE];
+                 if (!parseHex(request->header("X-Firmware-HMAC").c_str(), hmac, sizeof(hmac))) { // The upload was refused
+                   return request->send(400, "text/plain", "ERROR: X-Firmware-HMAC must carry the image's HMAC-SHA256 in hex\n");
+                 }
+                 bool ok = otaUpload == request && Update.isFinished() && !Update.hasError();
+                 if (otaUpload == request) otaUpload = NULL;
+                 request->send(ok ? 200 : 500, "text/plain",
+                               ok ? "OK: Update written, rebooting\n" : "ERROR: Update failed or not made with this board's key\n");
+                 if (ok) {
+                   LOG_INFO(LOG_SYSTEM, "Rebooting into the new firmware");
+                   otaRestartUs.store(esp_timer_get_time() + (int64_t)OTA_RESTART_DELAY * 1000);
+                 }
+               },
+               [](AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t length, bool final) {
+                 if (!otaKeySet || webAdminPassword[0] == '\0' ||
+                     !request->authenticate(webAdminUser, webAdminPassword)) {
+                   return; // The request handler refuses it
+                 }
+                 if (index == 0) {
+                   if (otaUpload != NULL || gameState != GAME_IDLE || tournamentRounds > 0) {
+                     LOG_WARN(LOG_SYSTEM, "Firmware upload refused: %s", otaUpload != NULL ? "another one runs" : "game in progress");
+                     return;
+                   }
+                   if (!parseHex(request->header("X-Firmware-HMAC").c_str(), otaExpectedHmac, sizeof(otaExpectedHmac))) {
+                     return; // The request handler refuses it
+                   }
+                   if (!Update.begin(UPDATE_SIZE_UNKNOWN)) { // Picks the idle app partition
+                     LOG_ERROR(LOG_SYSTEM, "Firmware update cannot start: %s", Update.errorString());
+                     return;
+                   }
+                   mbedtls_md_free(&otaHmac); // The last upload's, if it never finished
+                   mbedtls_md_init(&otaHmac);
+                   mbedtls_md_setup(&otaHmac, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+                   mbedtls_md_hmac_starts(&otaHmac, otaKey, sizeof(otaKey));
+                   otaUpload = request;
+                   request->onDisconnect([request]() { // Dropped before the end: free the updater
+                     if (otaUpload != request) return;
+                     Update.abort();
+                     otaUpload = NULL;
+                   });
+                   LOG_INFO(LOG_SYSTEM, "Firmware upload started: %s", filename.c_str());
+                 }
+                 if (otaUpload != request || !Update.isRunning()) return; // Refused, or failed earlier
+                 if (gameState != GAME_IDLE) { // Flash writes would stall the round
+                   Update.abort();
+                   LOG_WARN(LOG_SYSTEM, "Firmware upload aborted: a round started");
+                   return;
+                 }
+                 mbedtls_md_hmac_update(&otaHmac, data, length);
+                 if (Update.write(data, length) != length) {
+                   LOG_ERROR(LOG_SYSTEM, "Firmware write failed: %s", Update.errorString());
+                   return;
+                 }
+                 if (!final) return;
+                 uint8_t hmac[OTA_KEY_SIZE];
+                 mbedtls_md_hmac_finish(&otaHmac, hmac);
+                 mbedtls_md_free(&otaHmac);
+                 if (!sameBytes(hmac, otaExpectedHmac, sizeof(hmac))) {
+                   Update.abort(); // The half-written partition is never made the boot one
+                   LOG_ERROR(LOG_SYSTEM, "Firmware update rejected: HMAC does not match this board's key");
+                 } else if (!Update.end(true)) { // true: the image size is whatever arrived
+                   LOG_ERROR(LOG_SYSTEM, "Firmware update rejected: %s", Update.errorString());
+                 } else {
+                   LOG_INFO(LOG_SYSTEM, "Firmware update written: %lu bytes", (unsigned long)(index + length));
+                 }
+               });
+  webServer.begin();
+  xTaskCreatePinnedToCore(webTask, "web", WEB_TASK_STACK, NULL, WEB_TASK_PRIORITY, NULL, IO_TASK_CORE);
+  LOG_INFO(LOG_SYSTEM, "Scoreboard at http://%s/ on Wi-Fi %s", WiFi.softAPIP().toString().c_str(), WEB_AP_SSID);
 }
 
-// Loop function: Runs continuously after setup
-void loop() {
-  Serial.println("Entering loop()"); // Debug: Confirm loop is reached
-  // Debug: Check button state to detect if it's stuck
-  Serial.print("Button state (HIGH = not pressed, LOW = pressed): ");
-  Serial.println(digitalRead(MENU_BUTTON));
+// Take the admin credentials and the firmware key from NVS, or else from the
+// build (at boot)
+void loadWebAdmin() {
+  if (configStore.getString("admin_user", webAdminUser, sizeof(webAdminUser)) == 0) {
+    snprintf(webAdminUser, sizeof(webAdminUser), "%s", WEB_ADMIN_USER);
+  }
+  if (configStore.getString("admin_pass", webAdminPassword, sizeof(webAdminPassword)) == 0) {
+    snprintf(webAdminPassword, sizeof(webAdminPassword), "%s", WEB_ADMIN_PASSWORD);
+  }
+  if (webAdminPassword[0] == '\0') LOG_WARN(LOG_SYSTEM, "No web admin password set: POST /config and /update are refused");
+  otaKeySet = configStore.getBytes("ota_key", otaKey, sizeof(otaKey)) == sizeof(otaKey) ||
+              parseHex(OTA_KEY, otaKey, sizeof(otaKey));
+  if (!otaKeySet) LOG_WARN(LOG_SYSTEM, "No firmware key set: /update is refused");
+}
 
-  // Display the main menu if not already displayed
-  if (!menuDisplayed) {
-    displayMainMenu();
-    menuDisplayed = true;
-    Serial.println("Main menu displayed");
+// Web task: formats queued events and pushes them to the WebSocket clients
+void webTask(void *parameter) {
+  for (;;) {
+    serviceWeb();
   }
+}
 
-  // Read joystick Y-axis for menu navigation
-  int yValue = analogRead(JOYSTICK_Y);
-  static unsigned long lastJoystickMove = 0; // Static to retain last move time
-  if (millis() - lastJoystickMove > 200) { // Debounce joystick (200ms delay between moves)
-    if (yValue < JOYSTICK_THRESHOLD) { // Joystick moved up
-      currentMenuOption = (currentMenuOption - 1 + MENU_SIZE) % MENU_SIZE; // Move cursor up
-      displayMainMenu();
-      lastJoystickMove = millis();
-      Serial.print("Joystick moved UP, selected menu option: ");
-      Serial.println(MENU_OPTIONS[currentMenuOption]);
-    } else if (yValue > 4095 - JOYSTICK_THRESHOLD) { // Joystick moved down
-      currentMenuOption = (currentMenuOption + 1) % MENU_SIZE; // Move cursor down
-      displayMainMenu();
-      lastJoystickMove = millis();
-      Serial.print("Joystick moved DOWN, selected menu option: ");
-      Serial.println(MENU_OPTIONS[currentMenuOption]);
+// Push the next queued event, waiting up to WEB_CLEANUP_INTERVAL for one,
+// and reboot once a firmware update is written
+void serviceWeb() {
+  LiveEvent event;
+  if (xQueueReceive(webQueue, &event, pdMS_TO_TICKS(WEB_CLEANUP_INTERVAL)) == pdTRUE) {
+    JsonText json;
+    switch (event.type) {
+      case LIVE_EVENT_PHASE:
+        formatJsonPhase(event.phase, json);
+        webSocket.textAll(json.c_str());
+        break;
+      case LIVE_EVENT_RESULT:
+        formatJsonResult(event.round, json);
+        webSocket.textAll(json.c_str());
+        break;
+      case LIVE_EVENT_LEADERBOARD:
+        formatJsonLeaderboard(json);
+        webSocket.textAll(json.c_str());
+        break;
+      case LIVE_EVENT_HELLO:
+        formatJsonPhase(gameState, json);
+        webSocket.text(event.client, json.c_str());
+        formatJsonLeaderboard(json);
+        webSocket.text(event.client, json.c_str());
+        break;
     }
   }
-
-  // Check for menu button press to select an option
-  if (digitalRead(MENU_BUTTON) == LOW) {
-    delay(DEBOUNCE_DELAY); // Debounce the button
-    if (digitalRead(MENU_BUTTON) == LOW) { // Confirm button is still pressed
-      Serial.print("Menu button pressed, executing option: ");
-      Serial.println(MENU_OPTIONS[currentMenuOption]);
-      executeMenuOption(); // Execute the selected menu option
-      menuDisplayed = false; // Reset menu display flag
+  webSocket.cleanupClients(); // Release clients whose connection closed
+  int64_t restartUs = otaRestartUs.load();
+  if (restartUs != 0 && esp_timer_get_time() >= restartUs) {
+    StorageCommand shutdown;
+    shutdown.type = STORAGE_SHUTDOWN;
+    shutdown.done = xSemaphoreCreateBinary();
+    if (xQueueSend(storageQueue, &shutdown, pdMS_TO_TICKS(STORAGE_CLOSE_TIMEOUT)) != pdTRUE ||
+        xSemaphoreTake(shutdown.done, pdMS_TO_TICKS(STORAGE_CLOSE_TIMEOUT)) != pdTRUE) {
+      LOG_ERROR(LOG_SYSTEM, "SD card not closed in time, rebooting anyway");
     }
+    ESP.restart(); // The loop task has had OTA_RESTART_DELAY to flush the log
   }
+}
+#endif
 
-  // Check for Bluetooth commands
-  if (ESP_BT.available()) {
-    String command = ESP_BT.readStringUntil('\n'); // Read command until newline
-    command.trim(); // Remove whitespace
-    Serial.print("Bluetooth command received: ");
-    Serial.println(command);
-    menuDisplayed = false; // Reset menu display to refresh after command
-    if (command.startsWith("SELECT_PLAYERS_")) { // Set number of players
-      int num = command.substring(15).toInt();
-      if (num >= 1 && num <= MAX_PLAYERS) {
-        numberOfPlayers = num;
-        displayMenuOption("Players: " + String(num));
-        ESP_BT.println("OK: Players set to " + String(num));
-        Serial.println("Players set to: " + String(num));
-      } else {
-        displayMenuOption("Invalid player count");
-        ESP_BT.println("ERROR: Invalid player count");
-        Serial.println("Invalid player count received");
-      }
-    } else if (command.startsWith("SET_PLAYER_")) { // Set player name
-      int playerIndex = command.charAt(12) - '1';
-      String playerName = command.substring(14);
-      if (playerIndex >= 0 && playerIndex < numberOfPlayers && playerName.length() > 0) {
-        playerNames[playerIndex] = playerName;
-        displayMenuOption(playerNames[playerIndex] + " set!");
-        ESP_BT.println("OK: Player " + String(playerIndex + 1) + " set to " + playerName);
-        Serial.println("Player " + String(playerIndex + 1) + " set to: " + playerName);
-      } else {
-        displayMenuOption("Invalid player");
-        ESP_BT.println("ERROR: Invalid player or name");
-        Serial.println("Invalid player or name received");
-      }
-    } else if (command == "START") { // Start game command (disabled for debugging)
-      // Note: Uncomment the following lines to re-enable Bluetooth game start
-      Serial.println("START command received but disabled for debugging");
-      // displayMenuOption("Starting game...");
-      // ESP_BT.println("OK: Game started");
-      // Serial.println("Game started via Bluetooth");
-      // startGame();
-    } else if (command == "VIEW_HISTORY") { // View game history
-      displayMenuOption("Viewing history...");
-      ESP_BT.println("OK: Game history");
-      Serial.println("Viewing history via Bluetooth");
-      sendHistoryInChunks();
-    } else if (command == "VIEW_LEADERBOARD") { // View leaderboard
-      displayMenuOption("Leaderboard:");
-      ESP_BT.println("OK: Leaderboard");
-      Serial.println("Viewing leaderboard via Bluetooth");
-      showLeaderboard();
-    } else if (command == "DELETE_HISTORY") { // Delete game history
-      displayMenuOption("Deleting history...");
-      Serial.println("Deleting history via Bluetooth");
-      deleteHistory();
-    } else { // Unknown command
-      displayMenuOption("Invalid command");
-      ESP_BT.println("ERROR: Unknown command");
-      Serial.println("Unknown Bluetooth command received");
+// Persist a round to history and leaderboard (runs in the storage task)
+void storeRoundResults(const RoundResult &round) {
+  GameRecord game;
+  game.gameId = nextGameId++;
+  game.timestampMs = millis();
+  game.numberOfPlayers = round.numberOfPlayers;
+  for (int i = 0; i < round.numberOfPlayers; i++) {
+    if (round.reactionTimes[i] == REACTION_JUMPSTART) {
+      game.flags[i] = HISTORY_FLAG_JUMPSTART | round.flags[i];
+      game.reactionUs[i] = 0;
+    } else if (round.reactionTimes[i] != REACTION_NONE) {
+      game.flags[i] = HISTORY_FLAG_VALID | round.flags[i];
+      game.reactionUs[i] = round.reactionTimes[i];
+    } else {
+      game.flags[i] = HISTORY_FLAG_NO_RESPONSE;
+      game.reactionUs[i] = 0;
     }
   }
-  delay(100); // Small delay to slow down loop for debugging
+  historyRingPush(game); // Recent games stay queryable even without an SD card
+  // Save results to game history if SD card is available
+  if (checkSDCardSpace()) {
+    saveHistoryToSD(game); // Append the round to the log on SD
+  }
+  updateLeaderboard(round); // Update leaderboard with new results (written behind)
 }
 
-// Start the game: Runs the traffic light sequence and records player reactions
-void startGame() {
-  Serial.println("Starting game sequence");
-  // Reset reaction times and touch detection flags
-  for (int i = 0; i < MAX_PLAYERS; i++) {
-    reactionTimes[i] = 0xFFFFFFFF; // Reset to max value (indicating no touch)
-    touchDetected[i] = false;       // Reset touch detection
-    Serial.print("Reset reaction time for Player ");
-    Serial.print(i + 1);
-    Serial.println(": 0xFFFFFFFF ms");
-  }
+// Display traffic light phase on OLED
+void displayTrafficLight(const char *color) {
+  if (sessionReplaying.load()) return;
+  postDisplayCommand(DISPLAY_TRAFFIC_LIGHT, color, 0);
+}
 
-  // Red Light phase: Players must wait
-  redDuration = random(1000, 5000); // Random duration between 1-5 seconds
-  displayTrafficLight("RED");
-  Serial.print("Red Light displayed for ");
-  Serial.print(redDuration);
-  Serial.println(" ms");
-  unsigned long startTime = millis();
-  while (millis() - startTime < redDuration) {
-    for (int i = 0; i < numberOfPlayers; i++) {
-      if (touchDetected[i]) {
-        reactionTimes[i] = 0; // Jumpstart (penalized as 0ms)
-        Serial.print("Jumpstart detected for Player ");
-        Serial.print(i + 1);
-        Serial.println(" during Red Light");
-      }
-    }
+// Display Green Light and have the display task report when it is on screen
+void displayGreenLight() {
+  if (sessionReplaying.load()) return; // The replay reports Green Light from the recording
+  DisplayCommand command;
+  command.type = DISPLAY_TRAFFIC_LIGHT;
+  command.option = 0;
+  command.reportShown = true;
+  command.timestampUs = 0;
+  strcpy(command.text, "GREEN");
+  queueDisplayCommand(command);
+}
+
+// Display a menu option or message on OLED
+void displayMenuOption(const char *option) {
+  postDisplayCommand(DISPLAY_TEXT, option, 0);
+}
+
+// Display game results on OLED (the state machine keeps them on screen for
+// config.resultDisplayMs)
+void displayGameResults(const char *result) {
+  postDisplayCommand(DISPLAY_RESULTS, result, 0);
+}
+
+// Display the main menu on OLED
+void displayMainMenu() {
+  postDisplayCommand(DISPLAY_MENU, "", currentMenuOption);
+}
+
+#if DISPLAY_BACKEND == DISPLAY_TFT
+// Send the frame to the TFT; display() transfers only the bands that changed
+// (runs in the display task)
+void pushDisplay() {
+  PROFILE_SCOPE(PROFILE_DISPLAY_PUSH);
+  display.display();
+  displayPushedTime = esp_timer_get_time(); // The last band is on the panel
+}
+#else
+// Send the framebuffer to the OLED, transferring only what changed since the
+// last push: for each page, the span from the first to the last changed
+// column. A menu cursor move touches two pages instead of the full 1 KB frame.
+// (runs in the display task)
+void pushDisplay() {
+  PROFILE_SCOPE(PROFILE_DISPLAY_PUSH);
+  uint8_t *buffer = display.getBuffer();
+  if (!oledShadowValid) { // Panel contents unknown: send everything once
+    display.display();
+    memcpy(oledShadow, buffer, sizeof(oledShadow));
+    oledShadowValid = true;
+    displayPushedTime = esp_timer_get_time();
+    return;
   }
+  for (int page = 0; page < OLED_PAGES; page++) {
+    const uint8_t *current = buffer + page * SCREEN_WIDTH;
+    uint8_t *shown = oledShadow + page * SCREEN_WIDTH;
+    int first = 0;
+    while (first < SCREEN_WIDTH && current[first] == shown[first]) first++;
+    if (first == SCREEN_WIDTH) continue; // Page unchanged
+    int last = SCREEN_WIDTH - 1;
+    while (current[last] == shown[last]) last--;
 
-  // Yellow Light phase: Players prepare
-  yellowDuration = random(500, 2000); // Random duration between 0.5-2 seconds
-  displayTrafficLight("YELLOW");
-  Serial.print("Yellow Light displayed for ");
-  Serial.print(yellowDuration);
-  Serial.println(" ms");
-  startTime = millis();
-  while (millis() - startTime < yellowDuration) {
-    for (int i = 0; i < numberOfPlayers; i++) {
-      if (touchDetected[i]) {
-        reactionTimes[i] = 0; // Jumpstart
-        Serial.print("Jumpstart detected for Player ");
-        Serial.print(i + 1);
-        Serial.println(" during Yellow Light");
-      }
+    // Address window = the dirty span of this page
+    display.ssd1306_command(SSD1306_PAGEADDR);
+    display.ssd1306_command(page);
+    display.ssd1306_command(page);
+    display.ssd1306_command(SSD1306_COLUMNADDR);
+    display.ssd1306_command(first);
+    display.ssd1306_command(last);
+    for (int column = first; column <= last; column += OLED_I2C_CHUNK) {
+      int count = last + 1 - column;
+      if (count > OLED_I2C_CHUNK) count = OLED_I2C_CHUNK;
+      Wire.beginTransmission(OLED_I2C_ADDRESS);
+      Wire.write((uint8_t)0x40); // Control byte: display data follows
+      Wire.write(current + column, count);
+      Wire.endTransmission();
     }
+    memcpy(shown + first, current + first, last + 1 - first);
   }
+  displayPushedTime = esp_timer_get_time(); // The last byte is on the panel
+}
+#endif
 
-  // Green Light phase: Players must press their touch sensors
-  greenDuration = random(1000, 3000); // Random duration between 1-3 seconds
-  displayTrafficLight("GREEN");
-  greenStartTime = millis(); // Record the start time of Green Light
-  Serial.print("Green Light displayed for ");
-  Serial.print(greenDuration);
-  Serial.print(" ms, started at: ");
-  Serial.print(greenStartTime);
-  Serial.println(" ms");
-  while (millis() - greenStartTime < greenDuration) {
-    // Wait for the duration; reactions are recorded via ISRs
+// Draw a traffic light phase (runs in the display task)
+void drawTrafficLight(const char *color) {
+  int frame = trafficLightFrame(color);
+  if (frame >= 0) {
+    showStaticFrame(frame);
+  } else {
+    renderTrafficLight(color);
   }
+  pushDisplay();
+  LOG_DEBUG(LOG_DISPLAY, "OLED updated with: %s LIGHT", color);
+}
 
-  // Compile and display game results
-  String gameResult = "Game result: \n";
-  for (int i = 0; i < numberOfPlayers; i++) {
-    if (reactionTimes[i] == 0) { // Jumpstart
-      gameResult += playerNames[i] + ": JS (Jumpstart)\n";
-    } else if (reactionTimes[i] > greenStartTime) { // Valid reaction
-      unsigned long reactionTime = reactionTimes[i] - greenStartTime;
-      gameResult += playerNames[i] + ": " + String(reactionTime) + " ms\n";
-    } else { // No response
-      gameResult += playerNames[i] + ": No response\n";
-    }
-  }
-  ESP_BT.println(gameResult); // Send results via Bluetooth
-  Serial.print("Game results: ");
-  Serial.println(gameResult);
-  displayGameResults(gameResult); // Show results on OLED
-  // Save results to game history if SD card is available
-  if (checkSDCardSpace()) {
-    if (gameHistory.length() + gameResult.length() < MAX_HISTORY_SIZE) {
-      gameHistory += gameResult; // Append to history
-      Serial.println("Game result appended to history");
-    } else {
-      gameHistory = gameResult; // Truncate history if too large
-      displayMenuOption("History truncated!");
-      ESP_BT.println("WARNING: History truncated");
-      Serial.println("History truncated due to size limit");
-    }
-    saveHistoryToSD(); // Save to SD card
+// Static frame of a traffic light phase, or -1
+int trafficLightFrame(const char *color) {
+  for (int i = FRAME_RED; i <= FRAME_GREEN; i++) {
+    if (strcmp(color, TRAFFIC_LIGHT_COLORS[i]) == 0) return i;
   }
-  updateLeaderboard(); // Update leaderboard with new results
-  saveLeaderboardToSD(); // Save leaderboard to SD card
-  menuDisplayed = false; // Reset menu display flag to show menu again
-  Serial.println("Game ended, returning to menu");
-  delay(5000); // Delay to prevent immediate restart (helps with debugging)
+  return -1;
 }
 
-// Display traffic light phase on OLED
-void displayTrafficLight(String color) {
+// Render a traffic light phase into the framebuffer
+void renderTrafficLight(const char *color) {
   display.clearDisplay();
+#if DISPLAY_BACKEND == DISPLAY_TFT
+  // A large light in its own color under the text
+  display.setInk(trafficLightColor(color));
+  display.fillCircle(SCREEN_WIDTH / 2, TFT_LIGHT_Y, TFT_LIGHT_RADIUS, 1);
+  display.setCursor(0, 0);
+  display.setTextSize(3);
+#else
   display.setCursor(0, 0);
   display.setTextSize(2); // Larger text for traffic lights
-  display.println(color + " LIGHT");
-  display.display();
-  Serial.println("OLED updated with: " + color + " LIGHT");
+#endif
+  display.print(color);
+  display.println(" LIGHT");
 }
 
-// Display a menu option or message on OLED
-void displayMenuOption(String option) {
+#if DISPLAY_BACKEND == DISPLAY_TFT
+// RGB565 ink of a traffic light phase
+uint16_t trafficLightColor(const char *color) {
+  if (strcmp(color, "RED") == 0) return TFT_RED;
+  if (strcmp(color, "YELLOW") == 0) return TFT_YELLOW;
+  if (strcmp(color, "GREEN") == 0) return TFT_GREEN;
+  return TFT_WHITE;
+}
+#endif
+
+// Draw a menu option or message (runs in the display task)
+void drawMenuOption(const char *option) {
   display.clearDisplay();
   display.setCursor(0, 0);
-  display.setTextSize(1); // Smaller text for messages
+  display.setTextSize(TEXT_SCALE); // Smaller text for messages
   display.println(option);
-  display.display();
-  Serial.println("OLED updated with menu option: " + option);
+  pushDisplay();
+  LOG_DEBUG(LOG_DISPLAY, "OLED updated with menu option: %s", option);
 }
 
-// Display game results on OLED with text wrapping
-void displayGameResults(String result) {
+// Draw game results, one line per result line wrapped at the screen width
+// (runs in the display task)
+void drawGameResults(const char *result) {
   display.clearDisplay();
   display.setCursor(0, 0);
-  display.setTextSize(1);
+  display.setTextSize(TEXT_SCALE);
   int y = 0; // Y position for text
-  for (int i = 0; i < result.length(); i += 21) { // Wrap text every 21 characters
+  char line[TEXT_COLUMNS + 1];
+  while (*result != '\0' && y < SCREEN_HEIGHT) { // Stop if screen is full
+    int length = 0;
+    while (length < TEXT_COLUMNS && result[length] != '\0' && result[length] != '\n') length++;
+    memcpy(line, result, length);
+    line[length] = '\0';
+    result += length;
+    if (*result == '\n') result++;
     display.setCursor(0, y);
-    display.println(result.substring(i, i + 21));
-    y += 8; // Move down one line (8 pixels per line)
-    if (y >= SCREEN_HEIGHT) break; // Stop if screen is full
+    display.print(line);
+    y += TEXT_LINE_HEIGHT; // Move down one line
   }
-  display.display();
-  Serial.println("Displaying game results on OLED");
-  delay(RESULT_DISPLAY_TIME); // Show results for 5 seconds
+  pushDisplay();
+  LOG_DEBUG(LOG_DISPLAY, "Displaying game results on OLED");
 }
 
-// Display the main menu on OLED
-void displayMainMenu() {
+// Draw the main menu with the cursor on option (runs in the display task)
+void drawMainMenu(int option) {
+  showStaticFrame(FRAME_MENU + option);
+  pushDisplay();
+  LOG_DEBUG(LOG_DISPLAY, "Main menu updated on OLED");
+}
+
+// Render the main menu with the cursor on option into the framebuffer
+void renderMainMenu(int option) {
   display.clearDisplay();
   display.setCursor(0, 0);
-  display.setTextSize(1);
+  display.setTextSize(TEXT_SCALE);
   for (int i = 0; i < MENU_SIZE; i++) {
-    if (i == currentMenuOption) {
+    if (i == option) {
       display.print("> "); // Highlight selected option
     } else {
       display.print("  ");
     }
     display.println(MENU_OPTIONS[i]); // Display each menu option
   }
-  display.display();
-  Serial.println("Main menu updated on OLED");
+}
+
+// Render a screen title, leaving the cursor on the next line
+void renderTitle(const char *title) {
+  display.clearDisplay();
+  display.setCursor(0, 0);
+  display.setTextSize(TEXT_SCALE);
+  display.println(title);
+}
+
+// Render frame from scratch into the framebuffer
+void renderStaticFrame(int frame) {
+  if (frame <= FRAME_GREEN) {
+    renderTrafficLight(TRAFFIC_LIGHT_COLORS[frame]);
+  } else if (frame < FRAME_LEADERBOARD) {
+    renderMainMenu(frame - FRAME_MENU);
+  } else {
+    renderTitle(frame == FRAME_LEADERBOARD ? "Leaderboard:" : "Recent games:");
+  }
+}
+
+// Put a static frame in the framebuffer: a copy from the cache, or rendered
+// if there is none. Text drawn after it continues on the line below the
+// title (entries under the leaderboard and history titles).
+void showStaticFrame(int frame) {
+#if FRAME_CACHE
+  memcpy(display.getBuffer(), staticFrames[frame], FRAME_BYTES);
+#if DISPLAY_BACKEND == DISPLAY_TFT
+  display.setInk(staticFrameInk[frame]);
+#endif
+  display.setTextSize(TEXT_SCALE);
+  display.setCursor(0, TEXT_LINE_HEIGHT);
+#else
+  renderStaticFrame(frame);
+#endif
+}
+
+// Render every static frame into the cache (once, at boot)
+void buildStaticFrames() {
+#if FRAME_CACHE
+  for (int frame = 0; frame < STATIC_FRAMES; frame++) {
+    renderStaticFrame(frame);
+    memcpy(staticFrames[frame], display.getBuffer(), FRAME_BYTES);
+#if DISPLAY_BACKEND == DISPLAY_TFT
+    staticFrameInk[frame] = display.getInk();
+#endif
+  }
+  display.clearDisplay();
+  LOG_INFO(LOG_DISPLAY, "%d static frames cached (%lu bytes)", (int)STATIC_FRAMES, (unsigned long)sizeof(staticFrames));
+#endif
 }
 
 // Execute the selected menu option
 void executeMenuOption() {
-  Serial.print("Executing menu option: ");
-  Serial.println(MENU_OPTIONS[currentMenuOption]);
+  LOG_INFO(LOG_INPUT, "Executing menu option: %s", MENU_OPTIONS[currentMenuOption]);
   switch (currentMenuOption) {
     case 0: // Start Game
       displayMenuOption("Starting game...");
-      ESP_BT.println("OK: Game started");
-      Serial.println("Starting game from menu");
-      startGame();
+      btPrintln("OK: Game started");
+      LOG_INFO(LOG_INPUT, "Starting game from menu");
+      requestGameStart();
       break;
     case 1: // View History
-      displayMenuOption("Viewing history...");
-      ESP_BT.println("OK: Game history");
-      Serial.println("Viewing history from menu");
-      sendHistoryInChunks();
+      postDisplayCommand(DISPLAY_HISTORY, "", 0); // Recent games on the OLED
+      btPrintln("OK: Game history");
+      LOG_INFO(LOG_INPUT, "Viewing history from menu");
+      postBluetoothMessage(BT_SEND_HISTORY, 0);
       break;
     case 2: // View Leaderboard
       displayMenuOption("Leaderboard:");
-      ESP_BT.println("OK: Leaderboard");
-      Serial.println("Viewing leaderboard from menu");
+      btPrintln("OK: Leaderboard");
+      LOG_INFO(LOG_INPUT, "Viewing leaderboard from menu");
       showLeaderboard();
       break;
     case 3: // Delete History
       displayMenuOption("Deleting history...");
-      Serial.println("Deleting history from menu");
-      deleteHistory();
+      LOG_INFO(LOG_INPUT, "Deleting history from menu");
+      if (!postStorageCommand(STORAGE_DELETE_HISTORY, NULL)) btPrintln("ERROR: Storage busy, history not deleted");
       break;
   }
 }
 
-// Send game history in chunks over Bluetooth to avoid buffer overflow
+// CRC-16/CCITT-FALSE over a byte range (for on-SD record checksums)
+uint16_t crc16(const uint8_t *data, size_t length) {
+  return crc16Update(0xFFFF, data, length);
+}
+
+// Continue a CRC-16/CCITT-FALSE over more bytes (start with crc = 0xFFFF)
+uint16_t crc16Update(uint16_t crc, const uint8_t *data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+// Checksum of a history record (everything before the checksum field)
+uint16_t historyChecksum(const HistoryRecord &record) {
+  return crc16((const uint8_t *)&record, offsetof(HistoryRecord, checksum));
+}
+
+// Format one history record as text; starts a new game header when the
+// record's gameId differs from the previous record's
+void formatHistoryRecord(const HistoryRecord &record, uint32_t previousGameId, MessageText &line) {
+  line.clear();
+  if (record.gameId != previousGameId) {
+    line.appendf("Game %lu result: \n", (unsigned long)record.gameId);
+  }
+  MessageText reaction;
+  formatReaction(recordReaction(record.flags, record.reactionUs), record.flags, reaction);
+  line.appendf("Player %d: %s", record.player + 1, reaction.c_str());
+}
+
+// Send game history in chunks over Bluetooth to avoid buffer overflow: the
+// rotated-out generation first, then the current log (runs in the Bluetooth task)
 void sendHistoryInChunks() {
-  Serial.println("Sending game history in chunks via Bluetooth");
-  for (int i = 0; i < gameHistory.length(); i += BLUETOOTH_CHUNK_SIZE) {
-    ESP_BT.println(gameHistory.substring(i, i + BLUETOOTH_CHUNK_SIZE));
-    delay(50); // Small delay between chunks
-    Serial.print("Sent history chunk: ");
-    Serial.println(gameHistory.substring(i, i + BLUETOOTH_CHUNK_SIZE));
+  LOG_INFO(LOG_BLUETOOTH, "Sending game history in chunks via Bluetooth");
+  uint32_t previousGameId = 0;
+  xSemaphoreTake(historyMutex, portMAX_DELAY);
+  bool sentOld = sendHistoryFile(HISTORY_OLD_FILE, previousGameId);
+  bool sentCurrent = sendHistoryFile(HISTORY_FILE, previousGameId);
+  xSemaphoreGive(historyMutex);
+  if (!sentOld && !sentCurrent) {
+    ESP_BT.println("No history file found");
+  }
+}
+
+// Send one binary frame: header and payload are written as given, followed by
+// the CRC (runs in the Bluetooth task)
+void sendFrame(uint8_t type, const uint8_t *payload, uint16_t length) {
+  PROFILE_SCOPE(PROFILE_BT_WRITE);
+  uint8_t header[FRAME_HEADER_SIZE] = {FRAME_START, type, (uint8_t)(length & 0xFF), (uint8_t)(length >> 8)};
+  uint16_t crc = crc16Update(crc16Update(0xFFFF, header + 1, FRAME_HEADER_SIZE - 1), payload, length);
+  uint8_t trailer[FRAME_CRC_SIZE] = {(uint8_t)(crc & 0xFF), (uint8_t)(crc >> 8)};
+  btWriteFrame(header, FRAME_HEADER_SIZE);
+  if (length > 0) btWriteFrame(payload, length);
+  btWriteFrame(trailer, FRAME_CRC_SIZE);
+}
+
+// Write binary frame bytes: over SPP they share the stream with the text;
+// over BLE they go to the history characteristic (runs in the Bluetooth task)
+void btWriteFrame(const uint8_t *data, size_t length) {
+#if BT_TRANSPORT == BT_BLE
+  ESP_BT.writeFrame(data, length);
+#else
+  ESP_BT.write(data, length);
+#endif
+}
+
+// Send a FRAME_ERROR with the given FrameError code
+void sendFrameError(uint8_t code) {
+  sendFrame(FRAME_ERROR, &code, 1);
+}
+
+// Feed one received byte to the frame assembler; dispatches complete frames.
+// Never blocks: a slow client just leaves the frame partly assembled.
+void receiveFrameByte(uint8_t byte) {
+  frameRx[frameRxUsed++] = byte;
+  if (frameRxUsed < FRAME_HEADER_SIZE) return;
+  uint16_t length = frameRx[2] | (frameRx[3] << 8);
+  if (length > FRAME_MAX_RX_PAYLOAD) { // Not a frame we accept; drop it
+    frameRxUsed = 0;
+    sendFrameError(FRAME_ERROR_TYPE);
+    return;
+  }
+  if (frameRxUsed < FRAME_HEADER_SIZE + length + FRAME_CRC_SIZE) return;
+  frameRxUsed = 0; // Frame complete
+  const uint8_t *payload = frameRx + FRAME_HEADER_SIZE;
+  uint16_t crc = payload[length] | (payload[length + 1] << 8);
+  if (crc != crc16Update(0xFFFF, frameRx + 1, FRAME_HEADER_SIZE - 1 + length)) {
+    sendFrameError(FRAME_ERROR_CRC);
+    return;
+  }
+  handleFrame(frameRx[1], payload, length);
+}
+
+// True if either history generation is on the card (runs in the Bluetooth task)
+bool historyExists() {
+  xSemaphoreTake(historyMutex, portMAX_DELAY);
+  bool exists = SD.exists(HISTORY_OLD_FILE) || SD.exists(HISTORY_FILE);
+  xSemaphoreGive(historyMutex);
+  return exists;
+}
+
+// Execute one complete, CRC-checked client frame (runs in the Bluetooth task)
+void handleFrame(uint8_t type, const uint8_t *payload, uint16_t length) {
+  switch (type) {
+    case FRAME_HISTORY_REQUEST:
+      if (length != 2) break;
+      if (historyTransfer.active) {
+        sendFrameError(FRAME_ERROR_BUSY);
+        return;
+      }
+      if (!historyExists()) {
+        sendFrameError(FRAME_ERROR_NO_HISTORY);
+        return;
+      }
+      historyTransfer.active = true;
+      historyTransfer.generation = 0;
+      historyTransfer.offset = 0;
+      historyTransfer.recordsSent = 0;
+      historyTransfer.credits = 0;
+      // fall through: the request carries the initial credits
+    case FRAME_CREDIT:
+      if (length != 2) break;
+      if (historyTransfer.active) {
+        uint32_t credits = historyTransfer.credits + (payload[0] | (payload[1] << 8));
+        historyTransfer.credits = credits > FRAME_MAX_CREDITS ? FRAME_MAX_CREDITS : credits;
+      }
+      return;
+    case FRAME_CANCEL:
+      historyTransfer.active = false;
+      return;
+  }
+  sendFrameError(FRAME_ERROR_TYPE);
+}
+
+// Send the next FRAME_HISTORY_BATCH (up to bt_chunk bytes of records), or
+// FRAME_HISTORY_END when both generations are done. Records are read from the
+// card directly into the frame payload (runs in the Bluetooth task).
+void sendHistoryBatch() {
+  const char *paths[2] = {HISTORY_OLD_FILE, HISTORY_FILE};
+  uint8_t *payload = historyFrame + FRAME_HEADER_SIZE;
+  size_t bytes = 0;
+  xSemaphoreTake(historyMutex, portMAX_DELAY); // Only held for one sector read
+  while (historyTransfer.generation < 2 && bytes == 0) {
+    File file = SD.open(paths[historyTransfer.generation], FILE_READ);
+    if (file && file.seek(historyTransfer.offset)) {
+      bytes = file.read(payload + 2, config.bluetoothChunk);
+      bytes -= bytes % sizeof(HistoryRecord); // Whole records only
+    }
+    if (file) file.close();
+    if (bytes == 0) { // Generation finished (or missing): move on
+      historyTransfer.generation++;
+      historyTransfer.offset = 0;
+    }
+  }
+  xSemaphoreGive(historyMutex);
+
+  if (bytes == 0) { // Everything sent
+    uint32_t total = historyTransfer.recordsSent;
+    uint8_t end[4] = {(uint8_t)total, (uint8_t)(total >> 8), (uint8_t)(total >> 16), (uint8_t)(total >> 24)};
+    sendFrame(FRAME_HISTORY_END, end, sizeof(end));
+    historyTransfer.active = false;
+    LOG_INFO(LOG_BLUETOOTH, "Binary history transfer done: %lu records", (unsigned long)total);
+    return;
+  }
+  uint16_t count = bytes / sizeof(HistoryRecord);
+  uint16_t length = 2 + bytes;
+  payload[0] = count & 0xFF;
+  payload[1] = count >> 8;
+  historyFrame[0] = FRAME_START;
+  historyFrame[1] = FRAME_HISTORY_BATCH;
+  historyFrame[2] = length & 0xFF;
+  historyFrame[3] = length >> 8;
+  uint16_t crc = crc16Update(0xFFFF, historyFrame + 1, FRAME_HEADER_SIZE - 1 + length);
+  payload[length] = crc & 0xFF;
+  payload[length + 1] = crc >> 8;
+  btWriteFrame(historyFrame, FRAME_HEADER_SIZE + length + FRAME_CRC_SIZE); // One write per batch
+  historyTransfer.offset += bytes;
+  historyTransfer.recordsSent += count;
+  historyTransfer.credits--;
+}
+
+// Stream one history log file, bt_chunk bytes of records at a time (caller
+// holds historyMutex). Returns false if the file does not exist.
+bool sendHistoryFile(const char *path, uint32_t &previousGameId) {
+  if (!SD.exists(path)) return false;
+  File file = SD.open(path, FILE_READ);
+  if (!file) return false;
+  HistoryRecord chunk[BLUETOOTH_CHUNK_SIZE / sizeof(HistoryRecord)];
+  MessageText line;
+  size_t bytes;
+  while ((bytes = file.read((uint8_t *)chunk, config.bluetoothChunk)) >= sizeof(HistoryRecord)) {
+    for (size_t i = 0; i < bytes / sizeof(HistoryRecord); i++) {
+      if (chunk[i].checksum != historyChecksum(chunk[i])) {
+        continue; // Skip torn or corrupt records
+      }
+      formatHistoryRecord(chunk[i], previousGameId, line);
+      ESP_BT.println(line.c_str());
+      previousGameId = chunk[i].gameId;
+    }
+    LOG_DEBUG(LOG_BLUETOOTH, "Sent history chunk: %u records", (unsigned)(bytes / sizeof(HistoryRecord)));
   }
+  file.close();
+  return true;
 }
 
-// Load game history from SD card
-String loadHistoryFromSD() {
-  if (!SD.exists("/history.txt")) { // Check if history file exists
-    Serial.println("No history file found on SD card");
-    return "";
+// Open the game history log on SD (at boot). Only the file size and the last
+// record are read, so boot time does not grow with history length. A torn
+// record left by a power loss is padded to a whole record (it then fails its
+// checksum and is skipped) so later appends stay aligned.
+void loadHistoryFromSD() {
+  historyFile = SD.open(HISTORY_FILE, FILE_APPEND); // Created if missing
+  if (!historyFile) {
+    LOG_ERROR(LOG_STORAGE, "Failed to open history file on SD card");
+    return;
   }
-  File file = SD.open("/history.txt", FILE_READ); // Open file for reading
-  String history = "";
-  if (file) {
-    while (file.available()) {
-      history += (char)file.read(); // Read file contents
+  size_t size = historyFile.size();
+  size_t torn = size % sizeof(HistoryRecord);
+  if (torn != 0) {
+    uint8_t padding[sizeof(HistoryRecord)];
+    memset(padding, 0xFF, sizeof(padding));
+    historyFile.write(padding, sizeof(HistoryRecord) - torn);
+    historyFile.flush();
+    size += sizeof(HistoryRecord) - torn;
+    LOG_WARN(LOG_STORAGE, "Padded torn record at end of history file");
+  }
+  historyRecordCount = size / sizeof(HistoryRecord);
+
+  // Seed the RAM ring from the tail of the log, which also continues game
+  // numbering after the last valid record. Reads at most one ring's worth of
+  // records, independent of the log length.
+  File reader = SD.open(HISTORY_FILE, FILE_READ);
+  uint32_t window = HISTORY_RING_SIZE * MAX_PLAYERS;
+  uint32_t first = historyRecordCount > window ? historyRecordCount - window : 0;
+  if (reader && reader.seek(first * sizeof(HistoryRecord))) {
+    GameRecord game;
+    game.numberOfPlayers = 0;
+    bool skipFirstGame = first > 0; // May start mid-game
+    HistoryRecord record;
+    while (reader.read((uint8_t *)&record, sizeof(record)) == sizeof(record)) {
+      if (record.checksum != historyChecksum(record) || record.player >= MAX_PLAYERS) {
+        continue; // Skip torn or corrupt records
+      }
+      if (game.numberOfPlayers > 0 && record.gameId != game.gameId) {
+        if (!skipFirstGame) historyRingPush(game);
+        skipFirstGame = false;
+        game.numberOfPlayers = 0;
+      }
+      game.gameId = record.gameId;
+      game.timestampMs = record.timestampMs;
+      game.flags[record.player] = record.flags;
+      game.reactionUs[record.player] = record.reactionUs;
+      if (record.player + 1 > game.numberOfPlayers) game.numberOfPlayers = record.player + 1;
+      nextGameId = record.gameId + 1;
     }
-    file.close();
-    Serial.println("Game history loaded from SD card");
+    if (game.numberOfPlayers > 0 && !skipFirstGame) historyRingPush(game);
+  }
+  if (reader) reader.close();
+  LOG_INFO(LOG_STORAGE, "Game history opened on SD card: %lu records", (unsigned long)historyRecordCount);
+}
+
+// Start a new session file, replacing the last one (storage task)
+void openSessionFile() {
+  if (sessionFile) sessionFile.close();
+  xSemaphoreTake(historyMutex, portMAX_DELAY); // Downloads and replays read it under the mutex
+  historyGeneration++;
+  sessionFile = SD.open(SESSION_FILE, FILE_WRITE); // Truncates
+  xSemaphoreGive(historyMutex);
+  if (!sessionFile) {
+    btPrintln("ERROR: Failed to create the session file");
+    LOG_ERROR(LOG_STORAGE, "Failed to create %s", SESSION_FILE);
+  }
+}
+
+// Append a recorder buffer to the session file and give it back to the game
+// task. Flushed, so a power loss costs at most the round being played.
+void writeSessionBuffer(uint8_t buffer, uint16_t records) {
+  size_t bytes = records * sizeof(SessionRecord);
+  if (!sessionFile) {
+    // Not opened: the records are dropped
+  } else if (sdUsedBytes + bytes + SD_RESERVE_BYTES > sdTotalBytes) {
+    LOG_ERROR(LOG_STORAGE, "SD card full, session records dropped");
   } else {
-    Serial.println("Failed to open history file on SD card");
+    PROFILE_SCOPE(PROFILE_SD_APPEND);
+    if (sessionFile.write((const uint8_t *)sessionBuffer[buffer], bytes) == bytes) {
+      sessionFile.flush();
+      sdUsedBytes += bytes;
+    } else {
+      LOG_ERROR(LOG_STORAGE, "Failed to write session records to SD card");
+    }
   }
-  return history;
+  sessionBufferBusy[buffer].store(false);
+}
+
+// The session is complete (storage task)
+void closeSessionFile() {
+  if (sessionFile) sessionFile.close();
+}
+
+// Leave the card safe to lose power: write the dirty snapshots, close the
+// session, the history log and the registry, and refuse writes from here on
+// (storage task, before a reboot)
+void closeStorage() {
+  if (persistDirty != 0) flushPersistState();
+  closeSessionFile();
+  xSemaphoreTake(historyMutex, portMAX_DELAY);
+  if (historyFile) historyFile.close();
+  xSemaphoreGive(historyMutex);
+  if (playersFile) playersFile.close();
+  sdReady = false;
+  LOG_INFO(LOG_STORAGE, "SD card closed");
 }
 
-// Save game history to SD card
-void saveHistoryToSD() {
-  File file = SD.open("/history.txt", FILE_WRITE); // Open file for writing
-  if (file) {
-    file.print(gameHistory); // Write history to file
-    file.close();
-    Serial.println("Game history saved to SD card");
+// Append a game to the history log: one write of one record per player,
+// flushed so the round survives a power loss (runs in the storage task)
+void saveHistoryToSD(const GameRecord &game) {
+  HistoryRecord records[MAX_PLAYERS];
+  for (int i = 0; i < game.numberOfPlayers; i++) {
+    HistoryRecord &record = records[i];
+    record.gameId = game.gameId;
+    record.timestampMs = game.timestampMs;
+    record.reactionUs = game.reactionUs[i];
+    record.player = i;
+    record.flags = game.flags[i];
+    record.checksum = historyChecksum(record);
+  }
+  size_t bytes = game.numberOfPlayers * sizeof(HistoryRecord);
+  xSemaphoreTake(historyMutex, portMAX_DELAY);
+  if (!historyFile) {
+    historyFile = SD.open(HISTORY_FILE, FILE_APPEND); // Recreated after a delete
+  }
+  bool written;
+  {
+    PROFILE_SCOPE(PROFILE_SD_APPEND);
+    written = historyFile && historyFile.write((const uint8_t *)records, bytes) == bytes;
+    if (written) historyFile.flush();
+  }
+  if (written) {
+    historyRecordCount += game.numberOfPlayers;
+    sdUsedBytes += bytes;
+    LOG_DEBUG(LOG_STORAGE, "Game result appended to history on SD card");
   } else {
-    ESP_BT.println("ERROR: Failed to write history");
-    Serial.println("ERROR: Failed to write history to SD card");
+    btPrintln("ERROR: Failed to write history");
+    LOG_ERROR(LOG_STORAGE, "Failed to write history to SD card");
+  }
+  xSemaphoreGive(historyMutex);
+}
+
+// Add a game to the RAM ring, evicting the oldest game when full: O(1)
+void historyRingPush(const GameRecord &game) {
+  xSemaphoreTake(historyRingMutex, portMAX_DELAY);
+  historyRing[historyRingPushed % HISTORY_RING_SIZE] = game;
+  historyRingPushed++;
+  if (historyRingCount < HISTORY_RING_SIZE) historyRingCount++;
+  xSemaphoreGive(historyRingMutex);
+}
+
+// Copy the n-th most recent game (0 = latest) out of the RAM ring: O(1).
+// Returns false if fewer than n + 1 games are stored.
+bool historyRingGet(uint32_t n, GameRecord &game) {
+  bool found = false;
+  xSemaphoreTake(historyRingMutex, portMAX_DELAY);
+  if (n < historyRingCount) {
+    game = historyRing[(historyRingPushed - 1 - n) % HISTORY_RING_SIZE];
+    found = true;
   }
+  xSemaphoreGive(historyRingMutex);
+  return found;
 }
 
-// Delete game history from SD card
+// Empty the RAM ring
+void historyRingClear() {
+  xSemaphoreTake(historyRingMutex, portMAX_DELAY);
+  historyRingCount = 0;
+  xSemaphoreGive(historyRingMutex);
+}
+
+// Send the last count games from the RAM ring over Bluetooth, oldest first
+// (runs in the Bluetooth task). No SD access.
+void sendRecentHistory(uint16_t count) {
+  GameRecord game;
+  ResultText text;
+  MessageText reaction;
+  for (int n = count - 1; n >= 0; n--) {
+    if (!historyRingGet(n, game)) continue; // Fewer games stored than asked for
+    text.clear();
+    text.appendf("Game %lu result: \n", (unsigned long)game.gameId);
+    for (int i = 0; i < game.numberOfPlayers; i++) {
+      formatReaction(recordReaction(game.flags[i], game.reactionUs[i]), game.flags[i], reaction);
+      text.appendf("Player %d: %s\n", i + 1, reaction.c_str());
+    }
+    ESP_BT.print(text.c_str());
+  }
+}
+
+// Draw the most recent games, one line each with reaction times in ms
+// (JS = jumpstart, -- = no response, ? after a flagged result; runs in the
+// display task)
+void drawRecentHistory() {
+  showStaticFrame(FRAME_HISTORY);
+  GameRecord game;
+  MessageText line;
+  for (int n = 0; n < HISTORY_SCREEN_GAMES && historyRingGet(n, game); n++) {
+    line.clear();
+    line.appendf("#%lu", (unsigned long)game.gameId);
+    for (int i = 0; i < game.numberOfPlayers; i++) {
+      if (game.flags[i] & HISTORY_FLAG_JUMPSTART) {
+        line.append(" JS");
+      } else if (game.flags[i] & HISTORY_FLAG_VALID) {
+        line.appendf(" %lu", (unsigned long)(game.reactionUs[i] / 1000));
+      } else {
+        line.append(" --");
+      }
+      if (game.flags[i] & HISTORY_FLAGS_SUSPECT) line.append('?');
+    }
+    display.println(line.c_str());
+  }
+  pushDisplay();
+  LOG_DEBUG(LOG_DISPLAY, "Recent history displayed on OLED");
+}
+
+// Delete game history from SD card (runs in the storage task)
 void deleteHistory() {
-  if (SD.exists("/history.txt")) { // Check if history file exists
-    SD.remove("/history.txt");    // Delete the file
-    gameHistory = "";             // Clear in-memory history
-    ESP_BT.println("OK: History deleted");
-    Serial.println("Game history deleted from SD card");
+  xSemaphoreTake(historyMutex, portMAX_DELAY);
+  if (historyFile) {
+    historyFile.close(); // Reopened by the next append
+  }
+  historyGeneration++;
+  historyRingClear();
+  if (SD.exists(HISTORY_OLD_FILE)) {
+    removeFileAccounted(HISTORY_OLD_FILE);
+  }
+  historyFull = false;
+  if (SD.exists(HISTORY_FILE)) { // Check if history file exists
+    removeFileAccounted(HISTORY_FILE); // Delete the file
+    historyRecordCount = 0;
+    btPrintln("OK: History deleted");
+    LOG_INFO(LOG_STORAGE, "Game history deleted from SD card");
   } else {
-    ESP_BT.println("No history file found");
-    Serial.println("No history file found to delete on SD card");
+    btPrintln("No history file found");
+    LOG_INFO(LOG_STORAGE, "No history file found to delete on SD card");
+  }
+  xSemaphoreGive(historyMutex);
+}
+
+// Player id: 32-bit FNV-1a hash of the name
+uint32_t playerId(const char *name) {
+  uint32_t hash = 2166136261u;
+  while (*name != '\0') {
+    hash ^= (uint8_t)*name++;
+    hash *= 16777619u;
   }
+  return hash;
+}
+
+// Order for qsort() of the registry index
+int comparePlayerIndex(const void *a, const void *b) {
+  uint32_t idA = ((const PlayerIndexEntry *)a)->id;
+  uint32_t idB = ((const PlayerIndexEntry *)b)->id;
+  return idA < idB ? -1 : (idA > idB ? 1 : 0);
 }
 
-// Load leaderboard from SD card
-void loadLeaderboardFromSD() {
-  if (!SD.exists("/leaderboard.txt")) { // Check if leaderboard file exists
-    Serial.println("No leaderboard file found on SD card");
+// Open the player registry and load the index and leaderboard snapshots
+// (runs at boot). If a snapshot is missing, corrupt, or may be stale after a
+// power loss (PERSIST_MARKER_FILE), both are rebuilt with one pass over
+// PLAYERS_FILE, the source of truth.
+void loadRegistryFromSD() {
+  bool stale = SD.exists(PERSIST_MARKER_FILE);
+  recoverSnapshot(PLAYERS_INDEX_FILE);
+  recoverSnapshot(LEADERBOARD_FILE);
+  if (!SD.exists(PLAYERS_FILE)) {
+    File created = SD.open(PLAYERS_FILE, FILE_WRITE);
+    if (created) created.close();
+  }
+  playersFile = SD.open(PLAYERS_FILE, "r+");
+  if (!playersFile) {
+    LOG_ERROR(LOG_STORAGE, "Failed to open player registry on SD card");
+    return;
+  }
+  int records = playersFile.size() / sizeof(PlayerRecord);
+  if (records > REGISTRY_MAX_PLAYERS) records = REGISTRY_MAX_PLAYERS;
+  int32_t indexBytes = stale ? -1 : readSnapshot(PLAYERS_INDEX_FILE, playerIndex, sizeof(playerIndex), playersIndexFileBytes);
+  int32_t leaderboardBytes = stale ? -1 : readSnapshot(LEADERBOARD_FILE, leaderboard, sizeof(leaderboard), leaderboardFileBytes);
+  if (indexBytes == (int32_t)(records * sizeof(PlayerIndexEntry)) && leaderboardBytes >= 0 &&
+      leaderboardBytes % sizeof(PlayerRecord) == 0) {
+    registeredPlayers = records;
+    xSemaphoreTake(playerMutex, portMAX_DELAY);
+    leaderboardCount = leaderboardBytes / sizeof(PlayerRecord);
+    xSemaphoreGive(playerMutex);
+    LOG_INFO(LOG_STORAGE, "Player registry opened: %d players", registeredPlayers);
     return;
   }
-  File file = SD.open("/leaderboard.txt", FILE_READ); // Open file for reading
-  if (file) {
-    int index = 0;
-    while (file.available() && index < MAX_PLAYERS) {
-      leaderboard[index].name = file.readStringUntil(','); // Read name until comma
-      leaderboard[index].bestReactionTime = file.readStringUntil('\n').toInt(); // Read reaction time
-      index++;
+
+  LOG_WARN(LOG_STORAGE, "Rebuilding player index and leaderboard from %d records", records);
+  registeredPlayers = 0;
+  xSemaphoreTake(playerMutex, portMAX_DELAY);
+  leaderboardCount = 0;
+  xSemaphoreGive(playerMutex);
+  PlayerRecord record;
+  playersFile.seek(0);
+  for (int slot = 0; slot < records && playersFile.read((uint8_t *)&record, sizeof(record)) == sizeof(record); slot++) {
+    record.name[PLAYER_NAME_SIZE - 1] = '\0';
+    if (record.id != playerId(record.name)) continue; // Corrupt record: left unindexed
+    playerIndex[registeredPlayers].id = record.id;
+    playerIndex[registeredPlayers].slot = slot;
+    playerIndex[registeredPlayers].reserved = 0;
+    registeredPlayers++;
+    if (record.bestReactionTime != 0) {
+      xSemaphoreTake(playerMutex, portMAX_DELAY);
+      placeOnLeaderboard(record, 0);
+      xSemaphoreGive(playerMutex);
     }
-    file.close();
-    Serial.println("Leaderboard loaded from SD card");
-  } else {
-    Serial.println("Failed to open leaderboard file on SD card");
   }
+  qsort(playerIndex, registeredPlayers, sizeof(PlayerIndexEntry), comparePlayerIndex);
+  markPersistDirty(PERSIST_INDEX | PERSIST_LEADERBOARD);
+  flushPersistState(); // Boot is not on anyone's critical path
+  LOG_INFO(LOG_STORAGE, "Player registry opened: %d players", registeredPlayers);
+}
+
+// Note that snapshots (PersistFlags) changed in RAM; the storage task writes
+// them PERSIST_DELAY after the first change (storage task)
+void markPersistDirty(uint8_t flags) {
+  if (!sdReady) return;
+  if (persistDirty == 0) {
+    File marker = SD.open(PERSIST_MARKER_FILE, FILE_WRITE); // Snapshots may be stale from here on
+    if (marker) marker.close();
+    persistDueUs = esp_timer_get_time() + (int64_t)PERSIST_DELAY * 1000;
+  }
+  persistDirty |= flags;
 }
 
-// Save leaderboard to SD card
-void saveLeaderboardToSD() {
-  File file = SD.open("/leaderboard.txt", FILE_WRITE); // Open file for writing
-  if (file) {
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-      file.print(leaderboard[i].name); // Write name
-      file.print(",");                // Separator
-      file.println(leaderboard[i].bestReactionTime); // Write reaction time
+// Write the dirty snapshots now (storage task)
+void flushPersistState() {
+  if (persistDirty & PERSIST_INDEX) {
+    if (writeSnapshot(PLAYERS_INDEX_FILE, playerIndex, registeredPlayers * sizeof(PlayerIndexEntry), playersIndexFileBytes)) {
+      persistDirty &= ~PERSIST_INDEX;
     }
-    file.close();
-    Serial.println("Leaderboard saved to SD card");
+  }
+  if (persistDirty & PERSIST_LEADERBOARD) {
+    PlayerRecord snapshot[LEADERBOARD_SIZE]; // Copy so the lock is not held during SD I/O
+    xSemaphoreTake(playerMutex, portMAX_DELAY);
+    int count = leaderboardCount;
+    memcpy(snapshot, leaderboard, count * sizeof(PlayerRecord));
+    xSemaphoreGive(playerMutex);
+    if (writeSnapshot(LEADERBOARD_FILE, snapshot, count * sizeof(PlayerRecord), leaderboardFileBytes)) {
+      persistDirty &= ~PERSIST_LEADERBOARD;
+    }
+  }
+  if (persistDirty == 0) {
+    SD.remove(PERSIST_MARKER_FILE);
+    LOG_DEBUG(LOG_STORAGE, "Snapshots written to SD card");
+  } else { // Try again after another delay
+    persistDueUs = esp_timer_get_time() + (int64_t)PERSIST_DELAY * 1000;
+    LOG_ERROR(LOG_STORAGE, "Failed to write snapshots to SD card");
+  }
+}
+
+// Replace a snapshot file crash-safely: the new contents go to "<path>.tmp",
+// which only replaces path once it is complete. fileBytes tracks the file's
+// size for the SD usage estimate. Returns false if the card refused.
+bool writeSnapshot(const char *path, const void *data, uint32_t bytes, uint32_t &fileBytes) {
+  FixedString<32> temp(path);
+  temp.append(".tmp");
+  File file = SD.open(temp.c_str(), FILE_WRITE);
+  if (!file) return false;
+  SnapshotHeader header = {SNAPSHOT_MAGIC, bytes, crc16((const uint8_t *)data, bytes), 0};
+  bool written = file.write((const uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+                 file.write((const uint8_t *)data, bytes) == bytes;
+  file.close();
+  // FAT cannot rename over a file, so there is a moment with only the temp
+  // file; recoverSnapshot() finishes the job if power fails there
+  if (!written || (SD.exists(path) && !SD.remove(path)) || !SD.rename(temp.c_str(), path)) {
+    SD.remove(temp.c_str());
+    return false;
+  }
+  sdUsedBytes = sdUsedBytes + sizeof(header) + bytes - fileBytes; // File was rewritten
+  fileBytes = sizeof(header) + bytes;
+  return true;
+}
+
+// Read a snapshot's payload into data (capacity bytes at most). Returns the
+// payload size, or -1 if the file is missing, truncated or fails its CRC.
+int32_t readSnapshot(const char *path, void *data, uint32_t capacity, uint32_t &fileBytes) {
+  File file = SD.open(path, FILE_READ);
+  if (!file) return -1;
+  fileBytes = file.size();
+  SnapshotHeader header;
+  bool valid = file.read((uint8_t *)&header, sizeof(header)) == sizeof(header) && header.magic == SNAPSHOT_MAGIC &&
+               header.bytes <= capacity && file.read((uint8_t *)data, header.bytes) == header.bytes &&
+               header.crc == crc16((const uint8_t *)data, header.bytes);
+  file.close();
+  if (!valid) {
+    LOG_WARN(LOG_STORAGE, "Snapshot %s is corrupt", path);
+    return -1;
+  }
+  return header.bytes;
+}
+
+// Finish or roll back a snapshot replacement interrupted by a power loss
+// (runs at boot). A temp file next to its snapshot may be incomplete and is
+// dropped; a temp file alone was complete, since the old snapshot is only
+// removed after the temp file is closed.
+void recoverSnapshot(const char *path) {
+  FixedString<32> temp(path);
+  temp.append(".tmp");
+  if (!SD.exists(temp.c_str())) return;
+  if (SD.exists(path)) {
+    SD.remove(temp.c_str());
   } else {
-    ESP_BT.println("ERROR: Failed to write leaderboard");
-    Serial.println("ERROR: Failed to write leaderboard to SD card");
+    SD.rename(temp.c_str(), path);
+  }
+  LOG_WARN(LOG_STORAGE, "Recovered interrupted write of %s", path);
+}
+
+// Read or write one registry record (storage task)
+bool readPlayerRecord(int slot, PlayerRecord &record) {
+  if (!playersFile.seek(slot * sizeof(PlayerRecord))) return false;
+  if (playersFile.read((uint8_t *)&record, sizeof(record)) != sizeof(record)) return false;
+  record.name[PLAYER_NAME_SIZE - 1] = '\0';
+  return true;
+}
+bool writePlayerRecord(int slot, const PlayerRecord &record) {
+  if (!playersFile.seek(slot * sizeof(PlayerRecord))) return false;
+  bool written = playersFile.write((const uint8_t *)&record, sizeof(record)) == sizeof(record);
+  playersFile.flush();
+  return written;
+}
+
+// First index position whose id is not below id
+int playerIndexLowerBound(uint32_t id) {
+  int low = 0;
+  int high = registeredPlayers;
+  while (low < high) {
+    int middle = (low + high) / 2;
+    if (playerIndex[middle].id < id) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+// Look a player up by name, registering them if new. Fills record and
+// returns its slot, or -1 if the registry is unavailable or full.
+int findOrRegisterPlayer(const char *name, PlayerRecord &record) {
+  if (!playersFile) return -1;
+  uint32_t id = playerId(name);
+  int position = playerIndexLowerBound(id);
+  for (int i = position; i < registeredPlayers && playerIndex[i].id == id; i++) {
+    if (readPlayerRecord(playerIndex[i].slot, record) && strcmp(record.name, name) == 0) {
+      return playerIndex[i].slot;
+    }
+  }
+  if (registeredPlayers >= REGISTRY_MAX_PLAYERS) {
+    LOG_WARN(LOG_STORAGE, "Player registry full, %s not registered", name);
+    return -1;
+  }
+  int slot = playersFile.size() / sizeof(PlayerRecord); // Append
+  memset(&record, 0, sizeof(record));
+  record.id = id;
+  strncpy(record.name, name, PLAYER_NAME_SIZE - 1);
+  if (!writePlayerRecord(slot, record)) {
+    LOG_ERROR(LOG_STORAGE, "Failed to register player %s", name);
+    return -1;
   }
+  sdUsedBytes += sizeof(PlayerRecord);
+  memmove(&playerIndex[position + 1], &playerIndex[position], (registeredPlayers - position) * sizeof(PlayerIndexEntry));
+  playerIndex[position].id = id;
+  playerIndex[position].slot = slot;
+  playerIndex[position].reserved = 0;
+  registeredPlayers++;
+  markPersistDirty(PERSIST_INDEX);
+  LOG_INFO(LOG_STORAGE, "Registered player %s (id %08lx)", name, (unsigned long)id);
+  return slot;
+}
+
+// Import the CSV leaderboard of earlier versions into an empty registry
+// (times in microseconds; the millisecond file "/leaderboard.txt" is ignored
+// so stale values never outrank new ones). The CSV file is left in place.
+void importLegacyLeaderboard() {
+  if (registeredPlayers > 0 || !playersFile) return;
+  File legacy = SD.open(LEGACY_LEADERBOARD_FILE, FILE_READ);
+  if (!legacy) return;
+  while (legacy.available()) {
+    char name[PLAYER_NAME_SIZE];
+    size_t length = legacy.readBytesUntil(',', name, PLAYER_NAME_SIZE - 1); // Read name until comma
+    name[length] = '\0';
+    char number[12];
+    length = legacy.readBytesUntil('\n', number, sizeof(number) - 1); // Read reaction time
+    number[length] = '\0';
+    unsigned long best = strtoul(number, NULL, 10);
+    if (name[0] != '\0' && best > 0) recordPlayerResult(name, best);
+  }
+  legacy.close();
+  flushPersistState();
+  LOG_INFO(LOG_STORAGE, "Leaderboard imported from %s", LEGACY_LEADERBOARD_FILE);
 }
 
 // Show leaderboard on OLED and send via Bluetooth
 void showLeaderboard() {
-  display.clearDisplay();
-  display.setCursor(0, 0);
-  display.setTextSize(1);
-  display.println("Leaderboard:");
-  for (int i = 0; i < MAX_PLAYERS; i++) {
-    if (leaderboard[i].bestReactionTime > 0) { // Only show non-zero entries
-      display.println(leaderboard[i].name + ": " + String(leaderboard[i].bestReactionTime) + " ms");
-      ESP_BT.println(leaderboard[i].name + ": " + String(leaderboard[i].bestReactionTime) + " ms");
-      Serial.print("Leaderboard entry: ");
-      Serial.print(leaderboard[i].name);
-      Serial.print(": ");
-      Serial.print(leaderboard[i].bestReactionTime);
-      Serial.println(" ms");
+  postDisplayCommand(DISPLAY_LEADERBOARD, "", 0);
+  postBluetoothMessage(BT_SEND_LEADERBOARD, 0);
+}
+
+// Draw the leaderboard (runs in the display task)
+void drawLeaderboard() {
+  showStaticFrame(FRAME_LEADERBOARD);
+  xSemaphoreTake(playerMutex, portMAX_DELAY);
+  for (int i = 0; i < leaderboardCount && i < LEADERBOARD_SCREEN_ENTRIES; i++) {
+    display.printf("%d %s: %lu us\n", i + 1, leaderboard[i].name, (unsigned long)leaderboard[i].bestReactionTime);
+  }
+  xSemaphoreGive(playerMutex);
+  pushDisplay();
+  LOG_DEBUG(LOG_DISPLAY, "Leaderboard displayed on OLED");
+}
+
+// Send the leaderboard entries over Bluetooth (runs in the Bluetooth task)
+void sendLeaderboard() {
+  MessageText lines[LEADERBOARD_SIZE]; // Copy so the lock is not held during Bluetooth I/O
+  xSemaphoreTake(playerMutex, portMAX_DELAY);
+  int count = leaderboardCount;
+  for (int i = 0; i < count; i++) {
+    lines[i].appendf("%d. %s: %lu us", i + 1, leaderboard[i].name, (unsigned long)leaderboard[i].bestReactionTime);
+  }
+  xSemaphoreGive(playerMutex);
+  for (int i = 0; i < count; i++) {
+    ESP_BT.println(lines[i].c_str());
+    LOG_DEBUG(LOG_BLUETOOTH, "Leaderboard entry: %s", lines[i].c_str());
+  }
+}
+
+// Update registry and leaderboard with a round's results. Returns true if the
+// leaderboard changed (runs in the storage task).
+bool updateLeaderboard(const RoundResult &round) {
+  LOG_DEBUG(LOG_STORAGE, "Updating leaderboard");
+  char names[MAX_PLAYERS][PLAYER_NAME_SIZE]; // Copy so the lock is not held during SD I/O
+  xSemaphoreTake(playerMutex, portMAX_DELAY);
+  memcpy(names, playerNames, round.numberOfPlayers * PLAYER_NAME_SIZE);
+  xSemaphoreGive(playerMutex);
+  bool changed = false;
+  for (int i = 0; i < round.numberOfPlayers; i++) {
+    if (round.flags[i] & HISTORY_FLAGS_SUSPECT) continue; // Flagged by validateRound(): never ranked
+    if (round.reactionTimes[i] != REACTION_JUMPSTART && round.reactionTimes[i] != REACTION_NONE) { // Valid reaction
+      changed |= recordPlayerResult(names[i], round.reactionTimes[i]); // Already relative to greenStartTime (us)
     }
   }
-  display.display();
-  Serial.println("Leaderboard displayed on OLED");
-}
-
-// Update leaderboard with current game results
-void updateLeaderboard() {
-  Serial.println("Updating leaderboard");
-  for (int i = 0; i < numberOfPlayers; i++) {
-    if (reactionTimes[i] > greenStartTime && reactionTimes[i] != 0xFFFFFFFF) { // Valid reaction
-      unsigned long reactionTime = reactionTimes[i] - greenStartTime;
-      if (leaderboard[i].bestReactionTime == 0 || reactionTime < leaderboard[i].bestReactionTime) {
-        leaderboard[i].name = playerNames[i]; // Update name
-        leaderboard[i].bestReactionTime = reactionTime; // Update best time
-        Serial.print("Leaderboard updated for ");
-        Serial.print(playerNames[i]);
-        Serial.print(": ");
-        Serial.print(reactionTime);
-        Serial.println(" ms");
+  return changed;
+}
+
+// True for a seat's default "Player N" name, also with an arena board's
+// "B<n> " prefix: whoever sits there, it is not a person to register or rank
+bool isSeatName(const char *name) {
+  if (name[0] == 'B' && isdigit((unsigned char)name[1])) {
+    name++;
+    while (isdigit((unsigned char)*name)) name++;
+    if (*name++ != ' ') return false;
+  }
+  if (strncmp(name, "Player ", 7) != 0 || !isdigit((unsigned char)name[7])) return false;
+  char *end;
+  long seat = strtol(name + 7, &end, 10);
+  return *end == '\0' && seat >= 1 && seat <= MAX_PLAYERS;
+}
+
+// Record a valid reaction for a player by name: update their registry record
+// if it is a personal best, and the leaderboard if it places. Without an SD
+// card there is no registry and only the leaderboard remembers bests. A seat
+// nobody named is skipped. Returns true if the leaderboard changed (storage task).
+bool recordPlayerResult(const char *name, unsigned long reactionTime) {
+  if (isSeatName(name)) return false;
+  PlayerRecord record;
+  int slot = findOrRegisterPlayer(name, record);
+  if (slot < 0) { // No registry: the player's previous best is only known if they placed
+    record.id = playerId(name);
+    record.bestReactionTime = 0;
+    strncpy(record.name, name, PLAYER_NAME_SIZE - 1);
+    record.name[PLAYER_NAME_SIZE - 1] = '\0';
+    xSemaphoreTake(playerMutex, portMAX_DELAY);
+    for (int i = 0; i < leaderboardCount; i++) {
+      if (leaderboard[i].id == record.id && strcmp(leaderboard[i].name, name) == 0) {
+        record.bestReactionTime = leaderboard[i].bestReactionTime;
       }
     }
+    xSemaphoreGive(playerMutex);
+  }
+  uint32_t previousBest = record.bestReactionTime;
+  if (previousBest != 0 && reactionTime >= previousBest) return false; // Not a personal best
+  record.bestReactionTime = reactionTime;
+  if (slot >= 0) writePlayerRecord(slot, record);
+  xSemaphoreTake(playerMutex, portMAX_DELAY);
+  bool changed = placeOnLeaderboard(record, previousBest);
+  xSemaphoreGive(playerMutex);
+  if (changed) {
+    markPersistDirty(PERSIST_LEADERBOARD);
+    postLiveEvent(LIVE_EVENT_LEADERBOARD, 0, NULL);
+    LOG_INFO(LOG_STORAGE, "Leaderboard updated for %s: %lu us", name, reactionTime);
   }
+  return changed;
 }
 
-// Check SD card space and delete history if full (simplified check)
-bool checkSDCardSpace() {
-  File root = SD.open("/"); // Open root directory
-  unsigned long freeSpace = 0;
-  while (true) {
-    File entry = root.openNextFile();
-    if (!entry) break;
-    freeSpace += entry.size(); // Sum up used space (approximation)
-    entry.close();
-  }
-  root.close();
-  // If used space exceeds 1MB, delete history (simplified check)
-  if (freeSpace > 1024 * 1024) {
-    Serial.println("SD card space low; deleting history...");
-    deleteHistory();
-    gameHistory = "";
-    displayMenuOption("SD full, history cleared!");
-    ESP_BT.println("WARNING: SD card full, history cleared");
-    return true;
+// First leaderboard position that does not rank ahead of (time, id)
+int leaderboardLowerBound(uint32_t time, uint32_t id) {
+  int low = 0;
+  int high = leaderboardCount;
+  while (low < high) {
+    int middle = (low + high) / 2;
+    const PlayerRecord &entry = leaderboard[middle];
+    if (entry.bestReactionTime < time || (entry.bestReactionTime == time && entry.id < id)) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+// Move a player with a new personal best into place: their old entry (if
+// they placed with previousBest) is found and the new one positioned by
+// binary search, so an update costs O(log K) comparisons plus a short
+// memmove. Returns true if the leaderboard changed (caller holds playerMutex).
+bool placeOnLeaderboard(const PlayerRecord &record, uint32_t previousBest) {
+  int position = leaderboardLowerBound(record.bestReactionTime, record.id);
+  if (position >= LEADERBOARD_SIZE) return false; // Does not place
+  if (previousBest != 0) {
+    int old = leaderboardLowerBound(previousBest, record.id);
+    if (old < leaderboardCount && leaderboard[old].id == record.id && strcmp(leaderboard[old].name, record.name) == 0) {
+      memmove(&leaderboard[old], &leaderboard[old + 1], (leaderboardCount - old - 1) * sizeof(PlayerRecord));
+      leaderboardCount--; // The new best is faster, so position (< old) is unaffected
+    }
   }
+  int moved = (leaderboardCount < LEADERBOARD_SIZE ? leaderboardCount : LEADERBOARD_SIZE - 1) - position;
+  memmove(&leaderboard[position + 1], &leaderboard[position], moved * sizeof(PlayerRecord));
+  leaderboard[position] = record;
+  if (leaderboardCount < LEADERBOARD_SIZE) leaderboardCount++;
   return true;
 }
+
+// Remove a file and take its size off the cached SD usage (storage task)
+void removeFileAccounted(const char *path) {
+  File file = SD.open(path, FILE_READ);
+  uint32_t bytes = file ? file.size() : 0;
+  if (file) file.close();
+  if (SD.remove(path)) {
+    sdUsedBytes = sdUsedBytes > bytes ? sdUsedBytes - bytes : 0;
+  }
+}
+
+// Check whether a round of history fits, applying HISTORY_RETENTION when the
+// log reaches HISTORY_MAX_BYTES or the card would drop below SD_RESERVE_BYTES.
+// O(1): uses the cached usage counters instead of walking the card. Returns
+// true if the round may be appended (runs in the storage task).
+bool checkSDCardSpace() {
+  if (!sdReady) return false;
+  if (historyFull) return false; // RETAIN_STOP already triggered
+  uint32_t needed = MAX_PLAYERS * sizeof(HistoryRecord);
+  uint64_t historyBytes = (uint64_t)historyRecordCount * sizeof(HistoryRecord);
+  bool logFull = historyBytes + needed > HISTORY_MAX_BYTES;
+  bool cardFull = sdUsedBytes + needed + SD_RESERVE_BYTES > sdTotalBytes;
+  if (!logFull && !cardFull) return true;
+
+  switch (HISTORY_RETENTION) {
+    case RETAIN_ROTATE:
+      // Drop the older generation, keep the current log as the old one
+      LOG_WARN(LOG_STORAGE, "History log full; rotating");
+      xSemaphoreTake(historyMutex, portMAX_DELAY);
+      if (historyFile) historyFile.close();
+      historyGeneration++;
+      if (SD.exists(HISTORY_OLD_FILE)) removeFileAccounted(HISTORY_OLD_FILE);
+      SD.rename(HISTORY_FILE, HISTORY_OLD_FILE);
+      historyRecordCount = 0;
+      historyFile = SD.open(HISTORY_FILE, FILE_APPEND);
+      xSemaphoreGive(historyMutex);
+      if (sdUsedBytes + needed + SD_RESERVE_BYTES > sdTotalBytes) {
+        btPrintln("WARNING: SD card full, history not saved");
+        return false; // Even after rotating, the card has no room
+      }
+      btPrintln("OK: History log rotated");
+      return true;
+    case RETAIN_STOP:
+      LOG_WARN(LOG_STORAGE, "History log full; appends stopped");
+      historyFull = true;
+      displayMenuOption("History full!");
+      btPrintln("WARNING: History full, new games not saved");
+      return false;
+    case RETAIN_DELETE:
+    default:
+      LOG_WARN(LOG_STORAGE, "SD card space low; deleting history...");
+      deleteHistory();
+      displayMenuOption("SD full, history cleared!");
+      btPrintln("WARNING: SD card full, history cleared");
+      return !(sdUsedBytes + needed + SD_RESERVE_BYTES > sdTotalBytes);
+  }
+}
@@ -0,0 +1,964 @@
+// Host microbenchmarks for Reflex Rush. Builds code.c against the mocks in
+// hal.h and times the game, storage and Bluetooth paths without a board, so
+// changes such as a new history format can be compared in seconds.
+//
+//   make -C host run               # build and run every benchmark
+//   make -C host run FILTER=history # only benchmarks whose name contains "history"
+//
+// Numbers are host wall-clock time per operation: useful for comparing two
+// versions of the code on one machine, not as ESP32 timings.
+#include "sketch.cpp"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+
+namespace {
+
+const char *filter = NULL; // Run only benchmarks whose name contains this
+int failures = 0;
+volatile uint32_t sink;    // Keeps results of pure functions from being optimized away
+
+// Time body() over iterations runs (after a short warm-up) and print ns/op
+void benchmark(const char *name, int iterations, const std::function<void()> &body) {
+  if (filter != NULL && strstr(name, filter) == NULL) return;
+  for (int i = 0; i < iterations / 10 + 1; i++) body();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) body();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  double ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+  printf("%-32s %9d iterations %12.1f ns/op\n", name, iterations, ns);
+}
+
+// Sanity check on the mocked run, so a benchmark never times a broken path
+void check(bool condition, const char *what) {
+  if (!condition) {
+    printf("CHECK FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+// The Bluetooth client's side of the link, for either transport: bytes it
+// sends, connecting and letting go, and the replies it receives
+#if BT_TRANSPORT == BT_BLE
+void clientSend(const uint8_t *bytes, size_t size) { hostBleCharacteristic(BLE_COMMAND_UUID)->clientWrite(bytes, size); }
+void clientConnect(bool connected) {
+  ble_gap_conn_desc desc = {1};
+  if (connected) {
+    hostBleServer->callbacks->onConnect(hostBleServer, &desc);
+    hostBleServer->callbacks->onMTUChange(BLE_MTU, &desc);
+  } else {
+    hostBleServer->callbacks->onDisconnect(hostBleServer);
+  }
+}
+NimBLECharacteristic *clientLink(bool frames) { return hostBleCharacteristic(frames ? BLE_HISTORY_UUID : BLE_RESPONSE_UUID); }
+std::vector<uint8_t> &clientReplies(bool frames = false) { return clientLink(frames)->sent; }
+bool &clientKeepsReplies(bool frames = false) { return clientLink(frames)->keepOutput; }
+#else
+void clientSend(const uint8_t *bytes, size_t size) { ESP_BT.receive(bytes, size); }
+void clientConnect(bool connected) { ESP_BT.callback(connected ? ESP_SPP_SRV_OPEN_EVT : ESP_SPP_CLOSE_EVT, NULL); }
+std::vector<uint8_t> &clientReplies(bool frames = false) { return ESP_BT.tx; } // Text and frames share the stream
+bool &clientKeepsReplies(bool frames = false) { return ESP_BT.keepOutput; }
+#endif
+
+// The text replies (or binary frames) the client received while exchange() ran
+template <typename F>
+std::string clientRepliesTo(F exchange, bool frames = false) {
+  clientReplies(frames).clear();
+  clientKeepsReplies(frames) = true;
+  exchange();
+  clientKeepsReplies(frames) = false;
+  return std::string(clientReplies(frames).begin(), clientReplies(frames).end());
+}
+
+// Discard whatever the sketch queued for the display, Bluetooth and web tasks
+void drainOutput() {
+  DisplayCommand screen;
+  while (xQueueReceive(displayQueue, &screen, 0) == pdTRUE) {
+  }
+  BluetoothMessage message;
+  while (xQueueReceive(bluetoothQueue, &message, 0) == pdTRUE) {
+  }
+  clientReplies().clear();
+#if WEB_ENABLED
+  LiveEvent event;
+  while (xQueueReceive(webQueue, &event, 0) == pdTRUE) {
+  }
+  webSocket.sent.clear();
+#endif
+}
+
+// Run the I/O tasks until their queues are empty
+void runIoTasks() {
+#if ARENA_MODE != ARENA_OFF
+  while (uxQueueMessagesWaiting(arenaQueue) > 0) serviceArena();
+#endif
+  while (serviceDisplay(0) || serviceStorage(0)) {
+  }
+  while (uxQueueMessagesWaiting(bluetoothQueue) > 0 || ESP_BT.available()) serviceBluetooth();
+#if WEB_ENABLED
+  while (uxQueueMessagesWaiting(webQueue) > 0) serviceWeb();
+#endif
+}
+
+// Play one full round (or a whole armed tournament): every player touches
+// reactionUs after Green Light is shown, and with jumpstart player 1 also
+// touches once during the first Red Light; bounces extra edges follow player
+// 1's touch, 2 ms apart
+void playRound(unsigned long reactionUs, bool jumpstart = false, int bounces = 0) {
+  requestGameStart();
+  if (jumpstart) {
+    do {
+      if (!serviceGame(0)) hostAdvance(1000); // An arena coordinator arms the round first
+    } while (gameState != GAME_RED);
+    hostInterrupt(TOUCH_PINS[0]);
+    hostAdvance(TOUCH_DEBOUNCE_US);
+  }
+  bool touched = false;
+  do {
+    if (!serviceGame(0)) hostAdvance(1000); // Idle until a timer or touch wakes the game
+    if (gameState == GAME_GREEN && greenStartTime != 0 && !touched) {
+      hostAdvance(reactionUs);
+      for (int i = 0; i < numberOfPlayers; i++) hostInterrupt(TOUCH_PINS[i]);
+      for (int k = 0; k < bounces; k++) {
+        hostAdvance(2000);
+        hostInterrupt(TOUCH_PINS[0]);
+      }
+      touched = true;
+    }
+    if (gameState == GAME_RESULTS) touched = false; // A tournament's next round
+    runIoTasks();
+  } while (gameState != GAME_IDLE);
+  hostAdvance(TOUCH_DEBOUNCE_US); // Next round's touches are not debounced away
+}
+
+// A history log of records games of MAX_PLAYERS players, written directly
+void writeHistory(uint32_t games) {
+  SD.remove(HISTORY_FILE);
+  SD.remove(HISTORY_OLD_FILE);
+  File file = SD.open(HISTORY_FILE, FILE_APPEND);
+  for (uint32_t game = 1; game <= games; game++) {
+    for (int player = 0; player < MAX_PLAYERS; player++) {
+      HistoryRecord record = {game, game * 1000, 150000 + game % 1000 * 100, (uint8_t)player, HISTORY_FLAG_VALID, 0};
+      record.checksum = historyChecksum(record);
+      file.write((const uint8_t *)&record, sizeof(record));
+    }
+  }
+  file.close();
+}
+
+// Reopen the history log, as at boot
+void reloadHistory() {
+  if (historyFile) historyFile.close();
+  historyRingClear();
+  nextGameId = 1;
+  loadHistoryFromSD();
+}
+
+// Reopen the registry and its snapshots, as at boot
+void reopenRegistry() {
+  playersFile.close();
+  loadRegistryFromSD();
+}
+
+#if ARENA_MODE != ARENA_OFF
+// Deliver a packet from another board to the arena task and handle it
+template <typename Packet>
+void arenaDeliver(const uint8_t *mac, uint8_t board, uint8_t type, Packet &packet) {
+  packet.header.magic = ARENA_MAGIC;
+  packet.header.type = type;
+  packet.header.board = board;
+  packet.header.target = type == ARENA_ROUND ? ARENA_ALL_BOARDS : board == 0 ? ARENA_BOARD_ID : 0;
+  hostNowReceive(mac, (const uint8_t *)&packet, sizeof(packet));
+  serviceArena();
+}
+#endif
+
+// Bytes of one binary client frame
+std::vector<uint8_t> clientFrame(uint8_t type, uint16_t value) {
+  std::vector<uint8_t> frame = {FRAME_START, type, 2, 0, (uint8_t)(value & 0xFF), (uint8_t)(value >> 8)};
+  uint16_t crc = crc16Update(0xFFFF, frame.data() + 1, frame.size() - 1);
+  frame.push_back(crc & 0xFF);
+  frame.push_back(crc >> 8);
+  return frame;
+}
+
+#if WEB_ENABLED
+// HMAC-SHA256 of data under key in hex, as openssl prints it
+std::string hmacHex(const uint8_t *key, size_t keyLength, const std::vector<uint8_t> &data) {
+  mbedtls_md_context_t context;
+  mbedtls_md_init(&context);
+  mbedtls_md_setup(&context, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1);
+  mbedtls_md_hmac_starts(&context, key, keyLength);
+  mbedtls_md_hmac_update(&context, data.data(), data.size());
+  uint8_t hmac[32];
+  mbedtls_md_hmac_finish(&context, hmac);
+  mbedtls_md_free(&context);
+  char hex[65];
+  for (int i = 0; i < 32; i++) snprintf(hex + 2 * i, 3, "%02x", hmac[i]);
+  return hex;
+}
+#endif
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) filter = argv[++i];
+  }
+  hostAnalog[JOYSTICK_Y] = 2048; // Joystick centered
+  setup();
+  numberOfPlayers = MAX_PLAYERS;
+  for (int i = 0; i < MAX_PLAYERS; i++) snprintf(playerNames[i], PLAYER_NAME_SIZE, "Guest %d", i + 1);
+  clientConnect(true); // A phone stays connected, except while idle mode is tested
+
+  // Game: a whole round through the state machine and all three I/O tasks
+  playRound(180000);
+  check(lastRound.numberOfPlayers == MAX_PLAYERS && lastRound.reactionTimes[0] >= 180000 &&
+            lastRound.reactionTimes[0] < 200000,
+        "round records each player's reaction");
+  unsigned long fastest = lastRound.reactionTimes[0];
+  for (int i = 1; i < MAX_PLAYERS; i++) fastest = std::min(fastest, lastRound.reactionTimes[i]);
+  check(leaderboardCount == std::min(MAX_PLAYERS, LEADERBOARD_SIZE) && leaderboard[0].bestReactionTime == fastest,
+        "round updates the leaderboard");
+  uint32_t savedGames = nextGameId;
+  requestGameStart();
+  do {
+    if (!serviceGame(0)) hostAdvance(1000);
+    runIoTasks();
+  } while (gameState != GAME_RESULTS);
+  check(nextGameId == savedGames + 1 && historyRing[(historyRingPushed - 1) % HISTORY_RING_SIZE].gameId == savedGames,
+        "a round is in the history while its results are still shown");
+  do {
+    if (!serviceGame(0)) hostAdvance(1000);
+    runIoTasks();
+  } while (gameState != GAME_IDLE);
+  hostAdvance(TOUCH_DEBOUNCE_US);
+  check(nextGameId == savedGames + 1, "the results screen ending saves nothing more");
+  StorageCommand stalled = {STORAGE_SESSION_CLOSE}; // Harmless, with no session open
+  auto fillStorageQueue = [&] {
+    while (xQueueSend(storageQueue, &stalled, 0) == pdTRUE) {
+    }
+  };
+  fillStorageQueue();
+  hostOtherTasks = [] { serviceStorage(0); }; // The storage task gets to run while the game task waits
+  saveRoundResults();
+  hostOtherTasks = nullptr;
+  runIoTasks();
+  check(nextGameId == savedGames + 2, "a round waits for room in a full storage queue");
+  fillStorageQueue();
+  int64_t stalledAt = esp_timer_get_time();
+  std::string stalledText = clientRepliesTo([] {
+    saveRoundResults();
+    runIoTasks();
+  });
+  check(nextGameId == savedGames + 2 && esp_timer_get_time() - stalledAt >= (int64_t)STORAGE_SEND_TIMEOUT * 1000 &&
+            stalledText.find("ERROR: Storage busy, round not saved") != std::string::npos,
+        "a round the storage task never made room for is reported over Bluetooth");
+  int guests = registeredPlayers;
+  check(!recordPlayerResult("Player 2", 1000) && !recordPlayerResult("B3 Player 2", 1000) && registeredPlayers == guests &&
+            isSeatName("B12 Player 4") && !isSeatName("Player 1x") && !isSeatName("Bob Player 1") && !isSeatName("Player 0"),
+        "a seat nobody named is neither registered nor ranked");
+  RoundResult faster = lastRound;
+  faster.reactionTimes[0] = 1000;
+  storeRoundResults(faster);
+  check(persistDirty != 0 && SD.exists(PERSIST_MARKER_FILE), "a round leaves the snapshots to the write-behind");
+  hostAdvance((int64_t)PERSIST_DELAY * 1000);
+  serviceStorage(0);
+  check(persistDirty == 0 && !SD.exists(PERSIST_MARKER_FILE), "write-behind flushes after PERSIST_DELAY");
+  markPersistDirty(PERSIST_LEADERBOARD);
+  hostAdvance((int64_t)PERSIST_DELAY * 1000 - 500); // Due in less than a tick
+  int64_t waited = esp_timer_get_time();
+  serviceStorage(portMAX_DELAY);
+  check(persistDirty == 0 && esp_timer_get_time() - waited == 1000, "write-behind waits a whole tick for a sub-tick delay");
+  playRound(180000, true);
+  check(lastRound.reactionTimes[0] == REACTION_JUMPSTART && lastRound.reactionTimes[1] >= 180000,
+        "a jumpstart stands after a later Green Light touch");
+  unsigned long best = leaderboard[0].bestReactionTime;
+  playRound(50000);
+  check(lastRound.flags[0] == HISTORY_FLAG_TOO_FAST && leaderboard[0].bestReactionTime == best &&
+            padFlagged[0] == 1,
+        "a touch under the human floor is flagged and not ranked");
+#if TOUCH_SENSING == TOUCH_NATIVE
+  uint32_t edges = touchEdges[0];
+  playRound(180000, false, 3);
+  check(lastRound.flags[0] == 0 && touchEdges[0] == edges + 1, "a held native pad's repeated scans are one touch");
+  hostAdvance(touchHoldUs + 1); // Let go, then touch again
+  hostInterrupt(TOUCH_PINS[0]);
+  check(touchEdges[0] == edges + 2, "a native pad touched again after letting go is a new edge");
+  hostAdvance(TOUCH_DEBOUNCE_US);
+#else
+  playRound(180000, false, 3);
+  check(lastRound.flags[0] == HISTORY_FLAG_BOUNCE && lastRound.flags[1] == 0 && touchChatter[0] >= 3,
+        "a bouncing pad's touch is flagged");
+#endif
+  RoundResult flaggedJump = lastRound;
+  flaggedJump.reactionTimes[0] = REACTION_JUMPSTART;
+  flaggedJump.flags[0] = HISTORY_FLAG_BOUNCE;
+  ResultText flaggedText;
+  formatRoundResult(flaggedJump, flaggedText);
+  HistoryRecord flaggedRecord = {1, 0, 0, 0, HISTORY_FLAG_JUMPSTART | HISTORY_FLAG_BOUNCE, 0};
+  MessageText flaggedLine;
+  formatHistoryRecord(flaggedRecord, 1, flaggedLine);
+  check(strstr(flaggedText.c_str(), ": JS (Jumpstart) (flagged: pad bounce)\n") != NULL &&
+            strcmp(flaggedLine.c_str(), "Player 1: JS (Jumpstart) (flagged: pad bounce)") == 0,
+        "results and history write a flagged jumpstart the same way");
+  requestGameStart();
+  do {
+    if (!serviceGame(0)) hostAdvance(1000);
+    runIoTasks();
+  } while (gameState != GAME_GREEN || greenStartTime == 0);
+  GameCommand wakeUp = {GAME_CMD_TOUCH, 0};
+  while (xQueueSend(gameQueue, &wakeUp, 0) == pdTRUE) { // A game task far behind
+  }
+  hostAdvance(180000);
+  hostInterrupt(TOUCH_PINS[0]);
+  check(!touchWakePending.load(), "a touch whose wake-up found the game queue full lets the next one wake the game");
+  for (int i = 1; i < numberOfPlayers; i++) hostInterrupt(TOUCH_PINS[i]);
+  do {
+    if (!serviceGame(0)) hostAdvance(1000);
+    runIoTasks();
+  } while (gameState != GAME_IDLE);
+  hostAdvance(TOUCH_DEBOUNCE_US);
+  check(lastRound.reactionTimes[0] >= 180000 && lastRound.reactionTimes[0] < 200000,
+        "a touch queued behind a full game queue still counts");
+
+#if TOUCH_SENSING == TOUCH_NATIVE
+  // Native pad calibration, as at boot: scan period, baseline and threshold,
+  // and the spread of a noisy pad
+  const TouchPadCalibration &pad = touchCalibration[0];
+  check(pad.periodUs >= hostTouchPeriodUs - 50 && pad.periodUs <= hostTouchPeriodUs + 50 &&
+            pad.baseline >= HOST_TOUCH_UNTOUCHED && pad.baseline <= HOST_TOUCH_UNTOUCHED + 4 &&
+            pad.threshold == (uint16_t)(pad.baseline * TOUCH_THRESHOLD_RATIO) && hostTouchThreshold[TOUCH_PINS[0]] == pad.threshold &&
+            touchHoldUs == TOUCH_HOLD_SCANS * pad.periodUs,
+        "calibration measures each pad's scan period, baseline and threshold");
+  hostTouchNoise[TOUCH_PINS[1]] = 400;
+  calibrateTouchPads();
+  check(touchCalibration[1].noise >= 300 && touchCalibration[0].noise <= 4, "calibration measures a noisy pad's spread");
+  hostTouchNoise[TOUCH_PINS[1]] = 0;
+  calibrateTouchPads();
+  hostAdvance(TOUCH_DEBOUNCE_US);
+#endif
+
+  // Session recorder: rounds recorded on the mocked SD replay to the same
+  // results, and a tampered result does not
+  postGameCommand(GAME_CMD_RECORD, 1);
+  serviceGame(0);
+  playRound(180000);
+  playRound(180000, true);
+  playRound(150000, false, 3);
+  postGameCommand(GAME_CMD_RECORD, 0);
+  serviceGame(0);
+  runIoTasks();
+  RoundResult recorded = lastRound;
+  uint32_t liveState = phaseRandomState;
+  arenaRoundId = 42; // As a coordinator would have it after 42 rounds
+  auto replayed = [] {
+    postGameCommand(GAME_CMD_REPLAY, 0);
+    serviceGame(0);
+    runIoTasks();
+    drainOutput();
+  };
+  replayed();
+  check(replay.rounds == 3 && replay.matched == 3, "a recorded session replays to the same results");
+  check(phaseRandomState == liveState && lastRound.flags[0] == recorded.flags[0] && gameState == GAME_IDLE &&
+            !sessionReplaying.load() && arenaRoundId == 42,
+        "a replay leaves the live game as it was");
+  File session = SD.open(SESSION_FILE, "r+");
+  SessionRecord record;
+  uint32_t offset = 0;
+  while (session.read((uint8_t *)&record, sizeof(record)) == sizeof(record) && record.type != SESSION_RESULT) {
+    offset += sizeof(record);
+  }
+  record.data += 1000; // The first round's first result, recorded a millisecond off
+  session.seek(offset);
+  session.write((const uint8_t *)&record, sizeof(record));
+  session.close();
+  replayed();
+  check(replay.rounds == 3 && replay.matched == 2, "a replay exposes a tampered result");
+  benchmark("session/replay (3 rounds)", 1000, replayed);
+
+  // Runtime settings: checked when set, used by the next round, kept in the
+  // mocked NVS across a reload, and set aside while a session replays
+  MessageText reply;
+  check(setConfig("red_max_ms", "1500", reply) && config.redMaxMs == 1500 && !setConfig("red_max_ms", "900", reply) &&
+            !setConfig("joy_threshold", "99", reply) && !setConfig("bt_chunk", "100", reply) &&
+            !setConfig("nope", "1", reply) && config.redMaxMs == 1500 && config.bluetoothChunk == BLUETOOTH_CHUNK_SIZE,
+        "settings are range-checked and must fit together");
+  playRound(180000);
+  check(redDuration >= 1000 && redDuration < 1500, "a changed phase range takes effect on the next round");
+  loadConfig();
+  check(config.redMaxMs == 1500, "settings survive a reboot");
+  replayed();
+  check(replay.matched == 2 && config.redMaxMs == 1500, "a replay runs with the settings it was recorded with");
+  check(resetConfig(reply) && config.redMaxMs == 5000 && configStore.getUInt("red_max_ms", 0) == 0,
+        "settings reset to the defaults");
+  gameState = GAME_RED; // As if a START had just been handled
+  check(!setConfig("red_max_ms", "1500", reply) && strcmp(reply.c_str(), "ERROR: Game in progress") == 0 &&
+            config.redMaxMs == 5000,
+        "a setting never changes inside a round");
+  gameState = GAME_IDLE;
+  int bluetoothTask;
+  gameTaskHandle = &bluetoothTask; // Ask from another task: the game task only looks once the asker gave up
+  bool gaveUp = !setConfig("red_max_ms", "1500", reply);
+  gameTaskHandle = NULL;
+  serviceGame(0);
+  check(gaveUp && config.redMaxMs == 5000 && configStore.getUInt("red_max_ms", 0) == 0 &&
+            uxQueueMessagesWaiting(configReplyQueue) == 0,
+        "a setting change the game task took too long for is dropped, not applied late");
+  benchmark("game/round", 200, [] { playRound(150000 + random(0, 100000)); });
+  postGameCommand(GAME_CMD_TOURNAMENT, 3);
+  serviceGame(0);
+  playRound(200000);
+  check(tournamentRound == 3 && tournamentRounds == 0 && tournamentStats[0].valid == 3,
+        "tournament runs its rounds back to back");
+  check(fabs(tournamentStats[0].mean - 200000) < 1000 && tournamentStats[0].best >= 200000 &&
+            tournamentStats[0].best < 201000,
+        "tournament keeps each player's mean and best");
+  drainOutput();
+  for (int i = 0; i < BLUETOOTH_QUEUE_LENGTH; i++) postBluetoothMessage(BT_SEND_TEXT, 0); // A stalled link
+  int64_t before = esp_timer_get_time();
+  postGameCommand(GAME_CMD_STANDINGS, 0);
+  serviceGame(0);
+  check(bluetoothDropped.load() == (uint32_t)MAX_PLAYERS + 1 && esp_timer_get_time() == before,
+        "the game task drops Bluetooth text on a full queue instead of waiting");
+  bluetoothDropped.store(0);
+  drainOutput();
+  P2Quantile quantile(0.95f);
+  for (int i = 0; i < 100000; i++) quantile.add(random(0, 100000));
+  check(fabs(quantile.value() - 95000) < 1000, "P2 estimates the 95th percentile");
+  ClockSync clock; // Follower runs 30 ppm fast and 5 s behind; each way takes 1-3 ms
+  auto followerAt = [](int64_t coordinatorUs) { return coordinatorUs + coordinatorUs * 30 / 1000000 - 5000000; };
+  int64_t coordinatorUs = 10000000;
+  for (int i = 0; i < 2400; i++, coordinatorUs += 250000) { // Ten minutes
+    int64_t t2 = coordinatorUs + random(1000, 3000);
+    int64_t t3 = t2 + random(0, 500);
+    clock.addSample(followerAt(coordinatorUs), t2, t3, followerAt(t3 + random(1000, 3000)));
+  }
+  int64_t error = clock.toCoordinator(followerAt(coordinatorUs)) - coordinatorUs;
+  check(clock.synced() && llabs(error) < 1000 && fabs(clock.driftPpm() + 30) < 5,
+        "clock sync tracks the coordinator offset and drift");
+  check(llabs(clock.toLocal(coordinatorUs) - followerAt(coordinatorUs)) < 1000, "clock sync converts both ways");
+#if ARENA_MODE == ARENA_COORDINATOR
+  // Arena coordinator: a follower's result is shown and competes in the registry
+  const uint8_t followerMac[6] = {0x24, 0x6F, 0x28, 0, 0, 1};
+  ArenaResult arenaResult = {};
+  arenaResult.roundId = arenaLastRound;
+  arenaResult.reactionUs = 171000;
+  strcpy(arenaResult.name, "Zed");
+  drainOutput();
+  std::string arenaText = clientRepliesTo([&] {
+    arenaDeliver(followerMac, 1, ARENA_RESULT, arenaResult);
+    runIoTasks();
+  });
+  PlayerRecord zed;
+  int players = registeredPlayers;
+  check(arenaText.find(": 171000 us, touch at +") != std::string::npos && findOrRegisterPlayer("Zed", zed) >= 0 &&
+            registeredPlayers == players && zed.bestReactionTime == 171000,
+        "the coordinator merges a follower's result");
+  for (int board = 1; board <= 2; board++) { // Two full boards report before the storage task runs
+    for (int seat = 0; seat < MAX_PLAYERS; seat++) {
+      snprintf(arenaResult.name, sizeof(arenaResult.name), "Rider %d-%d", board, seat + 1);
+      arenaResult.reactionUs = 160000 + board * 1000 + seat;
+      arenaDeliver(followerMac, board, ARENA_RESULT, arenaResult);
+    }
+  }
+  runIoTasks();
+  bool ridersMerged = registeredPlayers == players + 2 * MAX_PLAYERS;
+  for (int board = 1; board <= 2; board++) {
+    for (int seat = 0; seat < MAX_PLAYERS; seat++) {
+      PlayerRecord rider;
+      char riderName[PLAYER_NAME_SIZE];
+      snprintf(riderName, sizeof(riderName), "Rider %d-%d", board, seat + 1);
+      ridersMerged = ridersMerged && findOrRegisterPlayer(riderName, rider) >= 0 &&
+                     rider.bestReactionTime == 160000UL + board * 1000 + seat;
+    }
+  }
+  check(ridersMerged && uxQueueMessagesWaiting(arenaResultQueue) == 0, "the coordinator merges every seat of several boards");
+  drainOutput();
+#elif ARENA_MODE == ARENA_FOLLOWER
+  // Arena follower: sync, play the announced round, and send each seat's
+  // result to the coordinator alone
+  const uint8_t coordinatorMac[6] = {0x24, 0x6F, 0x28, 0, 0, 0};
+  hostAdvance((int64_t)ARENA_SYNC_INTERVAL * 1000);
+  serviceArena(); // Sends a sync request
+  ArenaSync syncReply = {};
+  syncReply.t1 = arenaSyncT1;
+  syncReply.t2 = arenaSyncT1 + 5000000 + 1000; // Coordinator 5 s ahead, 1 ms each way
+  syncReply.t3 = syncReply.t2 + 100;
+  hostAdvance(2100);
+  arenaDeliver(coordinatorMac, 0, ARENA_SYNC_REPLY, syncReply);
+  ArenaRound arenaRound = {};
+  arenaRound.roundId = 7;
+  arenaRound.phaseMs[0] = 1200;
+  arenaRound.phaseMs[1] = 800;
+  arenaRound.phaseMs[2] = 3000;
+  arenaRound.startUs = arenaClock.toCoordinator(esp_timer_get_time()) + (int64_t)ARENA_START_LEAD * 1000;
+  arenaDeliver(coordinatorMac, 0, ARENA_ROUND, arenaRound);
+  arenaDeliver(coordinatorMac, 0, ARENA_ROUND, arenaRound); // Repeated by the radio
+  check(arenaClock.synced() && uxQueueMessagesWaiting(gameQueue) == 1, "a follower arms each announced round once");
+  size_t sent = hostNowSent.size();
+  bool touched = false;
+  do {
+    if (!serviceGame(0)) hostAdvance(1000);
+    if (gameState == GAME_GREEN && greenStartTime != 0 && !touched) {
+      hostAdvance(190000);
+      for (int i = 0; i < numberOfPlayers; i++) hostInterrupt(TOUCH_PINS[i]);
+      touched = true;
+    }
+    runIoTasks();
+  } while (gameState != GAME_IDLE);
+  hostAdvance(TOUCH_DEBOUNCE_US);
+  int unicasts = 0;
+  for (size_t i = sent; i < hostNowSent.size(); i++) {
+    ArenaResult sentResult;
+    memcpy(&sentResult, hostNowSent[i].data.data(), sizeof(sentResult));
+    if (sentResult.header.type != ARENA_RESULT) continue;
+    bool toCoordinator = memcmp(hostNowSent[i].mac.data(), coordinatorMac, 6) == 0;
+    unicasts += toCoordinator && sentResult.roundId == 7 && sentResult.reactionUs >= 190000;
+  }
+  check(lastRound.numberOfPlayers == MAX_PLAYERS && unicasts == MAX_PLAYERS,
+        "a follower unicasts each seat's result to the coordinator");
+  hostNowSendDone(coordinatorMac, ESP_NOW_SEND_FAIL);
+  check(arenaSendFailures.load() == 1, "a result the radio gave up on is counted");
+  drainOutput();
+#endif
+  benchmark("game/tournament stats", 100000, [] {
+    for (int i = 0; i < MAX_PLAYERS; i++) lastRound.reactionTimes[i] = 150000 + random(0, 100000);
+    lastRound.numberOfPlayers = MAX_PLAYERS;
+    updateTournamentStats(lastRound);
+  });
+  benchmark("game/startGame", 100000, [] {
+    startGame();
+    gameState = GAME_IDLE;
+    drainOutput();
+  });
+  benchmark("game/formatRoundResult", 100000, [] {
+    ResultText text;
+    formatRoundResult(lastRound, text);
+  });
+
+  // Leaderboard
+  RoundResult round = {};
+  round.numberOfPlayers = MAX_PLAYERS;
+  benchmark("leaderboard/update", 100000, [&round] {
+    for (int i = 0; i < MAX_PLAYERS; i++) round.reactionTimes[i] = 100000 + random(0, 200000);
+    updateLeaderboard(round);
+  });
+  benchmark("leaderboard/snapshot write", 10000, [] {
+    markPersistDirty(PERSIST_LEADERBOARD);
+    flushPersistState();
+  });
+  bool sorted = true;
+  for (int i = 1; i < leaderboardCount; i++) sorted &= leaderboard[i - 1].bestReactionTime <= leaderboard[i].bestReactionTime;
+  check(sorted, "leaderboard stays sorted");
+
+  // Player registry: a result for one of REGISTRY_MAX_PLAYERS / 2 registered people
+  char name[PLAYER_NAME_SIZE];
+  for (int i = 0; i < REGISTRY_MAX_PLAYERS / 2; i++) {
+    snprintf(name, sizeof(name), "Racer %d", i);
+    recordPlayerResult(name, 400000 + i);
+  }
+  benchmark("registry/record result", 100000, [&name] {
+    snprintf(name, sizeof(name), "Racer %d", (int)random(0, REGISTRY_MAX_PLAYERS / 2));
+    recordPlayerResult(name, 300000 + random(0, 100000));
+  });
+  flushPersistState();
+  check(!SD.exists(PERSIST_MARKER_FILE), "flushed snapshots clear the dirty marker");
+  benchmark("registry/boot load", 1000, [] { reopenRegistry(); });
+  PlayerRecord saved[LEADERBOARD_SIZE];
+  memcpy(saved, leaderboard, sizeof(saved));
+  int savedCount = leaderboardCount;
+
+  // Crash recovery: each boot must come back to the same registry and leaderboard
+  const int expectedPlayers = REGISTRY_MAX_PLAYERS / 2 + MAX_PLAYERS + (ARENA_MODE == ARENA_COORDINATOR) * (1 + 2 * MAX_PLAYERS); // Guests, Zed and the riders
+  auto recovered = [&] {
+    PlayerRecord found;
+      return registeredPlayers == expectedPlayers && leaderboardCount == savedCount &&
+           memcmp(leaderboard, saved, savedCount * sizeof(PlayerRecord)) == 0 &&
+           findOrRegisterPlayer("Racer 7", found) >= 0 && registeredPlayers == expectedPlayers;
+  };
+  SD.remove(PLAYERS_INDEX_FILE);
+  reopenRegistry();
+  check(recovered(), "registry rebuilds a missing index");
+  SD.open(PERSIST_MARKER_FILE, FILE_WRITE).close(); // Power lost with snapshots dirty
+  (*SD.files[LEADERBOARD_FILE])[sizeof(SnapshotHeader)] ^= 0xFF;
+  reopenRegistry();
+  check(recovered() && !SD.exists(PERSIST_MARKER_FILE), "registry rebuilds stale snapshots");
+  SD.rename(LEADERBOARD_FILE, "/leaderboard.bin.tmp"); // Power lost between remove and rename
+  reopenRegistry();
+  check(recovered() && SD.exists(LEADERBOARD_FILE), "an interrupted snapshot replacement completes at boot");
+  SD.open("/players.idx.tmp", FILE_WRITE).close(); // Power lost while writing a temp file
+  reopenRegistry();
+  check(recovered() && !SD.exists("/players.idx.tmp"), "a partial temp snapshot is dropped at boot");
+
+  // History
+  writeHistory(0);
+  reloadHistory();
+  GameRecord game = {};
+  game.numberOfPlayers = MAX_PLAYERS;
+  benchmark("history/saveHistoryToSD", 100000, [&game] {
+    game.gameId = nextGameId++;
+    saveHistoryToSD(game);
+  });
+  writeHistory(10000);
+  reloadHistory();
+  check(nextGameId == 10001, "history load continues game numbering");
+  check(historyRingCount >= HISTORY_RING_SIZE - 1, "history load seeds the RAM ring"); // The window's first game may be partial, so it is skipped
+  benchmark("history/load (10000 games)", 1000, [] { reloadHistory(); });
+  benchmark("history/ringGet", 1000000, [] {
+    GameRecord recent;
+    historyRingGet(random(0, HISTORY_RING_SIZE), recent);
+  });
+  benchmark("history/stream binary (10000)", 20, [] {
+    std::vector<uint8_t> request = clientFrame(FRAME_HISTORY_REQUEST, FRAME_MAX_CREDITS);
+    clientSend(request.data(), request.size());
+    serviceBluetooth();
+    while (historyTransfer.active) {
+      if (historyTransfer.credits == 0) {
+        std::vector<uint8_t> credit = clientFrame(FRAME_CREDIT, FRAME_MAX_CREDITS);
+        clientSend(credit.data(), credit.size());
+      }
+      serviceBluetooth();
+    }
+  });
+  benchmark("history/stream text (10000)", 20, [] { sendHistoryInChunks(); });
+#if BT_TRANSPORT == BT_BLE
+  NimBLECharacteristic *response = hostBleCharacteristic(BLE_RESPONSE_UUID);
+  uint8_t longReply[3 * BLE_ATTRIBUTE_MAX];
+  memset(longReply, 'x', sizeof(longReply));
+  response->largestValue = 0;
+  drainOutput();
+  std::string longText = clientRepliesTo([&] { ESP_BT.write(longReply, sizeof(longReply)); });
+  check(response->largestValue == BLE_ATTRIBUTE_MAX && longText == std::string(sizeof(longReply), 'x'),
+        "a long BLE reply goes out whole, in pieces no longer than an attribute");
+  hostBleServer->callbacks->onMTUChange(BLE_DEFAULT_MTU, NULL); // A client that never negotiates
+  response->largestValue = 0;
+  ESP_BT.write(longReply, sizeof(longReply));
+  check(response->largestValue == BLE_DEFAULT_MTU - 3, "a BLE reply fits the default MTU until a larger one is agreed");
+  hostBleServer->callbacks->onMTUChange(BLE_MTU, NULL);
+  drainOutput();
+#endif
+  HistoryReader reader;
+  uint32_t historyBytes = 0;
+  check(openHistoryReader(reader, HISTORY_FILE, historyBytes) && historyBytes == historyRecordCount * sizeof(HistoryRecord),
+        "a history download opens the log and sizes it");
+  uint32_t start, end;
+  check(parseByteRange("bytes=16-31", historyBytes, start, end) && start == 16 && end == 32 &&
+            parseByteRange("bytes=-16", historyBytes, start, end) && start == historyBytes - 16 &&
+            parseByteRange("bytes=32-", historyBytes, start, end) && end == historyBytes &&
+            !parseByteRange("bytes=5-4", historyBytes, start, end) &&
+            !parseByteRange("bytes=0-1,4-5", historyBytes, start, end),
+        "HTTP ranges parse to the right bytes");
+  HistoryRecord ranged;
+  check(readHistoryRange(reader, historyBytes - sizeof(ranged), (uint8_t *)&ranged, sizeof(ranged)) ==
+                sizeof(ranged) &&
+            ranged.gameId == nextGameId - 1 && ranged.checksum == historyChecksum(ranged),
+        "ranged history reads return whole records");
+  historyMutex->count++; // The storage task is appending
+  check(readHistoryRange(reader, 0, (uint8_t *)&ranged, sizeof(ranged)) == HISTORY_READ_BUSY,
+        "a ranged read never waits for the history log");
+  historyMutex->count--;
+  benchmark("history/range read (1 KiB)", 10000, [&reader, historyBytes] {
+    uint8_t buffer[1024];
+    readHistoryRange(reader, random(0, historyBytes / 1024) * 1024, buffer, sizeof(buffer));
+  });
+#if WEB_ENABLED
+  AsyncWebServerRequest whole;
+  hostWebServe(webServer, whole, HTTP_GET, "/history.bin");
+  check(whole.response->code == 200 && hostWebRead(whole).size() == historyBytes && !whole.connection.closed,
+        "GET /history.bin streams the whole log");
+  AsyncWebServerRequest download;
+  download.headers["Range"] = "bytes=0-4095";
+  hostWebServe(webServer, download, HTTP_GET, "/history.bin");
+  check(download.response->code == 206 && download.response->headers["Content-Range"] == "bytes 0-4095/" + std::to_string(historyBytes) &&
+            hostWebRead(download, 1024).size() == 1024,
+        "a ranged GET /history.bin answers 206 with its range");
+#endif
+  deleteHistory();
+  drainOutput();
+  check(readHistoryRange(reader, 0, (uint8_t *)&ranged, sizeof(ranged)) == 0,
+        "a download ends when the log is deleted or rotated under it");
+#if WEB_ENABLED
+  check(hostWebRead(download).empty() && download.connection.closed && download.response->sent == 1024,
+        "a download the log is deleted under is closed short instead of left waiting");
+#endif
+  reader.file.close();
+  std::vector<uint8_t> request = clientFrame(FRAME_HISTORY_REQUEST, FRAME_MAX_CREDITS);
+  std::string noHistory = clientRepliesTo([&request] {
+    clientSend(request.data(), request.size());
+    serviceBluetooth();
+  }, true);
+  std::string noHistoryError = {(char)FRAME_START, (char)FRAME_ERROR, 1, 0, (char)FRAME_ERROR_NO_HISTORY};
+  uint16_t errorCrc = crc16Update(0xFFFF, (const uint8_t *)noHistoryError.data() + 1, noHistoryError.size() - 1);
+  noHistoryError += (char)(errorCrc & 0xFF);
+  noHistoryError += (char)(errorCrc >> 8);
+  check(!historyTransfer.active && noHistory == noHistoryError,
+        "a history request with no log on the card gets FRAME_ERROR_NO_HISTORY");
+
+  // Web scoreboard messages
+  char savedName[PLAYER_NAME_SIZE];
+  strcpy(savedName, playerNames[0]);
+  strcpy(playerNames[0], "Al \"Q\"");
+  RoundResult webRound = {2, {REACTION_JUMPSTART, 231000}};
+  JsonText json;
+  formatJsonResult(webRound, json);
+  check(strncmp(json.c_str(), "{\"type\":\"result\",\"players\":[{\"name\":\"Al \\\"Q\\\"\",\"result\":\"jumpstart\"},", 64) == 0 &&
+            strstr(json.c_str(), ",\"us\":231000}]}") != NULL,
+        "result JSON escapes names and marks jumpstarts");
+  strcpy(playerNames[0], savedName);
+  benchmark("web/result json", 100000, [&webRound, &json] { formatJsonResult(webRound, json); });
+  benchmark("web/leaderboard json", 100000, [&json] { formatJsonLeaderboard(json); });
+#if WEB_ENABLED
+  // Web server: a spectator screen is greeted and follows the rounds, and the
+  // admin pages take the board's credentials
+  drainOutput();
+  webSocket.hostConnect(7);
+  runIoTasks();
+  check(webSocket.sent.size() == 2 && webSocket.sent[0].first == 7 &&
+            webSocket.sent[0].second == "{\"type\":\"phase\",\"phase\":\"idle\"}" &&
+            webSocket.sent[1].second.find("{\"type\":\"leaderboard\"") == 0,
+        "a new spectator screen gets the phase and the leaderboard");
+  webSocket.sent.clear();
+  playRound(180000);
+  int phases = 0, results = 0;
+  for (auto &sent : webSocket.sent) {
+    if (sent.first != 0) continue;
+    if (sent.second.find("{\"type\":\"phase\"") == 0) phases++;
+    if (sent.second.find("{\"type\":\"result\"") == 0) results++;
+  }
+  check(phases >= 3 && results == 1, "a round's phases and results reach every spectator screen");
+  AsyncWebServerRequest page;
+  check(hostWebServe(webServer, page, HTTP_GET, "/") && page.response->code == 200 &&
+            hostWebRead(page).find("<title>Reflex Rush</title>") != std::string::npos,
+        "the spectator page is served");
+  AsyncWebServerRequest settings;
+  hostWebServe(webServer, settings, HTTP_GET, "/config");
+  check(settings.response->code == 200 && hostWebRead(settings).find("\"red_max_ms\":5000") != std::string::npos,
+        "GET /config lists the settings");
+  auto postConfig = [](const char *user, const char *password) {
+    AsyncWebServerRequest change;
+    change.user = user;
+    change.password = password;
+    change.parameters.push_back(AsyncWebParameter("red_max_ms", "1500"));
+    hostWebServe(webServer, change, HTTP_POST, "/config");
+    return change.response->code;
+  };
+  int unset = postConfig("admin", "");
+  configStore.putString("admin_pass", "s3cret"); // Provisioned for this board
+  loadWebAdmin();
+  check(unset == 403 && postConfig("admin", "wrong") == 401 && config.redMaxMs == 5000,
+        "the admin pages are refused without this board's password");
+  check(postConfig("admin", "s3cret") == 200 && config.redMaxMs == 1500, "POST /config changes a setting");
+  const char *jefe = "what do ya want for nothing?";
+  check(hmacHex((const uint8_t *)"Jefe", 4, std::vector<uint8_t>(jefe, jefe + strlen(jefe))) ==
+            "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843",
+        "the host HMAC-SHA256 gives RFC 4231's answer");
+  std::vector<uint8_t> image(5000);
+  for (size_t i = 0; i < image.size(); i++) image[i] = (uint8_t)random(0, 256);
+  auto upload = [](const std::vector<uint8_t> &body, const std::string &hmac) {
+    AsyncWebServerRequest request;
+    request.user = "admin";
+    request.password = "s3cret";
+    if (!hmac.empty()) request.headers["X-Firmware-HMAC"] = hmac;
+    hostWebServe(webServer, request, HTTP_POST, "/update", body);
+    return request.response->code;
+  };
+  int keyless = upload(image, std::string(64, '0'));
+  uint8_t boardKey[OTA_KEY_SIZE];
+  for (size_t i = 0; i < sizeof(boardKey); i++) boardKey[i] = (uint8_t)(0xA0 + i);
+  configStore.putBytes("ota_key", boardKey, sizeof(boardKey)); // Provisioned for this board
+  loadWebAdmin();
+  std::string imageHmac = hmacHex(boardKey, sizeof(boardKey), image);
+  std::vector<uint8_t> tampered = image;
+  tampered[4321] ^= 1;
+  check(keyless == 403 && upload(image, "") == 400 && upload(tampered, imageHmac) == 500 && !Update.isFinished() &&
+            upload(image, hmacHex(boardKey, 16, image)) == 500 && !Update.isFinished() && otaRestartUs.load() == 0,
+        "an image without its HMAC under this board's key is never booted");
+  check(upload(image, imageHmac) == 200 && Update.isFinished() && Update.image == image && otaRestartUs.load() != 0,
+        "an image with its HMAC under this board's key is written and booted");
+  otaRestartUs.store(0);
+  MessageText restored;
+  setConfig("red_max_ms", "5000", restored);
+  drainOutput();
+#endif
+
+  // Bluetooth parsers
+  const char *commands[] = {"SELECT_PLAYERS_4\n", "SET_PLAYER_2_Alice\n", "VIEW_HISTORY_5\n", "NOT_A_COMMAND\n"};
+  auto parseCommands = [&commands] {
+    for (const char *line : commands) {
+      for (const char *c = line; *c != '\0'; c++) receiveCommandByte(*c);
+    }
+    drainOutput();
+  };
+  parseCommands();
+  check(strcmp(playerNames[1], "Alice") == 0, "SET_PLAYER_ renames the player");
+  benchmark("bluetooth/command line", 100000, parseCommands);
+  std::vector<uint8_t> cancel = {FRAME_START, FRAME_CANCEL, 0, 0};
+  uint16_t cancelCrc = crc16Update(0xFFFF, cancel.data() + 1, 3);
+  cancel.push_back(cancelCrc & 0xFF);
+  cancel.push_back(cancelCrc >> 8);
+  benchmark("bluetooth/frame (cancel)", 1000000, [&cancel] {
+    for (uint8_t byte : cancel) receiveFrameByte(byte);
+  });
+  benchmark("bluetooth/crc16 (512 B)", 100000, [] { sink = crc16(historyFrame, BLUETOOTH_CHUNK_SIZE); });
+
+  // Idle mode: a quiet menu turns the panel off and light-sleeps; the
+  // button and a Bluetooth connection wake it
+  clientConnect(false);
+  drainOutput();
+  lastActivityMs = millis();
+  hostAdvance((int64_t)idleTimeout * 1000);
+  loop();
+  runIoTasks();
+  bool idled = powerMode == POWER_IDLE && !panelOn && getCpuFrequencyMhz() == IDLE_CPU_FREQUENCY;
+  uint64_t sleeps = hostLightSleeps;
+#if ARENA_MODE != ARENA_OFF || WEB_ENABLED
+  loop();
+  check(idled && hostLightSleeps == sleeps, "an arena or scoreboard board idles without light sleep, so its radio keeps listening");
+  hostDigital[MENU_BUTTON] = LOW;
+  hostInterrupt(MENU_BUTTON);
+  loop();
+  hostDigital[MENU_BUTTON] = HIGH;
+  hostInterrupt(MENU_BUTTON);
+  runIoTasks();
+  check(powerMode == POWER_ACTIVE && panelOn, "the button wakes an arena or scoreboard board");
+#else
+  loop(); // A quiet slice
+  bool slept = hostLightSleeps > sleeps && powerMode == POWER_IDLE;
+  int wakeOption = currentMenuOption;
+  hostDigital[MENU_BUTTON] = LOW; // Press
+  loop();
+  hostDigital[MENU_BUTTON] = HIGH;
+  runIoTasks();
+  check(idled && slept && powerMode == POWER_ACTIVE && panelOn && currentMenuOption == wakeOption,
+        "idle mode sleeps after the timeout and the button wakes it");
+#if PROFILE_ENABLED
+  check(profiles[PROFILE_WAKE_LATENCY].count == 1, "a wake-up is profiled");
+#endif
+  hostAdvance((int64_t)idleTimeout * 1000);
+  loop();
+  clientConnect(true);
+  loop();
+  runIoTasks();
+  check(bluetoothConnected && powerMode == POWER_ACTIVE && panelOn, "a Bluetooth connection wakes idle mode");
+#if PROFILE_ENABLED
+  check(profiles[PROFILE_WAKE_LATENCY].count == 2, "each wake-up is profiled");
+#endif
+  clientConnect(false);
+  drainOutput();
+  check(hostLevelStorms == 0, "pin interrupts are off while their wake-up levels are armed");
+  hostAdvance((int64_t)idleTimeout * 1000);
+  loop();
+  hostBtControllerStatus = ESP_BT_CONTROLLER_STATUS_ENABLED; // On the main crystal
+  sleeps = hostLightSleeps;
+  loop();
+  check(hostLightSleeps == sleeps && powerMode == POWER_IDLE, "an enabled Bluetooth controller keeps the board awake");
+  hostBtControllerStatus = ESP_BT_CONTROLLER_STATUS_IDLE;
+  hostSleepResult = -1; // Refused
+  loop();
+  check(powerMode == POWER_IDLE, "a refused light sleep does not wake idle mode");
+  hostDigital[MENU_BUTTON] = LOW;
+  loop();
+  hostDigital[MENU_BUTTON] = HIGH;
+  hostSleepResult = ESP_OK;
+  runIoTasks();
+  check(powerMode == POWER_ACTIVE, "a press that made light sleep refuse still wakes idle mode");
+#if TOUCH_SENSING == TOUCH_NATIVE
+  drainOutput();
+  hostAdvance((int64_t)idleTimeout * 1000);
+  loop();
+  hostTouchDepth[TOUCH_PINS[2]] = 700; // Touched, below its threshold
+  loop();
+  hostTouchDepth[TOUCH_PINS[2]] = 0;
+  runIoTasks();
+  check(powerMode == POWER_ACTIVE, "a native pad touch wakes the board from light sleep");
+#endif
+#endif
+  drainOutput();
+
+  // Menu input: joystick sampler to loop() handling the event
+  clientConnect(true);
+  drainOutput();
+  auto pushDown = [] {
+    hostAnalog[JOYSTICK_Y] = 4095; // Push down
+    hostAdvance(JOYSTICK_SAMPLE_US);
+    loop();
+    hostAnalog[JOYSTICK_Y] = 2048; // Release
+    hostAdvance(JOYSTICK_SAMPLE_US);
+    drainOutput();
+  };
+  int startOption = currentMenuOption;
+  pushDown();
+  pushDown();
+  check(currentMenuOption == (startOption + 2) % MENU_SIZE, "each joystick push moves the cursor once");
+  benchmark("input/joystick move", 100000, pushDown);
+
+  // Display
+  bool cacheMatches = true;
+  std::vector<uint8_t> cached(FRAME_BYTES);
+  for (int frame = 0; frame < STATIC_FRAMES; frame++) {
+    showStaticFrame(frame);
+    memcpy(cached.data(), display.getBuffer(), FRAME_BYTES);
+    renderStaticFrame(frame);
+    cacheMatches = cacheMatches && memcmp(cached.data(), display.getBuffer(), FRAME_BYTES) == 0;
+  }
+  check(cacheMatches, "cached static frames match their rendering");
+#if DISPLAY_BACKEND == DISPLAY_TFT
+  drawTrafficLight("GREEN");
+  bool green = hostTft.at(SCREEN_WIDTH / 2, TFT_LIGHT_Y) == TFT_GREEN && hostTft.at(SCREEN_WIDTH - 1, SCREEN_HEIGHT - 1) == 0;
+  drawTrafficLight("RED");
+  check(green && hostTft.at(SCREEN_WIDTH / 2, TFT_LIGHT_Y) == TFT_RED, "the TFT shows each light in its own color");
+  drawMainMenu(0);
+  uint64_t pixelBytes = hostTft.pixelBytes;
+  drawMainMenu(1);
+  check(hostTft.pixelBytes > pixelBytes && hostTft.pixelBytes - pixelBytes <= 4 * TFT_BAND_BYTES,
+        "a menu cursor move sends only the TFT bands that changed");
+#endif
+  int light = 0;
+  benchmark("display/traffic light", 100000, [&light] {
+    drawTrafficLight(TRAFFIC_LIGHT_COLORS[light]);
+    light = (light + 1) % 3;
+  });
+  int option = 0;
+  benchmark("display/menu cursor move", 100000, [&option] {
+    drawMainMenu(option);
+    option = (option + 1) % MENU_SIZE;
+  });
+  benchmark("display/results", 100000, [] { drawGameResults(gameResult.c_str()); });
+
+  // Reboot: the storage task writes and closes everything, then says so
+  markPersistDirty(PERSIST_LEADERBOARD);
+  auto cardClosed = [] {
+    return persistDirty == 0 && !SD.exists(PERSIST_MARKER_FILE) && !historyFile && !playersFile && !sdReady;
+  };
+#if WEB_ENABLED
+  bool closedFirst = false;
+  ESP.onRestart = [&closedFirst, &cardClosed] { closedFirst = cardClosed(); };
+  hostOtherTasks = [] { serviceStorage(0); }; // The storage task runs while the web task waits
+  otaRestartUs.store(esp_timer_get_time()); // An update was written
+  serviceWeb();
+  hostOtherTasks = nullptr;
+  check(ESP.restarts == 1 && closedFirst, "the reboot after an update waits for the SD card to be flushed and closed");
+  int64_t stalledSince = esp_timer_get_time();
+  serviceWeb(); // Again, with a storage task that never answers
+  check(ESP.restarts == 2 && esp_timer_get_time() - stalledSince >= (int64_t)(WEB_CLEANUP_INTERVAL + STORAGE_CLOSE_TIMEOUT) * 1000,
+        "the reboot after an update goes ahead once the storage task had its time");
+  otaRestartUs.store(0);
+  ESP.onRestart = nullptr;
+  runIoTasks();
+#else
+  StorageCommand shutdown;
+  shutdown.type = STORAGE_SHUTDOWN;
+  shutdown.done = xSemaphoreCreateBinary(); // Given once the card is closed
+  xQueueSend(storageQueue, &shutdown, 0);
+  serviceStorage(0);
+  check(xSemaphoreTake(shutdown.done, 0) == pdTRUE && cardClosed(), "STORAGE_SHUTDOWN flushes and closes the SD card");
+#endif
+
+  if (failures > 0) {
+    printf("%d check(s) failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,1387 @@
+// Host HAL for Reflex Rush: the Arduino, ESP32, SSD1306, SPI TFT,
+// BluetoothSerial, NimBLE, ESP-NOW, web server, SD, Preferences, Update,
+// mbedtls and FreeRTOS calls the sketch makes, backed by in-memory mocks so
+// code.c builds and runs on a PC (see Makefile). Included by code.c when
+// HOST_BUILD is defined; nothing here is used on the board.
+//
+// Everything is single-threaded and deterministic: time only moves when the
+// sketch sleeps (delay(), or a queue wait that times out) or when the
+// benchmark calls hostAdvance(). Tasks are not started; the benchmark calls
+// the sketch's service functions instead.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// ---- Clock ------------------------------------------------------------------
+
+inline int64_t hostMicros = 0; // Simulated esp_timer clock (microseconds)
+
+// esp_timer: callbacks run inline when the clock passes their deadline
+typedef void (*esp_timer_cb_t)(void *arg);
+struct esp_timer_create_args_t {
+  esp_timer_cb_t callback;
+  void *arg;
+  int dispatch_method;
+  const char *name;
+  bool skip_unhandled_events;
+};
+struct HostTimer {
+  esp_timer_cb_t callback;
+  void *arg;
+  int64_t period; // 0 for one-shot
+  int64_t due;
+  bool active;
+};
+typedef HostTimer *esp_timer_handle_t;
+typedef int esp_err_t;
+#define ESP_OK 0
+inline std::vector<HostTimer *> hostTimers;
+
+// Move the clock forward, firing every timer that falls due on the way
+inline void hostAdvance(int64_t micros) {
+  int64_t target = hostMicros + micros;
+  for (;;) {
+    HostTimer *next = NULL;
+    for (HostTimer *timer : hostTimers) {
+      if (timer->active && timer->due <= target && (next == NULL || timer->due < next->due)) next = timer;
+    }
+    if (next == NULL) break;
+    if (next->due > hostMicros) hostMicros = next->due;
+    if (next->period > 0) {
+      next->due += next->period;
+    } else {
+      next->active = false;
+    }
+    next->callback(next->arg);
+  }
+  hostMicros = target;
+}
+inline int64_t esp_timer_get_time() { return hostMicros; }
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle) {
+  *handle = new HostTimer{args->callback, args->arg, 0, 0, false};
+  hostTimers.push_back(*handle);
+  return ESP_OK;
+}
+inline esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+  timer->period = period;
+  timer->due = hostMicros + period;
+  timer->active = true;
+  return ESP_OK;
+}
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout) {
+  timer->period = 0;
+  timer->due = hostMicros + timeout;
+  timer->active = true;
+  return ESP_OK;
+}
+inline esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  timer->active = false;
+  return ESP_OK;
+}
+inline unsigned long millis() { return (unsigned long)(hostMicros / 1000); }
+inline unsigned long micros() { return (unsigned long)hostMicros; }
+inline void delay(unsigned long ms) { hostAdvance((int64_t)ms * 1000); }
+inline void delayMicroseconds(uint32_t us) { hostAdvance(us); }
+
+// ---- Arduino core -----------------------------------------------------------
+
+#define IRAM_ATTR
+#define PROGMEM
+#define DRAM_ATTR
+#define F(text) (text)
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define INPUT_PULLUP 0x05
+#define OUTPUT 0x03
+#define RISING 0x01
+#define CHANGE 0x03
+#define digitalPinToInterrupt(pin) (pin)
+
+const int HOST_PINS = 40;
+inline int hostDigital[HOST_PINS];        // Level returned by digitalRead (set by the benchmark)
+inline int hostAnalog[HOST_PINS];         // Value returned by analogRead (set by the benchmark)
+inline void (*hostIsr[HOST_PINS])(void *); // Handlers from attachInterruptArg
+inline void *hostIsrArg[HOST_PINS];
+inline void (*hostIsrPlain[HOST_PINS])(); // Handlers from attachInterrupt
+inline bool hostIntrEnabled[HOST_PINS];   // Attached and not gpio_intr_disable'd
+
+inline void pinMode(int pin, int mode) { hostDigital[pin] = mode == INPUT_PULLUP ? HIGH : LOW; }
+inline int digitalRead(int pin) { return hostDigital[pin]; }
+inline void digitalWrite(int pin, int level) { hostDigital[pin] = level; }
+inline int analogRead(int pin) { return hostAnalog[pin]; }
+inline void attachInterruptArg(int pin, void (*handler)(void *), void *arg, int mode) {
+  hostIsr[pin] = handler;
+  hostIsrArg[pin] = arg;
+  hostIntrEnabled[pin] = true;
+}
+
+inline void attachInterrupt(int pin, void (*handler)(), int mode) {
+  hostIsrPlain[pin] = handler;
+  hostIntrEnabled[pin] = true;
+}
+
+// Raise the interrupt attached to pin, as a pad touch would
+inline void hostInterrupt(int pin) {
+  if (hostIsr[pin] != NULL) hostIsr[pin](hostIsrArg[pin]);
+  if (hostIsrPlain[pin] != NULL) hostIsrPlain[pin]();
+}
+
+// Native touch peripheral: each pad takes a fresh reading every
+// hostTouchPeriodUs, HOST_TOUCH_UNTOUCHED less the pad's depth (set by the
+// benchmark while it is touched) plus a little scan-to-scan noise. Reading
+// the register costs a microsecond. The per-scan interrupts of a held pad
+// are raised with hostInterrupt().
+const uint16_t HOST_TOUCH_UNTOUCHED = 1000;
+inline uint32_t hostTouchPeriodUs = 2000;
+inline uint16_t hostTouchDepth[HOST_PINS];     // Drop of the reading while touched
+inline uint16_t hostTouchNoise[HOST_PINS];     // Extra reading spread of a noisy pad
+inline uint16_t hostTouchThreshold[HOST_PINS]; // From touchAttachInterruptArg
+inline bool hostTouchWakeup = false;           // esp_sleep_enable_touchpad_wakeup was called
+typedef uint16_t touch_value_t;
+
+inline touch_value_t touchRead(int pin) {
+  hostAdvance(1);
+  uint32_t scan = (uint32_t)(hostMicros / hostTouchPeriodUs);
+  return HOST_TOUCH_UNTOUCHED - hostTouchDepth[pin] + (scan * 2654435761u >> 16) % (5 + hostTouchNoise[pin]); // Scrambled per scan
+}
+inline void touchSetCycles(uint16_t measure, uint16_t sleep) {}
+inline void touchAttachInterruptArg(int pin, void (*handler)(void *), void *arg, touch_value_t threshold) {
+  hostIsr[pin] = handler;
+  hostIsrArg[pin] = arg;
+  hostTouchThreshold[pin] = threshold;
+}
+
+inline uint32_t hostCpuMhz = 240; // Set by setCpuFrequencyMhz
+inline bool setCpuFrequencyMhz(uint32_t mhz) { hostCpuMhz = mhz; return true; }
+inline uint32_t getCpuFrequencyMhz() { return hostCpuMhz; }
+
+// ---- Light sleep and GPIO wake-up ---------------------------------------------
+
+typedef int gpio_num_t;
+typedef enum {
+  GPIO_INTR_DISABLE,
+  GPIO_INTR_POSEDGE,
+  GPIO_INTR_NEGEDGE,
+  GPIO_INTR_ANYEDGE,
+  GPIO_INTR_LOW_LEVEL,
+  GPIO_INTR_HIGH_LEVEL
+} gpio_int_type_t;
+typedef enum {
+  ESP_SLEEP_WAKEUP_UNDEFINED = 0,
+  ESP_SLEEP_WAKEUP_TIMER = 4,
+  ESP_SLEEP_WAKEUP_TOUCHPAD = 5,
+  ESP_SLEEP_WAKEUP_GPIO = 7
+} esp_sleep_wakeup_cause_t;
+
+inline gpio_int_type_t hostWakeLevel[HOST_PINS]; // Wake-up level per pin (GPIO_INTR_DISABLE: none)
+inline uint64_t hostSleepTimerUs;
+inline esp_sleep_wakeup_cause_t hostWakeCause = ESP_SLEEP_WAKEUP_UNDEFINED;
+inline uint64_t hostLightSleeps = 0; // esp_light_sleep_start calls
+inline esp_err_t hostSleepResult = ESP_OK; // What esp_light_sleep_start returns (set by the benchmark)
+inline uint64_t hostLevelStorms = 0;      // Light sleeps entered with a wake-up level on an enabled interrupt
+
+inline esp_err_t gpio_wakeup_enable(gpio_num_t pin, gpio_int_type_t level) { hostWakeLevel[pin] = level; return ESP_OK; }
+inline esp_err_t gpio_wakeup_disable(gpio_num_t pin) { hostWakeLevel[pin] = GPIO_INTR_DISABLE; return ESP_OK; }
+inline esp_err_t gpio_set_intr_type(gpio_num_t pin, gpio_int_type_t type) { return ESP_OK; }
+inline uint32_t hostLastLevelSet = 0; // Level of the latest gpio_set_level
+inline esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level) {
+  hostDigital[pin] = level;
+  hostLastLevelSet = level;
+  return ESP_OK;
+}
+inline esp_err_t gpio_intr_disable(gpio_num_t pin) { hostIntrEnabled[pin] = false; return ESP_OK; }
+inline esp_err_t gpio_intr_enable(gpio_num_t pin) { hostIntrEnabled[pin] = true; return ESP_OK; }
+inline esp_err_t esp_sleep_enable_gpio_wakeup() { return ESP_OK; }
+inline esp_err_t esp_sleep_enable_touchpad_wakeup() { hostTouchWakeup = true; return ESP_OK; }
+
+// The Bluetooth controller: stopped unless the benchmark says otherwise (the
+// mocked stacks need none)
+typedef enum {
+  ESP_BT_CONTROLLER_STATUS_IDLE,
+  ESP_BT_CONTROLLER_STATUS_INITED,
+  ESP_BT_CONTROLLER_STATUS_ENABLED
+} esp_bt_controller_status_t;
+inline esp_bt_controller_status_t hostBtControllerStatus = ESP_BT_CONTROLLER_STATUS_IDLE;
+inline esp_bt_controller_status_t esp_bt_controller_get_status() { return hostBtControllerStatus; }
+inline esp_err_t esp_sleep_enable_timer_wakeup(uint64_t micros) { hostSleepTimerUs = micros; return ESP_OK; }
+inline esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause() { return hostWakeCause; }
+
+// Light sleep returns at once if a wake-up pin is at its level (or a native
+// pad reads below its threshold), otherwise when the timer runs out (timers
+// that fell due fire on the way out)
+inline esp_err_t esp_light_sleep_start() {
+  hostLightSleeps++;
+  for (int pin = 0; pin < HOST_PINS; pin++) {
+    if (hostWakeLevel[pin] != GPIO_INTR_DISABLE && hostIntrEnabled[pin]) hostLevelStorms++; // Would interrupt until released
+  }
+  if (hostSleepResult != ESP_OK) return hostSleepResult;
+  for (int pin = 0; pin < HOST_PINS; pin++) {
+    if ((hostWakeLevel[pin] == GPIO_INTR_LOW_LEVEL && hostDigital[pin] == LOW) ||
+        (hostWakeLevel[pin] == GPIO_INTR_HIGH_LEVEL && hostDigital[pin] == HIGH)) {
+      hostWakeCause = ESP_SLEEP_WAKEUP_GPIO;
+      return ESP_OK;
+    }
+    if (hostTouchWakeup && hostTouchThreshold[pin] != 0 && HOST_TOUCH_UNTOUCHED - hostTouchDepth[pin] < hostTouchThreshold[pin]) {
+      hostWakeCause = ESP_SLEEP_WAKEUP_TOUCHPAD;
+      return ESP_OK;
+    }
+  }
+  hostWakeCause = ESP_SLEEP_WAKEUP_TIMER;
+  hostAdvance((int64_t)hostSleepTimerUs);
+  return ESP_OK;
+}
+
+inline uint32_t hostRandomState = 1; // Fixed seed: every run sees the same phases
+inline long random(long low, long high) {
+  hostRandomState = hostRandomState * 1103515245u + 12345u;
+  return low + (long)((hostRandomState >> 8) % (uint32_t)(high - low));
+}
+inline uint32_t esp_random() {
+  hostRandomState = hostRandomState * 1103515245u + 12345u;
+  return hostRandomState;
+}
+
+// Output half of Arduino's Print, enough for the sketch's print/println/printf
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t byte) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; i++) write(buffer[i]);
+    return size;
+  }
+  size_t write(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+  size_t print(const char *text) { return write(text); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int value) { return printf("%d", value); }
+  size_t print(unsigned int value) { return printf("%u", value); }
+  size_t print(long value) { return printf("%ld", value); }
+  size_t print(unsigned long value) { return printf("%lu", value); }
+  size_t println() { return write("\r\n"); }
+  template <typename T> size_t println(T value) { return print(value) + println(); }
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (length < 0) return 0;
+    return write((const uint8_t *)text, (size_t)length < sizeof(text) ? length : sizeof(text) - 1);
+  }
+  virtual int availableForWrite() { return 0; }
+};
+
+// Input half of Arduino's Stream
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  size_t readBytesUntil(char terminator, char *buffer, size_t length) {
+    size_t count = 0;
+    while (count < length && available()) {
+      int c = read();
+      if (c == terminator) break;
+      buffer[count++] = (char)c;
+    }
+    return count;
+  }
+};
+
+// Arduino String, as far as the web handlers use it
+class String {
+ public:
+  String(const char *text = "") : text(text) {}
+  String(const std::string &text) : text(text) {}
+  const char *c_str() const { return text.c_str(); }
+  size_t length() const { return text.size(); }
+  String operator+(const String &other) const { return String(text + other.text); }
+  String operator+(const char *other) const { return String(text + other); }
+  String operator+(int number) const { return String(text + std::to_string(number)); }
+  String operator+(unsigned int number) const { return String(text + std::to_string(number)); }
+  String operator+(long number) const { return String(text + std::to_string(number)); }
+  String operator+(unsigned long number) const { return String(text + std::to_string(number)); }
+
+  std::string text;
+};
+
+// UART: output is counted and discarded (the sketch logs nothing by default)
+class HardwareSerial : public Stream {
+ public:
+  void begin(unsigned long baud) {}
+  size_t setTxBufferSize(size_t size) { return size; }
+  size_t write(uint8_t byte) override { bytesWritten++; return 1; }
+  using Print::write;
+  int availableForWrite() override { return 1 << 16; }
+  void flush() {}
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  uint64_t bytesWritten = 0;
+};
+inline HardwareSerial Serial;
+
+// ESP.getCycleCount(): host nanoseconds stand in for CPU cycles, so the
+// profiler's "cycles" read as nanoseconds at a nominal 1000 MHz. ESP.restart()
+// returns: it counts the reboot and runs onRestart, for the benchmark to look
+// at the state the board would reboot with.
+struct EspClass {
+  uint32_t getCycleCount() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+  uint32_t getCpuFreqMHz() { return 1000; }
+  void restart() {
+    restarts++;
+    if (onRestart) onRestart();
+  }
+
+  int restarts = 0;
+  std::function<void()> onRestart;
+};
+inline EspClass ESP;
+
+// ---- FreeRTOS ---------------------------------------------------------------
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY 0xFFFFFFFFu
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms)) // 1 ms ticks
+#define portTICK_PERIOD_MS 1
+
+typedef struct { int unused; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+// The other tasks, for a wait that only they could end: a send to a full
+// queue (or a take of an empty binary semaphore) that may wait runs this once
+// (if the benchmark set it) and tries again, as the task it waits for would
+// have run in the meantime.
+inline std::function<void()> hostOtherTasks;
+inline bool hostOtherTasksRunning = false;
+inline void hostRunOtherTasks() {
+  if (!hostOtherTasks || hostOtherTasksRunning) return;
+  hostOtherTasksRunning = true;
+  hostOtherTasks();
+  hostOtherTasksRunning = false;
+}
+
+// Fixed-size item queue. Never blocks: an empty receive (or a full send)
+// with a finite wait advances the clock by the wait instead, as the sleeping
+// task would see.
+struct HostQueue {
+  size_t itemSize;
+  size_t capacity;
+  std::deque<std::vector<uint8_t>> items;
+};
+typedef HostQueue *QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  return new HostQueue{itemSize, length, {}};
+}
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait) {
+  if (queue->items.size() >= queue->capacity && wait > 0) hostRunOtherTasks();
+  if (queue->items.size() >= queue->capacity) {
+    if (wait != portMAX_DELAY) hostAdvance((int64_t)wait * 1000);
+    return pdFALSE;
+  }
+  const uint8_t *bytes = (const uint8_t *)item;
+  queue->items.emplace_back(bytes, bytes + queue->itemSize);
+  return pdTRUE;
+}
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait) {
+  if (queue->items.empty()) {
+    if (wait != portMAX_DELAY) hostAdvance((int64_t)wait * 1000);
+    return pdFALSE;
+  }
+  memcpy(item, queue->items.front().data(), queue->itemSize);
+  queue->items.pop_front();
+  return pdTRUE;
+}
+
+inline BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken) {
+  return xQueueSend(queue, item, 0);
+}
+#define portYIELD_FROM_ISR(...) ((void)0)
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) { return queue->items.size(); }
+
+// Mutexes count their holders. A take that may wait always succeeds (there is
+// no other task to wait for); one with no wait fails while the count is
+// above zero, so the benchmark can play another task by incrementing it.
+// A binary semaphore starts empty; a take that may wait for a give runs the
+// other tasks once, and without one in time advances the clock by the wait.
+struct HostSemaphore {
+  int count;   // Holders of a mutex; 1 while a binary semaphore is given
+  bool binary;
+};
+typedef HostSemaphore *SemaphoreHandle_t;
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return new HostSemaphore{0, false}; }
+inline SemaphoreHandle_t xSemaphoreCreateBinary() { return new HostSemaphore{0, true}; }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait) {
+  if (!semaphore->binary) {
+    if (wait == 0 && semaphore->count > 0) return pdFALSE;
+    semaphore->count++;
+    return pdTRUE;
+  }
+  if (semaphore->count == 0 && wait > 0) hostRunOtherTasks();
+  if (semaphore->count == 0) {
+    if (wait != portMAX_DELAY) hostAdvance((int64_t)wait * 1000);
+    return pdFALSE;
+  }
+  semaphore->count = 0;
+  return pdTRUE;
+}
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  semaphore->count = semaphore->binary ? 1 : semaphore->count - 1;
+  return pdTRUE;
+}
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+// Tasks are not run on the host; the benchmark calls the service functions
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack, void *parameter,
+                                          UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+  return pdTRUE;
+}
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return NULL; } // One task, which never waits on a queue
+
+// ---- I2C and SSD1306 --------------------------------------------------------
+
+class TwoWire {
+ public:
+  void beginTransmission(uint8_t address) {}
+  size_t write(uint8_t byte) { bytesSent++; return 1; }
+  size_t write(const uint8_t *buffer, size_t size) { bytesSent += size; return size; }
+  uint8_t endTransmission() { transactions++; return 0; }
+  uint64_t bytesSent = 0;    // Bytes that would have crossed the bus
+  uint64_t transactions = 0; // I2C transactions
+};
+inline TwoWire Wire;
+
+#define SSD1306_SWITCHCAPVCC 0x02
+#define SSD1306_WHITE 1
+#define SSD1306_PAGEADDR 0x22
+#define SSD1306_COLUMNADDR 0x21
+#define SSD1306_DISPLAYOFF 0xAE
+#define SSD1306_DISPLAYON 0xAF
+
+// Framebuffer-only SSD1306. Text is "drawn" as one 6x8 cell per character
+// (a byte pattern derived from the character), which is enough for the
+// sketch's dirty-span logic to see realistic changes.
+class Adafruit_SSD1306 : public Print {
+ public:
+  Adafruit_SSD1306(int width, int height, TwoWire *wire, int resetPin, uint32_t clockDuring, uint32_t clockAfter)
+      : width(width), height(height), wire(wire), buffer(width * height / 8) {}
+  bool begin(uint8_t vcc, uint8_t address) { return true; }
+  void display() { wire->write(buffer.data(), buffer.size()); wire->endTransmission(); }
+  void clearDisplay() { memset(buffer.data(), 0, buffer.size()); }
+  void setTextColor(int color) {}
+  void setTextSize(int size) { textSize = size; }
+  void setCursor(int x, int y) { cursorX = x; cursorY = y; }
+  uint8_t *getBuffer() { return buffer.data(); }
+  void ssd1306_command(uint8_t command) { wire->write(command); wire->endTransmission(); }
+  size_t write(uint8_t c) override {
+    if (c == '\n') {
+      cursorX = 0;
+      cursorY += 8 * textSize;
+      return 1;
+    }
+    if (c == '\r') return 1;
+    int page = cursorY / 8;
+    for (int column = 0; column < 6 * textSize && page < height / 8; column++) {
+      int x = cursorX + column;
+      if (x < width) buffer[page * width + x] = (uint8_t)(c * (column + 1));
+    }
+    cursorX += 6 * textSize;
+    return 1;
+  }
+  using Print::write;
+
+ private:
+  int width;
+  int height;
+  TwoWire *wire;
+  std::vector<uint8_t> buffer;
+  int textSize = 1;
+  int cursorX = 0;
+  int cursorY = 0;
+};
+
+// ---- SPI TFT -----------------------------------------------------------------
+
+// 1-bit Adafruit_GFX canvas. Text is "drawn" as one 6x8 cell per character,
+// scaled by the text size, with a pixel pattern derived from the character
+// (as the SSD1306 mock does).
+class GFXcanvas1 : public Print {
+ public:
+  GFXcanvas1(int width, int height) : width(width), height(height), buffer((width + 7) / 8 * height) {}
+  uint8_t *getBuffer() { return buffer.data(); }
+  void fillScreen(uint16_t color) { memset(buffer.data(), color ? 0xFF : 0, buffer.size()); }
+  void drawPixel(int x, int y, uint16_t color) {
+    if (x < 0 || y < 0 || x >= width || y >= height) return;
+    uint8_t &byte = buffer[y * ((width + 7) / 8) + x / 8];
+    if (color) {
+      byte |= 0x80 >> (x & 7);
+    } else {
+      byte &= ~(0x80 >> (x & 7));
+    }
+  }
+  void fillCircle(int x0, int y0, int r, uint16_t color) {
+    for (int y = -r; y <= r; y++) {
+      for (int x = -r; x <= r; x++) {
+        if (x * x + y * y <= r * r) drawPixel(x0 + x, y0 + y, color);
+      }
+    }
+  }
+  void setTextColor(uint16_t color) {}
+  void setTextSize(int size) { textSize = size; }
+  void setCursor(int x, int y) { cursorX = x; cursorY = y; }
+  size_t write(uint8_t c) override {
+    if (c == '\n') {
+      cursorX = 0;
+      cursorY += 8 * textSize;
+      return 1;
+    }
+    if (c == '\r') return 1;
+    for (int column = 0; column < 6 * textSize; column++) {
+      uint8_t pattern = (uint8_t)(c * (column / textSize + 1));
+      for (int row = 0; row < 8 * textSize; row++) {
+        if (pattern & (1 << (row / textSize))) drawPixel(cursorX + column, cursorY + row, 1);
+      }
+    }
+    cursorX += 6 * textSize;
+    return 1;
+  }
+  using Print::write;
+
+ private:
+  int width;
+  int height;
+  std::vector<uint8_t> buffer;
+  int textSize = 1;
+  int cursorX = 0;
+  int cursorY = 0;
+};
+
+#define MALLOC_CAP_DMA (1 << 3)
+inline void *heap_caps_malloc(size_t size, uint32_t caps) { return malloc(size); }
+
+typedef enum { SPI1_HOST, SPI2_HOST, SPI3_HOST } spi_host_device_t;
+#define SPI_DMA_CH_AUTO 3
+#define SPI_TRANS_USE_TXDATA (1 << 2)
+#define SPI_DEVICE_HALFDUPLEX (1 << 4)
+struct spi_bus_config_t {
+  int mosi_io_num;
+  int miso_io_num;
+  int sclk_io_num;
+  int quadwp_io_num;
+  int quadhd_io_num;
+  int max_transfer_sz;
+  uint32_t flags;
+};
+struct spi_transaction_t {
+  uint32_t flags;
+  size_t length; // Bits
+  void *user;
+  union {
+    const void *tx_buffer;
+    uint8_t tx_data[4];
+  };
+};
+typedef void (*transaction_cb_t)(spi_transaction_t *);
+struct spi_device_interface_config_t {
+  uint8_t mode;
+  int clock_speed_hz;
+  int spics_io_num;
+  uint32_t flags;
+  int queue_size;
+  transaction_cb_t pre_cb;
+};
+
+// The panel on the SPI bus: a 320x240 RGB565 controller that understands
+// CASET, RASET and RAMWR, so the benchmark can look at the pixels it shows.
+// Each transfer is data or a command by the D/C level its pre-callback sets.
+struct HostTftPanel {
+  static const int WIDTH = 320;
+  static const int HEIGHT = 240;
+  std::vector<uint16_t> pixels = std::vector<uint16_t>(WIDTH * HEIGHT);
+  uint8_t command = 0;
+  std::vector<uint8_t> arguments;
+  int x0 = 0, x1 = WIDTH - 1, y0 = 0, y1 = HEIGHT - 1;
+  int x = 0, y = 0;
+  uint8_t pixelHigh = 0;    // First byte of a pixel split across transfers
+  bool pixelHalf = false;
+  uint64_t pixelBytes = 0;  // RAMWR bytes received
+  uint64_t commands = 0;
+
+  void receive(bool data, const uint8_t *bytes, size_t count) {
+    if (!data) {
+      command = bytes[0];
+      arguments.clear();
+      commands++;
+      if (command == 0x2C) { // RAMWR
+        x = x0;
+        y = y0;
+        pixelHalf = false;
+      }
+      return;
+    }
+    if (command != 0x2C) {
+      arguments.insert(arguments.end(), bytes, bytes + count);
+      if (arguments.size() == 4 && (command == 0x2A || command == 0x2B)) {
+        int first = arguments[0] << 8 | arguments[1];
+        int last = arguments[2] << 8 | arguments[3];
+        if (command == 0x2A) {
+          x0 = first;
+          x1 = last;
+        } else {
+          y0 = first;
+          y1 = last;
+        }
+      }
+      return;
+    }
+    pixelBytes += count;
+    for (size_t i = 0; i < count; i++) {
+      if (!pixelHalf) {
+        pixelHigh = bytes[i];
+        pixelHalf = true;
+        continue;
+      }
+      pixelHalf = false;
+      if (x < WIDTH && y < HEIGHT) pixels[y * WIDTH + x] = (uint16_t)(pixelHigh << 8 | bytes[i]); // Big-endian on the wire
+      if (++x > x1) {
+        x = x0;
+        y++;
+      }
+    }
+  }
+  uint16_t at(int px, int py) const { return pixels[py * WIDTH + px]; }
+};
+inline HostTftPanel hostTft;
+
+// Transfers complete as soon as they are queued
+struct HostSpiDevice {
+  spi_device_interface_config_t config;
+  std::deque<spi_transaction_t *> done;
+};
+typedef HostSpiDevice *spi_device_handle_t;
+inline void hostSpiTransfer(spi_device_handle_t device, spi_transaction_t *transfer) {
+  if (device->config.pre_cb != NULL) device->config.pre_cb(transfer);
+  const uint8_t *bytes = (transfer->flags & SPI_TRANS_USE_TXDATA) ? transfer->tx_data : (const uint8_t *)transfer->tx_buffer;
+  hostTft.receive(hostLastLevelSet != 0, bytes, transfer->length / 8);
+}
+inline esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *bus, int dma) { return ESP_OK; }
+inline esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *config,
+                                    spi_device_handle_t *device) {
+  *device = new HostSpiDevice{*config, {}};
+  return ESP_OK;
+}
+inline esp_err_t spi_device_polling_transmit(spi_device_handle_t device, spi_transaction_t *transfer) {
+  hostSpiTransfer(device, transfer);
+  return ESP_OK;
+}
+inline esp_err_t spi_device_queue_trans(spi_device_handle_t device, spi_transaction_t *transfer, TickType_t wait) {
+  hostSpiTransfer(device, transfer);
+  device->done.push_back(transfer);
+  return ESP_OK;
+}
+inline esp_err_t spi_device_get_trans_result(spi_device_handle_t device, spi_transaction_t **transfer, TickType_t wait) {
+  if (device->done.empty()) return -1;
+  *transfer = device->done.front();
+  device->done.pop_front();
+  return ESP_OK;
+}
+
+// ---- Bluetooth --------------------------------------------------------------
+
+// Serial Port Profile link: the benchmark queues client bytes with receive()
+// and inspects (or clears) what the sketch sent
+typedef enum { ESP_SPP_CLOSE_EVT = 27, ESP_SPP_SRV_OPEN_EVT = 34 } esp_spp_cb_event_t;
+typedef union { int unused; } esp_spp_cb_param_t;
+typedef void (*esp_spp_cb_t)(esp_spp_cb_event_t event, esp_spp_cb_param_t *param);
+
+class BluetoothSerial : public Stream {
+ public:
+  bool begin(const char *name) { return true; }
+  esp_err_t register_callback(esp_spp_cb_t handler) { callback = handler; return ESP_OK; }
+  int available() override { return (int)rx.size(); }
+  int read() override {
+    if (rx.empty()) return -1;
+    int c = rx.front();
+    rx.pop_front();
+    return c;
+  }
+  int peek() override { return rx.empty() ? -1 : rx.front(); }
+  size_t write(uint8_t byte) override { return write(&byte, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override {
+    if (keepOutput) tx.insert(tx.end(), buffer, buffer + size);
+    bytesSent += size;
+    return size;
+  }
+  using Print::write;
+
+  void receive(const uint8_t *bytes, size_t size) { rx.insert(rx.end(), bytes, bytes + size); }
+  void receive(const char *text) { receive((const uint8_t *)text, strlen(text)); }
+
+  std::deque<uint8_t> rx;   // Bytes from the client not yet read
+  std::vector<uint8_t> tx;  // Bytes sent, if keepOutput
+  bool keepOutput = false;
+  uint64_t bytesSent = 0;
+  esp_spp_cb_t callback = NULL; // From register_callback; the benchmark raises SPP events through it
+};
+
+// ---- Wi-Fi and ESP-NOW -------------------------------------------------------
+
+// ESP-NOW radio for arena builds: sends are recorded, sends to a board that is
+// not a peer fail as on the board, and the benchmark delivers other boards'
+// packets through the receive callback (and send results through the send one)
+#define WIFI_STA 1
+#define WIFI_AP 2
+#define WIFI_AP_STA 3
+#define WIFI_SECOND_CHAN_NONE 0
+#define ESP_ERR_ESPNOW_NOT_FOUND 0x3069
+struct IPAddress {
+  String toString() const { return String("192.168.4.1"); }
+};
+struct WiFiClass {
+  void mode(int mode) {}
+  bool softAP(const char *ssid, const char *password, int channel = 1) { return true; }
+  IPAddress softAPIP() { return IPAddress(); }
+};
+inline WiFiClass WiFi;
+inline esp_err_t esp_wifi_set_channel(uint8_t channel, int second) { return ESP_OK; }
+
+typedef enum { ESP_NOW_SEND_SUCCESS = 0, ESP_NOW_SEND_FAIL } esp_now_send_status_t;
+struct esp_now_peer_info_t {
+  uint8_t peer_addr[6];
+  uint8_t channel;
+  bool encrypt;
+};
+typedef std::vector<uint8_t> HostMac;
+struct HostNowPacket {
+  HostMac mac;               // Destination
+  std::vector<uint8_t> data;
+};
+inline std::vector<HostMac> hostNowPeers;
+inline std::vector<HostNowPacket> hostNowSent; // Every accepted esp_now_send, oldest first
+inline void (*hostNowReceive)(const uint8_t *, const uint8_t *, int) = NULL;
+inline void (*hostNowSendDone)(const uint8_t *, esp_now_send_status_t) = NULL;
+
+inline esp_err_t esp_now_init() { return ESP_OK; }
+inline esp_err_t esp_now_register_recv_cb(void (*callback)(const uint8_t *, const uint8_t *, int)) {
+  hostNowReceive = callback;
+  return ESP_OK;
+}
+inline esp_err_t esp_now_register_send_cb(void (*callback)(const uint8_t *, esp_now_send_status_t)) {
+  hostNowSendDone = callback;
+  return ESP_OK;
+}
+inline esp_err_t esp_now_add_peer(const esp_now_peer_info_t *peer) {
+  hostNowPeers.push_back(HostMac(peer->peer_addr, peer->peer_addr + 6));
+  return ESP_OK;
+}
+inline esp_err_t esp_now_del_peer(const uint8_t *mac) {
+  for (auto peer = hostNowPeers.begin(); peer != hostNowPeers.end(); ++peer) {
+    if (memcmp(peer->data(), mac, 6) == 0) {
+      hostNowPeers.erase(peer);
+      return ESP_OK;
+    }
+  }
+  return ESP_ERR_ESPNOW_NOT_FOUND;
+}
+inline esp_err_t esp_now_send(const uint8_t *mac, const uint8_t *data, size_t length) {
+  for (const HostMac &peer : hostNowPeers) {
+    if (memcmp(peer.data(), mac, 6) != 0) continue;
+    hostNowSent.push_back({peer, std::vector<uint8_t>(data, data + length)});
+    return ESP_OK;
+  }
+  return ESP_ERR_ESPNOW_NOT_FOUND;
+}
+
+// BLE GATT server (NimBLE-Arduino). Characteristics keep their value and,
+// with keepOutput, the bytes they notified; the benchmark plays the client by
+// writing the command characteristic (clientWrite) and raising connection
+// events through the server's callbacks.
+#define BLE_HS_CONN_HANDLE_NONE 0xFFFF
+struct ble_gap_conn_desc {
+  uint16_t conn_handle;
+};
+namespace NIMBLE_PROPERTY {
+enum : uint32_t { READ = 0x02, WRITE_NR = 0x04, WRITE = 0x08, NOTIFY = 0x10 };
+}
+class NimBLECharacteristic;
+class NimBLEServer;
+class NimBLECharacteristicCallbacks {
+ public:
+  virtual ~NimBLECharacteristicCallbacks() {}
+  virtual void onWrite(NimBLECharacteristic *characteristic) {}
+};
+class NimBLEServerCallbacks {
+ public:
+  virtual ~NimBLEServerCallbacks() {}
+  virtual void onConnect(NimBLEServer *server, ble_gap_conn_desc *desc) {}
+  virtual void onDisconnect(NimBLEServer *server) {}
+  virtual void onMTUChange(uint16_t mtu, ble_gap_conn_desc *desc) {}
+};
+
+class NimBLECharacteristic {
+ public:
+  explicit NimBLECharacteristic(const char *uuid) : uuid(uuid) {}
+  void setCallbacks(NimBLECharacteristicCallbacks *handler) { callbacks = handler; }
+  void setValue(const uint8_t *data, size_t length) {
+    value.assign((const char *)data, length);
+    if (length > largestValue) largestValue = length;
+  }
+  std::string getValue() { return value; }
+  void notify(bool response = true) {
+    if (keepOutput) sent.insert(sent.end(), value.begin(), value.end());
+    bytesSent += value.size();
+    notifications++;
+  }
+
+  void clientWrite(const uint8_t *bytes, size_t size) {
+    value.assign((const char *)bytes, size);
+    if (callbacks != NULL) callbacks->onWrite(this);
+  }
+
+  std::string uuid;
+  std::string value;
+  std::vector<uint8_t> sent; // Notified bytes, if keepOutput
+  bool keepOutput = false;
+  uint64_t bytesSent = 0;
+  uint64_t notifications = 0;
+  size_t largestValue = 0;   // Longest setValue so far
+  NimBLECharacteristicCallbacks *callbacks = NULL;
+};
+inline std::vector<NimBLECharacteristic *> hostBleCharacteristics; // Every characteristic created
+
+// The characteristic with uuid, or NULL
+inline NimBLECharacteristic *hostBleCharacteristic(const char *uuid) {
+  for (NimBLECharacteristic *characteristic : hostBleCharacteristics) {
+    if (characteristic->uuid == uuid) return characteristic;
+  }
+  return NULL;
+}
+
+class NimBLEService {
+ public:
+  NimBLECharacteristic *createCharacteristic(const char *uuid, uint32_t properties) {
+    hostBleCharacteristics.push_back(new NimBLECharacteristic(uuid));
+    return hostBleCharacteristics.back();
+  }
+  bool start() { return true; }
+};
+class NimBLEServer {
+ public:
+  void setCallbacks(NimBLEServerCallbacks *handler, bool deleteCallbacks = true) { callbacks = handler; }
+  NimBLEService *createService(const char *uuid) { return new NimBLEService; }
+  void setDataLen(uint16_t handle, uint16_t length) {}
+  void updateConnParams(uint16_t handle, uint16_t minInterval, uint16_t maxInterval, uint16_t latency,
+                        uint16_t timeout) {}
+
+  NimBLEServerCallbacks *callbacks = NULL;
+};
+class NimBLEAdvertising {
+ public:
+  void addServiceUUID(const char *uuid) {}
+  bool start() { return true; }
+};
+inline NimBLEServer *hostBleServer = NULL; // From NimBLEDevice::createServer
+struct NimBLEDevice {
+  static void init(const std::string &name) {}
+  static void setMTU(uint16_t mtu) {}
+  static NimBLEServer *createServer() { return hostBleServer = new NimBLEServer; }
+  static NimBLEAdvertising *getAdvertising() {
+    static NimBLEAdvertising advertising;
+    return &advertising;
+  }
+};
+
+// ---- Web server -------------------------------------------------------------
+
+// ESPAsyncWebServer for WEB_ENABLED builds: the server keeps its routes, and
+// the benchmark serves a request through them with hostWebServe() and pulls a
+// streamed response with hostWebRead(). WebSocket messages are recorded.
+enum WebRequestMethod { HTTP_GET = 1, HTTP_POST = 2 };
+#define RESPONSE_TRY_AGAIN 0xFFFFFFFF
+typedef std::function<size_t(uint8_t *, size_t, size_t)> AwsResponseFiller;
+
+class AsyncClient {
+ public:
+  void close() { closed = true; }
+  bool closed = false;
+};
+
+class AsyncWebServerResponse {
+ public:
+  AsyncWebServerResponse(int code, const char *type, const char *body, size_t length, AwsResponseFiller filler)
+      : code(code), contentType(type), body(body), contentLength(length), filler(filler) {}
+  void setCode(int code) { this->code = code; }
+  void addHeader(const String &name, const String &value) { headers[name.text] = value.text; }
+
+  int code;
+  std::string contentType;
+  std::string body;          // Sent whole, unless...
+  size_t contentLength;
+  AwsResponseFiller filler;  // ...streamed from a callback
+  size_t sent = 0;           // Bytes pulled from the callback so far
+  std::map<std::string, std::string> headers;
+};
+
+class AsyncWebParameter {
+ public:
+  AsyncWebParameter(const String &name, const String &value) : parameterName(name), parameterValue(value) {}
+  const String &name() const { return parameterName; }
+  const String &value() const { return parameterValue; }
+
+ private:
+  String parameterName;
+  String parameterValue;
+};
+
+class AsyncWebServerRequest {
+ public:
+  bool authenticate(const char *user, const char *password) {
+    return !this->user.empty() && this->user == user && this->password == password;
+  }
+  void requestAuthentication() { send(401, "text/plain", ""); }
+  size_t params() const { return parameters.size(); }
+  AsyncWebParameter *getParam(size_t index) { return &parameters[index]; }
+  bool hasParam(const char *name) {
+    for (AsyncWebParameter &parameter : parameters) {
+      if (parameter.name().text == name) return true;
+    }
+    return false;
+  }
+  bool hasHeader(const char *name) { return headers.count(name) > 0; }
+  String header(const char *name) { return headers.count(name) > 0 ? String(headers[name]) : String(); }
+  void onDisconnect(std::function<void()> callback) { disconnected = callback; }
+  AsyncClient *client() { return &connection; }
+  AsyncWebServerResponse *beginResponse(int code) { return new AsyncWebServerResponse(code, "", "", 0, nullptr); }
+  AsyncWebServerResponse *beginResponse(const char *type, size_t length, AwsResponseFiller filler) {
+    return new AsyncWebServerResponse(200, type, "", length, filler);
+  }
+  void send(AsyncWebServerResponse *response) { this->response.reset(response); }
+  void send(int code, const char *type, const char *body) {
+    send(new AsyncWebServerResponse(code, type, body, strlen(body), nullptr));
+  }
+  void send_P(int code, const char *type, const char *body) { send(code, type, body); }
+
+  // Set by the benchmark before serving the request
+  std::map<std::string, std::string> headers;
+  std::vector<AsyncWebParameter> parameters;
+  std::string user;     // Basic auth credentials sent (empty: none)
+  std::string password;
+  // Left by the sketch
+  std::unique_ptr<AsyncWebServerResponse> response; // What was sent (null: nothing)
+  std::function<void()> disconnected;
+  AsyncClient connection;
+};
+
+enum AwsEventType { WS_EVT_CONNECT, WS_EVT_DISCONNECT, WS_EVT_PONG, WS_EVT_ERROR, WS_EVT_DATA };
+class AsyncWebSocketClient {
+ public:
+  explicit AsyncWebSocketClient(uint32_t id) : clientId(id) {}
+  uint32_t id() { return clientId; }
+
+ private:
+  uint32_t clientId;
+};
+class AsyncWebSocket;
+typedef std::function<void(AsyncWebSocket *, AsyncWebSocketClient *, AwsEventType, void *, uint8_t *, size_t)>
+    AwsEventHandler;
+class AsyncWebHandler {};
+class AsyncWebSocket : public AsyncWebHandler {
+ public:
+  explicit AsyncWebSocket(const char *url) {}
+  void onEvent(AwsEventHandler handler) { this->handler = handler; }
+  void textAll(const char *message) { sent.push_back({0, message}); }
+  void text(uint32_t client, const char *message) { sent.push_back({client, message}); }
+  void cleanupClients() {}
+  void hostConnect(uint32_t id) { // A spectator screen connects
+    AsyncWebSocketClient client(id);
+    handler(this, &client, WS_EVT_CONNECT, NULL, NULL, 0);
+  }
+
+  AwsEventHandler handler;
+  std::vector<std::pair<uint32_t, std::string>> sent; // (client, message); client 0: to all
+};
+
+typedef std::function<void(AsyncWebServerRequest *)> ArRequestHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest *, const String &, size_t, uint8_t *, size_t, bool)>
+    ArUploadHandlerFunction;
+struct HostWebRoute {
+  std::string path;
+  int method;
+  ArRequestHandlerFunction onRequest;
+  ArUploadHandlerFunction onUpload;
+};
+class AsyncWebServer {
+ public:
+  explicit AsyncWebServer(uint16_t port) {}
+  void addHandler(AsyncWebHandler *handler) {}
+  void on(const char *path, int method, ArRequestHandlerFunction onRequest, ArUploadHandlerFunction onUpload = nullptr) {
+    routes.push_back({path, method, onRequest, onUpload});
+  }
+  void begin() {}
+
+  std::vector<HostWebRoute> routes;
+};
+
+// Serve request as the server would: the route's upload handler gets body in
+// pieces of piece bytes, then its request handler answers. False if no route
+// matches.
+inline bool hostWebServe(AsyncWebServer &server, AsyncWebServerRequest &request, int method, const char *path,
+                         std::vector<uint8_t> body = {}, size_t piece = 1436) {
+  for (HostWebRoute &route : server.routes) {
+    if (route.method != method || route.path != path) continue;
+    for (size_t index = 0; route.onUpload && index < body.size(); index += piece) {
+      size_t length = body.size() - index < piece ? body.size() - index : piece;
+      route.onUpload(&request, String("firmware.bin"), index, body.data() + index, length, index + length == body.size());
+    }
+    route.onRequest(&request);
+    return true;
+  }
+  return false;
+}
+
+// Pull up to limit more bytes of request's response, as the server fills its
+// send buffer: a streamed response stops at its length, once the connection
+// is closed, or when the callback had nothing three times in a row (which on
+// the board would leave the client waiting)
+inline std::string hostWebRead(AsyncWebServerRequest &request, size_t limit = SIZE_MAX, size_t chunk = 1436) {
+  AsyncWebServerResponse *response = request.response.get();
+  if (response == nullptr) return "";
+  if (!response->filler) return response->body;
+  std::string body;
+  std::vector<uint8_t> buffer(chunk);
+  for (int idle = 0; idle < 3 && body.size() < limit && response->sent < response->contentLength &&
+                     !request.connection.closed;) {
+    size_t length = response->filler(buffer.data(), limit - body.size() < chunk ? limit - body.size() : chunk, response->sent);
+    if (length == 0 || length == RESPONSE_TRY_AGAIN) {
+      idle++;
+      continue;
+    }
+    idle = 0;
+    body.append((const char *)buffer.data(), length);
+    response->sent += length;
+  }
+  return body;
+}
+
+// ---- SD card ----------------------------------------------------------------
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+typedef std::vector<uint8_t> HostFileData;
+
+// Open file on the in-memory card. Files share their data with the card, so
+// several handles to one path see each other's writes, as on FAT.
+class File : public Stream {
+ public:
+  File() {}
+  File(std::shared_ptr<HostFileData> data, bool append) : data(data), position(append ? data->size() : 0) {}
+  explicit operator bool() const { return data != nullptr; }
+  size_t write(uint8_t byte) override { return write(&byte, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override {
+    if (!data) return 0;
+    if (position + size > data->size()) data->resize(position + size);
+    memcpy(data->data() + position, buffer, size);
+    position += size;
+    return size;
+  }
+  using Print::write;
+  size_t read(uint8_t *buffer, size_t size) {
+    if (!data || position >= data->size()) return 0;
+    size_t count = data->size() - position < size ? data->size() - position : size;
+    memcpy(buffer, data->data() + position, count);
+    position += count;
+    return count;
+  }
+  int read() override {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+  }
+  int peek() override { return data && position < data->size() ? (*data)[position] : -1; }
+  int available() override { return data && position < data->size() ? (int)(data->size() - position) : 0; }
+  bool seek(uint32_t offset) {
+    if (!data || offset > data->size()) return false;
+    position = offset;
+    return true;
+  }
+  size_t size() const { return data ? data->size() : 0; }
+  void flush() {}
+  void close() { data.reset(); }
+
+ private:
+  std::shared_ptr<HostFileData> data;
+  size_t position = 0;
+};
+
+class SDClass {
+ public:
+  bool begin(int csPin) { return present; }
+  uint64_t totalBytes() { return capacity; }
+  uint64_t usedBytes() {
+    uint64_t used = 0;
+    for (auto &file : files) used += file.second->size();
+    return used;
+  }
+  bool exists(const char *path) { return files.count(path) != 0; }
+  File open(const char *path, const char *mode) {
+    auto found = files.find(path);
+    if (mode[0] == 'r') {
+      return found == files.end() ? File() : File(found->second, false);
+    }
+    if (found == files.end() || mode[0] == 'w') { // "w" truncates, as on the ESP32 SD library
+      found = files.insert_or_assign(path, std::make_shared<HostFileData>()).first;
+    }
+    return File(found->second, mode[0] == 'a');
+  }
+  bool remove(const char *path) { return files.erase(path) != 0; }
+  bool rename(const char *from, const char *to) {
+    auto found = files.find(from);
+    if (found == files.end()) return false;
+    files[to] = found->second;
+    files.erase(found);
+    return true;
+  }
+
+  std::map<std::string, std::shared_ptr<HostFileData>> files; // The card's contents
+  uint64_t capacity = 4ull << 30; // 4 GB card
+  bool present = true;            // false: SD.begin() fails
+};
+inline SDClass SD;
+
+// ---- NVS and OTA ------------------------------------------------------------
+// Preferences keeps one namespace of values in memory, so settings
+// survive a second setup() the way NVS keeps them across reboots. The board
+// has two app partitions; the first one runs.
+class Preferences {
+ public:
+  bool begin(const char *name, bool readOnly = false) { return true; }
+  void end() {}
+  uint32_t getUInt(const char *key, uint32_t defaultValue = 0) {
+    auto found = values.find(key);
+    return found == values.end() ? defaultValue : found->second;
+  }
+  size_t putUInt(const char *key, uint32_t value) {
+    values[key] = value;
+    return sizeof(value);
+  }
+  size_t getString(const char *key, char *value, size_t size) {
+    auto found = strings.find(key);
+    if (found == strings.end() || found->second.size() >= size) return 0;
+    memcpy(value, found->second.c_str(), found->second.size() + 1);
+    return found->second.size() + 1;
+  }
+  size_t putString(const char *key, const char *value) {
+    strings[key] = value;
+    return strlen(value);
+  }
+  size_t getBytes(const char *key, void *buffer, size_t size) {
+    auto found = strings.find(key);
+    if (found == strings.end() || found->second.size() > size) return 0;
+    memcpy(buffer, found->second.data(), found->second.size());
+    return found->second.size();
+  }
+  size_t putBytes(const char *key, const void *value, size_t size) {
+    strings[key] = std::string((const char *)value, size);
+    return size;
+  }
+  bool clear() {
+    values.clear();
+    strings.clear();
+    return true;
+  }
+
+  std::map<std::string, uint32_t> values;     // The namespace's contents: integers
+  std::map<std::string, std::string> strings; // and strings and byte blobs
+};
+
+struct esp_partition_t { char label[17]; };
+inline esp_partition_t hostAppPartitions[2] = {{"app0"}, {"app1"}};
+inline const esp_partition_t *esp_ota_get_running_partition() { return &hostAppPartitions[0]; }
+inline const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start) { return &hostAppPartitions[1]; }
+inline esp_err_t esp_ota_mark_app_valid_cancel_rollback() { return ESP_OK; }
+
+// Update: the image written to the idle app partition, kept for the benchmark
+#define UPDATE_SIZE_UNKNOWN 0xFFFFFFFF
+class UpdateClass {
+ public:
+  bool begin(size_t size) {
+    if (running) return false;
+    running = true;
+    finished = false;
+    error = false;
+    image.clear();
+    return true;
+  }
+  size_t write(uint8_t *data, size_t length) {
+    if (!running) return 0;
+    image.insert(image.end(), data, data + length);
+    return length;
+  }
+  bool end(bool evenIfRemaining = false) {
+    if (!running) return false;
+    running = false;
+    finished = true;
+    return true;
+  }
+  void abort() {
+    running = false;
+    error = true;
+  }
+  bool isRunning() { return running; }
+  bool isFinished() { return finished; }
+  bool hasError() { return error; }
+  const char *errorString() { return error ? "Aborted" : "No Error"; }
+
+  std::vector<uint8_t> image;
+  bool running = false;
+  bool finished = false;
+  bool error = false;
+};
+inline UpdateClass Update;
+
+// mbedtls message digests: HMAC-SHA256 only, computed for real so a tag made
+// with openssl checks out here as on the board
+typedef enum { MBEDTLS_MD_SHA256 = 6 } mbedtls_md_type_t;
+struct mbedtls_md_info_t {
+  mbedtls_md_type_t type;
+};
+struct HostSha256 {
+  uint32_t state[8];
+  uint8_t block[64];
+  size_t used;     // Bytes in block
+  uint64_t length; // Bytes hashed
+};
+inline void hostSha256Start(HostSha256 &sha) {
+  static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  memcpy(sha.state, initial, sizeof(initial));
+  sha.used = 0;
+  sha.length = 0;
+}
+inline void hostSha256Block(HostSha256 &sha) {
+  static const uint32_t k[64] = {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+      0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+      0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+      0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+      0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+      0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+  auto rotate = [](uint32_t x, int n) { return (x >> n) | (x << (32 - n)); };
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) {
+    w[i] = (uint32_t)sha.block[4 * i] << 24 | (uint32_t)sha.block[4 * i + 1] << 16 |
+           (uint32_t)sha.block[4 * i + 2] << 8 | sha.block[4 * i + 3];
+  }
+  for (int i = 16; i < 64; i++) {
+    uint32_t s0 = rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  uint32_t v[8];
+  memcpy(v, sha.state, sizeof(v));
+  for (int i = 0; i < 64; i++) {
+    uint32_t t1 = v[7] + (rotate(v[4], 6) ^ rotate(v[4], 11) ^ rotate(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) + k[i] + w[i];
+    uint32_t t2 = (rotate(v[0], 2) ^ rotate(v[0], 13) ^ rotate(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+    memmove(v + 1, v, 7 * sizeof(uint32_t));
+    v[4] += t1;
+    v[0] = t1 + t2;
+  }
+  for (int i = 0; i < 8; i++) sha.state[i] += v[i];
+}
+inline void hostSha256Update(HostSha256 &sha, const uint8_t *data, size_t length) {
+  sha.length += length;
+  while (length > 0) {
+    size_t take = 64 - sha.used < length ? 64 - sha.used : length;
+    memcpy(sha.block + sha.used, data, take);
+    sha.used += take;
+    data += take;
+    length -= take;
+    if (sha.used == 64) {
+      hostSha256Block(sha);
+      sha.used = 0;
+    }
+  }
+}
+inline void hostSha256Finish(HostSha256 &sha, uint8_t digest[32]) {
+  uint64_t bits = sha.length * 8;
+  uint8_t pad = 0x80;
+  hostSha256Update(sha, &pad, 1);
+  pad = 0;
+  while (sha.used != 56) hostSha256Update(sha, &pad, 1);
+  uint8_t count[8];
+  for (int i = 0; i < 8; i++) count[i] = (uint8_t)(bits >> (56 - 8 * i));
+  hostSha256Update(sha, count, 8);
+  for (int i = 0; i < 32; i++) digest[i] = (uint8_t)(sha.state[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+struct mbedtls_md_context_t {
+  HostSha256 sha;
+  uint8_t key[64]; // Padded HMAC key
+};
+inline const mbedtls_md_info_t *mbedtls_md_info_from_type(mbedtls_md_type_t type) {
+  static const mbedtls_md_info_t sha256 = {MBEDTLS_MD_SHA256};
+  return type == MBEDTLS_MD_SHA256 ? &sha256 : NULL;
+}
+inline void mbedtls_md_init(mbedtls_md_context_t *context) { memset(context, 0, sizeof(*context)); }
+inline void mbedtls_md_free(mbedtls_md_context_t *context) { memset(context, 0, sizeof(*context)); }
+inline int mbedtls_md_setup(mbedtls_md_context_t *context, const mbedtls_md_info_t *info, int hmac) {
+  return info != NULL && hmac ? 0 : -1;
+}
+inline int mbedtls_md_hmac_starts(mbedtls_md_context_t *context, const uint8_t *key, size_t length) {
+  memset(context->key, 0, sizeof(context->key));
+  if (length > sizeof(context->key)) {
+    hostSha256Start(context->sha);
+    hostSha256Update(context->sha, key, length);
+    hostSha256Finish(context->sha, context->key);
+  } else {
+    memcpy(context->key, key, length);
+  }
+  uint8_t inner[64];
+  for (int i = 0; i < 64; i++) inner[i] = context->key[i] ^ 0x36;
+  hostSha256Start(context->sha);
+  hostSha256Update(context->sha, inner, sizeof(inner));
+  return 0;
+}
+inline int mbedtls_md_hmac_update(mbedtls_md_context_t *context, const uint8_t *data, size_t length) {
+  hostSha256Update(context->sha, data, length);
+  return 0;
+}
+inline int mbedtls_md_hmac_finish(mbedtls_md_context_t *context, uint8_t *output) {
+  uint8_t innerDigest[32];
+  hostSha256Finish(context->sha, innerDigest);
+  uint8_t outer[64];
+  for (int i = 0; i < 64; i++) outer[i] = context->key[i] ^ 0x5c;
+  hostSha256Start(context->sha);
+  hostSha256Update(context->sha, outer, sizeof(outer));
+  hostSha256Update(context->sha, innerDigest, sizeof(innerDigest));
+  hostSha256Finish(context->sha, output);
+  return 0;
+}
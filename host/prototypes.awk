@@ -0,0 +1,28 @@
+# Turn the sketch into a plain C++ file the way the Arduino builder does:
+# collect a prototype for every top-level function definition and insert them
+# all just before the first definition. Run with the sketch named twice:
+#   awk -f prototypes.awk ../code.c ../code.c > build/sketch.cpp
+
+# A function definition starts in column 0 and ends its line with ") {"
+function isDefinition(line) {
+  if (line !~ /^[A-Za-z_][^=;]*\) *\{ *(\/\/.*)?$/) return 0;
+  return line !~ /^(struct|class|enum|union|template|typedef|constexpr|if|else|for|while|switch)[ ({]/;
+}
+
+FNR == NR {
+  if (isDefinition($0)) {
+    prototype = $0;
+    sub(/ *\{ *(\/\/.*)?$/, ";", prototype);
+    prototypes[++count] = prototype;
+  }
+  next;
+}
+
+!inserted && isDefinition($0) {
+  print "#line 1 \"prototypes\"";
+  for (i = 1; i <= count; i++) print prototypes[i];
+  printf "#line %d \"%s\"\n", FNR, FILENAME;
+  inserted = 1;
+}
+
+{ print }